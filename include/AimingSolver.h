@@ -14,6 +14,7 @@
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include "Parameters.h"
+#include "GimbalHistory.h"
 #include "Utilities.h"
 
 namespace meta {
@@ -40,6 +41,7 @@ public:
         int number = 0;                        // 0 for empty (no number sticker)
 
         cv::Point3f ypd;                       // YPD: Yaw (.x [deg]) + Pitch (.y [deg]) + Distance (.z [mm])
+        cv::Point3f worldYPD;                  // YPD plus gimbal attitude at capture time (ypd if unavailable)
 
         enum Flag : unsigned {
             NONE = 0,
@@ -48,7 +50,21 @@ public:
         unsigned flags = 0;
     };
 
-    void setParams(const package::ParamSet &p);
+    /**
+     * Set parameters. Not thread-safe with updateArmors().
+     * @param p
+     * @param resetHistory  Whether to reset the tracking and TopKiller history. Can be false if only parameters that
+     *                      don't invalidate the history (e.g. thresholds and offsets) are changed.
+     */
+    void setParams(const package::ParamSet &p, bool resetHistory = true);
+
+    /**
+     * Set the source of gimbal attitudes. If set, armor angles are converted to the world frame using the attitude at
+     * image capture time, and control commands are computed relative to the latest attitude, compensating gimbal
+     * movement between exposure and command. Can be nullptr.
+     * @param history
+     */
+    void setGimbalHistory(const GimbalHistory *history) { gimbalHistory = history; }
 
     void resetHistory();
 
@@ -81,6 +97,8 @@ private:
 
     package::ParamSet params;
 
+    const GimbalHistory *gimbalHistory = nullptr;
+
     unsigned frameCount = 0;
 
     // Control command
@@ -0,0 +1,100 @@
+#ifndef META_VISION_SOLAIS_ARMORCLASSIFIER_H
+#define META_VISION_SOLAIS_ARMORCLASSIFIER_H
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/dnn.hpp>
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace meta {
+
+/**
+ * Classifier of the number sticker between the two lights of an armor, with a small model on the CPU backend of
+ * OpenCV DNN.
+ *
+ * The sticker is about twice as tall as the lights. The region between the lights, extended to twice their length, is
+ * perspective-warped to a PATCH_WIDTH x PATCH_HEIGHT gray patch, with the lights just outside the left and right
+ * borders, and stretched to the full range of 8 bits. The patches of all armors of a frame go through the model in one
+ * batch.
+ *
+ * The model (e.g. ONNX with a dynamic batch size) takes N x 1 x PATCH_HEIGHT x PATCH_WIDTH in [0, 1] and outputs
+ * N x C logits: numbers 0 (no number sticker) to C - 2, then one for a pair of lights that is not an armor.
+ */
+class ArmorClassifier {
+public:
+
+    static constexpr int PATCH_WIDTH = 32;
+    static constexpr int PATCH_HEIGHT = 32;
+
+    using Model = std::shared_ptr<cv::dnn::Net>;
+
+    /**
+     * Load a model, and check its output with a blank patch. Errors are printed. This reads and parses the file, so
+     * Executor does it on the thread applying the parameters, and the detection thread only gets the pointer by
+     * setModel().
+     * @param modelFile  Any format of cv::dnn::readNet().
+     * @return nullptr if failed.
+     */
+    static Model loadModel(const std::string &modelFile);
+
+    /**
+     * Replace the model by swapping the pointer. A model runs one inference at a time, so it should only be set to one
+     * classifier in use.
+     * @param model  nullptr for no model.
+     */
+    void setModel(Model model) { net = std::move(model); }
+
+    /**
+     * Load a model and set it, see loadModel().
+     * @return Whether the model is loaded.
+     */
+    bool load(const std::string &modelFile) {
+        setModel(loadModel(modelFile));
+        return loaded();
+    }
+
+    bool loaded() const { return net != nullptr; }
+
+    struct Result {
+        int number;        // -1 for not an armor
+        float confidence;  // softmax of the class
+    };
+
+    /**
+     * Classify armors of an image in one inference.
+     * @param img      BGR image.
+     * @param armors   Corners of the armors, in the order of ArmorDetector::DetectedArmor.
+     * @param results  [Out] Results in the order of the armors.
+     * @return false if no model is loaded. If the inference fails, the error is printed and the model is dropped.
+     */
+    bool classify(const cv::Mat &img, const std::vector<std::array<cv::Point2f, 4>> &armors,
+                  std::vector<Result> &results);
+
+    /**
+     * Patches of the last classify(), in the order of the armors, e.g. to be saved for labeling.
+     */
+    const std::vector<cv::Mat> &getPatches() const { return patches; }
+
+    /**
+     * Warp the patch of an armor, as the input of the model.
+     * @param img     BGR image.
+     * @param points  Corners of the armor.
+     * @param patch   [Out] CV_8UC1 of PATCH_WIDTH x PATCH_HEIGHT.
+     */
+    static void extractPatch(const cv::Mat &img, const std::array<cv::Point2f, 4> &points, cv::Mat &patch);
+
+private:
+
+    Model net;
+
+    // Buffers reused across frames
+    std::vector<cv::Mat> patches;
+    cv::Mat blob;
+
+};
+
+}
+
+#endif //META_VISION_SOLAIS_ARMORCLASSIFIER_H
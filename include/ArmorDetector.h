@@ -5,6 +5,8 @@
 #ifndef META_VISION_SOLAIS_ARMORDETECTOR_H
 #define META_VISION_SOLAIS_ARMORDETECTOR_H
 
+#include "ArmorClassifier.h"
+#include "BinaryMorphology.h"
 #include "Parameters.h"
 #include <mutex>
 #include <opencv2/highgui/highgui.hpp>
@@ -15,15 +17,29 @@ namespace meta {
 class ArmorDetector {
 public:
 
-    void setParams(const ParamSet &p) { params = p; }
+    ArmorDetector() { setParams(params); }
+
+    /**
+     * Set parameters, and select the steps of detect() specialized for the modes and the enabled filters. Not
+     * thread-safe with detect(). Executor sets them from the detection thread between two frames.
+     * @param p
+     */
+    void setParams(const ParamSet &p);
 
     const ParamSet &getParams() const { return params; }
 
+    /**
+     * Set the model of the number classifier, used while armor_number_min_confidence is enabled. Only the pointer is
+     * swapped, as the model is loaded by ArmorClassifier::loadModel() outside of the detection thread.
+     * @param model  nullptr for no model, with which the armors are not classified.
+     */
+    void setClassifierModel(ArmorClassifier::Model model) { classifier.setModel(std::move(model)); }
+
     struct DetectedArmor {
         std::array<cv::Point2f, 4> points;
         cv::Point2f center;
         bool largeArmor = false;
-        int number = 0;                 // unused yet
+        int number = 0;                 // 0 for empty (no number sticker), by the classifier if enabled
         std::array<int, 2> lightIndex;  // left, right
         float lightAngleDiff;           // absolute value, non-negative
         float avgLightAngle;
@@ -31,19 +47,247 @@ public:
 
     std::vector<DetectedArmor> detect(const cv::Mat &img);
 
+    /**
+     * Whether the last detect() only looked for the tracked armors in their windows (see armor_tracking).
+     */
+    bool lastDetectionTracked() const { return framesSinceFullDetection > 0; }
+
     static float normalizeLightAngle(float angle) { return angle <= 90 ? angle : 180 - angle; }
 
+    /** Intermediate Images **/
+
+    enum IntermediateImage : unsigned {
+        BRIGHTNESS_IMAGE = 1U << 0U,
+        COLOR_IMAGE = 1U << 1U,
+        LIGHTS_IMAGE = 1U << 2U,
+    };
+
+    /**
+     * Request intermediate images of the following detect() calls, copied out of the buffers of the steps when the
+     * whole image is thresholded (at the coarse level if multi-scale). Without requests, the buffers are reused in
+     * place across frames, and the brightness and color images are not even written unless used by the morphology.
+     * @param imageMask  Bits of IntermediateImage.
+     */
+    void requestImages(unsigned imageMask) { requestedImages = imageMask; }
+
+    /**
+     * Take the requested images of the last detect(), which are then owned by the caller. Images not requested are
+     * empty.
+     * @return false if the last detect() didn't threshold the whole image (i.e. only detected tracked armors in
+     *         windows), and there is no image to take.
+     */
+    bool takeImages(cv::Mat &brightness, cv::Mat &color, cv::Mat &lights);
+
 private:
 
     ParamSet params;
 
+    // Buffers of the steps, reused across frames
     cv::Mat imgOriginal;
+    cv::Mat imgCoarse;  // downsampled imgOriginal of detectMultiScale()
     cv::Mat imgGray;
+    cv::Mat imgHSV;
     cv::Mat imgBrightness;
     cv::Mat imgColor;
     std::vector<cv::RotatedRect> lightRects;
     cv::Mat imgLights;
 
+    // Copies of the buffers for the requested images
+    unsigned requestedImages = 0;
+    bool imagesCopied = false;  // whether the copies are of the last detect()
+    cv::Mat brightnessImage;
+    cv::Mat colorImage;
+    cv::Mat lightsImage;
+
+    /**
+     * Copy the requested images out of the buffers.
+     */
+    void copyRequestedImages();
+
+    /** Specialized Steps **/
+
+    // Selected by setParams() from the tables of instantiations, so that detect() has no per-frame branches on the
+    // modes or the filters
+    using ThresholdFunction = void (ArmorDetector::*)(const cv::Mat &img);
+    using LightFunction = void (ArmorDetector::*)();
+    using CombineFunction = void (ArmorDetector::*)(std::vector<DetectedArmor> &acceptedArmors);
+
+    ThresholdFunction thresholdFunction = nullptr;
+    ThresholdFunction thresholdLightsFunction = nullptr;  // only making imgLights
+    LightFunction lightFunction = nullptr;
+    LightFunction coarseLightFunction = nullptr;  // of the coarse pass of detectMultiScale()
+    CombineFunction combineFunction = nullptr;
+    CombineFunction coarseCombineFunction = nullptr;
+
+    /**
+     * Threshold an image and extract lights of it into lightRects, in the coordinates of the image.
+     * @param img         Image, or a window of imgOriginal.
+     * @param extract     lightFunction, or coarseLightFunction.
+     * @param morphology  Whether to apply erode/dilate/open/close of the parameters, which are sized for the full
+     *                    resolution.
+     * @param wholeImage  Whether img is the whole image (or a downsampled one), of which the requested images are made.
+     */
+    void extractLights(const cv::Mat &img, LightFunction extract, bool morphology, bool wholeImage);
+
+    /**
+     * Sort lightRects and combine them to armors.
+     * @param combine              combineFunction, or coarseCombineFunction.
+     * @param classify             Whether to classify the numbers of the armors, if enabled, and reject the pairs of
+     *                             lights that are not armors.
+     * @param removeSharingLights  Whether to keep only one of the armors that share a light.
+     */
+    std::vector<DetectedArmor> combineLights(CombineFunction combine, bool classify, bool removeSharingLights);
+
+    /**
+     * Find candidate armors on a downsampled image, then extract lights at the full resolution only in windows around
+     * them, and combine them to the armors. The requested images are of the downsampled image.
+     */
+    std::vector<DetectedArmor> detectMultiScale();
+
+    /**
+     * Windows around armors at the full resolution, clipped to imgOriginal, and merged if overlapping.
+     * @param armors   Armors, in the coordinates of imgOriginal divided by the scale.
+     * @param scale
+     * @param offsets  Motion of each armor to its predicted position at the full resolution, or empty for none.
+     */
+    std::vector<cv::Rect> armorWindows(const std::vector<DetectedArmor> &armors, int scale,
+                                       const std::vector<cv::Point2f> &offsets) const;
+
+    /**
+     * Extract lights at the full resolution in windows of imgOriginal, into lightRects in the coordinates of
+     * imgOriginal.
+     */
+    void extractLightsInWindows(const std::vector<cv::Rect> &windows);
+
+    /** Morphology **/
+
+    BinaryMorphology binaryMorphology;
+    BinaryMorphology::Kernel erodeKernel;  // made by setParams()
+    BinaryMorphology::Kernel dilateKernel;
+    BinaryMorphology::Kernel openKernel;
+    BinaryMorphology::Kernel closeKernel;
+
+    // Buffers reused across frames
+    BinaryMorphology::Mask packedColor;
+    BinaryMorphology::Mask packedLights;
+
+    /** Tracking **/
+
+    // Armors of the last frame, and their motion from the frame before [pixel/frame]
+    std::vector<DetectedArmor> trackedArmors;
+    std::vector<cv::Point2f> trackedVelocities;
+    int framesSinceFullDetection = 0;
+
+    /**
+     * Detect only in windows around the tracked armors at their predicted positions. No requested image is made.
+     * @param armors  [Out] Armors found in the windows.
+     * @return Whether all tracked armors are found again. Otherwise, a full detection is needed.
+     */
+    bool detectTracked(std::vector<DetectedArmor> &armors);
+
+    /**
+     * Track the armors of this frame, with the motion of the ones matched to the last tracked armors.
+     */
+    void updateTracking(const std::vector<DetectedArmor> &armors);
+
+    static double armorHeight(const DetectedArmor &armor);
+
+    /**
+     * Move the corners of the armors to the ends of their lights in imgOriginal, located with sub-pixel precision. The
+     * corners of an armor are kept as fitted if any end of its lights is not found.
+     */
+    void refineCorners(std::vector<DetectedArmor> &armors);
+
+    /**
+     * Locate the ends of a light along its long axis, where the intensity profile of the core of the light falls to
+     * the half level between the light and the background, interpolated between the samples.
+     * @param rect    Canonicalized light in imgOriginal.
+     * @param bottom  [Out] End at points[0] or points[3] of the armor.
+     * @param top     [Out] End at points[1] or points[2] of the armor.
+     * @return Whether both ends are found.
+     */
+    bool refineLightEnds(const cv::RotatedRect &rect, cv::Point2f &bottom, cv::Point2f &top);
+
+    /** Number Classification **/
+
+    ArmorClassifier classifier;
+
+    // Buffers reused across frames
+    std::vector<std::array<cv::Point2f, 4>> classifierArmors;
+    std::vector<ArmorClassifier::Result> classifierResults;
+
+    /**
+     * Set the numbers of the armors by the classifier, and remove the ones that are not armors or of a confidence
+     * below armor_number_min_confidence. Armors are kept as they are if no model is loaded.
+     */
+    void classifyArmors(std::vector<DetectedArmor> &armors);
+
+    // Buffers of refineLightEnds(), reused across lights
+    cv::Mat refineStrip;
+    cv::Mat refineStripGray;
+    cv::Mat refineProfile;
+
+    /**
+     * Brightness and color threshold in one pass over the image, making imgLights.
+     * @tparam MASKS  Whether to make imgBrightness and imgColor too.
+     */
+    template<ParamSet::ColorThresholdMode MODE, ParamSet::EnemyColor ENEMY, bool MASKS>
+    void thresholdImpl(const cv::Mat &img);
+
+    /**
+     * Find contours of imgLights, and fit and filter them into lightRects.
+     * @tparam FILTERS  Bits of ContourFilter in ArmorDetector.cpp, for the enabled filters.
+     */
+    template<ParamSet::ContourFitFunction FIT, unsigned FILTERS>
+    void filterContoursImpl();
+
+    /**
+     * Label 8-connected components of imgLights in one pass over the runs of pixels, accumulating the moments of each,
+     * and filter the rects of the components from their moments into lightRects. The counts and areas are of pixels.
+     * @tparam FILTERS  Bits of ContourFilter in ArmorDetector.cpp, for the enabled filters.
+     */
+    template<unsigned FILTERS>
+    void extractComponentsImpl();
+
+    /**
+     * Filters of a fitted light after the canonicalization, shared by contours and components.
+     * @return Whether the light is accepted.
+     */
+    template<unsigned FILTERS>
+    bool acceptLightRect(const cv::RotatedRect &rect) const;
+
+    /**
+     * Combine sorted lightRects to armors.
+     * @tparam FILTERS  Bits of CombineFilter in ArmorDetector.cpp, for the enabled filters.
+     */
+    template<unsigned FILTERS>
+    void combineLightsImpl(std::vector<DetectedArmor> &acceptedArmors);
+
+    /** Connected Components **/
+
+    struct ComponentRun {
+        int start;  // [start, end) of a row
+        int end;
+        int label;
+    };
+
+    struct ComponentMoments {
+        double m00, m10, m01, m20, m11, m02;  // raw moments of the pixel centers
+    };
+
+    // Buffers reused across frames
+    std::vector<ComponentRun> componentRuns[2];        // of the previous row and the current row
+    std::vector<int> componentParents;                 // union-find of labels
+    std::vector<ComponentMoments> componentMoments;    // valid for roots
+
+    int findComponentRoot(int label);
+
+    /**
+     * Rect of the same second-order moments, taking each pixel as a unit square so that a run of n pixels is n long.
+     * Canonicalized as canonicalizeRotatedRect().
+     */
+    static cv::RotatedRect rectFromMoments(const ComponentMoments &m);
+
     static void drawRotatedRect(cv::Mat &img, const cv::RotatedRect &rect, const cv::Scalar &boarderColor);
 
     /**
@@ -0,0 +1,150 @@
+#ifndef META_VISION_SOLAIS_BINARYMORPHOLOGY_H
+#define META_VISION_SOLAIS_BINARYMORPHOLOGY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace meta {
+
+/**
+ * Morphology of binary masks (threshold images) on bit-packed rows, 64 pixels per word. The results are the same as
+ * cv::erode(), cv::dilate() and cv::morphologyEx() with MORPH_OPEN and MORPH_CLOSE, with a kernel of
+ * cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(size, size)) at the default anchor and border.
+ *
+ * A kernel is taken as a horizontal segment of pixels on each of its rows. An erosion (dilation) makes each row of the
+ * mask, for each distinct segment, the AND (OR) of the row shifted to each pixel of the segment, and then ANDs (ORs)
+ * the rows of the kernel together, one word of 64 pixels at a time. The loops over the words of a row are kept free of
+ * branches, so that the compiler can vectorize the shifts. Pixels beyond the borders are taken as 1 for erosion and 0
+ * for dilation, as OpenCV does.
+ *
+ * A chain of operations (e.g. erode, dilate, AND with another mask, open and close) runs on a packed mask, which is
+ * packed and unpacked only once.
+ */
+class BinaryMorphology {
+public:
+
+    using Word = uint64_t;
+    static constexpr int WORD_BITS = 64;
+
+    enum Operation {
+        ERODE,
+        DILATE,
+        OPEN,   // erode, then dilate
+        CLOSE   // dilate, then erode
+    };
+
+    /**
+     * Elliptic kernel, as cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(size, size)) anchored at the center.
+     */
+    class Kernel {
+    public:
+
+        /**
+         * @param size  Width and height, at least 1.
+         */
+        explicit Kernel(int size = 1);
+
+        int size() const { return size_; }
+
+        struct Segment {
+            int dxMin;  // offsets of the first and the last pixel from the anchor
+            int dxMax;
+        };
+
+        struct Row {
+            int dy;       // offset of the row from the anchor
+            int segment;  // index in segments()
+        };
+
+        const std::vector<Row> &rows() const { return rows_; }
+
+        /**
+         * Distinct segments of the rows, which are symmetric for an ellipse.
+         */
+        const std::vector<Segment> &segments() const { return segments_; }
+
+        /**
+         * Maximal absolute offset of the segments.
+         */
+        int maxShift() const { return maxShift_; }
+
+        /**
+         * Whether the kernel is a single pixel, with which every operation keeps the mask as it is.
+         */
+        bool identity() const { return size_ == 1; }
+
+    private:
+        int size_;
+        std::vector<Row> rows_;  // non-empty rows only
+        std::vector<Segment> segments_;
+        int maxShift_ = 0;
+    };
+
+    /**
+     * Mask of 1 bit per pixel. Bit i of word j of a row is pixel 64 * j + i. Bits beyond the width are 0.
+     */
+    class Mask {
+    public:
+
+        /**
+         * Pack a mask of bytes, taking any non-zero pixel as 1. The buffer is reused for the same size.
+         * @param data    Pixels, one byte each.
+         * @param width   Width of the mask.
+         * @param height  Height of the mask.
+         * @param step    Bytes between the starts of two rows.
+         */
+        void pack(const uint8_t *data, int width, int height, size_t step);
+
+        /**
+         * Unpack the mask into bytes of 0 or 255.
+         * @param data  [Out] Pixels of the width and the height of the mask.
+         * @param step  Bytes between the starts of two rows.
+         */
+        void unpack(uint8_t *data, size_t step) const;
+
+        /**
+         * AND with a mask of the same size.
+         */
+        Mask &operator&=(const Mask &other);
+
+        int width() const { return width_; }
+
+        int height() const { return height_; }
+
+        int wordsPerRow() const { return wordsPerRow_; }
+
+        Word *row(int y) { return words.data() + (size_t) y * wordsPerRow_; }
+
+        const Word *row(int y) const { return words.data() + (size_t) y * wordsPerRow_; }
+
+    private:
+        int width_ = 0;
+        int height_ = 0;
+        int wordsPerRow_ = 0;
+        std::vector<Word> words;
+
+        friend class BinaryMorphology;
+    };
+
+    /**
+     * Apply an operation to a mask in place.
+     */
+    void apply(Mask &mask, Operation operation, const Kernel &kernel);
+
+private:
+
+    // Buffers reused across operations
+    std::vector<Word> paddedRow;                 // a row with the border words on both sides
+    std::vector<std::vector<Word>> segmentRows;  // rows of the horizontal pass, for each segment of the kernel
+
+    /**
+     * Erode (ERODE = true) or dilate a mask in place.
+     */
+    template<bool ERODE>
+    void morph(Mask &mask, const Kernel &kernel);
+};
+
+}
+
+#endif //META_VISION_SOLAIS_BINARYMORPHOLOGY_H
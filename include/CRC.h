@@ -2,23 +2,25 @@
 #define _CRC_CHECK_H_
 
 #include <cstdint>
+#include <cstddef>
 
 namespace rm {
 
 /**
- * Get CRC16 checksum.
+ * Get CRC8 checksum.
  * @param pchMessage  Data to check
  * @param dwLength    Data length
  * @return            CRC checksum
  */
-uint8_t getCRC8CheckSum(uint8_t *pchMessage, uint32_t dwLength);
+uint8_t getCRC8CheckSum(const uint8_t *pchMessage, uint32_t dwLength);
 
 /**
- * Append CRC8 to the end of data.
- * @param pchMessage  Data to append CRC
+ * CRC8 verification function.
+ * @param pchMessage  Data to verify
  * @param dwLength    Stream length = data + checksum
+ * @return            CRC verify result
  */
-bool verifyCRC8CheckSum(uint8_t *pchMessage, uint32_t dwLength);
+bool verifyCRC8CheckSum(const uint8_t *pchMessage, uint32_t dwLength);
 
 /**
  * Append CRC8 to the end of data.
@@ -33,7 +35,7 @@ void appendCRC8CheckSum(uint8_t *pchMessage, uint32_t dwLength);
  * @param dwLength    Data length
  * @return            CRC checksum
  */
-uint16_t getCRC16CheckSum(uint8_t *pchMessage, uint32_t dwLength);
+uint16_t getCRC16CheckSum(const uint8_t *pchMessage, uint32_t dwLength);
 
 /**
  * CRC16 verification function.
@@ -41,7 +43,7 @@ uint16_t getCRC16CheckSum(uint8_t *pchMessage, uint32_t dwLength);
  * @param dwLength    Stream length = data + checksum
  * @return            CRC verify result
  */
-bool verifyCRC16CheckSum(uint8_t *pchMessage, uint32_t dwLength);
+bool verifyCRC16CheckSum(const uint8_t *pchMessage, uint32_t dwLength);
 
 /**
  * Append CRC16 to the end of data.
@@ -50,6 +52,55 @@ bool verifyCRC16CheckSum(uint8_t *pchMessage, uint32_t dwLength);
  */
 void appendCRC16CheckSum(uint8_t *pchMessage, uint32_t dwLength);
 
+/**
+ * CRC8 with slicing-by-N: N bytes are folded per step with N lookup tables, breaking the dependency chain of one
+ * lookup per byte. N = 1 is the classic byte-at-a-time algorithm, which getCRC8CheckSum uses, as CRC8 only covers
+ * short frames (e.g. 22 bytes of a control command) on which slicing gains no measurable time.
+ * @tparam N          1, 4 or 8
+ * @param pchMessage  Data to check
+ * @param dwLength    Data length
+ * @return            CRC checksum
+ */
+template<int N>
+uint8_t getCRC8CheckSumSliced(const uint8_t *pchMessage, uint32_t dwLength);
+
+/**
+ * CRC16 with slicing-by-N. getCRC16CheckSum uses N = 8.
+ * @tparam N          1, 4 or 8
+ * @param pchMessage  Data to check
+ * @param dwLength    Data length
+ * @return            CRC checksum
+ */
+template<int N>
+uint16_t getCRC16CheckSumSliced(const uint8_t *pchMessage, uint32_t dwLength);
+
+/**
+ * Verify CRC8 of many frames at once. Four frames are processed in an interleaved way, so that their table lookups
+ * overlap instead of waiting for each other.
+ * @param frames   Pointers to frames, each with the checksum at the end
+ * @param lengths  Stream lengths = data + checksum
+ * @param count    Number of frames
+ * @param results  [Out] Verify result of each frame
+ * @return         Number of frames that pass
+ */
+size_t verifyCRC8Batch(const uint8_t *const *frames, const uint32_t *lengths, size_t count, bool *results);
+
+/**
+ * Verify CRC16 of many frames at once. See verifyCRC8Batch.
+ */
+size_t verifyCRC16Batch(const uint8_t *const *frames, const uint32_t *lengths, size_t count, bool *results);
+
+/**
+ * Verify CRC8 of fixed-length frames starting at 16 consecutive offsets, for resynchronizing on a byte stream. Byte i
+ * of the 16 candidates is one unaligned 16-byte load, so each lane of a SIMD register carries one candidate. The CRC8
+ * table is linear, so the lookup is split into two 16-entry lookups of the low and high nibbles, which map to byte
+ * shuffles (SSSE3 pshufb or NEON tbl). Other platforms fall back to getCRC8CheckSum on each candidate.
+ * @param pchBuffer  Buffer with at least dwLength + 15 bytes
+ * @param dwLength   Stream length of each frame = data + checksum
+ * @return           Bit j is set if the frame at pchBuffer + j passes
+ */
+uint16_t verifyCRC8At16Offsets(const uint8_t *pchBuffer, uint32_t dwLength);
+
 }
 
 #endif
@@ -0,0 +1,135 @@
+#ifndef META_VISION_SOLAIS_CALIBRATIONSTORE_H
+#define META_VISION_SOLAIS_CALIBRATIONSTORE_H
+
+#include <opencv2/core/core.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+
+namespace meta {
+
+/**
+ * Camera calibration of an input resolution, derived for an ROI, immutable once created.
+ */
+struct Calibration {
+
+    std::string filename;
+
+    int imageWidth;
+    int imageHeight;
+    int roiWidth;
+    int roiHeight;
+
+    cv::Mat cameraMatrix;  // with the principal point scaled to the ROI
+    cv::Mat distCoeffs;
+    float zScale;
+
+    static constexpr int UNDISTORT_GRID_STEP = 8;  // [pixel]
+
+    // Undistorted position of every UNDISTORT_GRID_STEP pixels of the ROI, in pixels of cameraMatrix (CV_32FC2)
+    cv::Mat undistortGrid;
+
+    /**
+     * Undistort a point of the ROI by bilinear interpolation of the grid, instead of the iterative cv::undistortPoints.
+     * The distortion is smooth so that the error is far below a pixel. Points outside the ROI are extrapolated from the
+     * cell at the border.
+     * @param p  Point in the ROI [pixel].
+     * @return Undistorted point, to be used with cameraMatrix and no distortion coefficients.
+     */
+    cv::Point2f undistortPoint(cv::Point2f p) const {
+        float gx = p.x / UNDISTORT_GRID_STEP, gy = p.y / UNDISTORT_GRID_STEP;
+        int x0 = std::clamp((int) std::floor(gx), 0, undistortGrid.cols - 2);
+        int y0 = std::clamp((int) std::floor(gy), 0, undistortGrid.rows - 2);
+        float fx = gx - (float) x0, fy = gy - (float) y0;  // out of [0, 1] outside the grid
+        const auto *r0 = undistortGrid.ptr<cv::Point2f>(y0);
+        const auto *r1 = undistortGrid.ptr<cv::Point2f>(y0 + 1);
+        cv::Point2f top = r0[x0] * (1 - fx) + r0[x0 + 1] * fx;
+        cv::Point2f bottom = r1[x0] * (1 - fx) + r1[x0 + 1] * fx;
+        return top * (1 - fy) + bottom * fy;
+    }
+};
+
+/**
+ * Calibrations in PARAM_SET_ROOT/params, loaded once and kept in memory, so that applying parameters never touches the
+ * disk. Files are named <width>x<height>.xml, or <width>x<height>_<camera serial>.xml for a specific camera, which is
+ * preferred. Calibrations derived for an ROI are cached.
+ *
+ * On Linux, the directory is watched with inotify and reloaded on changes. Otherwise, call reload().
+ */
+class CalibrationStore {
+public:
+
+    explicit CalibrationStore(std::string directory);
+
+    ~CalibrationStore();
+
+    /**
+     * Reload all calibration files, and derive again the cached ones. Thread-safe.
+     */
+    void reload();
+
+    /**
+     * Find the calibration for a resolution and an ROI. Thread-safe. Only derived on the first call of an ROI, and
+     * without disk IO.
+     * @param imageWidth
+     * @param imageHeight
+     * @param roiWidth
+     * @param roiHeight
+     * @param cameraSerial  Serial number of the camera, empty if unknown.
+     * @return nullptr if there is no calibration of the resolution.
+     */
+    std::shared_ptr<const Calibration> get(int imageWidth, int imageHeight, int roiWidth, int roiHeight,
+                                           const std::string &cameraSerial = "");
+
+    /**
+     * Incremented on each reload, after which get() may return updated calibrations.
+     */
+    unsigned generation() const { return generation_; }
+
+private:
+
+    std::string directory;
+
+    // Loaded from files, with the principal point of the full image
+    struct FileCalibration {
+        std::string filename;
+        cv::Mat cameraMatrix;
+        cv::Mat distCoeffs;
+        float zScale;
+    };
+    using FileKey = std::tuple<int, int, std::string>;  // width, height, camera serial (empty for any camera)
+    using FileMap = std::map<FileKey, std::shared_ptr<const FileCalibration>>;
+
+    // width, height, ROI width, ROI height, camera serial (as requested)
+    using DerivedKey = std::tuple<int, int, int, int, std::string>;
+    using DerivedMap = std::map<DerivedKey, std::shared_ptr<const Calibration>>;
+
+    std::mutex mutex;  // protects the maps, only held to look up and swap them
+    FileMap files;
+    DerivedMap derived;  // nullptr for no calibration
+    std::atomic<unsigned> generation_{0};
+
+    FileMap loadFiles() const;
+
+    static std::shared_ptr<const FileCalibration> find(const FileMap &map, int imageWidth, int imageHeight,
+                                                       const std::string &cameraSerial);
+
+    static std::shared_ptr<const Calibration> derive(const FileCalibration *file, const DerivedKey &key);
+
+    // Watcher of the directory
+    int inotifyFD = -1;
+    std::thread *watcherThread = nullptr;
+    std::atomic<bool> watcherShouldExit{false};
+
+    void watch();
+};
+
+}
+
+#endif //META_VISION_SOLAIS_CALIBRATIONSTORE_H
@@ -9,6 +9,7 @@
 #include "Parameters.pb.h"
 #include "InputSource.h"
 #include "CameraApi.h"
+#include "TimeBase.h"
 #include "Utilities.h"
 
 namespace meta {
@@ -20,6 +21,8 @@ public:
 
     virtual std::string getCameraInfo() const = 0;
 
+    virtual std::string getSerialNumber() const { return ""; }  // empty if unknown, e.g. for OpenCVCamera
+
     virtual int getFPS() const = 0;
 
     virtual bool startRecordToVideo(std::string &path, const package::ParamSet &params);  // path will be changed to filename
@@ -85,6 +88,8 @@ public:
 
     std::string getCameraInfo() const override { return capInfoSS.str(); };
 
+    std::string getSerialNumber() const override { return serialNumber; }
+
     int getFPS() const override { return params.fps(); }
 
     TimePoint getFrameCaptureTime() const override { return bufferCaptureTime[lastBuffer]; }
@@ -97,6 +102,7 @@ private:
 
     int hCamera = 0;
     package::ParamSet params;
+    std::string serialNumber;
 
     std::stringstream capInfoSS;
 
@@ -106,6 +112,11 @@ private:
     cv::Mat buffer[2];
     TimePoint bufferCaptureTime[2] = {0, 0};
 
+    // Sensor timestamps (uiTimeStamp, 32-bit in 0.1ms) mapped onto the unified clock
+    ClockSync sensorClock{256};
+    uint64_t lastSensorTime = 0;
+    bool sensorTimeReceived = false;
+
     static void newFrameCallback(CameraHandle hCamera, BYTE *pFrameBuffer, tSdkFrameHead *pFrameHead, PVOID pContext);
 
 };
@@ -16,6 +16,12 @@
 #include "PositionCalculator.h"
 #include "AimingSolver.h"
 #include "Serial.h"
+#include "Telemetry.h"
+#include "CalibrationStore.h"
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <thread>
 
 namespace meta {
@@ -26,7 +32,7 @@ public:
     explicit Executor(OpenCVCamera *openCvCamera, MVCamera *mvCamera, ImageSet *imageSet, VideoSet *videoSet,
                       ParamSetManager *paramSetManager,
                       ArmorDetector *detector, PositionCalculator *positionCalculator, AimingSolver *aimingSolver,
-                      Serial *serial);
+                      Serial *serial, TelemetrySender *telemetry = nullptr);
 
     /** Read-Only Components **/
 
@@ -60,6 +66,11 @@ public:
 
     const ParamSet &getCurrentParams() const { return params; }
 
+    /**
+     * Version of getCurrentParams(), as reported by fetchOutputs() for the outputs produced with them.
+     */
+    uint32_t getCurrentParamsVersion() const { return paramsVersions.empty() ? 0 : paramsVersions.back()->version; }
+
     cv::Mat getVideoPreview(const std::string &videoName) const { return videoSet_->getVideoFirstFrame(videoName, params); }
 
     /** Capture and Record **/
@@ -115,22 +126,53 @@ public:
 
     bool hasOutputs();
 
+    enum ImageOutput : unsigned {
+        ORIGINAL_OUTPUT = 1U << 0U,
+        BRIGHTNESS_OUTPUT = 1U << 1U,
+        COLOR_OUTPUT = 1U << 2U,
+        LIGHTS_OUTPUT = 1U << 3U,
+        ALL_IMAGE_OUTPUTS = ORIGINAL_OUTPUT | BRIGHTNESS_OUTPUT | COLOR_OUTPUT | LIGHTS_OUTPUT
+    };
+
+    /**
+     * Set the images to output, which are copied out of the detection at most at the rate. Other images are empty in
+     * the outputs, and the detector reuses its buffers without making them. Single image detection outputs all images.
+     * This function can be called from another thread than the detection thread.
+     * @param imageMask  Bits of ImageOutput.
+     * @param fps        Maximal rate of the image outputs, positive. Other values are ignored.
+     */
+    void setImageOutputs(unsigned imageMask, double fps);
+
     /**
-     * Fetch image outputs. Outputs are guaranteed to be completed and from the same detection pipeline. This function
-     * can be called from another thread than the detection thread.
+     * Fetch outputs. Outputs are guaranteed to be completed and from the same detection pipeline. This function can be
+     * called from another thread than the detection thread.
      * @param originalImage
      * @param brightnessImage
      * @param colorImage
      * @param lightsImage
+     * @param imageFrameTime  Capture time of the frame of the images, which may be earlier than the other outputs, as
+     *                        images are only output at the rate of setImageOutputs(). 0 if there is no image.
      * @param lightRects
      * @param armors
      * @param tkTriggered
      * @param tkPulses
      * @param tkPeriod
+     * @param paramsVersion  Version of the parameters producing the outputs, see getCurrentParamsVersion().
+     * @return Capture time of the frame of the outputs, 0 if there is no output.
      */
-    void fetchOutputs(cv::Mat &originalImage, cv::Mat &brightnessImage, cv::Mat &colorImage, cv::Mat &lightsImage,
-                      std::vector<cv::RotatedRect> &lightRects, std::vector<AimingSolver::ArmorInfo> &armors,
-                      bool &tkTriggered, std::deque<AimingSolver::PulseInfo> &tkPulses, TimePoint &tkPeriod);
+    TimePoint fetchOutputs(cv::Mat &originalImage, cv::Mat &brightnessImage, cv::Mat &colorImage, cv::Mat &lightsImage,
+                           TimePoint &imageFrameTime, std::vector<cv::RotatedRect> &lightRects,
+                           std::vector<AimingSolver::ArmorInfo> &armors,
+                           bool &tkTriggered, std::deque<AimingSolver::PulseInfo> &tkPulses, TimePoint &tkPeriod,
+                           uint32_t &paramsVersion);
+
+    /**
+     * Fetch only the image outputs. Unlike hasOutputs(), this function doesn't change the state of the executor, so it
+     * can be called by other threads (e.g. the preview encoder) besides the TCP handling.
+     * @return Capture time of the frame of the images, 0 if there is no image.
+     */
+    TimePoint fetchImageOutputs(cv::Mat &originalImage, cv::Mat &brightnessImage, cv::Mat &colorImage,
+                                cv::Mat &lightsImage);
 
 private:
 
@@ -144,10 +186,41 @@ private:
     PositionCalculator *positionCalculator_;
     AimingSolver *aimingSolver_;
     Serial *serial_;
+    TelemetrySender *telemetry_;  // one record per frame if not nullptr
 
     InputSource *currentInput_ = nullptr;
 
-    ParamSet params;
+    /** Parameter Application **/
+
+    ParamSet params;                      // the latest ones, accessed by the calling thread of the public functions
+    bool paramsInitialized = false;       // whether params have been applied once
+
+    CalibrationStore calibrationStore;    // of PARAM_SET_ROOT/params
+
+    ArmorClassifier::Model classifierModel;  // of PARAM_SET_ROOT/models, loaded when the classifier is enabled
+    bool classifierLoadAttempted = false;    // not to retry a missing model on each applyParams()
+
+    // Parameters with the calibration for them, immutable once published
+    struct ParamsVersion {
+        uint32_t version;                 // increments by 1 for each publishing, starting from 1
+        ParamSet params;
+        std::string cameraSerial;         // of the opened camera when published, empty if unknown
+        std::shared_ptr<const Calibration> calibration;  // nullptr if there is none for the resolution
+        unsigned calibrationGeneration;   // of calibrationStore when calibration is got
+        ArmorClassifier::Model classifierModel;  // nullptr if the classifier is disabled or there is no model
+    };
+
+    // Published by applyParams() with an atomic pointer swap and latched by the detection thread at the start of each
+    // frame, so that the detection thread never waits and each frame runs with one consistent version. A version is
+    // deleted by applyParams() once a later one is latched.
+    std::atomic<const ParamsVersion *> publishedParams{nullptr};
+    std::atomic<uint32_t> latchedVersion{0};
+    std::deque<std::unique_ptr<const ParamsVersion>> paramsVersions;  // not deleted yet, in the order of versions
+
+    // Accessed by the detection thread (or by the calling thread when there is no detection thread)
+    const ParamsVersion *latchedParams = nullptr;
+    std::shared_ptr<const Calibration> latchedCalibration;
+    unsigned latchedCalibrationGeneration = 0;
 
     enum Action {
         NONE,
@@ -160,24 +233,54 @@ private:
     std::thread *th = nullptr;
     bool threadShouldExit = false;
 
+    /**
+     * Apply parameters. Only the components depending on the changed fields are reinitialized. Slow work (reopening
+     * the camera, loading the classifier model) is done on the calling thread, while the parameters of the detection
+     * components are published as a new version, and applied by the detection thread between two frames.
+     * @param p
+     */
     void applyParams(const ParamSet &p);
 
+    /**
+     * Publish params as a new version, with the calibration for them from the memory.
+     */
+    void publishParams();
+
+    /**
+     * Latch the latest published parameters, and apply the changes to the detection components, as well as the
+     * calibration if it's reloaded. Called by the detection thread between two frames.
+     */
+    void latchParams();
+
     void runStreamingDetection(InputSource *source);
 
+    TelemetryRecord telemetryRecord;  // only accessed by the detection thread
+
+    void sendTelemetry(TimePoint frameTime, const std::vector<AimingSolver::ArmorInfo> &armors,
+                       const AimingSolver::ControlCommand *command, const uint32_t stageMicros[]);
+
+    // Set by setImageOutputs() from any thread, and read by the detection thread at the start of each frame
+    std::atomic<unsigned> imageOutputMask{0};
+    std::atomic<TimePoint> imageOutputPeriod{0};
+    TimePoint lastImageOutputTime = 0;  // only accessed by the detection thread
+
     std::mutex outputMutex;
 
-    // Output Mats are assigned (no copying) after a completed detection so there is no intermediate result
+    // Output Mats are copied out of the detection only when due (see setImageOutputs()), and owned by the outputs
     cv::Mat originalOutput;
-    cv::Mat grayOutput;
     cv::Mat brightnessOutput;
     cv::Mat colorOutput;
     cv::Mat lightsImageOutput;
+    TimePoint imageFrameTimeOutput = 0;
+
+    TimePoint frameTimeOutput = 0;
 
     std::vector<cv::RotatedRect> lightRectsOutput;
     std::vector<AimingSolver::ArmorInfo> armorsOutput;
     bool tkTriggeredOutput;
     std::deque<AimingSolver::PulseInfo> tkPulsesOutput;
     TimePoint tkPeriodOutput;
+    uint32_t paramsVersionOutput = 0;
 };
 
 }
@@ -0,0 +1,76 @@
+#ifndef META_VISION_SOLAIS_GIMBALHISTORY_H
+#define META_VISION_SOLAIS_GIMBALHISTORY_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include "Utilities.h"
+
+namespace meta {
+
+/**
+ * Timestamped history of gimbal attitudes reported by the MCU.
+ *
+ * There is a single producer (the serial IO thread, which pushes every feedback package) and any number of consumers
+ * (the Executor thread looking up the attitude at frame capture time, for example). Consumers never lock. Each slot of
+ * the ring buffer is guarded by its own sequence number (a seqlock): the producer makes it odd while writing and
+ * stores 2 * (index + 1) after the slot is complete, so a consumer can tell whether the slot it copied is complete
+ * and still holds the expected entry. A slot being overwritten is treated as no longer available.
+ */
+class GimbalHistory {
+public:
+
+    struct Attitude {
+        TimePoint time;  // [0.1ms]
+        float yaw;       // rightward for positive [deg]
+        float pitch;     // downward for positive [deg]
+    };
+
+    static constexpr size_t CAPACITY = 1024;  // about 1 s of history at 1 kHz
+
+    /**
+     * Append an attitude. Must only be called from one thread. Time is expected to be non-decreasing.
+     * @param attitude
+     */
+    void push(const Attitude &attitude);
+
+    /**
+     * Get the latest attitude.
+     * @param attitude [Out]
+     * @return Whether there is any attitude in the history.
+     */
+    bool getLatest(Attitude &attitude) const;
+
+    /**
+     * Get the attitude at the given time, linearly interpolated between the two samples around it. If the time is
+     * newer than the latest sample, the latest sample is returned (no extrapolation).
+     * @param time      [0.1ms]
+     * @param attitude  [Out] Attitude with time set to the given time.
+     * @return Whether the time is covered by the history.
+     */
+    bool interpolate(TimePoint time, Attitude &attitude) const;
+
+    /**
+     * Get the number of attitudes ever pushed.
+     */
+    uint64_t size() const { return writeCount.load(std::memory_order_acquire); }
+
+private:
+
+    struct Slot {
+        std::atomic<uint64_t> seq{0};  // odd while being written, 2 * (index + 1) when complete
+        std::atomic<TimePoint> time{0};
+        std::atomic<float> yaw{0};
+        std::atomic<float> pitch{0};
+    };
+
+    std::array<Slot, CAPACITY> slots;
+
+    std::atomic<uint64_t> writeCount{0};
+
+    bool readSlot(uint64_t index, Attitude &attitude) const;
+};
+
+}
+
+#endif //META_VISION_SOLAIS_GIMBALHISTORY_H
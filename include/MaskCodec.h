@@ -0,0 +1,143 @@
+#ifndef META_VISION_SOLAIS_MASKCODEC_H
+#define META_VISION_SOLAIS_MASKCODEC_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace meta {
+
+/**
+ * Lossless codec for binary masks (threshold images), the Image.BINARY format of Parameters.proto. Any non-zero pixel
+ * is taken as 1, and decoded as 255.
+ *
+ * Encoded data, little endian:
+ *   uint8   flags: MASK_PACKED_BITS (otherwise runs), MASK_DELTA (otherwise a key frame)
+ *   uint16  width
+ *   uint16  height
+ *   uint32  frame ID, never 0
+ *   uint32  ID of the key frame that a delta frame is against, 0 for a key frame
+ *   payload
+ *
+ * Payload:
+ *   runs:         lengths of the alternating runs of 0 and 1 over the pixels in row-major order, starting with a run of
+ *                 0 (can be empty), each as a LEB128 varint. The last run is implicit.
+ *   packed bits:  1 bit per pixel in row-major order, MSB first. Used when it is smaller than runs (noisy masks).
+ *
+ * A delta frame encodes the XOR against a key frame. It is only used when it is smaller than the key frame encoding of
+ * the same mask, which is often not the case for moving objects. Any frame that is not a delta is a key frame. Only key
+ * frames that have been delivered to the decoder (see MaskEncoder::markDelivered) are used as the reference, so frames
+ * that are encoded but never sent don't break the decoding. The decoder keeps the last two key frames to tolerate a
+ * delta frame encoded right before a new key frame is delivered.
+ */
+
+inline constexpr uint8_t MASK_PACKED_BITS = 1;
+inline constexpr uint8_t MASK_DELTA = 2;
+inline constexpr size_t MASK_HEADER_SIZE = 13;
+
+/**
+ * Whether encoded data is a key frame. Once delivered, it is the reference of the following delta frames, so a decoder
+ * that misses it can't decode them.
+ */
+inline bool isMaskKeyFrame(const uint8_t *encoded, size_t size) {
+    return size >= MASK_HEADER_SIZE && !(encoded[0] & MASK_DELTA);
+}
+
+class MaskEncoder {
+public:
+
+    /**
+     * @param keyFrameInterval  Maximal number of delta frames after a key frame. 0 to only encode key frames.
+     */
+    explicit MaskEncoder(int keyFrameInterval = 0) : keyFrameInterval(keyFrameInterval) {}
+
+    /**
+     * Encode a mask.
+     * @param data    Pixels, one byte each.
+     * @param width   Width of the mask, at most 65535.
+     * @param height  Height of the mask, at most 65535.
+     * @param step    Bytes between the starts of two rows.
+     * @param out     Output buffer. Its capacity is reused.
+     */
+    void encode(const uint8_t *data, int width, int height, size_t step, std::vector<uint8_t> &out);
+
+    /**
+     * Tell the encoder that an encoded frame is sent to the decoder, in order. Can be called from another thread than
+     * encode().
+     * @param encoded  Data from encode().
+     * @param size     Size of the data.
+     */
+    void markDelivered(const uint8_t *encoded, size_t size);
+
+    /**
+     * Forget all key frames, e.g. when the decoder is restarted.
+     */
+    void reset();
+
+private:
+
+    const int keyFrameInterval;
+
+    struct KeyFrame {
+        uint32_t id = 0;
+        int width = 0;
+        int height = 0;
+        std::vector<uint8_t> plane;  // 0 or 1 per pixel
+    };
+
+    KeyFrame keyFrames[2];  // the two most recently encoded
+    int nextKeyFrameSlot = 0;
+    std::atomic<uint32_t> deliveredKeyFrameID = 0;
+    std::atomic<bool> shouldReset = false;
+
+    uint32_t nextFrameID = 1;
+    int framesSinceKeyFrame = 0;
+
+    std::vector<uint8_t> plane;       // current frame, 0 or 1 per pixel
+    std::vector<uint8_t> deltaPlane;  // XOR of the current frame and the key frame
+    std::vector<uint8_t> deltaOut;
+
+    /**
+     * Write the header and the payload of a plane.
+     * @return False if the encoded data would be larger than the limit.
+     */
+    static bool encodePayload(const uint8_t *p, size_t pixels, uint8_t flags, uint32_t id, uint32_t baseID,
+                              int width, int height, std::vector<uint8_t> &out, size_t limit);
+};
+
+class MaskDecoder {
+public:
+
+    /**
+     * Decode a mask.
+     * @param encoded  Data from MaskEncoder::encode().
+     * @param size     Size of the data.
+     * @param out      [Out] Pixels, 0 or 255, width * height bytes without padding.
+     * @param width    [Out] Width of the mask.
+     * @param height   [Out] Height of the mask.
+     * @return Whether the data is valid and, for a delta frame, its key frame is available.
+     */
+    bool decode(const uint8_t *encoded, size_t size, std::vector<uint8_t> &out, int &width, int &height);
+
+    /**
+     * Forget all key frames.
+     */
+    void reset();
+
+private:
+
+    struct KeyFrame {
+        uint32_t id = 0;
+        int width = 0;
+        int height = 0;
+        std::vector<uint8_t> pixels;  // 0 or 255
+    };
+
+    KeyFrame keyFrames[2];
+    int nextKeyFrameSlot = 0;
+};
+
+}
+
+#endif //META_VISION_SOLAIS_MASKCODEC_H
@@ -6,6 +6,9 @@
 #define META_VISION_SOLAIS_PARAMETERS_H
 
 #include "Parameters.pb.h"
+#include <initializer_list>
+#include <string>
+#include <vector>
 
 namespace meta {
 
@@ -71,21 +74,59 @@ inline FloatPair *allocFloatPair(float x, float y) {
     return ret;
 }
 
-inline ResultPoint2f *allocResultPoint2f(float x, float y) {
-    auto ret = new ResultPoint2f;
+// Results are built per frame, on an arena (see main.cpp of Solais) unless arena is nullptr
+
+inline ResultPoint2f *allocResultPoint2f(float x, float y, google::protobuf::Arena *arena = nullptr) {
+    auto ret = google::protobuf::Arena::CreateMessage<ResultPoint2f>(arena);
     ret->set_x(x);
     ret->set_y(y);
     return ret;
 }
 
-inline ResultPoint3f *allocResultPoint3f(float x, float y, float z) {
-    auto ret = new ResultPoint3f;
+inline ResultPoint3f *allocResultPoint3f(float x, float y, float z, google::protobuf::Arena *arena = nullptr) {
+    auto ret = google::protobuf::Arena::CreateMessage<ResultPoint3f>(arena);
     ret->set_x(x);
     ret->set_y(y);
     ret->set_z(z);
     return ret;
 }
 
+/**
+ * Top-level fields of ParamSet that differ between two sets, so that each component only reinitializes what depends on
+ * the changed fields. Fields are identified by the generated field numbers, e.g. ParamSet::kImageWidthFieldNumber.
+ * A field of a message type (e.g. gamma) is changed if any of its subfields is.
+ */
+class ParamSetDiff {
+public:
+
+    /**
+     * Empty diff.
+     */
+    ParamSetDiff() = default;
+
+    ParamSetDiff(const ParamSet &from, const ParamSet &to);
+
+    /**
+     * Diff with every field changed, for the first application of a ParamSet.
+     */
+    static ParamSetDiff all();
+
+    bool empty() const { return fields.empty(); }
+
+    bool changed(int fieldNumber) const;
+
+    bool anyChanged(std::initializer_list<int> fieldNumbers) const;
+
+    /**
+     * Names of the changed fields, separated by spaces, for logging.
+     */
+    std::string toString() const;
+
+private:
+
+    std::vector<int> fields;  // sorted field numbers
+};
+
 }
 
 #endif //META_VISION_SOLAIS_PARAMETERS_H
@@ -5,8 +5,10 @@
 #ifndef META_VISION_SOLAIS_POSITIONCALCULATOR_H
 #define META_VISION_SOLAIS_POSITIONCALCULATOR_H
 
+#include "CalibrationStore.h"
 #include <vector>
 #include <array>
+#include <memory>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
@@ -26,13 +28,23 @@ public:
     void setParameters(cv::Point2f smallArmorSize, cv::Point2f largeArmorSize,
                        const cv::Mat &cameraMatrix, const cv::Mat &distCoeffs, float zScale);
 
+    /**
+     * Set parameters with a calibration of CalibrationStore. Image points are undistorted with its precomputed grid,
+     * so that PnP is solved without distortion.
+     * @param smallArmorSize  [mm]
+     * @param largeArmorSize  [mm]
+     * @param calibration     Can be nullptr, with which solve() fails.
+     */
+    void setParameters(cv::Point2f smallArmorSize, cv::Point2f largeArmorSize,
+                       std::shared_ptr<const Calibration> calibration);
+
     /**
      * Solve armor position in physical world.
      * @param imagePoints
      * @param largeArmor
      * @param manualImagePoints
      * @param offset       [Out] Displacement: x, y, z(distance) in mm
-     * @return
+     * @return Whether the position is solved. False if there is no calibration.
      */
     bool solve(const std::array<cv::Point2f, 4> &imagePoints, bool largeArmor, bool manualImagePoints,
                cv::Point3f &offset) const;
@@ -49,6 +61,9 @@ private:
     cv::Mat distCoeffs;
 
     float zScale;
+
+    std::shared_ptr<const Calibration> calibration;  // nullptr if set with the matrices
+
 };
 
 }
@@ -0,0 +1,214 @@
+#ifndef META_VISION_SOLAIS_PREVIEWENCODER_H
+#define META_VISION_SOLAIS_PREVIEWENCODER_H
+
+#include <opencv2/core/core.hpp>
+#include "MaskCodec.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace meta {
+
+/**
+ * Background stage that encodes the preview images for Terminal, so that the TCP IO thread only forwards ready-made
+ * bytes. The original image is encoded into JPEG. The threshold images are binary masks, encoded losslessly in full
+ * resolution with MaskEncoder (Image.BINARY), which is both smaller and faster than JPEG for them.
+ *
+ * Worker threads pull the latest images through the ImageSource at a limited rate and encode only the subscribed
+ * channels. Channels are distributed to workers (channel i goes to worker i % workerCount). After each round, a worker
+ * sleeps long enough to keep its CPU usage under the configured share, even if that means a lower rate than requested.
+ * Output buffers are recycled once the TCP side has released them.
+ */
+class PreviewEncoder {
+public:
+
+    enum Channel {
+        ORIGINAL,
+        BRIGHTNESS,
+        COLOR,
+        LIGHTS,
+        CHANNEL_COUNT
+    };
+
+    using Images = std::array<cv::Mat, CHANNEL_COUNT>;
+
+    struct EncodedImage {
+        std::shared_ptr<const std::vector<uint8_t>> data;  // nullptr if the image is empty
+        bool binary = false;                               // Image.BINARY (MaskCodec), otherwise Image.JPEG
+    };
+
+    /**
+     * Function to fetch the latest images. Called from worker threads.
+     * Return an ID of the frame (e.g. the capture time), which changes when the images change, or 0 if there is none.
+     */
+    using ImageSource = std::function<uint64_t(Images &images)>;
+
+    /**
+     * Create the encoder and start the workers. No image is encoded until channels are subscribed.
+     * @param source         Function to fetch the latest images.
+     * @param previewHeight  Height of the preview images, aspect ratio preserved.
+     * @param workerCount    Number of worker threads.
+     */
+    explicit PreviewEncoder(ImageSource source, int previewHeight, int workerCount = 2);
+
+    ~PreviewEncoder();
+
+    /**
+     * Set the channels to encode. Unsubscribed channels drop their encoded images and restart delta encoding of masks,
+     * so subscribe again after Terminal reconnects.
+     * @param channelMask  Bit i for channel i.
+     */
+    void setSubscription(unsigned channelMask);
+
+    /**
+     * Restart delta encoding of masks, so that the next ones fetched are key frames, e.g. when a Terminal has missed
+     * some. The encoded masks are dropped.
+     */
+    void restartMasks();
+
+    /**
+     * Set the maximal encoding rate of each channel.
+     * @param fps  Frames per second, positive. Other values are ignored.
+     */
+    void setRate(double fps);
+
+    /**
+     * Set the maximal CPU share of each worker.
+     * @param share  Fraction of one core, in (0, 1].
+     */
+    void setCPUShare(double share);
+
+    void setQuality(int quality) { jpegQuality = quality; }
+
+    /**
+     * Set the height of the JPEG preview images. Takes effect from the next encoding.
+     */
+    void setHeight(int height) { previewHeight = height; }
+
+    /**
+     * Get the encoded image of a channel for sending. If the channel has no recent image (e.g. just subscribed, or
+     * no new frame since a single image detection), the given image is encoded in the calling thread instead.
+     *
+     * The returned image is taken as delivered to Terminal, as masks may be encoded as deltas against it. So it must be
+     * sent, in the order of the calls.
+     *
+     * @param channel  The channel.
+     * @param current  Image of the channel just fetched by the caller, used if there is no recent encoded one.
+     * @param frameID  ID of the current image, see ImageSource.
+     * @return Encoded image. Its data should be released soon to allow recycling.
+     */
+    EncodedImage fetch(Channel channel, const cv::Mat &current, uint64_t frameID);
+
+    /**
+     * Encode one image into JPEG.
+     * @param image    Input image, resized to the height.
+     * @param height   Height of the output image.
+     * @param quality  JPEG quality.
+     * @param resized  Intermediate buffer for the resized image.
+     * @param buf      Output buffer. Its capacity is reused.
+     */
+    static void encode(const cv::Mat &image, int height, int quality, cv::Mat &resized, std::vector<uint8_t> &buf);
+
+private:
+
+    ImageSource source;
+    std::atomic<int> previewHeight;
+
+    std::atomic<unsigned> subscription = 0;
+    std::atomic<int> jpegQuality = 60;
+    std::atomic<double> period = 1.0 / 15;  // [s]
+    std::atomic<double> cpuShare = 0.25;
+
+    static constexpr int MASK_KEY_FRAME_INTERVAL = 30;
+
+    struct ChannelState {
+        std::mutex encodeMutex;  // held during encoding, protects the members below
+        cv::Mat resized;
+        std::vector<std::shared_ptr<std::vector<uint8_t>>> bufferPool;
+        MaskEncoder maskEncoder{MASK_KEY_FRAME_INTERVAL};  // markDelivered() and reset() are thread-safe
+
+        std::mutex latestMutex;  // protects the members below
+        EncodedImage latest;
+        uint64_t latestFrameID = 0;
+        std::chrono::steady_clock::time_point latestEncodeTime;
+    };
+
+    std::array<ChannelState, CHANNEL_COUNT> channels;
+
+    static constexpr size_t BUFFERS_PER_CHANNEL = 3;
+
+    std::vector<std::thread> workers;
+    std::mutex workerMutex;
+    std::condition_variable workerCV;
+    bool workerShouldExit = false;
+
+    void runWorker(int index, int workerCount);
+
+    /**
+     * Encode with encodeMutex of the channel locked.
+     */
+    void encodeChannel(Channel channel, const cv::Mat &image, uint64_t frameID);
+
+    static bool isMaskChannel(Channel channel) { return channel != ORIGINAL; }
+
+};
+
+/**
+ * Adapt the JPEG quality and the height of preview images to keep streamed results within a bandwidth budget.
+ *
+ * The bandwidth is estimated from the size of each pushed result and the interval since the previous one, smoothed by
+ * an exponential moving average. Quality is reduced first, since it is less visible than resolution, down to
+ * MIN_QUALITY, and then the height, down to 1/4. When the usage is well under the budget, the height is restored first.
+ * Adjustments are made at most once every ADJUST_INTERVAL pushes, so that each takes effect before the next.
+ */
+class PreviewBudget {
+public:
+
+    PreviewBudget(int maxQuality, int maxHeight) : maxQuality(maxQuality), maxHeight(maxHeight) { reset(0); }
+
+    /**
+     * Reset to the full quality and height.
+     * @param budget  [bytes/s], 0 for unlimited.
+     */
+    void reset(double budget);
+
+    /**
+     * Update after each push.
+     * @param bytes     Size of the pushed result.
+     * @param interval  Time since the previous push [s].
+     */
+    void update(size_t bytes, double interval);
+
+    int quality() const { return quality_; }
+
+    int height() const { return height_; }
+
+    double bandwidth() const { return bandwidth_; }
+
+private:
+
+    static constexpr int MIN_QUALITY = 20;
+    static constexpr int QUALITY_STEP = 10;
+    static constexpr double HEIGHT_STEP = 0.8;
+    static constexpr int ADJUST_INTERVAL = 5;
+    static constexpr double RESTORE_THRESHOLD = 0.6;  // restore when the usage is below this fraction of the budget
+
+    const int maxQuality;
+    const int maxHeight;
+
+    double budget_ = 0;
+    double bandwidth_ = 0;
+    int quality_ = 0;
+    int height_ = 0;
+    int pushesSinceAdjust = 0;
+};
+
+}
+
+#endif //META_VISION_SOLAIS_PREVIEWENCODER_H
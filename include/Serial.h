@@ -9,7 +9,11 @@
 #include <cstdint>
 #include <boost/asio.hpp>
 #include <utility>
+#include <deque>
+#include <atomic>
 #include "FrameCounterBase.h"
+#include "GimbalHistory.h"
+#include "TimeBase.h"
 #include "Utilities.h"
 
 namespace meta {
@@ -17,12 +21,7 @@ namespace meta {
 class Serial : public FrameCounterBase {
 public:
 
-    explicit Serial(boost::asio::io_context &ioContext);
-
-    bool sendControlCommand(bool detected, bool topKillerTriggered, TimePoint time, float yawDelta, float pitchDelta, float distance,
-                            float avgLightAngle, float imageX, float imageY, int remainingTimeToTarget, int period);
-
-private:
+    /** Protocol. Public for MCU emulators in tests and benchmarks. **/
 
     static constexpr uint8_t SOF = 0xA5;
 
@@ -32,10 +31,11 @@ private:
             NONE = 0,
             DETECTED = 1,
             TOP_KILLER_TRIGGERED = 2,
+            TIME_SYNCHRONIZED = 4,      // frameTime is on the MCU clock, otherwise it is on the host clock
         };
 
         uint8_t flag;
-        uint16_t frameTime;             // [0.1ms]
+        uint16_t frameTime;             // lowest 16 bits of frame capture time [0.1ms], unwrap around the current time
         int16_t yawDelta;               // yaw relative angle [deg] * 100
         int16_t pitchDelta;             // pitch relative angle [deg] * 100
         int16_t distance;               // [mm]
@@ -46,45 +46,151 @@ private:
         int16_t period;                 // [ms]
     };
 
+    struct __attribute__((packed, aligned(1))) GimbalFeedback {
+        uint32_t time;                  // MCU time [0.1ms]
+        int32_t yaw;                    // absolute yaw angle [deg] * 100, leftward for positive (MCU convention)
+        int32_t pitch;                  // absolute pitch angle [deg] * 100, downward for positive
+    };
+
+    struct __attribute__((packed, aligned(1))) TimeSyncRequest {
+        uint32_t hostTime;              // lowest 32 bits of host time when sent [0.1ms], to be echoed back as is
+    };
+
+    struct __attribute__((packed, aligned(1))) TimeSyncEcho {
+        uint32_t hostTime;              // hostTime of the request
+        uint32_t mcuTime;               // MCU time when the request is received [0.1ms]
+    };
+
     struct __attribute__((packed, aligned(1))) Package {
         uint8_t sof;  // start of frame, 0xA5
         uint8_t cmdID;
         union {  // union takes the maximal size of its elements
             VisionCommand command;
+            GimbalFeedback feedback;
+            TimeSyncRequest timeSyncRequest;
+            TimeSyncEcho timeSyncEcho;
         };
         uint8_t crc8;  // just for reference but not use (the offset of this is not correct)
     };
 
     enum CommandID : uint8_t {
-        VISION_CONTROL_CMD_ID = 0,
+        VISION_CONTROL_CMD_ID = 0,      // Vision -> MCU
+        GIMBAL_FEEDBACK_CMD_ID = 1,     // MCU -> Vision
+        TIME_SYNC_REQUEST_CMD_ID = 2,   // Vision -> MCU
+        TIME_SYNC_ECHO_CMD_ID = 3,      // MCU -> Vision
         CMD_ID_COUNT
     };
 
     static constexpr size_t DATA_SIZE[CMD_ID_COUNT] = {
-            sizeof(VisionCommand)
+            sizeof(VisionCommand),
+            sizeof(GimbalFeedback),
+            sizeof(TimeSyncRequest),
+            sizeof(TimeSyncEcho)
+    };
+
+    /** Interface **/
+
+    static constexpr int DEFAULT_BAUD_RATE = 115200;
+
+    explicit Serial(boost::asio::io_context &ioContext);
+
+    /**
+     * Open the serial device, then start receiving and pinging the MCU for clock synchronization.
+     * @param device    Path to the device, such as /dev/ttyTHS1.
+     * @param baudRate
+     * @return Whether the device is opened successfully. Errors are printed.
+     */
+    bool open(const std::string &device, int baudRate = DEFAULT_BAUD_RATE);
+
+    bool isOpened() const { return serial.is_open(); }
+
+    /**
+     * Close the serial device. Pending operations are cancelled. Must be called from the IO thread or when the
+     * io_context is not running.
+     */
+    void close();
+
+    struct Statistics {
+        uint64_t packagesSent;
+        uint64_t commandsSent;       // control commands among packagesSent
+        uint64_t bytesSent;
+        uint64_t packagesReceived;   // with correct CRC
+        uint64_t bytesReceived;
+        uint64_t crcErrors;          // candidate packages rejected by CRC (corrupted, or a 0xA5 that is not a SOF)
     };
 
+    /**
+     * Cumulative statistics since the construction. Can be called from any thread.
+     */
+    Statistics statistics() const;
+
+    /**
+     * Send a control command to the MCU. Can be called from any thread.
+     * @param time  Frame capture time on the unified clock. Sent on the MCU clock once the clocks are synchronized.
+     * @return Whether the command is queued, false if the device is not opened.
+     */
+    bool sendControlCommand(bool detected, bool topKillerTriggered, TimePoint time, float yawDelta, float pitchDelta, float distance,
+                            float avgLightAngle, float imageX, float imageY, int remainingTimeToTarget, int period);
+
+    /**
+     * Gimbal attitudes received from the MCU. Filled by the serial IO thread and readable from any thread.
+     */
+    const GimbalHistory &gimbalHistory() const { return gimbalHistory_; }
+
+    /**
+     * Mapping from the MCU clock to the unified clock, estimated from time sync ping/echo packages.
+     */
+    const ClockSync &mcuClock() const { return mcuClock_; }
+
 private:
 
     boost::asio::io_context &ioContext;
     boost::asio::serial_port serial;
 
-    static constexpr int SERIAL_BAUD_RATE = 115200;
-
-    enum ReceiverState {
-        RECV_PREAMBLE,          // 0xA5
-        RECV_CMD_ID,            // cmdID
-        RECV_DATA_TAIL,         // data section and 1-byte CRC8
-    };
+    static constexpr auto TIME_SYNC_INTERVAL = std::chrono::milliseconds(100);
+    boost::asio::steady_timer timeSyncTimer;
 
+    /*
+     * Whatever is available is read into the buffer at once, then complete packages are parsed from recvBegin.
+     * Unparsed bytes (at most one partial package) are moved to the front before the next read.
+     */
     static constexpr size_t RECV_BUFFER_SIZE = 0x1000;
-    ReceiverState recvState = RECV_PREAMBLE;
+    uint8_t recvBuffer[RECV_BUFFER_SIZE];
+    size_t recvBegin = 0;  // first unparsed byte
+    size_t recvEnd = 0;    // end of received bytes
+
+    void startRecv();
+
+    void parseRecvBuffer();
+
+    void handlePackage(const Package &pkg);
+
+    GimbalHistory gimbalHistory_;
+
+    ClockSync mcuClock_;
+    uint64_t lastMCUTime = 0;  // full-width MCU time of the latest package
+    bool mcuTimeReceived = false;
+
+    // Packages are queued and written one at a time on the IO thread, so that packages from different threads never
+    // interleave on the wire
+    std::deque<std::pair<std::shared_ptr<Package>, size_t>> sendQueue;
+
+    std::atomic<uint64_t> packagesSent{0};
+    std::atomic<uint64_t> commandsSent{0};
+    std::atomic<uint64_t> bytesSent{0};
+    std::atomic<uint64_t> packagesReceived{0};
+    std::atomic<uint64_t> bytesReceived{0};
+    std::atomic<uint64_t> crcErrors{0};
+
+    void queuePackage(std::shared_ptr<Package> pkg, size_t size);
+
+    void startSend();
 
-    uint8_t sendSeq = 0;
+    void handleSend(const boost::system::error_code &error, size_t numBytes);
 
-    Package recvPackage;
+    void sendTimeSyncRequest();
 
-    void handleSend(std::shared_ptr<Package> buf, const boost::system::error_code &error, size_t numBytes);
+    uint64_t unwrapMCUTime(uint32_t mcuTime);
 
     void handleRecv(const boost::system::error_code &error, size_t numBytes);
 
@@ -0,0 +1,192 @@
+#ifndef META_VISION_SOLAIS_TELEMETRY_H
+#define META_VISION_SOLAIS_TELEMETRY_H
+
+#include <boost/asio.hpp>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace meta {
+
+/**
+ * Low-latency telemetry over UDP, beside the TCP socket to Terminal. Each processed frame is sent as one datagram of a
+ * fixed layout (little endian, as the serial protocol), so the small and time-critical data (armors, YPD, control
+ * command, stage timings, TopKiller) is never blocked behind a large result on the TCP stream. Control and images stay
+ * on TCP. Datagrams may be lost, which is measured by the sequence numbers, but never retransmitted.
+ *
+ * The destination can be a unicast or a multicast address.
+ */
+struct __attribute__((packed, aligned(1))) TelemetryRecord {
+
+    static constexpr uint16_t MAGIC = 0x544D;  // "MT"
+    static constexpr uint8_t VERSION = 1;
+    static constexpr int MAX_ARMORS = 8;        // more armors in a frame are not sent
+
+    enum Flag : uint8_t {
+        NONE = 0,
+        DETECTED = 1,                 // the control command has a target
+        TOP_KILLER_TRIGGERED = 2,
+    };
+
+    enum Stage {
+        DETECT,                       // ArmorDetector
+        SOLVE,                        // PositionCalculator
+        AIM,                          // AimingSolver and the serial command
+        LATENCY,                      // from the frame capture to the send of this record
+        STAGE_COUNT
+    };
+
+    struct __attribute__((packed, aligned(1))) Armor {
+        int16_t imageX;               // center [pixel]
+        int16_t imageY;
+        float yaw;                    // [deg]
+        float pitch;                  // [deg]
+        float distance;               // [mm]
+        uint8_t number;               // 0 for empty (no number sticker)
+        uint8_t large;
+        uint8_t selected;             // the target of the control command
+        uint8_t reserved;
+    };
+
+    // Header, filled by TelemetrySender::send()
+    uint16_t magic;
+    uint8_t version;
+    uint8_t armorCount;               // valid entries of armors, the rest are not sent
+    uint32_t senderID;                // random for each sender, changes when Core restarts
+    uint32_t sequence;                // increments by 1 for each record of the sender, starting from 1
+
+    uint64_t frameTime;               // capture time of the frame [0.1ms], on the unified clock of Core
+    uint8_t flags;                    // Flag
+    uint8_t tkPulseCount;
+    uint16_t tkPeriod;                // TopKiller rotation period [ms]
+    float yawDelta;                   // control command [deg], rightward for positive
+    float pitchDelta;                 // [deg], downward for positive
+    float distance;                   // [mm]
+    uint16_t remainingTimeToTarget;   // TopKiller [ms]
+    uint16_t paramsVersion;           // lower 16 bits of the version of the parameters (see Executor)
+    uint32_t stageMicros[STAGE_COUNT];  // [us]
+
+    Armor armors[MAX_ARMORS];
+
+    /**
+     * Size of the datagram of this record, with only the valid armors.
+     */
+    size_t size() const { return HEADER_SIZE + armorCount * sizeof(Armor); }
+
+    static constexpr size_t HEADER_SIZE = sizeof(uint16_t) + 2 * sizeof(uint8_t) + 2 * sizeof(uint32_t) +
+                                          sizeof(uint64_t) + 2 * sizeof(uint8_t) + sizeof(uint16_t) +
+                                          3 * sizeof(float) + 2 * sizeof(uint16_t) + STAGE_COUNT * sizeof(uint32_t);
+};
+
+static_assert(offsetof(TelemetryRecord, armors) == TelemetryRecord::HEADER_SIZE, "unexpected padding");
+
+class TelemetrySender {
+public:
+
+    explicit TelemetrySender(boost::asio::io_context &ioContext);
+
+    /**
+     * Open the socket to a destination.
+     * @param address  IPv4 address, unicast or multicast (224.0.0.0/4).
+     * @param port     UDP port.
+     * @param ttl      Multicast TTL. 1 keeps it in the local network.
+     * @return Whether the socket is opened. Errors are printed.
+     */
+    bool open(const std::string &address, int port, int ttl = 1);
+
+    bool isOpened() const { return socket.is_open(); }
+
+    void close();
+
+    /**
+     * Send a record. The header is filled here. The socket is non-blocking, so this never waits, but the record is
+     * dropped if the socket buffer is full. Should be called from one thread at a time (e.g. the executor thread).
+     * @param record  Record with the content filled.
+     * @return Whether the record is sent.
+     */
+    bool send(TelemetryRecord &record);
+
+    struct Statistics {
+        uint64_t recordsSent;
+        uint64_t bytesSent;
+        uint64_t recordsDropped;   // socket errors or a full socket buffer
+    };
+
+    /**
+     * Cumulative statistics since the construction. Can be called from any thread.
+     */
+    Statistics statistics() const;
+
+private:
+
+    boost::asio::ip::udp::socket socket;
+    boost::asio::ip::udp::endpoint destination;
+
+    uint32_t senderID;
+    uint32_t nextSequence = 1;
+
+    std::atomic<uint64_t> recordsSent{0};
+    std::atomic<uint64_t> bytesSent{0};
+    std::atomic<uint64_t> recordsDropped{0};
+};
+
+class TelemetryReceiver {
+public:
+
+    /**
+     * Called on the IO thread for each valid record.
+     */
+    using RecordCallback = std::function<void(const TelemetryRecord &record)>;
+
+    explicit TelemetryReceiver(boost::asio::io_context &ioContext);
+
+    /**
+     * Open the socket and start receiving. Must be called from the IO thread or when the io_context is not running.
+     * @param port              UDP port.
+     * @param multicastAddress  Multicast group to join, empty for unicast.
+     * @param callback          Called for each valid record.
+     * @return Whether the socket is opened. Errors are printed.
+     */
+    bool open(int port, const std::string &multicastAddress, RecordCallback callback);
+
+    void close();
+
+    struct Statistics {
+        uint64_t recordsReceived;  // valid ones
+        uint64_t recordsLost;      // gaps in the sequence numbers, less the ones arriving late (within 64 records)
+        uint64_t recordsLate;      // out of order or duplicated
+        uint64_t invalidDatagrams; // wrong magic, version or size
+    };
+
+    /**
+     * Cumulative statistics since open(). Can be called from any thread.
+     */
+    Statistics statistics() const;
+
+private:
+
+    boost::asio::ip::udp::socket socket;
+    RecordCallback callback;
+
+    uint8_t recvBuffer[sizeof(TelemetryRecord) + 1];  // one more byte to detect oversized datagrams
+    TelemetryRecord recvRecord;                         // copied out of the buffer, with the missing armors zeroed
+
+    uint32_t senderID = 0;
+    uint32_t lastSequence = 0;  // the highest one received from the sender
+    uint64_t recentSequences = 0;  // bit i for lastSequence - i received, to tell late records from duplicates
+
+    std::atomic<uint64_t> recordsReceived{0};
+    std::atomic<uint64_t> recordsLost{0};
+    std::atomic<uint64_t> recordsLate{0};
+    std::atomic<uint64_t> invalidDatagrams{0};
+
+    void startRecv();
+
+    void handleRecv(const boost::system::error_code &error, size_t numBytes);
+};
+
+}
+
+#endif //META_VISION_SOLAIS_TELEMETRY_H
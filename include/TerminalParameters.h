@@ -5,10 +5,21 @@
 #ifndef META_VISION_SOLAIS_TERMINALPARAMETERS_H
 #define META_VISION_SOLAIS_TERMINALPARAMETERS_H
 
+#include <cstddef>
+
 namespace meta {
 
 inline constexpr int TERMINAL_IMAGE_PREVIEW_HEIGHT = 360;
+inline constexpr int TERMINAL_PREVIEW_JPEG_QUALITY = 60;
+inline constexpr double TERMINAL_PREVIEW_FPS = 15;           // max encoding rate of each preview image
+inline constexpr double TERMINAL_PREVIEW_CPU_SHARE = 0.25;   // max CPU share of each encoder thread
+inline constexpr int TERMINAL_PREVIEW_ENCODER_THREADS = 2;
+inline constexpr float TERMINAL_STREAM_FPS = 20;                // result rate requested by Terminal
+inline constexpr int TERMINAL_STREAM_MAX_BANDWIDTH = 0x200000;  // [bytes/s] budget requested by Terminal
+inline constexpr int TERMINAL_MAX_CLIENTS = 4;                    // concurrent Terminals accepted by Core
+inline constexpr size_t TERMINAL_CLIENT_SEND_QUEUE_LIMIT = 0x1000000;  // [bytes] a slower Terminal is disconnected
 inline constexpr const char *TCP_SOCKET_PORT_STR = "8800";
+inline constexpr int TELEMETRY_PORT = 8801;                   // UDP, see Telemetry.h
 
 }
 
@@ -8,6 +8,9 @@
 #include <thread>
 #include <boost/asio.hpp>
 #include <utility>
+#include <deque>
+#include <mutex>
+#include <vector>
 #include <google/protobuf/message.h>
 
 namespace meta {
@@ -16,8 +19,8 @@ namespace meta {
  * TerminalSocket provides a bidirectional TCP socket to send and receive several types of data, each labelled with a
  * NUL-terminated string.
  *
- * This class is a base class (not instantiable from outside) for TerminalSocketServer and TerminalSocketClient (below).
- * Only one concurrent TCP connection is allowed (see TerminalSocketServer::startAccept() below).
+ * This class is a base class (not instantiable from outside) for TerminalSocketServer::Session and TerminalSocketClient
+ * (below). Each instance manages one TCP connection. TerminalSocketServer accepts several clients, each as a Session.
  *
  * Boost asio is used for the low-level TCP socket. The main motivation is the requirement for asynchronous socket
  * operation. Sockets are slow. If instant processing results are to be sent, we don't want the socket operations take
@@ -31,6 +34,13 @@ namespace meta {
  * actually performed and there should not be any memory leak after the operations are performed or cancelled.
  * shared_ptr's are frequently used in this class to help manage the memory.
  *
+ * Sending functions can be called from any thread. Each package is encoded into a buffer taken from a pool (no
+ * allocation once the pool is warm) and appended to a send queue. At most one async_write is in flight on the socket,
+ * so packages never interleave. When it completes, all packages queued in the meantime are written together by a
+ * single async_write over a buffer sequence (scatter-gather), and their buffers are returned to the pool. A payload
+ * shared by the caller (see sendBytes with SharedPayload) is referenced in the buffer sequence without being copied.
+ * The send queue can be bounded (see setSendQueueLimit), so that a slow peer can't hold unlimited memory.
+ *
  * Cleaning up sockets also requires careful handling. Boost does well on cleaning up the socket. No manual shutdown or
  * close is performed on the socket objects in this class. Instead, we just carefully manage the life cycles of socket
  * instances and let their destructor do the clean-up. When a socket instance is destroyed, queued async work will
@@ -74,7 +84,28 @@ protected:
 
 public:
 
-    bool connected() const { return (socket != nullptr && socket->is_open() && !socketDisconnected); }
+    bool connected() const { return !socketDisconnected; }  // socket is only accessed on the IO thread
+
+    /**
+     * Whether there are packages queued or being written, i.e. the peer or the network is not keeping up. Optional
+     * packages (e.g. streamed results) can be skipped in this case instead of piling up.
+     */
+    bool hasPendingSends();
+
+    /**
+     * What to do with a package that doesn't fit in the bounded send queue.
+     */
+    enum OverflowPolicy {
+        DROP_PACKAGE,  // drop the package, the sending function returns false
+        DISCONNECT     // drop the package and close the connection, as the peer is not keeping up at all
+    };
+
+    /**
+     * Bound the bytes queued or being written. Unlimited by default.
+     * @param maxBytes  Maximal bytes, 0 for unlimited.
+     * @param policy    What to do with a package that doesn't fit.
+     */
+    void setSendQueueLimit(size_t maxBytes, OverflowPolicy policy);
 
     /**
      * Async send a single string.
@@ -109,6 +140,20 @@ public:
      */
     bool sendBytes(const std::string &name, const google::protobuf::Message &message);
 
+    /**
+     * Payload that can be sent without copying, possibly to several sockets. It must not be modified after being
+     * passed to a sending function.
+     */
+    using SharedPayload = std::shared_ptr<const std::vector<uint8_t>>;
+
+    /**
+     * Async send bytes without copying them.
+     * @param name     Name of the package.
+     * @param payload  The data, kept alive by the send queue until written.
+     * @return         Whether the operation succeeded.
+     */
+    bool sendBytes(const std::string &name, SharedPayload payload);
+
     /**
      * Async send a list of strings
      * @param name  Name of the package.
@@ -158,11 +203,26 @@ public:
         listOfStringsCallBack = std::move(listOfStrings);
     }
 
+    /**
+     * Contents from this size are read from the socket directly into a separate buffer, see RecvBufferProvider.
+     */
+    static constexpr size_t LARGE_PACKAGE_SIZE = 0x10000;
+
+    /**
+     * Function type to provide the buffer for the content of a large bytes package (LARGE_PACKAGE_SIZE or larger), e.g.
+     * the data of a preallocated image. It is called on the IO thread once the header of the package arrives, and the
+     * content is then read into the buffer without copying. Return nullptr to use an internal buffer. The buffer must
+     * be valid until the bytes callback of the package returns, which gets a pointer into it.
+     */
+    using RecvBufferProvider = std::function<uint8_t *(std::string_view name, size_t size)>;
+
+    void setRecvBufferProvider(RecvBufferProvider provider) { recvBufferProvider = std::move(provider); }
+
     /**
      * Get the number of bytes sent/received since last clear.
      * @return {sent bytes, received bytes}
      */
-    std::pair<unsigned, unsigned> getAndClearStats();
+    std::pair<uint64_t, uint64_t> getAndClearStats();
 
 protected:
 
@@ -189,21 +249,56 @@ protected:
 
     boost::asio::io_context &ioContext;
 
-    std::atomic<unsigned> uploadBytes = 0;
-    std::atomic<unsigned> downloadBytes = 0;
+    std::atomic<uint64_t> uploadBytes = 0;
+    std::atomic<uint64_t> downloadBytes = 0;
 
 private:
 
     // ================================ Socket and IO Context ================================
 
     std::shared_ptr<boost::asio::ip::tcp::socket> socket = nullptr;
-    std::atomic<bool> socketDisconnected = false;
+    std::atomic<bool> socketDisconnected = true;  // no socket, closed, disconnected or overflowed
+    std::atomic<bool> sendOverflowed = false;  // to be closed on the IO thread by handleSend or closeOverflowed
 
     // ================================ Sending ================================
 
-    void handleSend(std::shared_ptr<std::vector<uint8_t>> buf, const boost::system::error_code &error, size_t numBytes);
+    struct OutPackage {
+        std::vector<uint8_t> buf;  // header and copied content, from the pool
+        SharedPayload payload;     // content not copied, can be nullptr
+
+        size_t size() const { return buf.size() + (payload ? payload->size() : 0); }
+    };
+
+    std::mutex sendMutex;                // protects the members below
+    std::deque<OutPackage> sendQueue;    // to be written
+    std::vector<OutPackage> writing;     // being written by the async_write in flight
+    bool writeInFlight = false;
+    size_t queuedBytes = 0;              // in sendQueue and writing
+    size_t maxQueuedBytes = 0;           // 0 for unlimited
+    OverflowPolicy overflowPolicy = DROP_PACKAGE;
+    std::vector<std::vector<uint8_t>> bufferPool;
+    std::vector<boost::asio::const_buffer> writeBuffers;  // only used on the IO thread
+
+    static constexpr size_t MAX_POOLED_BUFFERS = 64;
+    static constexpr size_t MAX_POOLED_BUFFER_CAPACITY = 0x400000;  // larger buffers are released
+
+    std::vector<uint8_t> acquireBuffer(PackageType type, const std::string &name, size_t contentSize);
+
+    /**
+     * @return False if the package is dropped by the send queue limit.
+     */
+    bool queuePackage(OutPackage &&package);
 
-    static std::shared_ptr<std::vector<uint8_t>> allocateBuffer(PackageType type, const std::string &name, size_t contentSize);
+    void startWrite();
+
+    void handleSend(boost::asio::ip::tcp::socket *s, const boost::system::error_code &error, size_t numBytes);
+
+    /**
+     * Close the socket that overflowed while no write was in flight.
+     */
+    void closeOverflowed();
+
+    void releaseBuffers(std::vector<OutPackage> &packages);
 
     static void emplaceInt32(std::vector<uint8_t> &buf, int32_t n);
 
@@ -214,75 +309,242 @@ private:
     BytesCallback bytesCallBack = nullptr;
     ListOfStringsCallback listOfStringsCallBack = nullptr;
 
-    enum ReceiverState {
-        RECV_PREAMBLE,
-        RECV_PACKAGE_TYPE,
-        RECV_NAME,
-        RECV_SIZE,
-        RECV_CONTENT
-    };
+    RecvBufferProvider recvBufferProvider = nullptr;
+
+    /*
+     * Whatever is available is read into recvBuf at once, then complete packages are parsed from recvBegin and passed
+     * to the callbacks as pointers into the buffer. Unparsed bytes (at most the header and the content of one small
+     * package) are moved to the front only when the free space at the end is less than RECV_READ_SIZE, so a large read
+     * is normally parsed without moving anything.
+     *
+     * The content of a large package (LARGE_PACKAGE_SIZE or larger) that has not fully arrived is read into a separate
+     * buffer instead, from the RecvBufferProvider or largeRecvPool, with the bytes already received copied once.
+     */
+    static constexpr size_t RECV_BUFFER_SIZE = 0x40000;
+    static constexpr size_t RECV_READ_SIZE = 0x10000;        // minimal free space for each read
+    static constexpr size_t MAX_NAME_LENGTH = 0x400;         // longer names are taken as corrupted data
+    static constexpr size_t MAX_POOLED_RECV_CAPACITY = 0x2000000;  // a larger internal buffer is released after use
 
-    static constexpr size_t RECV_BUFFER_SIZE = 0x10000;
+    std::vector<uint8_t> recvBuf;
+    size_t recvBegin = 0;  // first unparsed byte
+    size_t recvEnd = 0;    // end of received bytes
 
-    ReceiverState recvState = RECV_PREAMBLE;
+    bool recvLarge = false;  // reading the content of a large package, the members below are valid
+    PackageType largeRecvType = PACKAGE_TYPE_COUNT;
+    std::string largeRecvName;
+    uint8_t *largeRecvTarget = nullptr;
+    size_t largeRecvSize = 0;
+    size_t largeRecvReceived = 0;
 
-    std::vector<uint8_t> recvBuf;  // use std::vector to ensure the support of large packages
-    ssize_t recvOffset = 0;
+    std::unique_ptr<uint8_t[]> largeRecvPool;  // not zero-initialized, unlike std::vector
+    size_t largeRecvPoolCapacity = 0;
 
-    ssize_t recvRemainingBytes = 0;
-    PackageType recvCurrentPackageType = PACKAGE_TYPE_COUNT;
-    ssize_t recvNameStart = -1;
-    ssize_t recvContentSize = -1;
-    ssize_t recvContentStart = -1;
+    template<class T>
+    void startRecv(std::function<void(T *)> disconnectCallback);
 
     template<class T>
     void
     handleRecv(const boost::system::error_code &error, size_t numBytes, std::function<void(T *)> disconnectCallback);
 
+    /**
+     * Parse and handle the packages in recvBuf, until an incomplete one. Starts reading a large package if there is.
+     */
+    void parseRecvBuffer();
+
     static int32_t decodeInt32(const uint8_t *start);
 
-    void handlePackage() const;
+    void handlePackage(PackageType type, const char *name, const uint8_t *content, size_t size) const;
 
 };
 
 /**
- * Derived class to act as the TCP server (listener).
+ * TCP server (listener) that accepts up to a number of concurrent clients, each as a Session with its own send queue.
+ *
+ * Received packages are passed to the callbacks with the Session they come from, so that replies can go to that client
+ * only. The sending functions of the server send to all the clients. A protobuf message is serialized once and shared
+ * by the send queues of all clients (see SharedPayload), instead of being encoded for each client.
+ *
+ * Sessions are created and destroyed on the IO thread. A disconnected session is dropped by the server once its
+ * pending operations are aborted, so it must not be used after the disconnection callback.
  */
-class TerminalSocketServer : public TerminalSocketBase {
+class TerminalSocketServer {
 public:
 
-    using ServerDisconnectionCallback = std::function<void(TerminalSocketServer *)>;
+    /**
+     * Connection to one client.
+     */
+    class Session : public TerminalSocketBase {
+    public:
+
+        Session(boost::asio::io_context &ioContext, unsigned id) : TerminalSocketBase(ioContext), id_(id) {}
+
+        /**
+         * ID of the session, unique within the server.
+         */
+        unsigned id() const { return id_; }
+
+        /**
+         * Address of the client, for logging.
+         */
+        const std::string &address() const { return address_; }
+
+        /**
+         * Disconnect the client. Call on the IO thread.
+         */
+        void disconnect() { closeSocket(); }
+
+    private:
+
+        friend class TerminalSocketServer;
+
+        const unsigned id_;
+        std::string address_;
+    };
+
+    using SessionPtr = std::shared_ptr<Session>;
+
+    using SingleStringCallback = std::function<void(Session *session, std::string_view name, std::string_view s)>;
+
+    using SingleIntCallback = std::function<void(Session *session, std::string_view name, int32_t n)>;
+
+    using BytesCallback = std::function<void(Session *session, std::string_view name, const uint8_t *buf,
+                                             size_t size)>;
+
+    using ListOfStringsCallback = std::function<void(Session *session, std::string_view name,
+                                                     const std::vector<const char *> &list)>;
+
+    using ServerDisconnectionCallback = std::function<void(Session *session)>;
+
+    using RecvBufferProvider = std::function<uint8_t *(Session *session, std::string_view name, size_t size)>;
+
+    static constexpr int DEFAULT_MAX_SESSIONS = 4;
 
     /**
      * Create a server listening on the given port. The server will not accept incoming connection until startAccept()
-     * is called. A server can connect to at most one client concurrently.
+     * is called.
      * @param port                   The port to listen on.
-     * @param disconnectionCallback  Callback function when the socket is disconnected.
+     * @param disconnectionCallback  Callback function when a client is disconnected, on the IO thread.
+     * @param maxSessions            Maximal number of concurrent clients. Further connections are refused.
      */
-    explicit TerminalSocketServer(boost::asio::io_context &ioContext,
-                                  int port, ServerDisconnectionCallback disconnectionCallback = nullptr);
+    explicit TerminalSocketServer(boost::asio::io_context &ioContext, int port,
+                                  ServerDisconnectionCallback disconnectionCallback = nullptr,
+                                  int maxSessions = DEFAULT_MAX_SESSIONS);
 
     /**
-     * Start accepting incoming connection. A server can connect to at most one client concurrently. If this function
-     * is called when there is already a connection, and another request comes, the previous one will get disconnected.
-     *
-     * To restart acceptance after disconnection, call this function in the disconnect callback.
+     * Start accepting incoming connections. Acceptance continues until the server is destroyed.
      */
     void startAccept();
 
     /**
-     * Disconnect the socket.
+     * Set callback functions for arrivals of data, from any client. Set before startAccept().
+     */
+    void setCallbacks(SingleStringCallback singleString = nullptr,
+                      SingleIntCallback singleInt = nullptr,
+                      BytesCallback bytes = nullptr,
+                      ListOfStringsCallback listOfStrings = nullptr) {
+        singleStringCallBack = std::move(singleString);
+        singleIntCallBack = std::move(singleInt);
+        bytesCallBack = std::move(bytes);
+        listOfStringsCallBack = std::move(listOfStrings);
+    }
+
+    /**
+     * Set the provider of buffers for large bytes packages from any client, see TerminalSocketBase. Set before
+     * startAccept().
+     */
+    void setRecvBufferProvider(RecvBufferProvider provider) { recvBufferProvider = std::move(provider); }
+
+    /**
+     * Bound the send queue of each client. Applies to clients connected afterwards.
+     */
+    void setSendQueueLimit(size_t maxBytes, TerminalSocketBase::OverflowPolicy policy) {
+        sessionQueueLimit = maxBytes;
+        sessionOverflowPolicy = policy;
+    }
+
+    /**
+     * Whether any client is connected.
+     */
+    bool connected();
+
+    /**
+     * Get the connected clients.
+     */
+    std::vector<SessionPtr> sessions();
+
+    /**
+     * Serialize a protobuf message into a payload that can be sent to several clients. Payload buffers are recycled
+     * once all send queues have released them.
+     */
+    TerminalSocketBase::SharedPayload serialize(const google::protobuf::Message &message);
+
+    /**
+     * Functions to send to all clients. See TerminalSocketBase.
+     * @return Whether the package is queued for at least one client.
+     */
+
+    bool sendSingleString(const std::string &name, const std::string &s);
+
+    bool sendSingleInt(const std::string &name, int32_t n);
+
+    bool sendBytes(const std::string &name, uint8_t *data = nullptr, size_t size = 0);
+
+    bool sendBytes(const std::string &name, const google::protobuf::Message &message);
+
+    bool sendBytes(const std::string &name, const TerminalSocketBase::SharedPayload &payload);
+
+    bool sendListOfStrings(const std::string &name, const std::vector<std::string> &list);
+
+    /**
+     * Disconnect all clients.
      */
     void disconnect();
 
+    /**
+     * Get the number of bytes sent/received since last clear, summed over the clients.
+     * @return {sent bytes, received bytes}
+     */
+    std::pair<uint64_t, uint64_t> getAndClearStats();
+
 protected:
 
+    boost::asio::io_context &ioContext;
     int port;
+    int maxSessions;
     boost::asio::ip::tcp::acceptor acceptor;
     ServerDisconnectionCallback disconnectionCallback;
 
+    SingleStringCallback singleStringCallBack = nullptr;
+    SingleIntCallback singleIntCallBack = nullptr;
+    BytesCallback bytesCallBack = nullptr;
+    ListOfStringsCallback listOfStringsCallBack = nullptr;
+    RecvBufferProvider recvBufferProvider = nullptr;
+
+    size_t sessionQueueLimit = 0;
+    TerminalSocketBase::OverflowPolicy sessionOverflowPolicy = TerminalSocketBase::DROP_PACKAGE;
+
+    std::mutex sessionMutex;  // protects the members below
+    std::vector<SessionPtr> sessions_;
+    unsigned nextSessionID = 1;
+    std::vector<std::shared_ptr<std::vector<uint8_t>>> payloadPool;
+    std::pair<uint64_t, uint64_t> reapedStats{0, 0};  // of the sessions destroyed since the last getAndClearStats()
+
+    static constexpr size_t MAX_POOLED_PAYLOADS = 8;
+
+    void doAccept();
+
     void handleAccept(std::shared_ptr<boost::asio::ip::tcp::socket> socket, const boost::system::error_code &error);
 
+    void handleSessionDisconnection(Session *session);
+
+    /**
+     * Keep a closed session alive until its aborted operations have completed.
+     */
+    void reapSession(SessionPtr session);
+
+    template<class F>
+    bool sendToAll(F &&send);
+
 };
 
 /**
@@ -0,0 +1,149 @@
+#ifndef META_VISION_SOLAIS_TIMEBASE_H
+#define META_VISION_SOLAIS_TIMEBASE_H
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <type_traits>
+#include "Utilities.h"
+
+namespace meta {
+
+/**
+ * The unified clock of Solais. All TimePoints (frame capture time, gimbal feedback time, etc.) are on this clock, which
+ * is the host steady_clock in 0.1 ms since the start of the process. It is monotonic, 64-bit (no wrapping in practice)
+ * and never 0, as 0 is used by input sources to indicate the end of the stream.
+ *
+ * Other clocks (camera sensor, MCU) are mapped onto it through ClockSync.
+ */
+class TimeBase {
+public:
+
+    /**
+     * Current time on the unified clock.
+     * @return [0.1ms], always positive
+     */
+    static TimePoint now();
+
+    /**
+     * Reconstruct a full-width time from its lowest bits, e.g. a uint16_t or uint32_t time on the wire. The result is
+     * the value with the given lowest bits that is closest to the reference, so it is correct as long as the actual
+     * time is within half of the wrapping period around the reference (3.2 s for 16 bits, 2.5 days for 32 bits).
+     * @tparam T         Unsigned type of the truncated value.
+     * @param reference  A full-width time close to the actual one, such as the last unwrapped time.
+     * @param truncated  Lowest bits of the actual time.
+     * @return Full-width time.
+     */
+    template<typename T>
+    static uint64_t unwrap(uint64_t reference, T truncated) {
+        static_assert(std::is_unsigned<T>::value && sizeof(T) < sizeof(uint64_t), "T should be a narrow unsigned type");
+        auto diff = (std::make_signed_t<T>) (T) (truncated - (T) reference);  // wrapped difference in [-2^(n-1), 2^(n-1))
+        return reference + (int64_t) diff;
+    }
+};
+
+/**
+ * Online estimation of the linear mapping from a remote clock (MCU or camera sensor) to the unified clock:
+ *
+ *     host = offset + (1 + drift) * (remote - remoteOrigin)
+ *
+ * Timestamps are fed as samples, from which a least-squares line is fitted over a sliding window. Only the samples with
+ * the least uncertainty (the shortest round trip) take part in the fitting, as a longer round trip only means the
+ * packet has waited somewhere. The drift is only estimated after the window spans long enough, otherwise it is taken
+ * as zero.
+ *
+ * Two kinds of samples are supported, one kind per instance:
+ *  - Round trip (ping/echo): the host sends its time, the remote replies with its time. The remote time is paired with
+ *    the midpoint of the host sending and receiving time.
+ *  - One way: the remote time arrives with some unknown but positive latency (camera frames, for example). The fitted
+ *    line is shifted down to the lower envelope of the samples, so a remote time maps to the earliest possible arrival.
+ *
+ * Samples are added from one thread. Conversions can be made from any thread.
+ */
+class ClockSync {
+public:
+
+    /**
+     * @param windowSize    Number of samples kept for fitting.
+     * @param minDriftSpan  Minimal time span of the window before the drift is estimated [0.1ms].
+     */
+    explicit ClockSync(size_t windowSize = 64, uint64_t minDriftSpan = 20000);
+
+    /**
+     * Add a ping/echo sample.
+     * @param hostSend  Time when the ping is sent, on the unified clock.
+     * @param remote    Full-width remote time in the echo. Use TimeBase::unwrap if it is truncated on the wire.
+     * @param hostRecv  Time when the echo is received, on the unified clock.
+     */
+    void addRoundTrip(TimePoint hostSend, uint64_t remote, TimePoint hostRecv);
+
+    /**
+     * Add a one-way sample.
+     * @param remote    Full-width remote time.
+     * @param hostRecv  Time when the remote time is received, on the unified clock.
+     */
+    void addOneWay(uint64_t remote, TimePoint hostRecv);
+
+    /**
+     * Drop all samples and the estimation, e.g. after the remote restarts.
+     */
+    void reset();
+
+    /**
+     * Whether there are enough samples for conversion.
+     */
+    bool synchronized() const;
+
+    /**
+     * Convert a remote time to the unified clock. Only meaningful when synchronized.
+     */
+    TimePoint toHost(uint64_t remote) const;
+
+    /**
+     * Convert a time on the unified clock to the remote clock. Only meaningful when synchronized.
+     */
+    uint64_t toRemote(TimePoint host) const;
+
+    /**
+     * Estimated drift of the remote clock relative to the host [ppm], positive if the remote clock is slower.
+     */
+    double driftPPM() const;
+
+    /**
+     * Uncertainty of the best sample in the window (half of the shortest round trip, 0 for one-way samples) [0.1ms].
+     */
+    double uncertainty() const;
+
+private:
+
+    struct Sample {
+        uint64_t remote;
+        double host;         // midpoint for round trips, [0.1ms]
+        double halfRoundTrip;
+    };
+
+    struct Model {
+        bool valid = false;
+        uint64_t remoteOrigin = 0;
+        double offset = 0;   // host time at remoteOrigin [0.1ms]
+        double slope = 1;    // host ticks per remote tick
+        double uncertainty = 0;
+    };
+
+    const size_t windowSize;
+    const uint64_t minDriftSpan;
+
+    std::deque<Sample> samples;  // only accessed by the thread adding samples
+    bool oneWay = false;
+
+    mutable std::mutex modelMutex;
+    Model model;
+
+    void addSample(const Sample &sample);
+
+    void fit();
+};
+
+}
+
+#endif //META_VISION_SOLAIS_TIMEBASE_H
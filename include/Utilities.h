@@ -7,10 +7,12 @@
 
 #include <sstream>
 #include <iomanip>
+#include <chrono>
+#include <cstdint>
 
 namespace meta {
 
-using TimePoint = unsigned;  // 0.1ms
+using TimePoint = uint64_t;  // 0.1ms, on the unified clock of TimeBase
 
 inline std::string currentTimeString() {
     // Reference: https://stackoverflow.com/questions/24686846/get-current-time-in-milliseconds-or-hhmmssmmm-format
@@ -28,6 +28,14 @@ void AimingSolver::updateArmors(std::vector<ArmorInfo> &armors, TimePoint imageC
     frameCount++;
     ArmorInfo *selectedArmor = nullptr;
 
+    // Gimbal attitudes at capture time and the latest one. Without feedback from the MCU both are zero, so world
+    // angles equal relative angles (the gimbal is assumed to be still between exposure and command).
+    GimbalHistory::Attitude captureAttitude{imageCaptureTime, 0, 0};
+    GimbalHistory::Attitude currentAttitude{imageCaptureTime, 0, 0};
+    if (gimbalHistory && gimbalHistory->interpolate(imageCaptureTime, captureAttitude)) {
+        if (!gimbalHistory->getLatest(currentAttitude)) currentAttitude = captureAttitude;
+    }
+
     if (armors.empty()) {
 
         tracker.update(nullptr);
@@ -37,6 +45,7 @@ void AimingSolver::updateArmors(std::vector<ArmorInfo> &armors, TimePoint imageC
         for (auto &armor : armors) {
             armor.offset.z += 200;  //FIXME:
             armor.ypd = xyzToYPD(armor.offset);
+            armor.worldYPD = {armor.ypd.x + captureAttitude.yaw, armor.ypd.y + captureAttitude.pitch, armor.ypd.z};
         }
 
         // Select the armor closest to the point required by the Tracker
@@ -63,12 +72,11 @@ void AimingSolver::updateArmors(std::vector<ArmorInfo> &armors, TimePoint imageC
 
     if (selectedArmor) {
 
-        // Aim at the selected armor
-        const auto &xyz = selectedArmor->offset;
-        const auto &ypd = selectedArmor->ypd;
+        // Aim at the selected armor, relative to the latest gimbal attitude
+        const auto &ypd = selectedArmor->worldYPD;
         latestCommand.detected = true;
-        latestCommand.yawDelta = ypd.x + params.manual_delta_offset().x();
-        latestCommand.pitchDelta = ypd.y + params.manual_delta_offset().y();
+        latestCommand.yawDelta = ypd.x - currentAttitude.yaw + params.manual_delta_offset().x();
+        latestCommand.pitchDelta = ypd.y - currentAttitude.pitch + params.manual_delta_offset().y();
         latestCommand.dist = ypd.z;
         latestCommand.avgLightAngle = selectedArmor->avgLightAngle;
         latestCommand.imageX = selectedArmor->imgCenter.x;
@@ -88,15 +96,16 @@ void AimingSolver::updateArmors(std::vector<ArmorInfo> &armors, TimePoint imageC
         cv::Point3f ypd;
         latestCommand.detected = topKiller.shouldSendTarget(ypd);
         if (latestCommand.detected) {
-            latestCommand.yawDelta = ypd.x + params.manual_delta_offset().x();
-            latestCommand.pitchDelta = ypd.y + params.manual_delta_offset().y();
+            // ypd is in the world frame
+            latestCommand.yawDelta = ypd.x - currentAttitude.yaw + params.manual_delta_offset().x();
+            latestCommand.pitchDelta = ypd.y - currentAttitude.pitch + params.manual_delta_offset().y();
             /*
              * When an armor rotates to the target point, it will be little closer than the midpoint of two
              * rotated armors at the two sides.
              */
             latestCommand.dist = ypd.z + params.tk_target_dist_offset();
             latestCommand.remainingTimeToTarget =
-                    ((int) topKiller.getTimePointToTarget() - (int) imageCaptureTime) / 10;
+                    (int) (((int64_t) topKiller.getTimePointToTarget() - (int64_t) imageCaptureTime) / 10);
             latestCommand.period = (int) topKiller.getPeriod() / 10;
         }
 
@@ -142,9 +151,9 @@ void AimingSolver::Tracker::reset() {
 
 /** TopKiller **/
 
-void AimingSolver::setParams(const ParamSet &p) {
+void AimingSolver::setParams(const ParamSet &p, bool resetHistory_) {
     params = p;
-    resetHistory();
+    if (resetHistory_) resetHistory();
 }
 
 void AimingSolver::TopKiller::update(const AimingSolver::ArmorInfo *armor, TimePoint time) {
@@ -172,14 +181,15 @@ void AimingSolver::TopKiller::update(const AimingSolver::ArmorInfo *armor, TimeP
                 /*
                  * Completely replace the pulse position with the latest.
                  * This update will trigger the sending thread, which is basically like high-frequency control signal.
-                 * Gimbal may rotate during this series of updates. Including the last pulses introduces inaccuracy.
+                 * Gimbal may rotate during this series of updates. Angles are in the world frame if gimbal
+                 * feedback is available, otherwise including the last pulses introduces inaccuracy.
                  * Let Control filter the angles and the distance.
                  */
 
                 pulses.emplace_back(PulseInfo{
-                        {(lastArmor->ypd.x + armor->ypd.x) / 2,
-                         (lastArmor->ypd.y + armor->ypd.y) / 2,
-                         (lastPulse.ypdMid.z * lastPulse.frameCount + (lastArmor->ypd.z + armor->ypd.z)) /
+                        {(lastArmor->worldYPD.x + armor->worldYPD.x) / 2,
+                         (lastArmor->worldYPD.y + armor->worldYPD.y) / 2,
+                         (lastPulse.ypdMid.z * lastPulse.frameCount + (lastArmor->worldYPD.z + armor->worldYPD.z)) /
                          (lastPulse.frameCount + 2)},
                         lastPulse.startTime,
                         (lastPulse.avgTime * lastPulse.frameCount + time) / (lastPulse.frameCount + 1),
@@ -188,7 +198,7 @@ void AimingSolver::TopKiller::update(const AimingSolver::ArmorInfo *armor, TimeP
                 });
             } else {
                 pulses.emplace_back(PulseInfo{
-                        (lastArmor->ypd + armor->ypd) / 2,
+                        (lastArmor->worldYPD + armor->worldYPD) / 2,
                         time,
                         time,
                         time,
@@ -214,7 +224,8 @@ void AimingSolver::TopKiller::update(const AimingSolver::ArmorInfo *armor, TimeP
 
             // Compute target point and distance
             {
-                // Only use last pulse since Vision is unaware of gimbal movement between two pulses
+                // Only use last pulse. Pulses are in the world frame (see updateArmors), but without gimbal
+                // feedback Vision is unaware of gimbal movement between two pulses
                 targetYPD = lastPulse.ypdMid;
             }
 
@@ -0,0 +1,103 @@
+#include "ArmorClassifier.h"
+#include <opencv2/imgproc/imgproc.hpp>
+#include <cmath>
+#include <iostream>
+
+using namespace cv;
+
+namespace meta {
+
+ArmorClassifier::Model ArmorClassifier::loadModel(const std::string &modelFile) {
+    auto model = std::make_shared<dnn::Net>();
+    try {
+        *model = dnn::readNet(modelFile);
+    } catch (const cv::Exception &e) {
+        std::cerr << "ArmorClassifier: failed to load " << modelFile << ": " << e.what() << std::endl;
+        return nullptr;
+    }
+    if (model->empty()) {
+        std::cerr << "ArmorClassifier: failed to load " << modelFile << std::endl;
+        return nullptr;
+    }
+    model->setPreferableBackend(dnn::DNN_BACKEND_OPENCV);
+    model->setPreferableTarget(dnn::DNN_TARGET_CPU);
+
+    // Check the output with a blank patch here, rather than on each frame
+    try {
+        Mat blob;
+        dnn::blobFromImages(std::vector<Mat>{Mat::zeros(PATCH_HEIGHT, PATCH_WIDTH, CV_8UC1)}, blob, 1.0 / 255);
+        model->setInput(blob);
+        Mat scores = model->forward();
+        if (scores.total() < 2) {
+            std::cerr << "ArmorClassifier: unexpected output of " << scores.total() << " classes from " << modelFile
+                      << std::endl;
+            return nullptr;
+        }
+    } catch (const cv::Exception &e) {
+        std::cerr << "ArmorClassifier: failed to run " << modelFile << ": " << e.what() << std::endl;
+        return nullptr;
+    }
+
+    std::cout << "ArmorClassifier: loaded " << modelFile << std::endl;
+    return model;
+}
+
+void ArmorClassifier::extractPatch(const Mat &img, const std::array<Point2f, 4> &points, Mat &patch) {
+    /*
+     *   1 ----------- 2    lights over the middle half of the height, 2 pixels beyond the borders
+     *   |             |
+     *   0 ----------- 3
+     */
+    static constexpr float LIGHT_MARGIN = 2;
+    const float left = -LIGHT_MARGIN, right = PATCH_WIDTH - 1 + LIGHT_MARGIN;
+    const float top = (float) PATCH_HEIGHT / 4, bottom = (float) PATCH_HEIGHT * 3 / 4;
+    const Point2f src[4] = {points[0], points[1], points[2], points[3]};
+    const Point2f dst[4] = {{left, bottom}, {left, top}, {right, top}, {right, bottom}};
+
+    // Only the patch is computed from the image
+    Mat warped;
+    warpPerspective(img, warped, getPerspectiveTransform(src, dst), Size(PATCH_WIDTH, PATCH_HEIGHT), INTER_LINEAR,
+                    BORDER_CONSTANT);
+    cvtColor(warped, patch, COLOR_BGR2GRAY);
+    normalize(patch, patch, 0, 255, NORM_MINMAX);  // stickers are dim and exposures differ
+}
+
+bool ArmorClassifier::classify(const Mat &img, const std::vector<std::array<Point2f, 4>> &armors,
+                               std::vector<Result> &results) {
+    results.clear();
+    if (!net) return false;
+    if (armors.empty()) return true;
+
+    patches.resize(armors.size());
+    for (size_t i = 0; i < armors.size(); i++) {
+        extractPatch(img, armors[i], patches[i]);
+    }
+
+    // One batch for all armors
+    dnn::blobFromImages(patches, blob, 1.0 / 255);
+    Mat scores;
+    try {
+        net->setInput(blob);
+        scores = net->forward().reshape(1, (int) armors.size());
+    } catch (const cv::Exception &e) {
+        // Disabled rather than failing on each frame, until a model is set again
+        std::cerr << "ArmorClassifier: inference failed, disabled: " << e.what() << std::endl;
+        net = nullptr;
+        return false;
+    }
+
+    // Softmax of the best class
+    for (int i = 0; i < scores.rows; i++) {
+        const auto *logits = scores.ptr<float>(i);
+        int best = 0;
+        for (int c = 1; c < scores.cols; c++) {
+            if (logits[c] > logits[best]) best = c;
+        }
+        float sum = 0;
+        for (int c = 0; c < scores.cols; c++) sum += std::exp(logits[c] - logits[best]);
+        results.emplace_back(Result{best == scores.cols - 1 ? -1 : best, 1 / sum});
+    }
+    return true;
+}
+
+}
@@ -3,344 +3,869 @@
 //
 
 #include "ArmorDetector.h"
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <utility>
 
 using namespace cv;
 
 namespace meta {
 
+namespace {
+
+// Bits of the template parameter of ArmorDetector::filterContoursImpl() and extractComponentsImpl()
+enum ContourFilter : unsigned {
+    CONTOUR_PIXEL_COUNT = 1U << 0U,
+    CONTOUR_MIN_AREA = 1U << 1U,
+    LONG_EDGE_MIN_LENGTH = 1U << 2U,
+    LIGHT_MAX_ROTATION = 1U << 3U,
+    LIGHT_ASPECT_RATIO = 1U << 4U,
+    CONTOUR_FILTER_COMBINATIONS = 1U << 5U
+};
+
+// Bits of the template parameter of ArmorDetector::combineLightsImpl()
+enum CombineFilter : unsigned {
+    LIGHT_LENGTH_MAX_RATIO = 1U << 0U,
+    LIGHT_X_DIST_OVER_L = 1U << 1U,
+    LIGHT_Y_DIST_OVER_L = 1U << 2U,
+    LIGHT_ANGLE_MAX_DIFF = 1U << 3U,
+    COMBINE_FILTER_COMBINATIONS = 1U << 4U
+};
+
+constexpr int COLOR_THRESHOLD_MODE_COUNT = ParamSet::ColorThresholdMode_ARRAYSIZE;
+constexpr int ENEMY_COLOR_COUNT = ParamSet::EnemyColor_ARRAYSIZE;
+constexpr int CONTOUR_FIT_FUNCTION_COUNT = ParamSet::ContourFitFunction_ARRAYSIZE;
+
+/**
+ * Table of the functions for indices 0 to N - 1, made by f(std::integral_constant<size_t, I>) at compile time.
+ */
+template<typename T, typename F, size_t... I>
+constexpr std::array<T, sizeof...(I)> makeTable(F f, std::index_sequence<I...>) {
+    return {f(std::integral_constant<size_t, I>())...};
+}
+
+/**
+ * The integer threshold of an 8-bit image equivalent to cv::threshold() with THRESH_BINARY, i.e. pass if > it.
+ */
+int binaryThreshold(float thresh) {
+    return std::clamp(cvFloor(thresh), -1, 255);
+}
+
+}
+
+void ArmorDetector::setParams(const ParamSet &p) {
+    params = p;
+
+    static constexpr auto thresholdTable = makeTable<ThresholdFunction>([](auto i) {
+        constexpr auto mode = (ParamSet::ColorThresholdMode) (decltype(i)::value / (ENEMY_COLOR_COUNT * 2));
+        constexpr auto enemy = (ParamSet::EnemyColor) (decltype(i)::value / 2 % ENEMY_COLOR_COUNT);
+        return &ArmorDetector::thresholdImpl<mode, enemy, (bool) (decltype(i)::value % 2)>;
+    }, std::make_index_sequence<COLOR_THRESHOLD_MODE_COUNT * ENEMY_COLOR_COUNT * 2>());
+
+    static constexpr auto lightTable = makeTable<LightFunction>([](auto i) {
+        constexpr auto fit = (ParamSet::ContourFitFunction) (decltype(i)::value / CONTOUR_FILTER_COMBINATIONS);
+        constexpr auto filters = (unsigned) (decltype(i)::value % CONTOUR_FILTER_COMBINATIONS);
+        if constexpr (fit == ParamSet::CONNECTED_COMPONENTS) {
+            return &ArmorDetector::extractComponentsImpl<filters>;
+        } else {
+            return &ArmorDetector::filterContoursImpl<fit, filters>;
+        }
+    }, std::make_index_sequence<CONTOUR_FIT_FUNCTION_COUNT * CONTOUR_FILTER_COMBINATIONS>());
+
+    static constexpr auto combineTable = makeTable<CombineFunction>([](auto i) {
+        return &ArmorDetector::combineLightsImpl<(unsigned) decltype(i)::value>;
+    }, std::make_index_sequence<COMBINE_FILTER_COMBINATIONS>());
+
+    assert(ParamSet::ColorThresholdMode_IsValid(params.color_threshold_mode()) && "Invalid color_threshold_mode");
+    assert(ParamSet::EnemyColor_IsValid(params.enemy_color()) && "Invalid enemy_color");
+    assert(ParamSet::ContourFitFunction_IsValid(params.contour_fit_function()) && "Invalid contour_fit_function");
+
+    const int thresholdIndex = params.color_threshold_mode() * ENEMY_COLOR_COUNT + params.enemy_color();
+    thresholdFunction = thresholdTable[thresholdIndex * 2 + 1];
+    thresholdLightsFunction = thresholdTable[thresholdIndex * 2];
+
+    unsigned contourFilters = 0;
+    if (params.contour_pixel_count().enabled()) contourFilters |= CONTOUR_PIXEL_COUNT;
+    if (params.contour_min_area().enabled()) contourFilters |= CONTOUR_MIN_AREA;
+    if (params.long_edge_min_length().enabled()) contourFilters |= LONG_EDGE_MIN_LENGTH;
+    if (params.light_max_rotation().enabled()) contourFilters |= LIGHT_MAX_ROTATION;
+    if (params.light_aspect_ratio().enabled()) contourFilters |= LIGHT_ASPECT_RATIO;
+    lightFunction = lightTable[params.contour_fit_function() * CONTOUR_FILTER_COMBINATIONS + contourFilters];
+
+    // Sizes and aspect ratios of lights are not reliable at a low resolution, and contours of small lights have too
+    // few points to fit ellipses. Candidates are only kept by the filters that are unlikely to reject real ones.
+    coarseLightFunction = lightTable[ParamSet::CONNECTED_COMPONENTS * CONTOUR_FILTER_COMBINATIONS +
+                                     (contourFilters & LIGHT_MAX_ROTATION)];
+
+    unsigned combineFilters = 0;
+    if (params.light_length_max_ratio().enabled()) combineFilters |= LIGHT_LENGTH_MAX_RATIO;
+    if (params.light_x_dist_over_l().enabled()) combineFilters |= LIGHT_X_DIST_OVER_L;
+    if (params.light_y_dist_over_l().enabled()) combineFilters |= LIGHT_Y_DIST_OVER_L;
+    if (params.light_angle_max_diff().enabled()) combineFilters |= LIGHT_ANGLE_MAX_DIFF;
+    combineFunction = combineTable[combineFilters];
+    coarseCombineFunction = combineTable[combineFilters & LIGHT_LENGTH_MAX_RATIO];  // angles of small lights are noisy
+
+    // Kernels of the morphology
+    erodeKernel = BinaryMorphology::Kernel(params.contour_erode().val());
+    dilateKernel = BinaryMorphology::Kernel(params.contour_dilate().val());
+    openKernel = BinaryMorphology::Kernel(params.contour_open().val());
+    closeKernel = BinaryMorphology::Kernel(params.contour_close().val());
+
+    // Tracked armors may not be found with the new parameters
+    trackedArmors.clear();
+    trackedVelocities.clear();
+}
+
 std::vector<ArmorDetector::DetectedArmor> ArmorDetector::detect(const Mat &img) {
+    imgOriginal = img;
+    imagesCopied = false;
+    std::vector<DetectedArmor> armors;
+
+    // Only look for the tracked armors in windows, with a full detection every armor_tracking frames, or once any of
+    // them is lost
+    if (params.armor_tracking().enabled() && !trackedArmors.empty() &&
+        framesSinceFullDetection + 1 < params.armor_tracking().val() && detectTracked(armors)) {
+        framesSinceFullDetection++;
+    } else {
+        framesSinceFullDetection = 0;
+        if (params.coarse_detection_level().enabled()) {
+            armors = detectMultiScale();
+        } else {
+            extractLights(imgOriginal, lightFunction, true, true);
+            armors = combineLights(combineFunction, true, true);
+        }
+    }
+
+    if (params.corner_refinement().enabled()) {
+        refineCorners(armors);
+    }
+    if (params.armor_tracking().enabled()) {
+        updateTracking(armors);
+    }
+    return armors;
+}
+
+void ArmorDetector::extractLights(const Mat &img, LightFunction extract, bool morphology, bool wholeImage) {
 
     /*
-     * Note: in this mega function, steps are wrapped with {} to reduce local variable pollution and make it easier to
-     *       read. Please follow the convention.
-     * Note: for debug purpose, allows some local variables and single-line compound statements.
+     * Note: the steps depending on the modes and the filters are specialized by templates below, and selected by
+     *       setParams(). The morphology ones stay here, as their cost is in the passes over the bit-packed masks
+     *       (see BinaryMorphology) rather than the branches.
+     *       The buffers are reused in place, as the requested images are copied out of them.
      */
 
-    // ================================ Setup ================================
-    {
-        imgOriginal = img;
-        imgGray = imgBrightness = imgColor = imgLights = Mat();
-    }
+    const bool colorMorphology =
+            morphology && (params.contour_erode().enabled() || params.contour_dilate().enabled());
+    const bool lightsMorphology =
+            morphology && (params.contour_open().enabled() || params.contour_close().enabled());
 
-    // ================================ Brightness Threshold ================================
+    // ================================ Brightness and Color Threshold ================================
     {
-        cvtColor(imgOriginal, imgGray, COLOR_BGR2GRAY);
-        threshold(imgGray, imgBrightness, params.brightness_threshold(), 255, THRESH_BINARY);
+        // imgBrightness and imgColor are only made if they are used
+        bool colorRequested = wholeImage && (requestedImages & (BRIGHTNESS_IMAGE | COLOR_IMAGE));
+        (this->*(colorMorphology || colorRequested ? thresholdFunction : thresholdLightsFunction))(img);
     }
 
-    // ================================ Color Threshold ================================
-    {
-        if (params.color_threshold_mode() == ParamSet::HSV) {
-
-            // Convert to HSV color space
-            Mat hsvImg;
-            cvtColor(imgOriginal, hsvImg, COLOR_BGR2HSV);
-
-            if (params.enemy_color() == ParamSet::RED) {
-                // Red color spreads over the 0 (180) boundary, so combine them
-                Mat thresholdImg0, thresholdImg1;
-                inRange(hsvImg, Scalar(0, 0, 0), Scalar(params.hsv_red_hue().max(), 255, 255), thresholdImg0);
-                inRange(hsvImg, Scalar(params.hsv_red_hue().min(), 0, 0), Scalar(180, 255, 255), thresholdImg1);
-                imgColor = thresholdImg0 | thresholdImg1;
-            } else {
-                inRange(hsvImg, Scalar(params.hsv_blue_hue().min(), 0, 0),
-                        Scalar(params.hsv_blue_hue().max(), 255, 255),
-                        imgColor);
-            }
+    // ================================ Morphology ================================
+    // The masks are packed once, and go through all the enabled operations before the lights are unpacked once
+    if (colorMorphology || lightsMorphology) {
+        if (colorMorphology) {
+            packedColor.pack(imgColor.data, imgColor.cols, imgColor.rows, imgColor.step);
 
-        } else {
+            // Color erode
+            if (params.contour_erode().enabled()) {
+                binaryMorphology.apply(packedColor, BinaryMorphology::ERODE, erodeKernel);
+            }
 
-            std::vector<Mat> channels;
-            split(imgOriginal, channels);
+            // Color dilate
+            if (params.contour_dilate().enabled()) {
+                binaryMorphology.apply(packedColor, BinaryMorphology::DILATE, dilateKernel);
+            }
 
-            // Filter using channel subtraction
-            int mainChannel = (params.enemy_color() == ParamSet::RED ? 2 : 0);
-            int oppositeChannel = (params.enemy_color() == ParamSet::RED ? 0 : 2);
-            subtract(channels[mainChannel], channels[oppositeChannel], imgColor);
-            threshold(imgColor, imgColor, params.rb_channel_threshold(), 255, THRESH_BINARY);
+            if (wholeImage && (requestedImages & COLOR_IMAGE)) {
+                packedColor.unpack(imgColor.data, imgColor.step);
+            }
 
+            // Apply filter again with the changed color image
+            packedLights.pack(imgBrightness.data, imgBrightness.cols, imgBrightness.rows, imgBrightness.step);
+            packedLights &= packedColor;
+        } else {
+            packedLights.pack(imgLights.data, imgLights.cols, imgLights.rows, imgLights.step);
         }
 
-        // Color erode
-        if (params.contour_erode().enabled()) {
-            Mat element = cv::getStructuringElement(
-                    cv::MORPH_ELLIPSE,
-                    cv::Size(params.contour_erode().val(), params.contour_erode().val()));
-            erode(imgColor, imgColor, element);
+        // Contour open
+        if (params.contour_open().enabled()) {
+            binaryMorphology.apply(packedLights, BinaryMorphology::OPEN, openKernel);
         }
 
-        // Color dilate
-        if (params.contour_dilate().enabled()) {
-            Mat element = cv::getStructuringElement(
-                    cv::MORPH_ELLIPSE,
-                    cv::Size(params.contour_dilate().val(), params.contour_dilate().val()));
-            dilate(imgColor, imgColor, element);
+        // Contour close
+        if (params.contour_close().enabled()) {
+            binaryMorphology.apply(packedLights, BinaryMorphology::CLOSE, closeKernel);
         }
 
-        // Apply filter
-        imgLights = imgBrightness & imgColor;
+        packedLights.unpack(imgLights.data, imgLights.step);
+    }
+
+    if (wholeImage) {
+        copyRequestedImages();
     }
 
     // ================================ Find Contours ================================
 
-    // Contour open
-    if (params.contour_open().enabled()) {
-        Mat element = cv::getStructuringElement(
-                cv::MORPH_ELLIPSE,
-                cv::Size(params.contour_open().val(), params.contour_open().val()));
-        morphologyEx(imgLights, imgLights, MORPH_OPEN, element);
+    {
+        lightRects.clear();
+        (this->*extract)();
     }
+}
+
+void ArmorDetector::copyRequestedImages() {
+    brightnessImage = (requestedImages & BRIGHTNESS_IMAGE) ? imgBrightness.clone() : Mat();
+    colorImage = (requestedImages & COLOR_IMAGE) ? imgColor.clone() : Mat();
+    lightsImage = (requestedImages & LIGHTS_IMAGE) ? imgLights.clone() : Mat();
+    imagesCopied = true;
+}
 
-    // Contour close
-    if (params.contour_close().enabled()) {
-        Mat element = cv::getStructuringElement(
-                cv::MORPH_ELLIPSE,
-                cv::Size(params.contour_close().val(), params.contour_close().val()));
-        morphologyEx(imgLights, imgLights, MORPH_CLOSE, element);
+bool ArmorDetector::takeImages(Mat &brightness, Mat &color, Mat &lights) {
+    if (requestedImages && !imagesCopied) return false;
+    brightness = brightnessImage;
+    color = colorImage;
+    lights = lightsImage;
+    brightnessImage = colorImage = lightsImage = Mat();
+    imagesCopied = false;
+    return true;
+}
+
+std::vector<ArmorDetector::DetectedArmor>
+ArmorDetector::combineLights(CombineFunction combine, bool classify, bool removeSharingLights) {
+
+    // If there is less than two light contours, stop detection
+    if (lightRects.size() < 2) {
+        return {};
     }
 
+    // Sort lights from left to right based on center X
+    sort(lightRects.begin(), lightRects.end(),
+         [](RotatedRect &a1, RotatedRect &a2) {
+             return a1.center.x < a2.center.x;
+         });
+
+    /*
+     * OpenCV coordinate: +x right, +y down
+     */
+
+    // ================================ Combine Lights to Armors ================================
+    std::vector<DetectedArmor> acceptedArmors;
     {
-        lightRects.clear();
+        (this->*combine)(acceptedArmors);
+    }
 
-        std::vector<std::vector<Point>> contours;
-        findContours(imgLights, contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
+    // Classify numbers, before the armors that share lights are resolved, so that pairs that are not armors lose
+    if (classify && params.armor_number_min_confidence().enabled()) {
+        classifyArmors(acceptedArmors);
+    }
 
-        // Filter individual contours
-        for (const auto &contour : contours) {
+    // Filter armors that share lights
+    if (removeSharingLights) {
+        while(true) {
+            auto it = filterAcceptedArmorsToRemove(acceptedArmors);
+            if (it == acceptedArmors.end()) break;  // nothing to remove
+            acceptedArmors.erase(it);       // remove the armor
+            // continue to try again
+        }
+    }
 
-            // Filter pixel count
-            if (params.contour_pixel_count().enabled()) {
-                if (contour.size() < params.contour_pixel_count().val()) {
-                    continue;
+    return acceptedArmors;
+}
+
+std::vector<ArmorDetector::DetectedArmor> ArmorDetector::detectMultiScale() {
+    const int scale = 1 << std::clamp(params.coarse_detection_level().val(), 1, 4);
+
+    // ================================ Coarse Pass ================================
+    std::vector<DetectedArmor> candidates;
+    {
+        resize(imgOriginal, imgCoarse, Size(imgOriginal.cols / scale, imgOriginal.rows / scale), 0, 0, INTER_AREA);
+
+        // Without morphology of the full resolution, and all candidates kept, even if they share lights. The requested
+        // images are the coarse ones, to be seen together with the candidates.
+        extractLights(imgCoarse, coarseLightFunction, false, true);
+        candidates = combineLights(coarseCombineFunction, false, false);
+    }
+
+    // ================================ Refinement ================================
+    extractLightsInWindows(armorWindows(candidates, scale, {}));
+
+    return combineLights(combineFunction, true, true);
+}
+
+std::vector<Rect> ArmorDetector::armorWindows(const std::vector<DetectedArmor> &armors, int scale,
+                                             const std::vector<Point2f> &offsets) const {
+    std::vector<Rect> windows;
+    const Rect imageRect(0, 0, imgOriginal.cols, imgOriginal.rows);
+    for (size_t i = 0; i < armors.size(); i++) {
+
+        // Pixel x of the scaled image covers [x * scale, (x + 1) * scale) of the full resolution
+        Rect box = boundingRect(std::vector<Point2f>(armors[i].points.begin(), armors[i].points.end()));
+        box = Rect(box.x * scale, box.y * scale, box.width * scale, box.height * scale);
+        if (!offsets.empty()) {
+            box.x += cvRound(offsets[i].x);
+            box.y += cvRound(offsets[i].y);
+        }
+
+        // Margin for the full length of the lights, which are blurred or partially found at a low resolution, and for
+        // the motion from a predicted position
+        int margin = std::max(box.height / 2, 2 * scale);
+        Rect window = Rect(box.x - margin, box.y - margin, box.width + 2 * margin, box.height + 2 * margin) &
+                      imageRect;
+        if (window.empty()) continue;
+
+        // Merge overlapping windows, so that no light is extracted twice
+        for (bool merged = true; merged;) {
+            merged = false;
+            for (auto it = windows.begin(); it != windows.end(); ++it) {
+                if ((*it & window).area() > 0) {
+                    window |= *it;
+                    windows.erase(it);
+                    merged = true;
+                    break;
                 }
             }
+        }
+        windows.emplace_back(window);
+    }
+    return windows;
+}
 
-            // Filter area size
-            if (params.contour_min_area().enabled()) {
-                double area = contourArea(contour);
-                if (area < params.contour_min_area().val()) {
-                    continue;
-                }
+void ArmorDetector::extractLightsInWindows(const std::vector<Rect> &windows) {
+    std::vector<RotatedRect> windowLights;
+    for (const auto &window : windows) {
+        extractLights(imgOriginal(window), lightFunction, true, false);
+        for (auto &rect : lightRects) {
+            rect.center.x += (float) window.x;
+            rect.center.y += (float) window.y;
+            windowLights.emplace_back(rect);
+        }
+    }
+    lightRects = std::move(windowLights);
+}
+
+bool ArmorDetector::detectTracked(std::vector<DetectedArmor> &armors) {
+    extractLightsInWindows(armorWindows(trackedArmors, 1, trackedVelocities));
+    armors = combineLights(combineFunction, true, true);
+
+    // Every tracked armor should be found again around its predicted position
+    for (size_t i = 0; i < trackedArmors.size(); i++) {
+        Point2f predicted = trackedArmors[i].center + trackedVelocities[i];
+        double tolerance = armorHeight(trackedArmors[i]) / 2;
+        if (std::none_of(armors.begin(), armors.end(), [&](const DetectedArmor &armor) {
+            return cv::norm(armor.center - predicted) < tolerance;
+        })) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void ArmorDetector::updateTracking(const std::vector<DetectedArmor> &armors) {
+    std::vector<Point2f> velocities(armors.size(), Point2f(0, 0));
+    for (size_t i = 0; i < armors.size(); i++) {
+
+        // The closest tracked armor around its predicted position, if any, of which the armor is the motion
+        double minDist = armorHeight(armors[i]) / 2;
+        for (size_t j = 0; j < trackedArmors.size(); j++) {
+            double dist = cv::norm(armors[i].center - (trackedArmors[j].center + trackedVelocities[j]));
+            if (dist < minDist) {
+                minDist = dist;
+                velocities[i] = armors[i].center - trackedArmors[j].center;
             }
+        }
+    }
+    trackedArmors = armors;
+    trackedVelocities = std::move(velocities);
+}
 
-            // Fit contour using a rotated rect
-            RotatedRect rect;
-            switch (params.contour_fit_function()) {
-                case ParamSet::MIN_AREA_RECT:
-                    rect = minAreaRect(contour);
-                    break;
-                case ParamSet::ELLIPSE:
-                    // There should be at least 5 points to fit the ellipse
-                    if (contour.size() < 5) continue;
-                    rect = fitEllipse(contour);
-                    break;
-                case ParamSet::ELLIPSE_AMS:
-                    if (contour.size() < 5) continue;
-                    rect = fitEllipseAMS(contour);
-                    break;
-                case ParamSet::ELLIPSE_DIRECT:
-                    if (contour.size() < 5) continue;
-                    rect = fitEllipseDirect(contour);
-                    break;
-                default:
-                    assert(!"Invalid params.contour_fit_function()");
+double ArmorDetector::armorHeight(const DetectedArmor &armor) {
+    return (cv::norm(armor.points[1] - armor.points[0]) + cv::norm(armor.points[2] - armor.points[3])) / 2;
+}
+
+void ArmorDetector::classifyArmors(std::vector<DetectedArmor> &armors) {
+    classifierArmors.clear();
+    for (const auto &armor : armors) classifierArmors.emplace_back(armor.points);
+    if (!classifier.classify(imgOriginal, classifierArmors, classifierResults)) return;
+
+    const float minConfidence = params.armor_number_min_confidence().val();
+    auto out = armors.begin();
+    for (size_t i = 0; i < armors.size(); i++) {
+        const auto &result = classifierResults[i];
+        if (result.number < 0 || result.confidence < minConfidence) continue;  // not an armor, or not sure of it
+        armors[i].number = result.number;
+        *out++ = armors[i];
+    }
+    armors.erase(out, armors.end());
+}
+
+void ArmorDetector::refineCorners(std::vector<DetectedArmor> &armors) {
+    for (auto &armor : armors) {
+        Point2f leftBottom, leftTop, rightBottom, rightTop;
+        if (!refineLightEnds(lightRects[armor.lightIndex[0]], leftBottom, leftTop) ||
+            !refineLightEnds(lightRects[armor.lightIndex[1]], rightBottom, rightTop)) {
+            continue;  // keep the four corners consistent
+        }
+        armor.points = {leftBottom, leftTop, rightTop, rightBottom};
+        armor.center = (leftBottom + leftTop + rightTop + rightBottom) / 4;
+    }
+}
+
+bool ArmorDetector::refineLightEnds(const RotatedRect &rect, Point2f &bottom, Point2f &top) {
+    static constexpr float MIN_CONTRAST = 32;  // between the light and the background, in gray levels
+
+    const float halfLength = rect.size.height / 2;
+
+    // Unit vectors of the short edge and the long edge. The long one points to points[0] of the armor for angle <= 90
+    // (see combineLightsImpl()).
+    const float rad = rect.angle * (float) CV_PI / 180;
+    const Point2f across(std::cos(rad), std::sin(rad)), along(-std::sin(rad), std::cos(rad));
+
+    // Sample a strip of the core of the light (the center half of the width) at 1-pixel steps along the long edge,
+    // beyond both ends by the margin. warpAffine() only computes the strip, so this costs little to the detection.
+    const int width = std::max(1, cvRound(rect.size.width / 2)) | 1;
+    const int length = 2 * cvCeil(halfLength + (float) params.corner_refinement().val()) + 1;
+    const int center = (length - 1) / 2;  // sample at rect.center
+    const float x0 = (float) (width - 1) / 2, y0 = (float) center;
+    Matx23f stripToImage(across.x, along.x, rect.center.x - x0 * across.x - y0 * along.x,
+                         across.y, along.y, rect.center.y - x0 * across.y - y0 * along.y);
+    warpAffine(imgOriginal, refineStrip, stripToImage, Size(width, length), INTER_LINEAR | WARP_INVERSE_MAP,
+               BORDER_REPLICATE);
+    cvtColor(refineStrip, refineStripGray, COLOR_BGR2GRAY);
+    reduce(refineStripGray, refineProfile, 1, REDUCE_AVG, CV_32F);  // the profile along the long edge
+    const auto *p = refineProfile.ptr<float>();
+
+    // Level of the light from the middle half of it, and of the background from the samples beyond the fitted ends
+    float peak = 0, background = 255;
+    const int inner = std::max(cvFloor(halfLength / 2), 1);
+    for (int i = center - inner; i <= center + inner; i++) peak = std::max(peak, p[i]);
+    const int outer = std::min(cvCeil(halfLength) + 1, center);
+    for (int i = 0; i <= center - outer; i++) background = std::min(background, p[i]);
+    for (int i = center + outer; i < length; i++) background = std::min(background, p[i]);
+    if (peak - background < MIN_CONTRAST) return false;
+    const float level = (peak + background) / 2;
+    if (p[center] < level) return false;  // not the core of the light
+
+    // Walk from the center to the first sample below the level on each side, and interpolate the crossing
+    int i = center;
+    while (i > 0 && p[i - 1] >= level) i--;
+    if (i == 0) return false;  // not falling within the strip
+    float negativeEnd = (float) (i - 1) + (level - p[i - 1]) / (p[i] - p[i - 1]) - y0;
+
+    i = center;
+    while (i < length - 1 && p[i + 1] >= level) i++;
+    if (i == length - 1) return false;
+    float positiveEnd = (float) i + (p[i] - level) / (p[i] - p[i + 1]) - y0;
+
+    if (positiveEnd - negativeEnd < halfLength) return false;  // stopped by a dip inside the light
+
+    Point2f positivePoint = rect.center + along * positiveEnd, negativePoint = rect.center + along * negativeEnd;
+    if (rect.angle <= 90) {
+        bottom = positivePoint;
+        top = negativePoint;
+    } else {
+        bottom = negativePoint;
+        top = positivePoint;
+    }
+    return true;
+}
+
+template<ParamSet::ColorThresholdMode MODE, ParamSet::EnemyColor ENEMY, bool MASKS>
+void ArmorDetector::thresholdImpl(const Mat &img) {
+    cvtColor(img, imgGray, COLOR_BGR2GRAY);
+
+    if constexpr (MODE == ParamSet::HSV) {
+        cvtColor(img, imgHSV, COLOR_BGR2HSV);
+    }
+    const Mat &colorSource = (MODE == ParamSet::HSV ? imgHSV : img);
+
+    if constexpr (MASKS) {
+        imgBrightness.create(img.size(), CV_8UC1);
+        imgColor.create(img.size(), CV_8UC1);
+    }
+    imgLights.create(img.size(), CV_8UC1);
+
+    const int brightnessThreshold = binaryThreshold(params.brightness_threshold());
+
+    // Hue is an integer, so a float range is the same as [ceil(min), floor(max)]
+    const FloatRange &hueRange = (ENEMY == ParamSet::RED ? params.hsv_red_hue() : params.hsv_blue_hue());
+    const int hueMin = cvCeil(hueRange.min());
+    const int hueMax = cvFloor(hueRange.max());
+
+    // Channel subtraction saturates at 0
+    constexpr int mainChannel = (ENEMY == ParamSet::RED ? 2 : 0);
+    constexpr int oppositeChannel = (ENEMY == ParamSet::RED ? 0 : 2);
+    const int rbThreshold = binaryThreshold(params.rb_channel_threshold());
+
+    // Branch-free per pixel, so that the compiler can vectorize it. The size is in locals, as uchar stores may alias.
+    const int rows = img.rows, cols = img.cols;
+    for (int y = 0; y < rows; y++) {
+        const uchar *gray = imgGray.ptr<uchar>(y);
+        const uchar *src = colorSource.ptr<uchar>(y);
+        uchar *brightness = MASKS ? imgBrightness.ptr<uchar>(y) : nullptr;
+        uchar *color = MASKS ? imgColor.ptr<uchar>(y) : nullptr;
+        uchar *lights = imgLights.ptr<uchar>(y);
+
+        for (int x = 0; x < cols; x++) {
+            bool b = gray[x] > brightnessThreshold;
+            bool c;
+            if constexpr (MODE == ParamSet::HSV) {
+                int hue = src[3 * x];
+                if constexpr (ENEMY == ParamSet::RED) {
+                    // Red color spreads over the 0 (180) boundary, so combine [0, max] and [min, 180]
+                    c = (hue <= hueMax) | (hue >= hueMin);
+                } else {
+                    c = (hue >= hueMin) & (hue <= hueMax);
+                }
+            } else {
+                uchar main = src[3 * x + mainChannel], opposite = src[3 * x + oppositeChannel];
+                uchar diff = (main > opposite ? main - opposite : 0);
+                c = diff > rbThreshold;
+            }
+            if constexpr (MASKS) {
+                brightness[x] = b ? 255 : 0;
+                color[x] = c ? 255 : 0;
             }
-            canonicalizeRotatedRect(rect);
-            // Now, width: the short edge, height: the long edge, angle: in [0, 180)
+            lights[x] = (b & c) ? 255 : 0;
+        }
+    }
+}
+
+template<ParamSet::ContourFitFunction FIT, unsigned FILTERS>
+void ArmorDetector::filterContoursImpl() {
 
-            // Filter long edge min length
-            if (params.long_edge_min_length().enabled() && rect.size.height < params.long_edge_min_length().val()) {
+    std::vector<std::vector<Point>> contours;
+    findContours(imgLights, contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
+
+    // Filter individual contours
+    for (const auto &contour : contours) {
+
+        // Filter pixel count
+        if constexpr (FILTERS & CONTOUR_PIXEL_COUNT) {
+            if (contour.size() < params.contour_pixel_count().val()) {
                 continue;
             }
+        }
 
-            // Filter angle
-            if (params.light_max_rotation().enabled() &&
-                std::min(rect.angle, 180 - rect.angle) >= params.light_max_rotation().val()) {
+        // Filter area size
+        if constexpr (FILTERS & CONTOUR_MIN_AREA) {
+            double area = contourArea(contour);
+            if (area < params.contour_min_area().val()) {
                 continue;
             }
+        }
 
-            // Filter aspect ratio
-            if (params.light_aspect_ratio().enabled()) {
-                double aspectRatio = rect.size.height / rect.size.width;
-                if (!inRange(aspectRatio, params.light_aspect_ratio())) {
-                    continue;
+        // Fit contour using a rotated rect
+        RotatedRect rect;
+        if constexpr (FIT == ParamSet::MIN_AREA_RECT) {
+            rect = minAreaRect(contour);
+        } else {
+            // There should be at least 5 points to fit the ellipse
+            if (contour.size() < 5) continue;
+            if constexpr (FIT == ParamSet::ELLIPSE) {
+                rect = fitEllipse(contour);
+            } else if constexpr (FIT == ParamSet::ELLIPSE_AMS) {
+                rect = fitEllipseAMS(contour);
+            } else {
+                rect = fitEllipseDirect(contour);
+            }
+        }
+        canonicalizeRotatedRect(rect);
+        // Now, width: the short edge, height: the long edge, angle: in [0, 180)
+
+        // Accept the rect
+        if (acceptLightRect<FILTERS>(rect)) {
+            lightRects.emplace_back(rect);
+        }
+    }
+}
+
+template<unsigned FILTERS>
+void ArmorDetector::extractComponentsImpl() {
+    componentParents.clear();
+    componentMoments.clear();
+    std::vector<ComponentRun> *prevRuns = &componentRuns[0], *curRuns = &componentRuns[1];
+    prevRuns->clear();
+
+    const int rows = imgLights.rows, cols = imgLights.cols;
+    for (int y = 0; y < rows; y++) {
+        const uchar *row = imgLights.ptr<uchar>(y);
+        curRuns->clear();
+
+        size_t firstPrevRun = 0;  // the first run of the previous row that may touch the current run
+        for (int x = 0; x < cols;) {
+            if (!row[x]) {
+                x++;
+                continue;
+            }
+            int start = x;
+            while (x < cols && row[x]) x++;
+            int end = x;
+
+            // Merge with the runs of the previous row that touch [start - 1, end] (8-connectivity)
+            int label = -1;
+            while (firstPrevRun < prevRuns->size() && (*prevRuns)[firstPrevRun].end < start) firstPrevRun++;
+            for (size_t i = firstPrevRun; i < prevRuns->size() && (*prevRuns)[i].start <= end; i++) {
+                int root = findComponentRoot((*prevRuns)[i].label);
+                if (label == -1) {
+                    label = root;
+                } else if (root != label) {
+                    componentParents[root] = label;
+                    auto &m = componentMoments[label];
+                    const auto &r = componentMoments[root];
+                    m.m00 += r.m00, m.m10 += r.m10, m.m01 += r.m01, m.m20 += r.m20, m.m11 += r.m11, m.m02 += r.m02;
                 }
             }
+            if (label == -1) {
+                label = (int) componentParents.size();
+                componentParents.emplace_back(label);
+                componentMoments.emplace_back(ComponentMoments{0, 0, 0, 0, 0, 0});
+            }
+
+            // Moments of the run in closed form
+            double n = end - start;
+            double sumX = (double) (start + end - 1) * n / 2;
+            auto sumSquares = [](double k) { return k * (k + 1) * (2 * k + 1) / 6; };  // 0^2 + ... + k^2
+            double sumXX = sumSquares(end - 1) - sumSquares(start - 1);
+            auto &m = componentMoments[label];
+            m.m00 += n, m.m10 += sumX, m.m01 += y * n, m.m20 += sumXX, m.m11 += y * sumX, m.m02 += (double) y * y * n;
+
+            curRuns->emplace_back(ComponentRun{start, end, label});
+        }
+        std::swap(prevRuns, curRuns);
+    }
+
+    // Filter individual components
+    for (int label = 0; label < (int) componentParents.size(); label++) {
+        if (componentParents[label] != label) continue;  // merged into another
+        const auto &m = componentMoments[label];
+
+        // Filter pixel count
+        if constexpr (FILTERS & CONTOUR_PIXEL_COUNT) {
+            if (m.m00 < params.contour_pixel_count().val()) {
+                continue;
+            }
+        }
 
-            // Accept the rect
+        // Filter area size
+        if constexpr (FILTERS & CONTOUR_MIN_AREA) {
+            if (m.m00 < params.contour_min_area().val()) {
+                continue;
+            }
+        }
+
+        RotatedRect rect = rectFromMoments(m);
+
+        // Accept the rect
+        if (acceptLightRect<FILTERS>(rect)) {
             lightRects.emplace_back(rect);
         }
     }
+}
 
-    // If there is less than two light contours, stop detection
-    if (lightRects.size() < 2) {
-        return {};
+template<unsigned FILTERS>
+bool ArmorDetector::acceptLightRect(const RotatedRect &rect) const {
+
+    // Filter long edge min length
+    if constexpr (FILTERS & LONG_EDGE_MIN_LENGTH) {
+        if (rect.size.height < params.long_edge_min_length().val()) {
+            return false;
+        }
     }
 
-    // Sort lights from left to right based on center X
-    sort(lightRects.begin(), lightRects.end(),
-         [](RotatedRect &a1, RotatedRect &a2) {
-             return a1.center.x < a2.center.x;
-         });
+    // Filter angle
+    if constexpr (FILTERS & LIGHT_MAX_ROTATION) {
+        if (std::min(rect.angle, 180 - rect.angle) >= params.light_max_rotation().val()) {
+            return false;
+        }
+    }
+
+    // Filter aspect ratio
+    if constexpr (FILTERS & LIGHT_ASPECT_RATIO) {
+        double aspectRatio = rect.size.height / rect.size.width;
+        if (!inRange(aspectRatio, params.light_aspect_ratio())) {
+            return false;
+        }
+    }
+
+    return true;
+}
 
+int ArmorDetector::findComponentRoot(int label) {
+    while (componentParents[label] != label) {
+        componentParents[label] = componentParents[componentParents[label]];  // path halving
+        label = componentParents[label];
+    }
+    return label;
+}
+
+RotatedRect ArmorDetector::rectFromMoments(const ComponentMoments &m) {
+    double cx = m.m10 / m.m00, cy = m.m01 / m.m00;
+
+    // Covariance, plus 1/12 of a unit square on each axis
+    double a = m.m20 / m.m00 - cx * cx + 1.0 / 12;
+    double b = m.m11 / m.m00 - cx * cy;
+    double c = m.m02 / m.m00 - cy * cy + 1.0 / 12;
+
+    // Eigenvalues are the variances along the axes, L^2 / 12 for a rect of length L
+    double d = std::sqrt((a - c) * (a - c) / 4 + b * b);
+    double major = (a + c) / 2 + d, minor = std::max((a + c) / 2 - d, 1.0 / 12);
+
+    // The major axis is at theta from +x. The long edge of a RotatedRect is its height, at angle + 90 deg from +x.
+    double theta = 0.5 * std::atan2(2 * b, a - c) * 180 / CV_PI;
+
+    RotatedRect rect(Point2f((float) cx, (float) cy),
+                     Size2f((float) std::sqrt(12 * minor), (float) std::sqrt(12 * major)),
+                     (float) (theta + 90));
+    canonicalizeRotatedRect(rect);
+    return rect;
+}
+
+template<unsigned FILTERS>
+void ArmorDetector::combineLightsImpl(std::vector<DetectedArmor> &acceptedArmors) {
+    std::array<Point2f, 4> armorPoints;
     /*
-     * OpenCV coordinate: +x right, +y down
+     *              1 ----------- 2
+     *            |*|             |*|
+     * left light |*|             |*| right light
+     *            |*|             |*|
+     *              0 ----------- 3
+     *
+     * Edges (0, 1) and (2, 3) lie on inner edge
      */
 
-    // ================================ Combine Lights to Armors ================================
-    std::vector<DetectedArmor> acceptedArmors;
-    {
-        std::array<Point2f, 4> armorPoints;
-        /*
-         *              1 ----------- 2
-         *            |*|             |*|
-         * left light |*|             |*| right light
-         *            |*|             |*|
-         *              0 ----------- 3
-         *
-         * Edges (0, 1) and (2, 3) lie on inner edge
-         */
-
-        for (int leftLightIndex = 0; leftLightIndex < lightRects.size() - 1; ++leftLightIndex) {
-
-            const RotatedRect &leftRect = lightRects[leftLightIndex];  // already canonicalized
-
-
-            Point2f leftPoints[4];
-            leftRect.points(leftPoints);  // bottomLeft, topLeft, topRight, bottomRight of unrotated rect
-            if (leftRect.angle <= 90) {
-                armorPoints[0] = (leftPoints[0] + leftPoints[3]) / 2;
-                armorPoints[1] = (leftPoints[1] + leftPoints[2]) / 2;
-            } else {
-                armorPoints[0] = (leftPoints[1] + leftPoints[2]) / 2;
-                armorPoints[1] = (leftPoints[0] + leftPoints[3]) / 2;
-            }
+    for (int leftLightIndex = 0; leftLightIndex < lightRects.size() - 1; ++leftLightIndex) {
 
-            auto &leftCenter = leftRect.center;
+        const RotatedRect &leftRect = lightRects[leftLightIndex];  // already canonicalized
 
-            for (int rightLightIndex = leftLightIndex + 1; rightLightIndex < lightRects.size(); rightLightIndex++) {
 
-                const RotatedRect &rightRect = lightRects[rightLightIndex];  // already canonicalized
+        Point2f leftPoints[4];
+        leftRect.points(leftPoints);  // bottomLeft, topLeft, topRight, bottomRight of unrotated rect
+        if (leftRect.angle <= 90) {
+            armorPoints[0] = (leftPoints[0] + leftPoints[3]) / 2;
+            armorPoints[1] = (leftPoints[1] + leftPoints[2]) / 2;
+        } else {
+            armorPoints[0] = (leftPoints[1] + leftPoints[2]) / 2;
+            armorPoints[1] = (leftPoints[0] + leftPoints[3]) / 2;
+        }
 
+        auto &leftCenter = leftRect.center;
 
-                Point2f rightPoints[4];
-                rightRect.points(rightPoints);  // bottomLeft, topLeft, topRight, bottomRight of unrotated rect
-                if (rightRect.angle <= 90) {
-                    armorPoints[3] = (rightPoints[0] + rightPoints[3]) / 2;
-                    armorPoints[2] = (rightPoints[1] + rightPoints[2]) / 2;
-                } else {
-                    armorPoints[3] = (rightPoints[1] + rightPoints[2]) / 2;
-                    armorPoints[2] = (rightPoints[0] + rightPoints[3]) / 2;
-                }
+        for (int rightLightIndex = leftLightIndex + 1; rightLightIndex < lightRects.size(); rightLightIndex++) {
 
+            const RotatedRect &rightRect = lightRects[rightLightIndex];  // already canonicalized
 
-                auto leftVector = armorPoints[1] - armorPoints[0];   // up
-                if (leftVector.y > 0) {
-                    continue;  // leftVector should be upward, or lights intersect
-                }
-                auto rightVector = armorPoints[2] - armorPoints[3];  // up
-                if (rightVector.y > 0) {
-                    continue;  // rightVector should be upward, or lights intersect
-                }
-                auto topVector = armorPoints[2] - armorPoints[1];    // right
-                if (topVector.x < 0) {
-                    continue;  // topVector should be rightward, or lights intersect
-                }
-                auto bottomVector = armorPoints[3] - armorPoints[0];  // right
-                if (bottomVector.x < 0) {
-                    continue;  // bottomVector should be rightward, or lights intersect
-                }
+
+            Point2f rightPoints[4];
+            rightRect.points(rightPoints);  // bottomLeft, topLeft, topRight, bottomRight of unrotated rect
+            if (rightRect.angle <= 90) {
+                armorPoints[3] = (rightPoints[0] + rightPoints[3]) / 2;
+                armorPoints[2] = (rightPoints[1] + rightPoints[2]) / 2;
+            } else {
+                armorPoints[3] = (rightPoints[1] + rightPoints[2]) / 2;
+                armorPoints[2] = (rightPoints[0] + rightPoints[3]) / 2;
+            }
+
+
+            auto leftVector = armorPoints[1] - armorPoints[0];   // up
+            if (leftVector.y > 0) {
+                continue;  // leftVector should be upward, or lights intersect
+            }
+            auto rightVector = armorPoints[2] - armorPoints[3];  // up
+            if (rightVector.y > 0) {
+                continue;  // rightVector should be upward, or lights intersect
+            }
+            auto topVector = armorPoints[2] - armorPoints[1];    // right
+            if (topVector.x < 0) {
+                continue;  // topVector should be rightward, or lights intersect
+            }
+            auto bottomVector = armorPoints[3] - armorPoints[0];  // right
+            if (bottomVector.x < 0) {
+                continue;  // bottomVector should be rightward, or lights intersect
+            }
 
 
-                auto &rightCenter = rightRect.center;
+            auto &rightCenter = rightRect.center;
 
-                double leftLength = cv::norm(armorPoints[1] - armorPoints[0]);
-                double rightLength = cv::norm(armorPoints[2] - armorPoints[3]);
-                double averageLength = (leftLength + rightLength) / 2;
+            double leftLength = cv::norm(armorPoints[1] - armorPoints[0]);
+            double rightLength = cv::norm(armorPoints[2] - armorPoints[3]);
+            double averageLength = (leftLength + rightLength) / 2;
 
-                // Filter long light length to short light length ratio
-                if (params.light_length_max_ratio().enabled()) {
-                    double lengthRatio = leftLength > rightLength ?
-                                         leftLength / rightLength : rightLength / leftLength;  // >= 1
-                    if (lengthRatio > params.light_length_max_ratio().val()) continue;
-                }
+            // Filter long light length to short light length ratio
+            if constexpr (FILTERS & LIGHT_LENGTH_MAX_RATIO) {
+                double lengthRatio = leftLength > rightLength ?
+                                     leftLength / rightLength : rightLength / leftLength;  // >= 1
+                if (lengthRatio > params.light_length_max_ratio().val()) continue;
+            }
 
-                // Filter central X's difference
-                if (params.light_x_dist_over_l().enabled()) {
-                    double xDiffOverAvgL = abs(leftCenter.x - rightCenter.x) / averageLength;
-                    if (!inRange(xDiffOverAvgL, params.light_x_dist_over_l())) {
-                        continue;
-                    }
+            // Filter central X's difference
+            if constexpr (FILTERS & LIGHT_X_DIST_OVER_L) {
+                double xDiffOverAvgL = abs(leftCenter.x - rightCenter.x) / averageLength;
+                if (!inRange(xDiffOverAvgL, params.light_x_dist_over_l())) {
+                    continue;
                 }
+            }
 
-                // Filter central Y's difference
-                if (params.light_y_dist_over_l().enabled()) {
-                    double yDiffOverAvgL = abs(leftCenter.y - rightCenter.y) / averageLength;
-                    if (!inRange(yDiffOverAvgL, params.light_y_dist_over_l())) {
-                        continue;
-                    }
+            // Filter central Y's difference
+            if constexpr (FILTERS & LIGHT_Y_DIST_OVER_L) {
+                double yDiffOverAvgL = abs(leftCenter.y - rightCenter.y) / averageLength;
+                if (!inRange(yDiffOverAvgL, params.light_y_dist_over_l())) {
+                    continue;
                 }
+            }
 
-                // Filter angle difference
-                float angleDiff = std::abs(leftRect.angle - rightRect.angle);
-                if (params.light_angle_max_diff().enabled()) {
-                    if (angleDiff > 90) {
-                        angleDiff = 180 - angleDiff;
-                    }
-                    if (angleDiff > params.light_angle_max_diff().val()) {
-                        continue;
-                    }
+            // Filter angle difference
+            float angleDiff = std::abs(leftRect.angle - rightRect.angle);
+            if constexpr (FILTERS & LIGHT_ANGLE_MAX_DIFF) {
+                if (angleDiff > 90) {
+                    angleDiff = 180 - angleDiff;
                 }
-
-                double armorHeight = (cv::norm(leftVector) + cv::norm(rightVector)) / 2;
-                double armorWidth = (cv::norm(topVector) + cv::norm(bottomVector)) / 2;
-
-                // Filter armor aspect ratio
-                bool largeArmor;
-                if (inRange(armorWidth / armorHeight, params.small_armor_aspect_ratio())) {
-                    largeArmor = false;
-                } else if (inRange(armorWidth / armorHeight, params.large_armor_aspect_ratio())) {
-                    largeArmor = true;
-                } else {
+                if (angleDiff > params.light_angle_max_diff().val()) {
                     continue;
                 }
+            }
 
+            double armorHeight = (cv::norm(leftVector) + cv::norm(rightVector)) / 2;
+            double armorWidth = (cv::norm(topVector) + cv::norm(bottomVector)) / 2;
 
-                // Accept the armor
-                Point2f center = {0, 0};
-                for (int i = 0; i < 4; i++) {
-                    center.x += armorPoints[i].x;
-                    center.y += armorPoints[i].y;
-                }
+            // Filter armor aspect ratio
+            bool largeArmor;
+            if (inRange(armorWidth / armorHeight, params.small_armor_aspect_ratio())) {
+                largeArmor = false;
+            } else if (inRange(armorWidth / armorHeight, params.large_armor_aspect_ratio())) {
+                largeArmor = true;
+            } else {
+                continue;
+            }
 
-                // Just use the average X and Y coordinate for the four point
-                center.x /= 4;
-                center.y /= 4;
-
-                acceptedArmors.emplace_back(DetectedArmor{
-                        armorPoints,
-                        center,
-                        largeArmor,
-                        0,
-                        {leftLightIndex, rightLightIndex},
-                        angleDiff,
-                        (normalizeLightAngle(leftRect.angle) + normalizeLightAngle(rightRect.angle)) / 2
-                });
+
+            // Accept the armor
+            Point2f center = {0, 0};
+            for (int i = 0; i < 4; i++) {
+                center.x += armorPoints[i].x;
+                center.y += armorPoints[i].y;
             }
-        }
-    }
 
-    // Filter armors that share lights
-    {
-        while(true) {
-            auto it = filterAcceptedArmorsToRemove(acceptedArmors);
-            if (it == acceptedArmors.end()) break;  // nothing to remove
-            acceptedArmors.erase(it);       // remove the armor
-            // continue to try again
+            // Just use the average X and Y coordinate for the four point
+            center.x /= 4;
+            center.y /= 4;
+
+            acceptedArmors.emplace_back(DetectedArmor{
+                    armorPoints,
+                    center,
+                    largeArmor,
+                    0,
+                    {leftLightIndex, rightLightIndex},
+                    angleDiff,
+                    (normalizeLightAngle(leftRect.angle) + normalizeLightAngle(rightRect.angle)) / 2
+            });
         }
     }
-
-    return acceptedArmors;
 }
 
 std::vector<ArmorDetector::DetectedArmor>::iterator
@@ -0,0 +1,225 @@
+#include "BinaryMorphology.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+
+namespace meta {
+
+namespace {
+
+using Word = BinaryMorphology::Word;
+constexpr int WORD_BITS = BinaryMorphology::WORD_BITS;
+
+/**
+ * Bits of the pixels of a row in its last word, all ones if the width is a multiple of 64.
+ */
+Word lastWordMask(int width) {
+    int bits = width % WORD_BITS;
+    return bits ? (((Word) 1 << bits) - 1) : ~(Word) 0;
+}
+
+constexpr uint64_t LOW_7_BITS = 0x7F7F7F7F7F7F7F7FULL;
+constexpr uint64_t HIGH_BITS = 0x8080808080808080ULL;
+
+/**
+ * Pack 8 pixels, loaded little endian as the targets: the high bit of each byte is made 1 if the byte is non-zero, and
+ * the 8 high bits are gathered into the top byte by one multiplication.
+ */
+inline Word pack8(const uint8_t *p) {
+    static constexpr uint64_t GATHER = 0x0002040810204081ULL;  // high bit of byte i to bit 56 + i
+    uint64_t v;
+    std::memcpy(&v, p, 8);
+    uint64_t nonZero = (((v & LOW_7_BITS) + LOW_7_BITS) | v) & HIGH_BITS;
+    return (nonZero * GATHER) >> 56;
+}
+
+/**
+ * Unpack 8 pixels: bit i of the byte of bits to byte i, which is then made 0xFF if non-zero.
+ */
+inline void unpack8(Word bits, uint8_t *p) {
+    static constexpr uint64_t SPREAD = 0x0101010101010101ULL;  // a byte to all bytes
+    static constexpr uint64_t SELECT = 0x8040201008040201ULL;  // bit i of byte i
+    uint64_t selected = ((bits & 0xFF) * SPREAD) & SELECT;
+    uint64_t v = (((((selected & LOW_7_BITS) + LOW_7_BITS) | selected) & HIGH_BITS) >> 7) * 0xFF;
+    std::memcpy(p, &v, 8);
+}
+
+/**
+ * Floor division and the non-negative remainder by WORD_BITS.
+ */
+void splitShift(int shift, int &words, int &bits) {
+    words = (shift >= 0 ? shift : shift - (WORD_BITS - 1)) / WORD_BITS;
+    bits = shift - words * WORD_BITS;
+}
+
+}
+
+BinaryMorphology::Kernel::Kernel(int size) : size_(std::max(size, 1)) {
+
+    // Same as cv::getStructuringElement() for MORPH_ELLIPSE, of which cv::saturate_cast<int>(double) rounds to even
+    const int r = size_ / 2, c = size_ / 2;
+    const double invR2 = r ? 1.0 / ((double) r * r) : 0;
+    for (int i = 0; i < size_; i++) {
+        int dy = i - r;
+        int j1 = 0, j2 = 0;
+        if (size_ == 1) {
+            j2 = 1;  // taken as MORPH_RECT by OpenCV
+        } else if (std::abs(dy) <= r) {
+            int dx = (int) std::lrint(c * std::sqrt((r * r - dy * dy) * invR2));
+            j1 = std::max(c - dx, 0);
+            j2 = std::min(c + dx + 1, size_);
+        }
+        if (j1 >= j2) continue;
+
+        Segment segment{j1 - c, j2 - 1 - c};
+        auto it = std::find_if(segments_.begin(), segments_.end(), [&](const Segment &s) {
+            return s.dxMin == segment.dxMin && s.dxMax == segment.dxMax;
+        });
+        rows_.emplace_back(Row{dy, (int) (it - segments_.begin())});
+        if (it == segments_.end()) segments_.emplace_back(segment);
+        maxShift_ = std::max({maxShift_, std::abs(segment.dxMin), std::abs(segment.dxMax)});
+    }
+}
+
+void BinaryMorphology::Mask::pack(const uint8_t *data, int width, int height, size_t step) {
+    width_ = width;
+    height_ = height;
+    wordsPerRow_ = (width + WORD_BITS - 1) / WORD_BITS;
+    words.resize((size_t) wordsPerRow_ * height);
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t *p = data + y * step;
+        Word *out = row(y);
+        int x = 0;
+
+        // Each word is made in a register, 8 pixels at a time
+        for (; x + WORD_BITS <= width; x += WORD_BITS) {
+            Word word = 0;
+            for (int i = 0; i < 8; i++) word |= pack8(p + x + 8 * i) << (8 * i);
+            out[x / WORD_BITS] = word;
+        }
+        if (x < width) {  // the last word of the row
+            Word word = 0;
+            int i = 0;
+            for (; x + i + 8 <= width; i += 8) word |= pack8(p + x + i) << i;
+            for (; x + i < width; i++) word |= (Word) (p[x + i] != 0) << i;
+            out[x / WORD_BITS] = word;
+        }
+    }
+}
+
+void BinaryMorphology::Mask::unpack(uint8_t *data, size_t step) const {
+    for (int y = 0; y < height_; y++) {
+        const Word *in = row(y);
+        uint8_t *p = data + y * step;
+        int x = 0;
+
+        for (; x + WORD_BITS <= width_; x += WORD_BITS) {
+            Word word = in[x / WORD_BITS];
+            for (int i = 0; i < 8; i++) unpack8(word >> (8 * i), p + x + 8 * i);
+        }
+        if (x < width_) {  // the last word of the row
+            Word word = in[x / WORD_BITS];
+            int i = 0;
+            for (; x + i + 8 <= width_; i += 8) unpack8(word >> i, p + x + i);
+            for (; x + i < width_; i++) p[x + i] = ((word >> i) & 1) ? 255 : 0;
+        }
+    }
+}
+
+BinaryMorphology::Mask &BinaryMorphology::Mask::operator&=(const Mask &other) {
+    assert(width_ == other.width_ && height_ == other.height_ && "Masks of different sizes");
+    const size_t count = words.size();
+    Word *a = words.data();
+    const Word *b = other.words.data();
+    for (size_t i = 0; i < count; i++) a[i] &= b[i];
+    return *this;
+}
+
+void BinaryMorphology::apply(Mask &mask, Operation operation, const Kernel &kernel) {
+    if (kernel.identity() || mask.words.empty()) return;
+    switch (operation) {
+        case ERODE:
+            morph<true>(mask, kernel);
+            break;
+        case DILATE:
+            morph<false>(mask, kernel);
+            break;
+        case OPEN:
+            morph<true>(mask, kernel);
+            morph<false>(mask, kernel);
+            break;
+        case CLOSE:
+            morph<false>(mask, kernel);
+            morph<true>(mask, kernel);
+            break;
+    }
+}
+
+template<bool ERODE>
+void BinaryMorphology::morph(Mask &mask, const Kernel &kernel) {
+    const int height = mask.height_, wordsPerRow = mask.wordsPerRow_;
+    const Word border = ERODE ? ~(Word) 0 : 0;
+    const Word lastMask = lastWordMask(mask.width_);
+    const auto &kernelRows = kernel.rows();
+    const auto &segments = kernel.segments();
+    if (segmentRows.size() < segments.size()) segmentRows.resize(segments.size());
+
+    // ================================ Horizontal Pass ================================
+    // Word w of a row shifted by s pixels (pixel x from pixel x + s) is made of two neighbouring words of the padded
+    // row, in which the border words stand for the pixels beyond the borders
+    const int padWords = kernel.maxShift() / WORD_BITS + 1;
+    paddedRow.assign(wordsPerRow + 2 * padWords, border);
+    for (size_t s = 0; s < segments.size(); s++) {
+        segmentRows[s].resize((size_t) height * wordsPerRow);
+    }
+
+    for (int y = 0; y < height; y++) {
+        Word *padded = paddedRow.data() + padWords;
+        std::copy(mask.row(y), mask.row(y) + wordsPerRow, padded);
+        padded[wordsPerRow - 1] |= border & ~lastMask;  // bits beyond the width
+
+        for (size_t s = 0; s < segments.size(); s++) {
+            Word *out = segmentRows[s].data() + (size_t) y * wordsPerRow;
+            std::fill(out, out + wordsPerRow, border);
+
+            for (int shift = segments[s].dxMin; shift <= segments[s].dxMax; shift++) {
+                int words, bits;
+                splitShift(shift, words, bits);
+                const Word *lo = padded + words, *hi = padded + words + 1;
+                if (bits == 0) {
+                    for (int w = 0; w < wordsPerRow; w++) {
+                        if constexpr (ERODE) out[w] &= lo[w]; else out[w] |= lo[w];
+                    }
+                } else {
+                    const int bitsBack = WORD_BITS - bits;
+                    for (int w = 0; w < wordsPerRow; w++) {
+                        Word v = (lo[w] >> bits) | (hi[w] << bitsBack);
+                        if constexpr (ERODE) out[w] &= v; else out[w] |= v;
+                    }
+                }
+            }
+            out[wordsPerRow - 1] &= lastMask;
+        }
+    }
+
+    // ================================ Vertical Pass ================================
+    // Rows beyond the borders are all ones for erosion and zeros for dilation, which don't change the result
+    for (int y = 0; y < height; y++) {
+        Word *out = mask.row(y);
+        std::fill(out, out + wordsPerRow, border);
+        for (const auto &kernelRow : kernelRows) {
+            int sy = y + kernelRow.dy;
+            if (sy < 0 || sy >= height) continue;
+            const Word *in = segmentRows[kernelRow.segment].data() + (size_t) sy * wordsPerRow;
+            for (int w = 0; w < wordsPerRow; w++) {
+                if constexpr (ERODE) out[w] &= in[w]; else out[w] |= in[w];
+            }
+        }
+        out[wordsPerRow - 1] &= lastMask;
+    }
+}
+
+}
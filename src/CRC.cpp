@@ -1,134 +1,316 @@
-﻿#include "CRC.h"
+#include "CRC.h"
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CRC_SIMD_SSSE3 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define CRC_SIMD_NEON 1
+#endif
 
 namespace rm {
 
-// CRC8 generator polynomial: G(x) = x8+x5+x4+1
-
-const uint8_t CRC8_INIT = 0xff;
-const uint8_t CRC8_TAB[256] =
-        {
-                0x00, 0x5e, 0xbc, 0xe2, 0x61, 0x3f, 0xdd, 0x83, 0xc2, 0x9c, 0x7e, 0x20, 0xa3, 0xfd, 0x1f, 0x41,
-                0x9d, 0xc3, 0x21, 0x7f, 0xfc, 0xa2, 0x40, 0x1e, 0x5f, 0x01, 0xe3, 0xbd, 0x3e, 0x60, 0x82, 0xdc,
-                0x23, 0x7d, 0x9f, 0xc1, 0x42, 0x1c, 0xfe, 0xa0, 0xe1, 0xbf, 0x5d, 0x03, 0x80, 0xde, 0x3c, 0x62,
-                0xbe, 0xe0, 0x02, 0x5c, 0xdf, 0x81, 0x63, 0x3d, 0x7c, 0x22, 0xc0, 0x9e, 0x1d, 0x43, 0xa1, 0xff,
-                0x46, 0x18, 0xfa, 0xa4, 0x27, 0x79, 0x9b, 0xc5, 0x84, 0xda, 0x38, 0x66, 0xe5, 0xbb, 0x59, 0x07,
-                0xdb, 0x85, 0x67, 0x39, 0xba, 0xe4, 0x06, 0x58, 0x19, 0x47, 0xa5, 0xfb, 0x78, 0x26, 0xc4, 0x9a,
-                0x65, 0x3b, 0xd9, 0x87, 0x04, 0x5a, 0xb8, 0xe6, 0xa7, 0xf9, 0x1b, 0x45, 0xc6, 0x98, 0x7a, 0x24,
-                0xf8, 0xa6, 0x44, 0x1a, 0x99, 0xc7, 0x25, 0x7b, 0x3a, 0x64, 0x86, 0xd8, 0x5b, 0x05, 0xe7, 0xb9,
-                0x8c, 0xd2, 0x30, 0x6e, 0xed, 0xb3, 0x51, 0x0f, 0x4e, 0x10, 0xf2, 0xac, 0x2f, 0x71, 0x93, 0xcd,
-                0x11, 0x4f, 0xad, 0xf3, 0x70, 0x2e, 0xcc, 0x92, 0xd3, 0x8d, 0x6f, 0x31, 0xb2, 0xec, 0x0e, 0x50,
-                0xaf, 0xf1, 0x13, 0x4d, 0xce, 0x90, 0x72, 0x2c, 0x6d, 0x33, 0xd1, 0x8f, 0x0c, 0x52, 0xb0, 0xee,
-                0x32, 0x6c, 0x8e, 0xd0, 0x53, 0x0d, 0xef, 0xb1, 0xf0, 0xae, 0x4c, 0x12, 0x91, 0xcf, 0x2d, 0x73,
-                0xca, 0x94, 0x76, 0x28, 0xab, 0xf5, 0x17, 0x49, 0x08, 0x56, 0xb4, 0xea, 0x69, 0x37, 0xd5, 0x8b,
-                0x57, 0x09, 0xeb, 0xb5, 0x36, 0x68, 0x8a, 0xd4, 0x95, 0xcb, 0x29, 0x77, 0xf4, 0xaa, 0x48, 0x16,
-                0xe9, 0xb7, 0x55, 0x0b, 0x88, 0xd6, 0x34, 0x6a, 0x2b, 0x75, 0x97, 0xc9, 0x4a, 0x14, 0xf6, 0xa8,
-                0x74, 0x2a, 0xc8, 0x96, 0x15, 0x4b, 0xa9, 0xf7, 0xb6, 0xe8, 0x0a, 0x54, 0xd7, 0x89, 0x6b, 0x35,
-        };
-
-uint8_t getCRC8CheckSum(uint8_t *pchMessage, uint32_t dwLength) {
-    uint8_t ucCRC8 = CRC8_INIT;
-    uint8_t ucIndex;
-
-    while (dwLength--) {
-        ucIndex = ucCRC8 ^ (*pchMessage++);
-        ucCRC8 = CRC8_TAB[ucIndex];
+namespace {
+
+/** Table generation **/
+
+// CRC8 generator polynomial: G(x) = x8+x5+x4+1, reflected as 0x8C
+constexpr uint8_t CRC8_POLY = 0x8C;
+constexpr uint8_t CRC8_INIT = 0xff;
+
+// CRC16 generator polynomial: G(x) = x16+x12+x5+1, reflected as 0x8408
+constexpr uint16_t CRC16_POLY = 0x8408;
+constexpr uint16_t CRC16_INIT = 0xffff;
+
+constexpr int MAX_SLICES = 8;
+
+/**
+ * Table k gives the CRC of byte i followed by k zero bytes, so that a slice of N bytes can be folded in one step.
+ */
+template<typename T, T POLY>
+constexpr std::array<std::array<T, 256>, MAX_SLICES> makeTables() {
+    std::array<std::array<T, 256>, MAX_SLICES> tables{};
+    for (unsigned i = 0; i < 256; i++) {
+        T crc = (T) i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (T) ((crc >> 1) ^ POLY) : (T) (crc >> 1);
+        }
+        tables[0][i] = crc;
+    }
+    for (int k = 1; k < MAX_SLICES; k++) {
+        for (unsigned i = 0; i < 256; i++) {
+            T prev = tables[k - 1][i];
+            tables[k][i] = (T) ((prev >> 8) ^ tables[0][prev & 0xff]);  // feed a zero byte
+        }
     }
+    return tables;
+}
+
+constexpr auto CRC8_TABLES = makeTables<uint8_t, CRC8_POLY>();
+constexpr auto CRC16_TABLES = makeTables<uint16_t, CRC16_POLY>();
 
-    return (ucCRC8);
+// Sanity check against the first entries of the original tables
+static_assert(CRC8_TABLES[0][1] == 0x5e && CRC8_TABLES[0][255] == 0x35, "CRC8 table mismatch");
+static_assert(CRC16_TABLES[0][1] == 0x1189 && CRC16_TABLES[0][255] == 0x0f78, "CRC16 table mismatch");
+
+inline uint64_t loadLE(const uint8_t *p, int n) {
+    uint64_t v = 0;
+    std::memcpy(&v, p, n);  // little-endian on all targets of Solais (x86-64, AArch64)
+    return v;
 }
 
-bool verifyCRC8CheckSum(uint8_t *pchMessage, uint32_t dwLength) {
-    unsigned char ucExpected;
+/** Slicing **/
 
-    if ((pchMessage == nullptr) || (dwLength <= 2)) return false;
+template<int N>
+inline uint8_t updateCRC8(uint8_t crc, const uint8_t *p, uint32_t len) {
+    static_assert(N == 1 || N == 4 || N == 8, "Unsupported N");
+    const auto &t = CRC8_TABLES;
+    if (N > 1) {
+        while (len >= (uint32_t) N) {
+            uint64_t v = loadLE(p, N) ^ crc;
+            uint8_t r = 0;
+            for (int i = 0; i < N; i++) {  // unrolled by the compiler
+                r ^= t[N - 1 - i][(v >> (8 * i)) & 0xff];
+            }
+            crc = r;
+            p += N;
+            len -= N;
+        }
+    }
+    while (len--) crc = t[0][crc ^ *p++];
+    return crc;
+}
+
+template<int N>
+inline uint16_t updateCRC16(uint16_t crc, const uint8_t *p, uint32_t len) {
+    static_assert(N == 1 || N == 4 || N == 8, "Unsupported N");
+    const auto &t = CRC16_TABLES;
+    if (N > 1) {
+        while (len >= (uint32_t) N) {
+            uint64_t v = loadLE(p, N) ^ crc;
+            uint16_t r = 0;
+            for (int i = 0; i < N; i++) {
+                r ^= t[N - 1 - i][(v >> (8 * i)) & 0xff];
+            }
+            crc = r;
+            p += N;
+            len -= N;
+        }
+    }
+    while (len--) crc = (uint16_t) ((crc >> 8) ^ t[0][(crc ^ *p++) & 0xff]);
+    return crc;
+}
 
-    ucExpected = getCRC8CheckSum(pchMessage, dwLength - 1);
-    return (ucExpected == pchMessage[dwLength - 1]);
+}
+
+template<int N>
+uint8_t getCRC8CheckSumSliced(const uint8_t *pchMessage, uint32_t dwLength) {
+    return updateCRC8<N>(CRC8_INIT, pchMessage, dwLength);
+}
+
+template uint8_t getCRC8CheckSumSliced<1>(const uint8_t *, uint32_t);
+template uint8_t getCRC8CheckSumSliced<4>(const uint8_t *, uint32_t);
+template uint8_t getCRC8CheckSumSliced<8>(const uint8_t *, uint32_t);
+
+template<int N>
+uint16_t getCRC16CheckSumSliced(const uint8_t *pchMessage, uint32_t dwLength) {
+    return updateCRC16<N>(CRC16_INIT, pchMessage, dwLength);
+}
+
+template uint16_t getCRC16CheckSumSliced<1>(const uint8_t *, uint32_t);
+template uint16_t getCRC16CheckSumSliced<4>(const uint8_t *, uint32_t);
+template uint16_t getCRC16CheckSumSliced<8>(const uint8_t *, uint32_t);
+
+/** CRC8 **/
+
+uint8_t getCRC8CheckSum(const uint8_t *pchMessage, uint32_t dwLength) {
+    return updateCRC8<1>(CRC8_INIT, pchMessage, dwLength);  // short frames, slicing doesn't pay off
+}
+
+bool verifyCRC8CheckSum(const uint8_t *pchMessage, uint32_t dwLength) {
+    if ((pchMessage == nullptr) || (dwLength <= 2)) return false;
+    return getCRC8CheckSum(pchMessage, dwLength - 1) == pchMessage[dwLength - 1];
 }
 
 void appendCRC8CheckSum(uint8_t *pchMessage, uint32_t dwLength) {
-    unsigned char ucCRC;
+    if ((pchMessage == nullptr) || (dwLength <= 2)) return;
+    pchMessage[dwLength - 1] = getCRC8CheckSum(pchMessage, dwLength - 1);
+}
+
+/** CRC16 **/
+
+uint16_t getCRC16CheckSum(const uint8_t *pchMessage, uint32_t dwLength) {
+    if (pchMessage == nullptr) return 0xFFFF;
+    return updateCRC16<8>(CRC16_INIT, pchMessage, dwLength);
+}
 
+bool verifyCRC16CheckSum(const uint8_t *pchMessage, uint32_t dwLength) {
+    if ((pchMessage == nullptr) || (dwLength <= 2)) return false;
+    uint16_t wExpected = getCRC16CheckSum(pchMessage, dwLength - 2);
+    return ((wExpected & 0xff) == pchMessage[dwLength - 2] && ((wExpected >> 8) & 0xff) == pchMessage[dwLength - 1]);
+}
+
+void appendCRC16CheckSum(uint8_t *pchMessage, uint32_t dwLength) {
     if ((pchMessage == nullptr) || (dwLength <= 2)) return;
+    uint16_t wCRC = getCRC16CheckSum(pchMessage, dwLength - 2);
+    pchMessage[dwLength - 2] = (uint8_t) (wCRC & 0x00ff);
+    pchMessage[dwLength - 1] = (uint8_t) ((wCRC >> 8) & 0x00ff);
+}
 
-    ucCRC = getCRC8CheckSum((unsigned char *) pchMessage, dwLength - 1);
-    pchMessage[dwLength - 1] = ucCRC;
-}
-
-uint16_t CRC_INIT = 0xffff;
-const uint16_t wCRC_Table[256] =
-        {
-                0x0000, 0x1189, 0x2312, 0x329b, 0x4624, 0x57ad, 0x6536, 0x74bf,
-                0x8c48, 0x9dc1, 0xaf5a, 0xbed3, 0xca6c, 0xdbe5, 0xe97e, 0xf8f7,
-                0x1081, 0x0108, 0x3393, 0x221a, 0x56a5, 0x472c, 0x75b7, 0x643e,
-                0x9cc9, 0x8d40, 0xbfdb, 0xae52, 0xdaed, 0xcb64, 0xf9ff, 0xe876,
-                0x2102, 0x308b, 0x0210, 0x1399, 0x6726, 0x76af, 0x4434, 0x55bd,
-                0xad4a, 0xbcc3, 0x8e58, 0x9fd1, 0xeb6e, 0xfae7, 0xc87c, 0xd9f5,
-                0x3183, 0x200a, 0x1291, 0x0318, 0x77a7, 0x662e, 0x54b5, 0x453c,
-                0xbdcb, 0xac42, 0x9ed9, 0x8f50, 0xfbef, 0xea66, 0xd8fd, 0xc974,
-                0x4204, 0x538d, 0x6116, 0x709f, 0x0420, 0x15a9, 0x2732, 0x36bb,
-                0xce4c, 0xdfc5, 0xed5e, 0xfcd7, 0x8868, 0x99e1, 0xab7a, 0xbaf3,
-                0x5285, 0x430c, 0x7197, 0x601e, 0x14a1, 0x0528, 0x37b3, 0x263a,
-                0xdecd, 0xcf44, 0xfddf, 0xec56, 0x98e9, 0x8960, 0xbbfb, 0xaa72,
-                0x6306, 0x728f, 0x4014, 0x519d, 0x2522, 0x34ab, 0x0630, 0x17b9,
-                0xef4e, 0xfec7, 0xcc5c, 0xddd5, 0xa96a, 0xb8e3, 0x8a78, 0x9bf1,
-                0x7387, 0x620e, 0x5095, 0x411c, 0x35a3, 0x242a, 0x16b1, 0x0738,
-                0xffcf, 0xee46, 0xdcdd, 0xcd54, 0xb9eb, 0xa862, 0x9af9, 0x8b70,
-                0x8408, 0x9581, 0xa71a, 0xb693, 0xc22c, 0xd3a5, 0xe13e, 0xf0b7,
-                0x0840, 0x19c9, 0x2b52, 0x3adb, 0x4e64, 0x5fed, 0x6d76, 0x7cff,
-                0x9489, 0x8500, 0xb79b, 0xa612, 0xd2ad, 0xc324, 0xf1bf, 0xe036,
-                0x18c1, 0x0948, 0x3bd3, 0x2a5a, 0x5ee5, 0x4f6c, 0x7df7, 0x6c7e,
-                0xa50a, 0xb483, 0x8618, 0x9791, 0xe32e, 0xf2a7, 0xc03c, 0xd1b5,
-                0x2942, 0x38cb, 0x0a50, 0x1bd9, 0x6f66, 0x7eef, 0x4c74, 0x5dfd,
-                0xb58b, 0xa402, 0x9699, 0x8710, 0xf3af, 0xe226, 0xd0bd, 0xc134,
-                0x39c3, 0x284a, 0x1ad1, 0x0b58, 0x7fe7, 0x6e6e, 0x5cf5, 0x4d7c,
-                0xc60c, 0xd785, 0xe51e, 0xf497, 0x8028, 0x91a1, 0xa33a, 0xb2b3,
-                0x4a44, 0x5bcd, 0x6956, 0x78df, 0x0c60, 0x1de9, 0x2f72, 0x3efb,
-                0xd68d, 0xc704, 0xf59f, 0xe416, 0x90a9, 0x8120, 0xb3bb, 0xa232,
-                0x5ac5, 0x4b4c, 0x79d7, 0x685e, 0x1ce1, 0x0d68, 0x3ff3, 0x2e7a,
-                0xe70e, 0xf687, 0xc41c, 0xd595, 0xa12a, 0xb0a3, 0x8238, 0x93b1,
-                0x6b46, 0x7acf, 0x4854, 0x59dd, 0x2d62, 0x3ceb, 0x0e70, 0x1ff9,
-                0xf78f, 0xe606, 0xd49d, 0xc514, 0xb1ab, 0xa022, 0x92b9, 0x8330,
-                0x7bc7, 0x6a4e, 0x58d5, 0x495c, 0x3de3, 0x2c6a, 0x1ef1, 0x0f78
-        };
-
-uint16_t getCRC16CheckSum(uint8_t *pchMessage, uint32_t dwLength) {
-    uint16_t wCRC = CRC_INIT;
-    uint8_t chData;
-
-    if (pchMessage == nullptr) {
-        return 0xFFFF;
-    }
+/** Batch verification **/
 
-    while (dwLength--) {
-        chData = *pchMessage++;
-        (wCRC) = ((uint16_t) (wCRC) >> 8) ^ wCRC_Table[((uint16_t) (wCRC) ^ (uint16_t) (chData)) & 0x00ff];
+size_t verifyCRC8Batch(const uint8_t *const *frames, const uint32_t *lengths, size_t count, bool *results) {
+    const auto &t = CRC8_TABLES[0];
+    size_t passed = 0;
+    size_t f = 0;
+
+    // Four frames at a time, byte by byte over their common length. The four chains are independent.
+    for (; f + 4 <= count; f += 4) {
+        const uint8_t *p[4] = {frames[f], frames[f + 1], frames[f + 2], frames[f + 3]};
+        uint32_t len[4];
+        uint32_t common = UINT32_MAX;
+        for (int k = 0; k < 4; k++) {
+            len[k] = (p[k] != nullptr && lengths[f + k] > 2) ? lengths[f + k] - 1 : 0;
+            if (len[k] < common) common = len[k];
+        }
+        uint8_t c0 = CRC8_INIT, c1 = CRC8_INIT, c2 = CRC8_INIT, c3 = CRC8_INIT;
+        for (uint32_t i = 0; i < common; i++) {
+            c0 = t[c0 ^ p[0][i]];
+            c1 = t[c1 ^ p[1][i]];
+            c2 = t[c2 ^ p[2][i]];
+            c3 = t[c3 ^ p[3][i]];
+        }
+        uint8_t c[4] = {c0, c1, c2, c3};
+        for (int k = 0; k < 4; k++) {
+            bool ok = false;
+            if (len[k] != 0) {
+                uint8_t crc = updateCRC8<1>(c[k], p[k] + common, len[k] - common);  // remaining bytes
+                ok = (crc == p[k][len[k]]);
+            }
+            results[f + k] = ok;
+            passed += ok;
+        }
+    }
+    for (; f < count; f++) {
+        results[f] = verifyCRC8CheckSum(frames[f], lengths[f]);
+        passed += results[f];
     }
+    return passed;
+}
+
+size_t verifyCRC16Batch(const uint8_t *const *frames, const uint32_t *lengths, size_t count, bool *results) {
+    const auto &t = CRC16_TABLES[0];
+    size_t passed = 0;
+    size_t f = 0;
 
-    return wCRC;
+    for (; f + 4 <= count; f += 4) {
+        const uint8_t *p[4] = {frames[f], frames[f + 1], frames[f + 2], frames[f + 3]};
+        uint32_t len[4];
+        uint32_t common = UINT32_MAX;
+        for (int k = 0; k < 4; k++) {
+            len[k] = (p[k] != nullptr && lengths[f + k] > 2) ? lengths[f + k] - 2 : 0;
+            if (len[k] < common) common = len[k];
+        }
+        uint16_t c0 = CRC16_INIT, c1 = CRC16_INIT, c2 = CRC16_INIT, c3 = CRC16_INIT;
+        for (uint32_t i = 0; i < common; i++) {
+            c0 = (uint16_t) ((c0 >> 8) ^ t[(c0 ^ p[0][i]) & 0xff]);
+            c1 = (uint16_t) ((c1 >> 8) ^ t[(c1 ^ p[1][i]) & 0xff]);
+            c2 = (uint16_t) ((c2 >> 8) ^ t[(c2 ^ p[2][i]) & 0xff]);
+            c3 = (uint16_t) ((c3 >> 8) ^ t[(c3 ^ p[3][i]) & 0xff]);
+        }
+        uint16_t c[4] = {c0, c1, c2, c3};
+        for (int k = 0; k < 4; k++) {
+            bool ok = false;
+            if (len[k] != 0) {
+                uint16_t crc = updateCRC16<8>(c[k], p[k] + common, len[k] - common);
+                ok = ((crc & 0xff) == p[k][len[k]] && (crc >> 8) == p[k][len[k] + 1]);
+            }
+            results[f + k] = ok;
+            passed += ok;
+        }
+    }
+    for (; f < count; f++) {
+        results[f] = verifyCRC16CheckSum(frames[f], lengths[f]);
+        passed += results[f];
+    }
+    return passed;
 }
 
-bool verifyCRC16CheckSum(uint8_t *pchMessage, uint32_t dwLength) {
-    uint16_t wExpected;
+namespace {
 
-    if ((pchMessage == nullptr) || (dwLength <= 2)) {
-        return false;
+uint16_t verifyCRC8At16OffsetsScalar(const uint8_t *pchBuffer, uint32_t dwLength) {
+    uint16_t mask = 0;
+    for (int j = 0; j < 16; j++) {
+        if (verifyCRC8CheckSum(pchBuffer + j, dwLength)) mask |= (uint16_t) (1U << j);
     }
+    return mask;
+}
 
-    wExpected = getCRC16CheckSum(pchMessage, dwLength - 2);
-    return ((wExpected & 0xff) == pchMessage[dwLength - 2] && ((wExpected >> 8) & 0xff) == pchMessage[dwLength - 1]);
+// Nibble tables: CRC8_TABLES[0][x] = LOW[x & 0x0F] ^ HIGH[x >> 4], since the table is linear over GF(2)
+template<int SHIFT>
+constexpr std::array<uint8_t, 16> makeNibbleTable() {
+    std::array<uint8_t, 16> table{};
+    for (unsigned i = 0; i < 16; i++) table[i] = CRC8_TABLES[0][i << SHIFT];
+    return table;
 }
 
-void appendCRC16CheckSum(uint8_t *pchMessage, uint32_t dwLength) {
-    uint16_t wCRC;
+alignas(16) constexpr auto CRC8_LOW_NIBBLE = makeNibbleTable<0>();
+alignas(16) constexpr auto CRC8_HIGH_NIBBLE = makeNibbleTable<4>();
+
+#if defined(CRC_SIMD_SSSE3)
 
-    if ((pchMessage == nullptr) || (dwLength <= 2)) {
-        return;
+__attribute__((target("ssse3")))
+uint16_t verifyCRC8At16OffsetsSSSE3(const uint8_t *pchBuffer, uint32_t dwLength) {
+    const __m128i low = _mm_load_si128((const __m128i *) CRC8_LOW_NIBBLE.data());
+    const __m128i high = _mm_load_si128((const __m128i *) CRC8_HIGH_NIBBLE.data());
+    const __m128i nibbleMask = _mm_set1_epi8(0x0F);
+
+    __m128i crc = _mm_set1_epi8((char) CRC8_INIT);
+    for (uint32_t i = 0; i + 1 < dwLength; i++) {
+        __m128i x = _mm_xor_si128(crc, _mm_loadu_si128((const __m128i *) (pchBuffer + i)));
+        __m128i lo = _mm_shuffle_epi8(low, _mm_and_si128(x, nibbleMask));
+        __m128i hi = _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi16(x, 4), nibbleMask));
+        crc = _mm_xor_si128(lo, hi);
     }
+    __m128i expected = _mm_loadu_si128((const __m128i *) (pchBuffer + dwLength - 1));
+    return (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(crc, expected));
+}
 
-    wCRC = getCRC16CheckSum((uint8_t *) pchMessage, dwLength - 2);
-    pchMessage[dwLength - 2] = (uint8_t) (wCRC & 0x00ff);
-    pchMessage[dwLength - 1] = (uint8_t) ((wCRC >> 8) & 0x00ff);
+#elif defined(CRC_SIMD_NEON)
+
+uint16_t verifyCRC8At16OffsetsNEON(const uint8_t *pchBuffer, uint32_t dwLength) {
+    const uint8x16_t low = vld1q_u8(CRC8_LOW_NIBBLE.data());
+    const uint8x16_t high = vld1q_u8(CRC8_HIGH_NIBBLE.data());
+    const uint8x16_t nibbleMask = vdupq_n_u8(0x0F);
+
+    uint8x16_t crc = vdupq_n_u8(CRC8_INIT);
+    for (uint32_t i = 0; i + 1 < dwLength; i++) {
+        uint8x16_t x = veorq_u8(crc, vld1q_u8(pchBuffer + i));
+        crc = veorq_u8(vqtbl1q_u8(low, vandq_u8(x, nibbleMask)), vqtbl1q_u8(high, vshrq_n_u8(x, 4)));
+    }
+    uint8x16_t eq = vceqq_u8(crc, vld1q_u8(pchBuffer + dwLength - 1));
+
+    // Narrow the comparison to one bit per lane
+    static const uint8_t bitsData[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t bits = vandq_u8(eq, vld1q_u8(bitsData));
+    return (uint16_t) (vaddv_u8(vget_low_u8(bits)) | (vaddv_u8(vget_high_u8(bits)) << 8));
+}
+
+#endif
+
+}
+
+uint16_t verifyCRC8At16Offsets(const uint8_t *pchBuffer, uint32_t dwLength) {
+    if ((pchBuffer == nullptr) || (dwLength <= 2)) return 0;
+#if defined(CRC_SIMD_SSSE3)
+    static const bool hasSSSE3 = __builtin_cpu_supports("ssse3");
+    if (hasSSSE3) return verifyCRC8At16OffsetsSSSE3(pchBuffer, dwLength);
+#elif defined(CRC_SIMD_NEON)
+    return verifyCRC8At16OffsetsNEON(pchBuffer, dwLength);
+#endif
+    return verifyCRC8At16OffsetsScalar(pchBuffer, dwLength);
 }
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,204 @@
+#include "CalibrationStore.h"
+#include <opencv2/calib3d/calib3d.hpp>
+#include <boost/filesystem.hpp>
+#include <cstdio>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace meta {
+
+namespace fs = boost::filesystem;
+
+CalibrationStore::CalibrationStore(std::string directory_) : directory(std::move(directory_)) {
+    files = loadFiles();
+
+#ifdef __linux__
+    inotifyFD = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFD < 0 ||
+        inotify_add_watch(inotifyFD, directory.c_str(),
+                          IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE) < 0) {
+        std::cerr << "CalibrationStore: failed to watch " << directory << ", changes are not reloaded" << std::endl;
+    } else {
+        watcherThread = new std::thread(&CalibrationStore::watch, this);
+    }
+#endif
+}
+
+CalibrationStore::~CalibrationStore() {
+    if (watcherThread) {
+        watcherShouldExit = true;
+        watcherThread->join();
+        delete watcherThread;
+    }
+#ifdef __linux__
+    if (inotifyFD >= 0) close(inotifyFD);
+#endif
+}
+
+CalibrationStore::FileMap CalibrationStore::loadFiles() const {
+    FileMap ret;
+    boost::system::error_code ec;
+    for (fs::directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->path().extension() != ".xml") continue;
+
+        // <width>x<height>[_<camera serial>]
+        std::string stem = it->path().stem().string();
+        int width, height, n = 0;
+        if (std::sscanf(stem.c_str(), "%dx%d%n", &width, &height, &n) != 2) continue;
+        std::string serial;
+        if (n < (int) stem.length()) {
+            if (stem[n] != '_') continue;
+            serial = stem.substr(n + 1);
+        }
+
+        auto file = std::make_shared<FileCalibration>();
+        file->filename = it->path().filename().string();
+        bool loaded = false;
+        try {
+            cv::FileStorage fs(it->path().string(), cv::FileStorage::READ);
+            if (fs.isOpened()) {
+                fs["cameraMatrix"] >> file->cameraMatrix;
+                fs["distCoeffs"] >> file->distCoeffs;
+                fs["zScale"] >> file->zScale;
+                loaded = true;
+            }
+        } catch (const cv::Exception &) {}  // e.g. being written
+        if (!loaded) {
+            std::cerr << "CalibrationStore: failed to load " << it->path().string() << std::endl;
+            continue;
+        }
+        if (file->cameraMatrix.rows != 3 || file->cameraMatrix.cols != 3 || file->cameraMatrix.type() != CV_64F) {
+            std::cerr << "CalibrationStore: invalid cameraMatrix in " << it->path().string() << std::endl;
+            continue;
+        }
+        ret[{width, height, serial}] = std::move(file);
+    }
+    if (ec) std::cerr << "CalibrationStore: failed to list " << directory << ": " << ec.message() << std::endl;
+    return ret;
+}
+
+std::shared_ptr<const CalibrationStore::FileCalibration>
+CalibrationStore::find(const FileMap &map, int imageWidth, int imageHeight, const std::string &cameraSerial) {
+    if (!cameraSerial.empty()) {
+        auto it = map.find({imageWidth, imageHeight, cameraSerial});
+        if (it != map.end()) return it->second;
+    }
+    auto it = map.find({imageWidth, imageHeight, ""});
+    return it != map.end() ? it->second : nullptr;
+}
+
+std::shared_ptr<const Calibration> CalibrationStore::derive(const FileCalibration *file, const DerivedKey &key) {
+    if (!file) return nullptr;
+    auto [imageWidth, imageHeight, roiWidth, roiHeight, serial] = key;
+
+    auto ret = std::make_shared<Calibration>();
+    ret->filename = file->filename;
+    ret->imageWidth = imageWidth;
+    ret->imageHeight = imageHeight;
+    ret->roiWidth = roiWidth;
+    ret->roiHeight = roiHeight;
+    ret->cameraMatrix = file->cameraMatrix.clone();
+    ret->cameraMatrix.at<double>(0, 2) *= (float) roiWidth / (float) imageWidth;
+    ret->cameraMatrix.at<double>(1, 2) *= (float) roiHeight / (float) imageHeight;
+    ret->distCoeffs = file->distCoeffs;
+    ret->zScale = file->zScale;
+
+    // Undistortion grid, covering the ROI
+    int cols = roiWidth / Calibration::UNDISTORT_GRID_STEP + 2;
+    int rows = roiHeight / Calibration::UNDISTORT_GRID_STEP + 2;
+    std::vector<cv::Point2f> points;
+    points.reserve(rows * cols);
+    for (int y = 0; y < rows; y++) {
+        for (int x = 0; x < cols; x++) {
+            points.emplace_back((float) (x * Calibration::UNDISTORT_GRID_STEP),
+                                (float) (y * Calibration::UNDISTORT_GRID_STEP));
+        }
+    }
+    std::vector<cv::Point2f> undistorted;
+    cv::undistortPoints(points, undistorted, ret->cameraMatrix, ret->distCoeffs, cv::noArray(), ret->cameraMatrix);
+    ret->undistortGrid = cv::Mat(undistorted, true).reshape(2, rows);
+
+    return ret;
+}
+
+std::shared_ptr<const Calibration> CalibrationStore::get(int imageWidth, int imageHeight, int roiWidth, int roiHeight,
+                                                         const std::string &cameraSerial) {
+    DerivedKey key{imageWidth, imageHeight, roiWidth, roiHeight, cameraSerial};
+    std::shared_ptr<const FileCalibration> file;
+    unsigned gen;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = derived.find(key);
+        if (it != derived.end()) return it->second;
+        file = find(files, imageWidth, imageHeight, cameraSerial);
+        gen = generation_;
+    }
+
+    auto ret = derive(file.get(), key);  // outside the lock
+    if (!ret) {
+        std::cerr << "CalibrationStore: no calibration of " << imageWidth << "x" << imageHeight
+                  << (cameraSerial.empty() ? "" : " for camera " + cameraSerial) << " in " << directory << std::endl;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (generation_ == gen) derived.emplace(key, ret);  // otherwise derived again by reload()
+    return ret;
+}
+
+void CalibrationStore::reload() {
+    FileMap newFiles = loadFiles();
+
+    std::vector<DerivedKey> keys;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto &item : derived) keys.emplace_back(item.first);
+    }
+
+    // Derive the cached ones again, so that get() of them stays without derivation
+    DerivedMap newDerived;
+    for (const auto &key : keys) {
+        auto file = find(newFiles, std::get<0>(key), std::get<1>(key), std::get<4>(key));
+        newDerived.emplace(key, derive(file.get(), key));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        files = std::move(newFiles);
+        derived = std::move(newDerived);
+        generation_++;
+    }
+    std::cout << "CalibrationStore: reloaded " << directory << std::endl;
+}
+
+void CalibrationStore::watch() {
+#ifdef __linux__
+    alignas(inotify_event) char buf[4096];
+    while (!watcherShouldExit) {
+        pollfd pfd{inotifyFD, POLLIN, 0};
+        if (poll(&pfd, 1, 200) <= 0) continue;  // timeout to check watcherShouldExit
+
+        // Wait for the burst of events of a write to end, then reload once if any calibration file is changed
+        bool changed = false;
+        do {
+            ssize_t len;
+            while ((len = read(inotifyFD, buf, sizeof(buf))) > 0) {
+                for (char *p = buf; p < buf + len; p += sizeof(inotify_event) + ((inotify_event *) p)->len) {
+                    auto event = (const inotify_event *) p;
+                    if (event->len && fs::path(event->name).extension() == ".xml") changed = true;
+                }
+            }
+        } while (!watcherShouldExit && poll(&pfd, 1, 100) > 0);
+
+        if (changed) reload();
+    }
+#endif
+}
+
+}
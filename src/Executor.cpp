@@ -4,6 +4,9 @@
 
 #include "Executor.h"
 #include "Utilities.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
 #include <iostream>
 
 namespace meta {
@@ -11,11 +14,13 @@ namespace meta {
 Executor::Executor(OpenCVCamera *openCvCamera, MVCamera *mvCamera, ImageSet *imageSet, VideoSet *videoSet,
                    ParamSetManager *paramSetManager,
                    ArmorDetector *detector, PositionCalculator *positionCalculator, AimingSolver *aimingSolver,
-                   Serial *serial)
+                   Serial *serial, TelemetrySender *telemetry)
         : openCvCamera_(openCvCamera), mvCamera_(mvCamera), imageSet_(imageSet), videoSet_(videoSet),
           paramSetManager_(paramSetManager),
           detector_(detector), positionCalculator_(positionCalculator), aimingSolver_(aimingSolver),
-          serial_(serial) {
+          serial_(serial), telemetry_(telemetry), calibrationStore(std::string(PARAM_SET_ROOT) + "/params") {
+
+    if (serial_) aimingSolver_->setGimbalHistory(&serial_->gimbalHistory());
 
     reloadLists();
 }
@@ -34,15 +39,23 @@ void Executor::applyParams(const ParamSet &p) {
     // For better user experience for parameter tuning, here we don't stop the detection thread
     // But if there is some changes in the streaming source, detection may terminate anyway
 
+    ParamSetDiff diff;
+    if (paramsInitialized) {
+        diff = ParamSetDiff(params, p);
+        if (diff.empty()) return;  // e.g. saved without changes
+        std::cout << "Executor: apply changes of " << diff.toString() << std::endl;
+    } else {
+        diff = ParamSetDiff::all();
+        paramsInitialized = true;
+    }
+
     // Input of Camera
     // Skip re-opening the video source if the parameter doesn't change to save some time
-    if (!(p.camera_backend() == params.camera_backend() && p.camera_id() == params.camera_id() &&
-          p.image_width() == params.image_width() && p.image_height() == params.image_height() &&
-          p.fps() == params.fps() &&
-          p.gamma().enabled() == params.gamma().enabled() && p.gamma().val() == params.gamma().val() &&
-          p.roi_width() == params.roi_width() && p.roi_height() == params.roi_height() &&
-          p.manual_exposure().enabled() == params.manual_exposure().enabled() &&
-          p.manual_exposure().val() == params.manual_exposure().val())) {
+    if (diff.anyChanged({ParamSet::kCameraBackendFieldNumber, ParamSet::kCameraIdFieldNumber,
+                         ParamSet::kImageWidthFieldNumber, ParamSet::kImageHeightFieldNumber,
+                         ParamSet::kFpsFieldNumber, ParamSet::kGammaFieldNumber,
+                         ParamSet::kRoiWidthFieldNumber, ParamSet::kRoiHeightFieldNumber,
+                         ParamSet::kManualExposureFieldNumber})) {
 
         bool cameraOpened = camera_ && camera_->isOpened();
         if (cameraOpened) camera_->close();
@@ -56,48 +69,96 @@ void Executor::applyParams(const ParamSet &p) {
         if (cameraOpened) camera_->open(p);
     }
 
+    // Model of the number classifier, read and parsed here rather than by the detection thread. Loaded again when the
+    // classifier is enabled again or the lists are reloaded, e.g. after the model file is replaced.
+    if (!p.armor_number_min_confidence().enabled()) {
+        classifierLoadAttempted = false;
+    } else if (!classifierLoadAttempted) {
+        classifierLoadAttempted = true;
+        classifierModel = ArmorClassifier::loadModel(std::string(PARAM_SET_ROOT) + "/models/armor_number.onnx");
+    }
+
     // Local copy
     params = p;
 
-    // Input of ImageSet
-    if (imageSet_->isOpened()) {
+    // Input of ImageSet, whose images are loaded with the ROI and the FPS
+    if (imageSet_->isOpened() && diff.anyChanged({ParamSet::kRoiWidthFieldNumber, ParamSet::kRoiHeightFieldNumber,
+                                                  ParamSet::kFpsFieldNumber})) {
         stop();
         imageSet_->close();
     }
 
-    // Detector
-    detector_->setParams(params);
+    publishParams();
+}
 
-    // PositionCalculator
-    {
-        std::string filename =
-                std::string(PARAM_SET_ROOT) + "/params/" +
-                std::to_string(params.image_width()) + "x" + std::to_string(params.image_height()) + ".xml";
-
-        cv::Mat cameraMatrix;
-        cv::Mat distCoeffs;
-        float zScale;
-
-        cv::FileStorage fs(filename, cv::FileStorage::READ);
-        if (!fs.isOpened()) {
-            std::cerr << "Failed to open " << filename << std::endl;
-            std::exit(1);
-        }
+void Executor::publishParams() {
+    auto version = std::make_unique<ParamsVersion>();
+    version->version = getCurrentParamsVersion() + 1;
+    version->params = params;
+    version->cameraSerial = (camera_ && camera_->isOpened()) ? camera_->getSerialNumber() : "";
+    version->calibrationGeneration = calibrationStore.generation();
+    version->calibration = calibrationStore.get(params.image_width(), params.image_height(),
+                                                params.roi_width(), params.roi_height(), version->cameraSerial);
+    if (params.armor_number_min_confidence().enabled()) version->classifierModel = classifierModel;
+    publishedParams.store(version.get(), std::memory_order_release);
+    paramsVersions.emplace_back(std::move(version));
+
+    if (!th) latchParams();  // no detection thread to latch it
+
+    // Delete the versions before the latched one, which are no longer used by the detection thread
+    uint32_t latched = latchedVersion.load(std::memory_order_acquire);
+    while (paramsVersions.front()->version < latched) paramsVersions.pop_front();
+}
+
+void Executor::latchParams() {
+    const ParamsVersion *latest = publishedParams.load(std::memory_order_acquire);
+    unsigned calibrationGeneration = calibrationStore.generation();
+    if (latest == latchedParams && calibrationGeneration == latchedCalibrationGeneration) return;
 
-        fs["cameraMatrix"] >> cameraMatrix;
-        cameraMatrix.at<double>(0, 2) *= (float) params.roi_width() / (float) params.image_width();
-        cameraMatrix.at<double>(1, 2) *= (float) params.roi_height() / (float) params.image_height();
-        fs["distCoeffs"] >> distCoeffs;
-        fs["zScale"] >> zScale;
+    // Not deleted until latchedVersion is updated below
+    ParamSetDiff diff;
+    if (latest != latchedParams) {
+        diff = latchedParams ? ParamSetDiff(latchedParams->params, latest->params) : ParamSetDiff::all();
+    }
+    const auto &p = latest->params;
+
+    // Detector, with no state other than the parameters and the model swapped in
+    if (!diff.empty()) {
+        detector_->setParams(p);
+        detector_->setClassifierModel(latest->classifierModel);
+    }
 
+    // PositionCalculator
+    auto calibration = latest->calibration;
+    if (calibrationGeneration != latest->calibrationGeneration) {
+        // Reloaded since published. The cached one is derived again by the store, so no disk IO here.
+        calibration = calibrationStore.get(p.image_width(), p.image_height(), p.roi_width(), p.roi_height(),
+                                           latest->cameraSerial);
+    }
+    if (calibration != latchedCalibration || diff.anyChanged({ParamSet::kSmallArmorSizeFieldNumber,
+                                                              ParamSet::kLargeArmorSizeFieldNumber})) {
         positionCalculator_->setParameters(
-                {(float) params.small_armor_size().x(), (float) params.small_armor_size().y()},
-                {(float) params.large_armor_size().x(), (float) params.large_armor_size().y()},
-                cameraMatrix, distCoeffs, zScale);
+                {(float) p.small_armor_size().x(), (float) p.small_armor_size().y()},
+                {(float) p.large_armor_size().x(), (float) p.large_armor_size().y()},
+                calibration);
+        latchedCalibration = std::move(calibration);
+    }
+    latchedCalibrationGeneration = calibrationGeneration;
+
+    // AimingSolver, whose history is kept if only thresholds and offsets change
+    if (!diff.empty()) {
+        aimingSolver_->setParams(p, diff.anyChanged(
+                {ParamSet::kCameraBackendFieldNumber, ParamSet::kCameraIdFieldNumber,
+                 ParamSet::kImageWidthFieldNumber, ParamSet::kImageHeightFieldNumber,
+                 ParamSet::kRoiWidthFieldNumber, ParamSet::kRoiHeightFieldNumber,
+                 ParamSet::kEnemyColorFieldNumber,
+                 ParamSet::kSmallArmorSizeFieldNumber, ParamSet::kLargeArmorSizeFieldNumber,
+                 ParamSet::kPulseMinXOffsetFieldNumber, ParamSet::kPulseMaxYOffsetFieldNumber,
+                 ParamSet::kPulseMinIntervalFieldNumber}));
     }
 
-    // AimingSolver
-    aimingSolver_->setParams(params);  // reset history inside
+    latchedParams = latest;
+    latchedVersion.store(latest->version, std::memory_order_release);
 }
 
 void Executor::stop() {
@@ -120,6 +181,9 @@ bool Executor::startRealTimeDetection() {
         }
     }
 
+    // Calibration may be specific to the camera, known once opened
+    if (camera_->getSerialNumber() != paramsVersions.back()->cameraSerial) publishParams();
+
     // Start real-time detection thread
     curAction = STREAMING_DETECTION;
     threadShouldExit = false;
@@ -169,7 +233,9 @@ void Executor::runStreamingDetection(InputSource *source) {
 
     currentInput_ = source;
     currentInput_->fetchAndClearFrameCounter();
+    latchParams();
     aimingSolver_->resetHistory();
+    lastImageOutputTime = 0;
 
     TimePoint lastFrameTime = 0;  // use last frame capture time to wait for new frame
     TimePoint frameTime = 0;
@@ -177,6 +243,7 @@ void Executor::runStreamingDetection(InputSource *source) {
 
         // Wait for new frame, fetch and store time first and then compare
         while (!threadShouldExit && lastFrameTime == (frameTime = source->getFrameCaptureTime())) {
+            latchParams();
             source->fetchNextFrame();
             std::this_thread::yield();
         }
@@ -189,9 +256,35 @@ void Executor::runStreamingDetection(InputSource *source) {
         auto &img = source->getFrame();  // no need for deep copying
         source->fetchNextFrame();
 
+        latchParams();  // one version for the whole frame
+        const ParamSet &frameParams = latchedParams->params;
+
+        uint32_t stageMicros[TelemetryRecord::STAGE_COUNT] = {};
+        auto stageStart = std::chrono::steady_clock::now();
+        auto endStage = [&](TelemetryRecord::Stage stage) {
+            auto now = std::chrono::steady_clock::now();
+            stageMicros[stage] = std::chrono::duration_cast<std::chrono::microseconds>(now - stageStart).count();
+            stageStart = now;
+        };
+
+        // Request the intermediate images of the detector only if the image outputs are due
+        unsigned imageMask = 0;
+        if (curAction == SINGLE_IMAGE_DETECTION) {
+            imageMask = ALL_IMAGE_OUTPUTS;
+        } else if (TimeBase::now() - lastImageOutputTime >= imageOutputPeriod) {
+            imageMask = imageOutputMask;
+        }
+        {
+            unsigned detectorImages = 0;
+            if (imageMask & BRIGHTNESS_OUTPUT) detectorImages |= ArmorDetector::BRIGHTNESS_IMAGE;
+            if (imageMask & COLOR_OUTPUT) detectorImages |= ArmorDetector::COLOR_IMAGE;
+            if (imageMask & LIGHTS_OUTPUT) detectorImages |= ArmorDetector::LIGHTS_IMAGE;
+            detector_->requestImages(detectorImages);
+        }
 
         // Run armor detection algorithm
         std::vector<ArmorDetector::DetectedArmor> detectedArmors = detector_->detect(img);
+        endStage(TelemetryRecord::DETECT);
 
         // Solve armor positions
         std::vector<AimingSolver::ArmorInfo> armors;
@@ -201,8 +294,8 @@ void Executor::runStreamingDetection(InputSource *source) {
                                              cv::norm(detectedArmor.points[2] - detectedArmor.points[3]));
             if (positionCalculator_->solve(detectedArmor.points,
                                            detectedArmor.largeArmor,
-                                           params.manual_pnp_rect_max_height().enabled() &&
-                                           (longLightLength < params.manual_pnp_rect_max_height().val()),
+                                           frameParams.manual_pnp_rect_max_height().enabled() &&
+                                           (longLightLength < frameParams.manual_pnp_rect_max_height().val()),
                                            offset)) {
                 armors.emplace_back(AimingSolver::ArmorInfo{
                         detectedArmor.points,
@@ -215,11 +308,14 @@ void Executor::runStreamingDetection(InputSource *source) {
             }
         }
 
+        endStage(TelemetryRecord::SOLVE);
+
         // Update
         aimingSolver_->updateArmors(armors, frameTime);
 
         AimingSolver::ControlCommand command;
-        if (serial_ && aimingSolver_->getControlCommand(command)) {
+        bool hasCommand = (serial_ || telemetry_) && aimingSolver_->getControlCommand(command);
+        if (serial_ && hasCommand) {
             // Send control command
             serial_->sendControlCommand(
                     command.detected,
@@ -234,18 +330,28 @@ void Executor::runStreamingDetection(InputSource *source) {
                     command.remainingTimeToTarget,
                     command.period);
         }
+        endStage(TelemetryRecord::AIM);
 
-        // Assign (no copying for cv::Mat) results all at once, if the result is not being processed
+        if (telemetry_) sendTelemetry(frameTime, armors, hasCommand ? &command : nullptr, stageMicros);
+
+        // Assign results all at once, if the result is not being processed
         if (outputMutex.try_lock()) {
-            originalOutput = detector_->imgOriginal;
-            brightnessOutput = detector_->imgBrightness;
-            colorOutput = detector_->imgColor;
-            lightsImageOutput = detector_->imgLights;
+            frameTimeOutput = frameTime;
+
+            // Images of a tracked detection are not made, so they stay due for the next frame
+            if (imageMask && detector_->takeImages(brightnessOutput, colorOutput, lightsImageOutput)) {
+                // The input source may load the next frames into the buffer of this one
+                originalOutput = (imageMask & ORIGINAL_OUTPUT) ? img.clone() : cv::Mat();
+                imageFrameTimeOutput = frameTime;
+                lastImageOutputTime = TimeBase::now();
+            }
+
             lightRectsOutput = detector_->lightRects;
             armorsOutput = armors;
             tkTriggeredOutput = aimingSolver_->topKiller.triggered;
             tkPulsesOutput = aimingSolver_->topKiller.pulses;
             tkPeriodOutput = aimingSolver_->topKiller.period;
+            paramsVersionOutput = latchedParams->version;
 
             outputMutex.unlock();
         }
@@ -264,10 +370,53 @@ void Executor::runStreamingDetection(InputSource *source) {
     }
 }
 
+void Executor::sendTelemetry(TimePoint frameTime, const std::vector<AimingSolver::ArmorInfo> &armors,
+                             const AimingSolver::ControlCommand *command, const uint32_t stageMicros[]) {
+    auto &r = telemetryRecord;
+
+    r.frameTime = frameTime;
+    r.flags = TelemetryRecord::NONE;
+    r.yawDelta = r.pitchDelta = r.distance = 0;
+    r.remainingTimeToTarget = 0;
+    r.paramsVersion = (uint16_t) latchedParams->version;
+    if (command) {
+        if (command->detected) r.flags |= TelemetryRecord::DETECTED;
+        if (command->topKillerTriggered) r.flags |= TelemetryRecord::TOP_KILLER_TRIGGERED;
+        r.yawDelta = command->yawDelta;
+        r.pitchDelta = command->pitchDelta;
+        r.distance = command->dist;
+        r.remainingTimeToTarget = (uint16_t) std::clamp(command->remainingTimeToTarget, 0, 0xFFFF);
+    }
+    r.tkPulseCount = (uint8_t) std::min(aimingSolver_->topKiller.pulses.size(), (size_t) 0xFF);
+    r.tkPeriod = (uint16_t) std::min(aimingSolver_->topKiller.period / 10, (TimePoint) 0xFFFF);  // [0.1ms] to [ms]
+
+    r.armorCount = (uint8_t) std::min(armors.size(), (size_t) TelemetryRecord::MAX_ARMORS);
+    for (int i = 0; i < r.armorCount; i++) {
+        const auto &armor = armors[i];
+        auto &a = r.armors[i];
+        a.imageX = (int16_t) armor.imgCenter.x;
+        a.imageY = (int16_t) armor.imgCenter.y;
+        a.yaw = armor.ypd.x;
+        a.pitch = armor.ypd.y;
+        a.distance = armor.ypd.z;
+        a.number = (uint8_t) armor.number;
+        a.large = armor.largeArmor;
+        a.selected = (armor.flags & AimingSolver::ArmorInfo::SELECTED_TARGET) != 0;
+        a.reserved = 0;
+    }
+
+    for (int s = 0; s < TelemetryRecord::LATENCY; s++) r.stageMicros[s] = stageMicros[s];
+    r.stageMicros[TelemetryRecord::LATENCY] = (uint32_t) ((TimeBase::now() - frameTime) * 100);  // [0.1ms] to [us]
+
+    telemetry_->send(r);
+}
+
 void Executor::reloadLists() {
     imageSet_->reloadImageSetList();
     videoSet_->reloadVideoList();
+    if (paramsInitialized) calibrationStore.reload();  // otherwise just loaded by the store
     paramSetManager_->reloadParamSetList();  // switch to default parameter set
+    classifierLoadAttempted = false;
     applyParams(paramSetManager_->loadCurrentParamSet());
 }
 
@@ -318,6 +467,14 @@ std::string Executor::startRecordToVideo() {
     return filename;
 }
 
+void Executor::setImageOutputs(unsigned imageMask, double fps) {
+    assert(fps > 0 && "Image output rate should be positive");
+    imageOutputMask = imageMask;
+    if (fps > 0) {  // otherwise the previous rate is kept, also for NaN
+        imageOutputPeriod = (TimePoint) std::min(10000 / fps, 1e9);  // [0.1ms], bounded for the cast
+    }
+}
+
 bool Executor::hasOutputs() {
     if (curAction == SINGLE_IMAGE_DETECTION) {
         curAction = NONE;  // reset
@@ -328,30 +485,59 @@ bool Executor::hasOutputs() {
     return false;
 }
 
-void Executor::fetchOutputs(cv::Mat &originalImage, cv::Mat &brightnessImage, cv::Mat &colorImage,
-                            cv::Mat &lightsImage, std::vector<cv::RotatedRect> &lightRects,
-                            std::vector<AimingSolver::ArmorInfo> &armors,
-                            bool &tkTriggered, std::deque<AimingSolver::PulseInfo> &tkPulses, TimePoint &tkPeriod) {
+TimePoint Executor::fetchOutputs(cv::Mat &originalImage, cv::Mat &brightnessImage, cv::Mat &colorImage,
+                                 cv::Mat &lightsImage, TimePoint &imageFrameTime,
+                                 std::vector<cv::RotatedRect> &lightRects,
+                                 std::vector<AimingSolver::ArmorInfo> &armors,
+                                 bool &tkTriggered, std::deque<AimingSolver::PulseInfo> &tkPulses, TimePoint &tkPeriod,
+                                 uint32_t &paramsVersion) {
     if (curAction != NONE) {
+        TimePoint frameTime;
         outputMutex.lock();
         {
+            frameTime = frameTimeOutput;
             originalImage = originalOutput;
             brightnessImage = brightnessOutput;
             colorImage = colorOutput;
             lightsImage = lightsImageOutput;
+            imageFrameTime = imageFrameTimeOutput;
             lightRects = lightRectsOutput;
             armors = armorsOutput;
             tkTriggered = tkTriggeredOutput;
             tkPulses = tkPulsesOutput;
             tkPeriod = tkPeriodOutput;
+            paramsVersion = paramsVersionOutput;
         }
         outputMutex.unlock();
+        return frameTime;
 
     } else {
+        paramsVersion = 0;
         if (camera_ && camera_->isRecordingVideo()) {
             originalImage = camera_->getFrame();
+            return imageFrameTime = camera_->getFrameCaptureTime();
         }
+        return imageFrameTime = 0;
     }
 }
 
-}
\ No newline at end of file
+TimePoint Executor::fetchImageOutputs(cv::Mat &originalImage, cv::Mat &brightnessImage, cv::Mat &colorImage,
+                                      cv::Mat &lightsImage) {
+    if (curAction != NONE) {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        originalImage = originalOutput;
+        brightnessImage = brightnessOutput;
+        colorImage = colorOutput;
+        lightsImage = lightsImageOutput;
+        return imageFrameTimeOutput;
+
+    } else {
+        if (camera_ && camera_->isRecordingVideo()) {
+            originalImage = camera_->getFrame();
+            return camera_->getFrameCaptureTime();
+        }
+        return 0;
+    }
+}
+
+}
@@ -0,0 +1,68 @@
+#include "GimbalHistory.h"
+
+namespace meta {
+
+void GimbalHistory::push(const Attitude &attitude) {
+    uint64_t index = writeCount.load(std::memory_order_relaxed);
+    Slot &slot = slots[index % CAPACITY];
+
+    slot.seq.store(2 * index + 1, std::memory_order_relaxed);  // mark as being written
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.time.store(attitude.time, std::memory_order_relaxed);
+    slot.yaw.store(attitude.yaw, std::memory_order_relaxed);
+    slot.pitch.store(attitude.pitch, std::memory_order_relaxed);
+
+    slot.seq.store(2 * (index + 1), std::memory_order_release);  // complete
+    writeCount.store(index + 1, std::memory_order_release);
+}
+
+bool GimbalHistory::readSlot(uint64_t index, Attitude &attitude) const {
+    const Slot &slot = slots[index % CAPACITY];
+
+    uint64_t seq0 = slot.seq.load(std::memory_order_acquire);
+    if (seq0 != 2 * (index + 1)) return false;  // being written, or already holding another entry
+
+    attitude.time = slot.time.load(std::memory_order_relaxed);
+    attitude.yaw = slot.yaw.load(std::memory_order_relaxed);
+    attitude.pitch = slot.pitch.load(std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot.seq.load(std::memory_order_relaxed) == seq0;  // not overwritten during copying
+}
+
+bool GimbalHistory::getLatest(Attitude &attitude) const {
+    uint64_t count = writeCount.load(std::memory_order_acquire);
+    if (count == 0) return false;
+    return readSlot(count - 1, attitude);
+}
+
+bool GimbalHistory::interpolate(TimePoint time, Attitude &attitude) const {
+    uint64_t count = writeCount.load(std::memory_order_acquire);
+    if (count == 0) return false;
+
+    // Walk backward from the latest sample. Frames are usually only a few milliseconds old, so this ends quickly.
+    uint64_t oldest = (count > CAPACITY ? count - CAPACITY : 0);
+    Attitude newer{}, older{};
+    for (uint64_t i = count; i-- > oldest;) {
+        if (!readSlot(i, older)) return false;  // overwritten by the producer, too old
+
+        if (older.time <= time) {
+            if (i == count - 1 || newer.time == older.time) {
+                attitude = older;  // newer than the latest sample, hold it
+            } else {
+                float t = (float) (time - older.time) / (float) (newer.time - older.time);
+                attitude.yaw = older.yaw + (newer.yaw - older.yaw) * t;
+                attitude.pitch = older.pitch + (newer.pitch - older.pitch) * t;
+            }
+            attitude.time = time;
+            return true;
+        }
+
+        newer = older;
+    }
+
+    return false;  // older than the whole history
+}
+
+}
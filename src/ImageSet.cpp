@@ -3,9 +3,11 @@
 //
 
 #include "ImageSet.h"
+#include "TimeBase.h"
 #include "Utilities.h"
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
 #include <opencv2/imgproc/imgproc.hpp>
 
 namespace meta {
@@ -74,7 +76,7 @@ bool ImageSet::openSingleImage(const std::string &imageName, const ParamSet &par
 
     // Load the image to the latest buffer
     buffer[lastBuffer] = img;
-    bufferCaptureTime[lastBuffer] = 1;
+    bufferCaptureTime[lastBuffer] = TimeBase::now();
 
     if (th) close();
     th = nullptr;  // do not start thread and clear the pointer for fetchNextFrame
@@ -110,6 +112,10 @@ void ImageSet::loadFrameFromImageSet(const ParamSet &params) {
     shouldFetchNextFrame = true;
 
     auto it = imageMats.begin();  // next frame iterator
+
+    // Images carry no timestamp. Space them at the nominal frame rate, starting from now on the unified clock.
+    TimePoint frameTime = TimeBase::now();
+    const TimePoint frameInterval = 10000 / std::max(params.fps(), 1);
     while (true) {
 
         while (!shouldFetchNextFrame && !threadShouldExit) std::this_thread::yield();
@@ -127,7 +133,8 @@ void ImageSet::loadFrameFromImageSet(const ParamSet &params) {
         ++it;
 
         // Increment frame time
-        bufferCaptureTime[workingBuffer] = bufferCaptureTime[lastBuffer] + 1;
+        bufferCaptureTime[workingBuffer] = frameTime;
+        frameTime += frameInterval;
 
         // Switch
         lastBuffer = workingBuffer;
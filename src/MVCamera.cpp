@@ -3,6 +3,7 @@
 //
 
 #include "Camera.h"
+#include <cstring>
 #include <iostream>
 #include <opencv2/imgproc/imgproc.hpp>
 #include "Utilities.h"
@@ -13,6 +14,10 @@ bool MVCamera::open(const package::ParamSet &params) {
 
     this->params = params;
 
+    // The sensor clock restarts with the camera
+    sensorClock.reset();
+    sensorTimeReceived = false;
+
     capInfoSS.str(std::string());  // clear capInfoSS
 
     // CameraSdkInit should be called outside
@@ -36,6 +41,8 @@ bool MVCamera::open(const package::ParamSet &params) {
         return false;
     }
 
+    serialNumber = std::string(cameraEnumList.acSn, strnlen(cameraEnumList.acSn, sizeof(cameraEnumList.acSn)));
+
     TRY_CALL(CameraInit, &cameraEnumList, -1, -1, &hCamera);
     TRY_CALL(CameraGetCapability, hCamera, &capability);
 
@@ -125,6 +132,16 @@ void MVCamera::newFrameCallback(CameraHandle hCamera, BYTE *pFrameBuffer, tSdkFr
 
     p->cumulativeFrameCounter++;  // count frame even if it's not processed
 
+    // Feed every frame to the clock estimation, even if it's not processed
+    TimePoint recvTime = TimeBase::now();
+    if (!p->sensorTimeReceived) {
+        p->lastSensorTime = pFrameHead->uiTimeStamp;
+        p->sensorTimeReceived = true;
+    } else {
+        p->lastSensorTime = TimeBase::unwrap(p->lastSensorTime, (uint32_t) pFrameHead->uiTimeStamp);
+    }
+    p->sensorClock.addOneWay(p->lastSensorTime, recvTime);
+
     if (!p->shouldFetchNextFrame) {  // do not process if not required
 
         CameraReleaseImageBuffer(hCamera, pFrameBuffer);
@@ -155,7 +172,7 @@ void MVCamera::newFrameCallback(CameraHandle hCamera, BYTE *pFrameBuffer, tSdkFr
             p->videoWriterMutex.unlock();
         }
 
-        p->bufferCaptureTime[workingBuffer] = frameInfo.uiTimeStamp;
+        p->bufferCaptureTime[workingBuffer] = p->sensorClock.toHost(p->lastSensorTime);
 
         // Switch frame
         p->lastBuffer = workingBuffer;
@@ -0,0 +1,230 @@
+#include "MaskCodec.h"
+#include <cstring>
+
+namespace meta {
+
+namespace {
+
+void emplaceVarint(std::vector<uint8_t> &out, size_t v) {
+    while (v >= 0x80) {
+        out.emplace_back((uint8_t) (v | 0x80));
+        v >>= 7;
+    }
+    out.emplace_back((uint8_t) v);
+}
+
+bool readVarint(const uint8_t *&p, const uint8_t *end, size_t &v) {
+    v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t b = *p++;
+        v |= (size_t) (b & 0x7F) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;  // truncated or too long
+}
+
+void emplaceUInt16(std::vector<uint8_t> &out, uint16_t n) {
+    out.emplace_back((uint8_t) (n & 0xFF));
+    out.emplace_back((uint8_t) (n >> 8));
+}
+
+void emplaceUInt32(std::vector<uint8_t> &out, uint32_t n) {
+    for (int i = 0; i < 4; i++) out.emplace_back((uint8_t) ((n >> (8 * i)) & 0xFF));
+}
+
+uint16_t decodeUInt16(const uint8_t *p) { return (uint16_t) (p[0] | (p[1] << 8)); }
+
+uint32_t decodeUInt32(const uint8_t *p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/**
+ * Append the run lengths of a plane of 0 and 1.
+ * @return False if the runs become larger than the limit.
+ */
+bool emplaceRuns(const uint8_t *p, size_t pixels, std::vector<uint8_t> &out, size_t limit) {
+    static constexpr uint64_t ONES = 0x0101010101010101ULL;
+
+    size_t i = 0;
+    uint8_t cur = 0;
+    while (true) {
+        size_t start = i;
+
+        // Skip 8 pixels at a time in long runs, which are most of a mask
+        uint64_t pattern = cur ? ONES : 0;
+        while (i + 8 <= pixels) {
+            uint64_t word;
+            std::memcpy(&word, p + i, 8);
+            if (word != pattern) break;
+            i += 8;
+        }
+        while (i < pixels && p[i] == cur) i++;
+
+        if (i == pixels) return true;  // the last run is implicit
+        emplaceVarint(out, i - start);
+        if (out.size() > limit) return false;
+        cur ^= 1;
+    }
+}
+
+void emplacePackedBits(const uint8_t *p, size_t pixels, std::vector<uint8_t> &out) {
+    size_t offset = out.size();
+    out.resize(offset + (pixels + 7) / 8);
+    uint8_t *q = out.data() + offset;
+    size_t i = 0;
+    for (; i + 8 <= pixels; i += 8) {
+        *q++ = (uint8_t) ((p[i] << 7) | (p[i + 1] << 6) | (p[i + 2] << 5) | (p[i + 3] << 4) |
+                          (p[i + 4] << 3) | (p[i + 5] << 2) | (p[i + 6] << 1) | p[i + 7]);
+    }
+    if (i < pixels) {
+        uint8_t b = 0;
+        for (int bit = 7; i < pixels; i++, bit--) b |= (uint8_t) (p[i] << bit);
+        *q = b;
+    }
+}
+
+}
+
+void MaskEncoder::encode(const uint8_t *data, int width, int height, size_t step, std::vector<uint8_t> &out) {
+    if (shouldReset.exchange(false)) {
+        for (auto &keyFrame : keyFrames) keyFrame.id = 0;
+        framesSinceKeyFrame = 0;
+    }
+
+    uint32_t id = nextFrameID++;
+    if (nextFrameID == 0) nextFrameID = 1;  // 0 means no key frame in the header
+
+    // The delivered key frame for delta, if there is one and it is not too old
+    const KeyFrame *base = nullptr;
+    uint32_t delivered = deliveredKeyFrameID;
+    if (keyFrameInterval > 0 && framesSinceKeyFrame < keyFrameInterval && delivered != 0) {
+        for (const auto &keyFrame : keyFrames) {
+            if (keyFrame.id == delivered && keyFrame.width == width && keyFrame.height == height) {
+                base = &keyFrame;
+            }
+        }
+    }
+
+    // Normalize to 0 or 1, continuous without padding
+    size_t pixels = (size_t) width * height;
+    plane.resize(pixels);
+    for (int r = 0; r < height; r++) {
+        const uint8_t *row = data + r * step;
+        uint8_t *dst = plane.data() + (size_t) r * width;
+        for (int c = 0; c < width; c++) dst[c] = (uint8_t) (row[c] != 0);
+    }
+
+    // As a key frame: runs, or packed bits if runs turn out to be larger
+    size_t packedSize = (pixels + 7) / 8;
+    encodePayload(plane.data(), pixels, 0, id, 0, width, height, out, MASK_HEADER_SIZE + packedSize);
+
+    // As a delta frame, kept if smaller. A moving mask has more edges in the XOR than in itself.
+    if (base) {
+        deltaPlane.resize(pixels);
+        for (size_t i = 0; i < pixels; i++) deltaPlane[i] = plane[i] ^ base->plane[i];
+        if (encodePayload(deltaPlane.data(), pixels, MASK_DELTA, id, base->id, width, height, deltaOut,
+                          out.size() - 1)) {
+            out.swap(deltaOut);
+            framesSinceKeyFrame++;
+            return;
+        }
+    }
+
+    auto &slot = keyFrames[nextKeyFrameSlot];
+    nextKeyFrameSlot ^= 1;
+    slot.id = id;
+    slot.width = width;
+    slot.height = height;
+    slot.plane.swap(plane);  // keep both capacities
+    framesSinceKeyFrame = 0;
+}
+
+bool MaskEncoder::encodePayload(const uint8_t *p, size_t pixels, uint8_t flags, uint32_t id, uint32_t baseID,
+                                int width, int height, std::vector<uint8_t> &out, size_t limit) {
+    out.clear();
+    out.emplace_back(flags);
+    emplaceUInt16(out, (uint16_t) width);
+    emplaceUInt16(out, (uint16_t) height);
+    emplaceUInt32(out, id);
+    emplaceUInt32(out, baseID);
+
+    if (emplaceRuns(p, pixels, out, limit)) return true;
+
+    size_t packedSize = (pixels + 7) / 8;
+    if (MASK_HEADER_SIZE + packedSize > limit) return false;
+    out.resize(MASK_HEADER_SIZE);
+    out[0] |= MASK_PACKED_BITS;
+    emplacePackedBits(p, pixels, out);
+    return true;
+}
+
+void MaskEncoder::markDelivered(const uint8_t *encoded, size_t size) {
+    if (!isMaskKeyFrame(encoded, size)) return;
+    deliveredKeyFrameID = decodeUInt32(encoded + 5);
+}
+
+void MaskEncoder::reset() {
+    deliveredKeyFrameID = 0;
+    shouldReset = true;  // the key frames are cleared by the next encode()
+}
+
+bool MaskDecoder::decode(const uint8_t *encoded, size_t size, std::vector<uint8_t> &out, int &width, int &height) {
+    if (size < MASK_HEADER_SIZE) return false;
+
+    uint8_t flags = encoded[0];
+    int w = decodeUInt16(encoded + 1);
+    int h = decodeUInt16(encoded + 3);
+    uint32_t id = decodeUInt32(encoded + 5);
+    uint32_t baseID = decodeUInt32(encoded + 9);
+
+    const KeyFrame *base = nullptr;
+    if (flags & MASK_DELTA) {
+        for (const auto &keyFrame : keyFrames) {
+            if (keyFrame.id == baseID && keyFrame.width == w && keyFrame.height == h) base = &keyFrame;
+        }
+        if (!base) return false;  // key frame missed
+    }
+
+    size_t pixels = (size_t) w * h;
+    out.resize(pixels);
+    const uint8_t *p = encoded + MASK_HEADER_SIZE, *end = encoded + size;
+
+    if (flags & MASK_PACKED_BITS) {
+        if ((size_t) (end - p) < (pixels + 7) / 8) return false;
+        for (size_t i = 0; i < pixels; i++) {
+            out[i] = (p[i / 8] >> (7 - i % 8)) & 1 ? 255 : 0;
+        }
+    } else {
+        size_t pos = 0;
+        uint8_t cur = 0;
+        while (p < end) {
+            size_t run;
+            if (!readVarint(p, end, run) || run > pixels - pos) return false;
+            std::memset(out.data() + pos, cur, run);
+            pos += run;
+            cur ^= 255;
+        }
+        std::memset(out.data() + pos, cur, pixels - pos);  // the last run
+    }
+
+    if (base) {
+        for (size_t i = 0; i < pixels; i++) out[i] ^= base->pixels[i];
+    } else {
+        auto &slot = keyFrames[nextKeyFrameSlot];
+        nextKeyFrameSlot ^= 1;
+        slot.id = id;
+        slot.width = w;
+        slot.height = h;
+        slot.pixels = out;
+    }
+
+    width = w;
+    height = h;
+    return true;
+}
+
+void MaskDecoder::reset() {
+    for (auto &keyFrame : keyFrames) keyFrame.id = 0;
+}
+
+}
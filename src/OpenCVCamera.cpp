@@ -109,6 +109,8 @@ void OpenCVCamera::readFrameFromCamera(const package::ParamSet &params) {
         if (!cap.read(buffer[workingBuffer])) {
             continue;  // try again
         }
+        // CAP_PROP_POS_MSEC is not reliable for live cameras, use the time the frame is read
+        TimePoint readTime = TimeBase::now();
 
         // Software crop
         buffer[workingBuffer] = buffer[workingBuffer](cv::Rect{
@@ -126,7 +128,7 @@ void OpenCVCamera::readFrameFromCamera(const package::ParamSet &params) {
             videoWriterMutex.unlock();
         }
 
-        bufferCaptureTime[workingBuffer] = (TimePoint) (cap.get(cv::CAP_PROP_POS_MSEC) * 10);
+        bufferCaptureTime[workingBuffer] = readTime;
 
         lastBuffer = workingBuffer;
 
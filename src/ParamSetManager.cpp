@@ -57,6 +57,8 @@ void ParamSetManager::reloadParamSetList() {
 
         params.set_allocated_contour_open(allocToggledInt(true, 3));
         params.set_allocated_contour_close(allocToggledInt(true, 3));
+        params.set_allocated_coarse_detection_level(allocToggledInt(false, 1));
+        params.set_allocated_armor_tracking(allocToggledInt(false, 10));
         params.set_contour_fit_function(ParamSet::ELLIPSE);
         params.set_allocated_contour_pixel_count(allocToggledFloat(true, 15));
         params.set_allocated_contour_min_area(allocToggledFloat(false, 3));
@@ -70,6 +72,8 @@ void ParamSetManager::reloadParamSetList() {
         params.set_allocated_light_angle_max_diff(allocToggledFloat(true, 10));
         params.set_allocated_small_armor_aspect_ratio(allocFloatRange(1.25, 2));
         params.set_allocated_large_armor_aspect_ratio(allocFloatRange(2, 5));
+        params.set_allocated_corner_refinement(allocToggledInt(false, 4));
+        params.set_allocated_armor_number_min_confidence(allocToggledFloat(false, 0.7));
         params.set_allocated_manual_pnp_rect_max_height(allocToggledInt(false, 50));
 
         params.set_allocated_small_armor_size(allocIntPair(120, 60));
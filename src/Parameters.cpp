@@ -0,0 +1,71 @@
+#include "Parameters.h"
+#include <google/protobuf/util/message_differencer.h>
+#include <algorithm>
+
+namespace meta {
+
+using google::protobuf::FieldDescriptor;
+
+// Compare a top-level field of two ParamSets
+static bool fieldEquals(const ParamSet &a, const ParamSet &b, const FieldDescriptor *field) {
+    if (field->is_repeated()) return false;  // all fields of ParamSet are required (see Parameters.proto)
+
+    auto reflection = ParamSet::GetReflection();
+    if (reflection->HasField(a, field) != reflection->HasField(b, field)) return false;
+    switch (field->cpp_type()) {
+#define COMPARE(CPPTYPE, Type) \
+        case FieldDescriptor::CPPTYPE: return reflection->Get##Type(a, field) == reflection->Get##Type(b, field);
+        COMPARE(CPPTYPE_INT32, Int32)
+        COMPARE(CPPTYPE_INT64, Int64)
+        COMPARE(CPPTYPE_UINT32, UInt32)
+        COMPARE(CPPTYPE_UINT64, UInt64)
+        COMPARE(CPPTYPE_DOUBLE, Double)
+        COMPARE(CPPTYPE_FLOAT, Float)
+        COMPARE(CPPTYPE_BOOL, Bool)
+        COMPARE(CPPTYPE_ENUM, EnumValue)
+        COMPARE(CPPTYPE_STRING, String)
+#undef COMPARE
+        case FieldDescriptor::CPPTYPE_MESSAGE:
+            return google::protobuf::util::MessageDifferencer::Equals(reflection->GetMessage(a, field),
+                                                                      reflection->GetMessage(b, field));
+    }
+    return false;
+}
+
+ParamSetDiff::ParamSetDiff(const ParamSet &from, const ParamSet &to) {
+    auto descriptor = ParamSet::GetDescriptor();
+    for (int i = 0; i < descriptor->field_count(); i++) {
+        auto field = descriptor->field(i);
+        if (!fieldEquals(from, to, field)) fields.emplace_back(field->number());
+    }
+    std::sort(fields.begin(), fields.end());
+}
+
+ParamSetDiff ParamSetDiff::all() {
+    ParamSetDiff ret;
+    auto descriptor = ParamSet::GetDescriptor();
+    for (int i = 0; i < descriptor->field_count(); i++) ret.fields.emplace_back(descriptor->field(i)->number());
+    std::sort(ret.fields.begin(), ret.fields.end());
+    return ret;
+}
+
+bool ParamSetDiff::changed(int fieldNumber) const {
+    return std::binary_search(fields.begin(), fields.end(), fieldNumber);
+}
+
+bool ParamSetDiff::anyChanged(std::initializer_list<int> fieldNumbers) const {
+    return std::any_of(fieldNumbers.begin(), fieldNumbers.end(), [this](int n) { return changed(n); });
+}
+
+std::string ParamSetDiff::toString() const {
+    auto descriptor = ParamSet::GetDescriptor();
+    std::string ret;
+    for (int n : fields) {
+        if (!ret.empty()) ret += " ";
+        auto field = descriptor->FindFieldByNumber(n);
+        ret += field ? field->name() : std::to_string(n);
+    }
+    return ret;
+}
+
+}
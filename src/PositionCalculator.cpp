@@ -15,6 +15,7 @@ void PositionCalculator::setParameters(cv::Point2f smallArmorSize_, cv::Point2f
     cameraMatrix = cameraMatrix_;
     distCoeffs = distCoeffs_;
     zScale = zScale_;
+    calibration = nullptr;
 
     smallArmorObjectPoints = {{-smallArmorSize.x / 2, smallArmorSize.y / 2,  0},
                               {-smallArmorSize.x / 2, -smallArmorSize.y / 2, 0},
@@ -36,8 +37,20 @@ void PositionCalculator::setParameters(cv::Point2f smallArmorSize_, cv::Point2f
 
 }
 
+void PositionCalculator::setParameters(cv::Point2f smallArmorSize_, cv::Point2f largeArmorSize_,
+                                       std::shared_ptr<const Calibration> calibration_) {
+    if (calibration_) {
+        setParameters(smallArmorSize_, largeArmorSize_,
+                      calibration_->cameraMatrix, calibration_->distCoeffs, calibration_->zScale);
+    } else {
+        setParameters(smallArmorSize_, largeArmorSize_, cv::Mat(), cv::Mat(), 1);
+    }
+    calibration = std::move(calibration_);
+}
+
 bool PositionCalculator::solve(const std::array<cv::Point2f, 4> &imagePoints, bool largeArmor, bool manualImagePoints,
                                cv::Point3f &offset) const {
+    if (cameraMatrix.empty()) return false;
 
     cv::Mat rVec = cv::Mat::zeros(3, 1, CV_64FC1);
     cv::Mat tVec = cv::Mat::zeros(3, 1, CV_64FC1);
@@ -56,8 +69,15 @@ bool PositionCalculator::solve(const std::array<cv::Point2f, 4> &imagePoints, bo
                   cv::Point2f{center.x + width / 2, center.y + height / 2}};
     }
 
-    cv::solvePnP((largeArmor ? largeArmorObjectPoints : smallArmorObjectPoints), points,
-                 cameraMatrix, distCoeffs, rVec, tVec, false, cv::SOLVEPNP_ITERATIVE);
+    if (calibration) {
+        // Undistorted by the precomputed grid instead of in every iteration of solvePnP
+        for (auto &point : points) point = calibration->undistortPoint(point);
+        cv::solvePnP((largeArmor ? largeArmorObjectPoints : smallArmorObjectPoints), points,
+                     cameraMatrix, cv::noArray(), rVec, tVec, false, cv::SOLVEPNP_ITERATIVE);
+    } else {
+        cv::solvePnP((largeArmor ? largeArmorObjectPoints : smallArmorObjectPoints), points,
+                     cameraMatrix, distCoeffs, rVec, tVec, false, cv::SOLVEPNP_ITERATIVE);
+    }
 
     offset = {static_cast<float>(tVec.at<double>(0, 0)),
               static_cast<float>(tVec.at<double>(1, 0)),
@@ -0,0 +1,221 @@
+#include "PreviewEncoder.h"
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <algorithm>
+#include <cassert>
+
+namespace meta {
+
+using std::chrono::steady_clock;
+
+PreviewEncoder::PreviewEncoder(ImageSource source, int previewHeight, int workerCount)
+        : source(std::move(source)), previewHeight(previewHeight) {
+    workerCount = std::clamp(workerCount, 1, (int) CHANNEL_COUNT);
+    for (int i = 0; i < workerCount; i++) {
+        workers.emplace_back(&PreviewEncoder::runWorker, this, i, workerCount);
+    }
+}
+
+PreviewEncoder::~PreviewEncoder() {
+    {
+        std::lock_guard<std::mutex> lock(workerMutex);
+        workerShouldExit = true;
+    }
+    workerCV.notify_all();
+    for (auto &worker : workers) worker.join();
+}
+
+void PreviewEncoder::setSubscription(unsigned channelMask) {
+    unsigned previous = subscription.exchange(channelMask);
+    if (previous == channelMask) return;
+
+    for (int c = 0; c < CHANNEL_COUNT; c++) {
+        if (!(channelMask & (1U << c))) {
+            channels[c].maskEncoder.reset();
+            std::lock_guard<std::mutex> lock(channels[c].latestMutex);
+            channels[c].latest = EncodedImage();
+            channels[c].latestFrameID = 0;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(workerMutex);  // avoid missing the notification
+    }
+    workerCV.notify_all();
+}
+
+void PreviewEncoder::restartMasks() {
+    for (int c = 0; c < CHANNEL_COUNT; c++) {
+        if (!isMaskChannel((Channel) c)) continue;
+        std::lock_guard<std::mutex> encodeLock(channels[c].encodeMutex);  // wait for the encoding in progress
+        channels[c].maskEncoder.reset();
+        std::lock_guard<std::mutex> lock(channels[c].latestMutex);
+        channels[c].latest = EncodedImage();  // may be a delta, encoded before the reset
+        channels[c].latestFrameID = 0;
+    }
+}
+
+void PreviewEncoder::setRate(double fps) {
+    assert(fps > 0 && "Rate should be positive");
+    if (!(fps > 0)) return;  // keep the previous rate, also for NaN
+    period = 1.0 / fps;
+    workerCV.notify_all();
+}
+
+void PreviewEncoder::setCPUShare(double share) {
+    cpuShare = std::clamp(share, 0.01, 1.0);
+    workerCV.notify_all();
+}
+
+PreviewEncoder::EncodedImage PreviewEncoder::fetch(Channel channel, const cv::Mat &current, uint64_t frameID) {
+    auto &ch = channels[channel];
+
+    // An image encoded by the worker within two periods is recent enough for preview
+    auto staleness = std::chrono::duration_cast<steady_clock::duration>(std::chrono::duration<double>(2 * period));
+    auto isRecent = [&] {
+        return ch.latest.data &&
+               (ch.latestFrameID == frameID || steady_clock::now() - ch.latestEncodeTime <= staleness);
+    };
+    auto deliver = [&](EncodedImage image) {
+        if (image.binary) ch.maskEncoder.markDelivered(image.data->data(), image.data->size());
+        return image;
+    };
+
+    {
+        std::lock_guard<std::mutex> lock(ch.latestMutex);
+        if (isRecent()) return deliver(ch.latest);
+    }
+    if (current.empty()) return EncodedImage();
+
+    // Encode in the calling thread, unless the worker finishes it in the meantime
+    std::lock_guard<std::mutex> encodeLock(ch.encodeMutex);
+    {
+        std::lock_guard<std::mutex> lock(ch.latestMutex);
+        if (isRecent()) return deliver(ch.latest);
+    }
+    encodeChannel(channel, current, frameID);
+
+    std::lock_guard<std::mutex> lock(ch.latestMutex);
+    return deliver(ch.latest);
+}
+
+void PreviewEncoder::encode(const cv::Mat &image, int height, int quality, cv::Mat &resized,
+                            std::vector<uint8_t> &buf) {
+    if (image.empty()) {
+        buf.clear();
+        return;
+    }
+    double ratio = (double) height / (double) image.rows;
+    cv::resize(image, resized, cv::Size(), ratio, ratio);
+    cv::imencode(".jpg", resized, buf, {cv::IMWRITE_JPEG_QUALITY, quality});
+}
+
+void PreviewEncoder::encodeChannel(Channel channel, const cv::Mat &image, uint64_t frameID) {
+    auto &ch = channels[channel];
+    std::shared_ptr<std::vector<uint8_t>> buf;
+    bool binary = isMaskChannel(channel) && image.type() == CV_8UC1;
+    if (!image.empty()) {
+        // Reuse a buffer that is held by nobody else (neither as the latest image nor by a pending send)
+        for (const auto &b : ch.bufferPool) {
+            if (b.use_count() == 1) {
+                buf = b;
+                break;
+            }
+        }
+        if (!buf) {
+            buf = std::make_shared<std::vector<uint8_t>>();
+            if (ch.bufferPool.size() < BUFFERS_PER_CHANNEL) ch.bufferPool.emplace_back(buf);
+        }
+        if (binary) {
+            ch.maskEncoder.encode(image.data, image.cols, image.rows, image.step, *buf);
+        } else {
+            encode(image, previewHeight, jpegQuality, ch.resized, *buf);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(ch.latestMutex);
+    ch.latest = {std::move(buf), binary};
+    ch.latestFrameID = frameID;
+    ch.latestEncodeTime = steady_clock::now();
+}
+
+void PreviewEncoder::runWorker(int index, int workerCount) {
+    unsigned workerMask = 0;
+    for (int c = index; c < CHANNEL_COUNT; c += workerCount) workerMask |= 1U << c;
+
+    Images images;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(workerMutex);
+            workerCV.wait(lock, [&] { return workerShouldExit || (subscription & workerMask); });
+            if (workerShouldExit) break;
+        }
+
+        auto start = steady_clock::now();
+
+        uint64_t frameID = source(images);
+        unsigned mask = subscription & workerMask;
+        if (frameID != 0) {
+            for (int c = 0; c < CHANNEL_COUNT; c++) {
+                if (!(mask & (1U << c))) continue;
+                auto &ch = channels[c];
+                {
+                    std::lock_guard<std::mutex> lock(ch.latestMutex);
+                    if (ch.latest.data && ch.latestFrameID == frameID) continue;  // no new frame
+                }
+                std::lock_guard<std::mutex> encodeLock(ch.encodeMutex);
+                encodeChannel((Channel) c, images[c], frameID);
+            }
+        }
+        for (auto &image : images) image.release();  // do not hold the frames while sleeping
+
+        // Sleep for the rest of the period, or longer to keep the CPU share
+        double busy = std::chrono::duration<double>(steady_clock::now() - start).count();
+        double cycle = std::max(period.load(), busy / cpuShare);
+        {
+            std::unique_lock<std::mutex> lock(workerMutex);
+            workerCV.wait_for(lock, std::chrono::duration<double>(cycle - busy), [&] { return workerShouldExit; });
+        }
+    }
+}
+
+void PreviewBudget::reset(double budget) {
+    budget_ = budget;
+    bandwidth_ = 0;
+    quality_ = maxQuality;
+    height_ = maxHeight;
+    pushesSinceAdjust = 0;
+}
+
+void PreviewBudget::update(size_t bytes, double interval) {
+    static constexpr double SMOOTHING = 0.3;
+
+    if (interval <= 0) return;
+    double rate = (double) bytes / interval;
+    bandwidth_ = (bandwidth_ == 0 ? rate : (1 - SMOOTHING) * bandwidth_ + SMOOTHING * rate);
+
+    if (budget_ <= 0 || ++pushesSinceAdjust < ADJUST_INTERVAL) return;
+
+    int minHeight = maxHeight / 4;
+    if (bandwidth_ > budget_) {
+        if (quality_ > MIN_QUALITY) {
+            quality_ = std::max(MIN_QUALITY, quality_ - QUALITY_STEP);
+        } else if (height_ > minHeight) {
+            height_ = std::max(minHeight, (int) (height_ * HEIGHT_STEP));
+        } else {
+            return;  // nothing more to reduce
+        }
+    } else if (bandwidth_ < budget_ * RESTORE_THRESHOLD) {
+        if (height_ < maxHeight) {
+            height_ = std::min(maxHeight, (int) (height_ / HEIGHT_STEP) + 1);
+        } else if (quality_ < maxQuality) {
+            quality_ = std::min(maxQuality, quality_ + QUALITY_STEP / 2);
+        } else {
+            return;  // already at full quality
+        }
+    } else {
+        return;
+    }
+    pushesSinceAdjust = 0;
+}
+
+}
@@ -5,36 +5,63 @@
 #include "Serial.h"
 #include "CRC.h"
 #include <iostream>
+#include <cstring>
 
 namespace meta {
 
 Serial::Serial(boost::asio::io_context &ioContext)
-        : ioContext(ioContext), serial(ioContext) {
+        : ioContext(ioContext), serial(ioContext), timeSyncTimer(ioContext) {}
+
+bool Serial::open(const std::string &device, int baudRate) {
+    if (serial.is_open()) close();
 
     boost::system::error_code ec;
-    // SERIAL_DEVICE defined in CMakeLists.txt
-    serial.open(SERIAL_DEVICE, ec);
+    serial.open(device, ec);
     if (ec) {
-        std::cerr << "Failed to open serial device \"" << SERIAL_DEVICE << "\": " << ec.message() << std::endl;
-        std::exit(1);
+        std::cerr << "Serial: failed to open device \"" << device << "\": " << ec.message() << std::endl;
+        return false;
     }
 
     ::tcflush(serial.lowest_layer().native_handle(), TCIOFLUSH);  // flush input and output
-    serial.set_option(boost::asio::serial_port::baud_rate(SERIAL_BAUD_RATE));
-    serial.set_option(boost::asio::serial_port::flow_control(boost::asio::serial_port::flow_control::none));
-    serial.set_option(boost::asio::serial_port_base::character_size(8));
-    serial.set_option(boost::asio::serial_port::stop_bits(boost::asio::serial_port::stop_bits::one));
-
-    // Start receiving SOF
-    boost::asio::async_read(serial,
-                            boost::asio::buffer(((uint8_t *) &recvPackage), 1),
-                            boost::asio::transfer_exactly(1),
-                            [this](auto &error, auto numBytes) { handleRecv(error, numBytes); });
+    serial.set_option(boost::asio::serial_port::baud_rate(baudRate), ec);
+    if (!ec) serial.set_option(boost::asio::serial_port::flow_control(boost::asio::serial_port::flow_control::none), ec);
+    if (!ec) serial.set_option(boost::asio::serial_port_base::character_size(8), ec);
+    if (!ec) serial.set_option(boost::asio::serial_port::stop_bits(boost::asio::serial_port::stop_bits::one), ec);
+    if (ec) {
+        std::cerr << "Serial: failed to configure device \"" << device << "\" at " << baudRate << " baud: "
+                  << ec.message() << std::endl;
+        serial.close(ec);
+        return false;
+    }
+
+    // Start receiving
+    recvBegin = recvEnd = 0;
+    startRecv();
+
+    // Start pinging the MCU for clock synchronization. The MCU may be a different one, so start over.
+    mcuClock_.reset();
+    mcuTimeReceived = false;
+    boost::asio::post(ioContext, [this] { sendTimeSyncRequest(); });
+
+    return true;
+}
+
+void Serial::close() {
+    boost::system::error_code ec;
+    timeSyncTimer.cancel();
+    serial.close(ec);  // pending operations complete with operation_aborted
+    sendQueue.clear();
+}
+
+Serial::Statistics Serial::statistics() const {
+    return {packagesSent.load(), commandsSent.load(), bytesSent.load(), packagesReceived.load(), bytesReceived.load(), crcErrors.load()};
 }
 
 bool Serial::sendControlCommand(bool detected, bool topKillerTriggered, TimePoint time, float yawDelta, float pitchDelta, float distance,
                                 float avgLightAngle, float imageX, float imageY, int remainingTimeToTarget, int period) {
 
+    if (!serial.is_open()) return false;
+
     auto pkg = std::make_shared<Package>();
 
     pkg->sof = SOF;
@@ -43,7 +70,12 @@ bool Serial::sendControlCommand(bool detected, bool topKillerTriggered, TimePoin
     pkg->command.flag = 0;
     if (detected) pkg->command.flag |= VisionCommand::DETECTED;
     if (topKillerTriggered) pkg->command.flag |= VisionCommand::TOP_KILLER_TRIGGERED;
-    pkg->command.frameTime = time;
+    if (mcuClock_.synchronized()) {
+        pkg->command.flag |= VisionCommand::TIME_SYNCHRONIZED;
+        pkg->command.frameTime = (uint16_t) mcuClock_.toRemote(time);
+    } else {
+        pkg->command.frameTime = (uint16_t) time;
+    }
     pkg->command.yawDelta = (int16_t) (-yawDelta * 100);  // notice the minus sign
     pkg->command.pitchDelta = (int16_t) (pitchDelta * 100);
     pkg->command.distance = (int16_t) distance;
@@ -54,81 +86,158 @@ bool Serial::sendControlCommand(bool detected, bool topKillerTriggered, TimePoin
     pkg->command.period = (int16_t) period;
     rm::appendCRC8CheckSum((uint8_t *) (pkg.get()), sizeof(uint8_t) * 2 + sizeof(VisionCommand) + sizeof(uint8_t));
 
-    //::tcflush(serial.lowest_layer().native_handle(), TCIFLUSH);  // clear input buffer
+    queuePackage(pkg, sizeof(uint8_t) * 2 + sizeof(VisionCommand) + sizeof(uint8_t));
+
+    return true;
+}
+
+void Serial::sendTimeSyncRequest() {
+    if (!serial.is_open()) return;
+
+    auto pkg = std::make_shared<Package>();
+
+    pkg->sof = SOF;
+    pkg->cmdID = TIME_SYNC_REQUEST_CMD_ID;
+    pkg->timeSyncRequest.hostTime = (uint32_t) TimeBase::now();
+    rm::appendCRC8CheckSum((uint8_t *) (pkg.get()), sizeof(uint8_t) * 2 + sizeof(TimeSyncRequest) + sizeof(uint8_t));
+
+    queuePackage(pkg, sizeof(uint8_t) * 2 + sizeof(TimeSyncRequest) + sizeof(uint8_t));
+
+    timeSyncTimer.expires_after(TIME_SYNC_INTERVAL);
+    timeSyncTimer.async_wait([this](const boost::system::error_code &error) {
+        if (!error) sendTimeSyncRequest();
+    });
+}
+
+void Serial::queuePackage(std::shared_ptr<Package> pkg, size_t size) {
+    boost::asio::post(ioContext, [this, pkg = std::move(pkg), size]() mutable {
+        if (!serial.is_open()) return;
+        sendQueue.emplace_back(std::move(pkg), size);
+        if (sendQueue.size() == 1) startSend();  // otherwise, it will be sent after the ones ahead
+    });
+}
+
+void Serial::startSend() {
+    const auto &front = sendQueue.front();
     boost::asio::async_write(
             serial,
-            boost::asio::buffer(pkg.get(), sizeof(uint8_t) * 2 + sizeof(VisionCommand) + sizeof(uint8_t)),
-            [this, pkg](auto &error, auto numBytes) { handleSend(pkg, error, numBytes); }
+            boost::asio::buffer(front.first.get(), front.second),
+            [this](auto &error, auto numBytes) { handleSend(error, numBytes); }
     );
-
-    return true;
 }
 
-void Serial::handleSend(std::shared_ptr<Package> buf, const boost::system::error_code &error,
-                        size_t numBytes) {
+void Serial::handleSend(const boost::system::error_code &error, size_t numBytes) {
+    if (error == boost::asio::error::operation_aborted) return;  // closed, the queue is cleared
     if (error) {
         std::cerr << "Serial: send error: " << error.message() << "\n";
+    } else {
+        ++packagesSent;
+        bytesSent += numBytes;
     }
-    ++cumulativeFrameCounter;
+    if (sendQueue.front().first->cmdID == VISION_CONTROL_CMD_ID) {
+        if (!error) ++commandsSent;
+        ++cumulativeFrameCounter;
+    }
+    sendQueue.pop_front();
+    if (!sendQueue.empty()) startSend();
+}
+
+uint64_t Serial::unwrapMCUTime(uint32_t mcuTime) {
+    if (!mcuTimeReceived) {
+        lastMCUTime = mcuTime;
+        mcuTimeReceived = true;
+    } else {
+        lastMCUTime = TimeBase::unwrap(lastMCUTime, mcuTime);
+    }
+    return lastMCUTime;
+}
+
+void Serial::startRecv() {
+    serial.async_read_some(boost::asio::buffer(recvBuffer + recvEnd, RECV_BUFFER_SIZE - recvEnd),
+                           [this](auto &error, auto numBytes) { handleRecv(error, numBytes); });
 }
 
 void Serial::handleRecv(const boost::system::error_code &error, size_t numBytes) {
 
+    if (error == boost::asio::error::operation_aborted || error == boost::asio::error::eof || !serial.is_open()) {
+        return;  // closed
+    }
     if (error) {
         std::cerr << "Serial: recv error: " << error.message() << "\n";
         // Continue to process data and start next async_recv
     }
+    bytesReceived += numBytes;
+    recvEnd += numBytes;
+
+    parseRecvBuffer();
+
+    // Move the partial package to the front. It is shorter than a package, so the copy is cheap.
+    if (recvBegin == recvEnd) {
+        recvBegin = recvEnd = 0;
+    } else if (recvBegin > 0) {
+        std::memmove(recvBuffer, recvBuffer + recvBegin, recvEnd - recvBegin);
+        recvEnd -= recvBegin;
+        recvBegin = 0;
+    }
 
-    size_t nextOffset, nextSize;
-
-    switch (recvState) {
-
-        case RECV_PREAMBLE:
-            if (recvPackage.sof == SOF) {
-                recvState = RECV_CMD_ID;
-            } // otherwise, keep waiting for SOF
-            break;
-
-        case RECV_CMD_ID:
-            if (recvPackage.cmdID < CMD_ID_COUNT) {
-                recvState = RECV_DATA_TAIL;
-            } else {
-                recvState = RECV_PREAMBLE;
-            }
-            break;
-
-        case RECV_DATA_TAIL:
-            if (rm::verifyCRC8CheckSum((uint8_t *) &recvPackage,
-                                       sizeof(uint8_t) * 2 + DATA_SIZE[recvPackage.cmdID] + sizeof(uint8_t))) {
-
-                switch (recvPackage.cmdID) {
+    startRecv();
+}
 
-                }
-            }
-            recvState = RECV_PREAMBLE;
-            break;
+void Serial::parseRecvBuffer() {
+    while (recvBegin < recvEnd) {
+
+        // Skip to the next SOF. memchr is vectorized in the C library and skips garbage many bytes at a time.
+        auto sof = (const uint8_t *) std::memchr(recvBuffer + recvBegin, SOF, recvEnd - recvBegin);
+        if (sof == nullptr) {
+            recvBegin = recvEnd;  // no SOF at all, discard
+            return;
+        }
+        recvBegin = sof - recvBuffer;
+
+        if (recvEnd - recvBegin < 2) return;  // wait for cmdID
+
+        uint8_t cmdID = recvBuffer[recvBegin + 1];
+        if (cmdID >= CMD_ID_COUNT) {
+            ++recvBegin;  // not a real SOF
+            continue;
+        }
+
+        size_t size = sizeof(uint8_t) * 2 + DATA_SIZE[cmdID] + sizeof(uint8_t);
+        if (recvEnd - recvBegin < size) return;  // wait for the rest of the package
+
+        if (rm::verifyCRC8CheckSum(recvBuffer + recvBegin, size)) {
+            handlePackage(*reinterpret_cast<const Package *>(recvBuffer + recvBegin));  // packed, no alignment
+            recvBegin += size;
+        } else {
+            // Either a corrupted package or a 0xA5 in the data of another one. Resync from the next byte.
+            ++crcErrors;
+            ++recvBegin;
+        }
     }
+}
 
-
-    switch (recvState) {
-        case RECV_PREAMBLE:
-            nextOffset = 0;
-            nextSize = sizeof(uint8_t);
+void Serial::handlePackage(const Package &pkg) {
+    ++packagesReceived;
+    TimePoint recvTime = TimeBase::now();
+    switch (pkg.cmdID) {
+        case GIMBAL_FEEDBACK_CMD_ID: {
+            uint64_t mcuTime = unwrapMCUTime(pkg.feedback.time);
+            // Before synchronized, take the receiving time, which is late by about the transfer time
+            gimbalHistory_.push(GimbalHistory::Attitude{
+                    mcuClock_.synchronized() ? mcuClock_.toHost(mcuTime) : recvTime,
+                    (float) -pkg.feedback.yaw / 100,  // notice the minus sign
+                    (float) pkg.feedback.pitch / 100
+            });
             break;
-        case RECV_CMD_ID:
-            nextOffset = sizeof(uint8_t);
-            nextSize = sizeof(uint8_t);
+        }
+        case TIME_SYNC_ECHO_CMD_ID:
+            mcuClock_.addRoundTrip(TimeBase::unwrap(recvTime, pkg.timeSyncEcho.hostTime),
+                                   unwrapMCUTime(pkg.timeSyncEcho.mcuTime),
+                                   recvTime);
             break;
-        case RECV_DATA_TAIL:
-            nextOffset = sizeof(uint8_t) * 2;
-            nextSize = DATA_SIZE[recvPackage.cmdID] + sizeof(uint8_t);
+        default:
             break;
     }
-
-    boost::asio::async_read(serial,
-                            boost::asio::buffer(((uint8_t *) &recvPackage) + nextOffset, nextSize),
-                            boost::asio::transfer_exactly(nextSize),
-                            [this](auto &error, auto numBytes) { handleRecv(error, numBytes); });
 }
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,176 @@
+#include "Telemetry.h"
+#include <cstring>
+#include <iostream>
+#include <random>
+
+namespace meta {
+
+using boost::asio::ip::udp;
+
+/** TelemetrySender **/
+
+TelemetrySender::TelemetrySender(boost::asio::io_context &ioContext)
+        : socket(ioContext), senderID(std::random_device()() | 1U) {}
+
+bool TelemetrySender::open(const std::string &address, int port, int ttl) {
+    if (socket.is_open()) close();
+
+    boost::system::error_code ec;
+    auto ip = boost::asio::ip::make_address_v4(address, ec);
+    if (ec) {
+        std::cerr << "TelemetrySender: invalid address \"" << address << "\": " << ec.message() << std::endl;
+        return false;
+    }
+    destination = udp::endpoint(ip, port);
+
+    socket.open(udp::v4(), ec);
+    if (!ec && ip.is_multicast()) {
+        socket.set_option(boost::asio::ip::multicast::hops(ttl), ec);
+        if (!ec) socket.set_option(boost::asio::ip::multicast::enable_loopback(true), ec);  // for a local Terminal
+    }
+    if (!ec) socket.non_blocking(true, ec);
+    if (ec) {
+        std::cerr << "TelemetrySender: failed to open socket to " << destination << ": " << ec.message() << std::endl;
+        socket.close(ec);
+        return false;
+    }
+
+    std::cout << "TelemetrySender: send to " << destination << std::endl;
+    return true;
+}
+
+void TelemetrySender::close() {
+    boost::system::error_code ec;
+    socket.close(ec);
+}
+
+bool TelemetrySender::send(TelemetryRecord &record) {
+    if (!socket.is_open()) return false;
+
+    record.magic = TelemetryRecord::MAGIC;
+    record.version = TelemetryRecord::VERSION;
+    if (record.armorCount > TelemetryRecord::MAX_ARMORS) record.armorCount = TelemetryRecord::MAX_ARMORS;
+    record.senderID = senderID;
+    record.sequence = nextSequence++;  // consumed even if dropped, so that the loss is seen by the receiver
+
+    boost::system::error_code ec;
+    size_t size = socket.send_to(boost::asio::buffer(&record, record.size()), destination, 0, ec);
+    if (ec) {
+        // would_block if the socket buffer is full. Other errors (e.g. no route) are not printed for each frame.
+        recordsDropped++;
+        return false;
+    }
+    recordsSent++;
+    bytesSent += size;
+    return true;
+}
+
+TelemetrySender::Statistics TelemetrySender::statistics() const {
+    return {recordsSent.load(), bytesSent.load(), recordsDropped.load()};
+}
+
+/** TelemetryReceiver **/
+
+TelemetryReceiver::TelemetryReceiver(boost::asio::io_context &ioContext) : socket(ioContext) {}
+
+bool TelemetryReceiver::open(int port, const std::string &multicastAddress, RecordCallback callback_) {
+    if (socket.is_open()) close();
+
+    boost::system::error_code ec;
+    boost::asio::ip::address_v4 group;
+    if (!multicastAddress.empty()) {
+        group = boost::asio::ip::make_address_v4(multicastAddress, ec);
+        if (!ec && !group.is_multicast()) ec = boost::asio::error::invalid_argument;
+        if (ec) {
+            std::cerr << "TelemetryReceiver: invalid multicast address \"" << multicastAddress << "\": "
+                      << ec.message() << std::endl;
+            return false;
+        }
+    }
+
+    socket.open(udp::v4(), ec);
+    if (!ec) socket.set_option(udp::socket::reuse_address(true), ec);  // several receivers of a multicast group
+    if (!ec) socket.bind(udp::endpoint(udp::v4(), port), ec);
+    if (!ec && !group.is_unspecified()) socket.set_option(boost::asio::ip::multicast::join_group(group), ec);
+    if (ec) {
+        std::cerr << "TelemetryReceiver: failed to listen on " << port
+                  << (multicastAddress.empty() ? "" : " of " + multicastAddress) << ": " << ec.message() << std::endl;
+        socket.close(ec);
+        return false;
+    }
+
+    callback = std::move(callback_);
+    senderID = lastSequence = 0;
+    recentSequences = 0;
+    recordsReceived = recordsLost = recordsLate = invalidDatagrams = 0;
+    startRecv();
+    return true;
+}
+
+void TelemetryReceiver::close() {
+    boost::system::error_code ec;
+    socket.close(ec);  // the pending receive completes with operation_aborted
+}
+
+TelemetryReceiver::Statistics TelemetryReceiver::statistics() const {
+    return {recordsReceived.load(), recordsLost.load(), recordsLate.load(), invalidDatagrams.load()};
+}
+
+void TelemetryReceiver::startRecv() {
+    socket.async_receive(boost::asio::buffer(recvBuffer, sizeof(recvBuffer)),
+                         [this](auto &error, auto numBytes) { handleRecv(error, numBytes); });
+}
+
+void TelemetryReceiver::handleRecv(const boost::system::error_code &error, size_t numBytes) {
+    if (error == boost::asio::error::operation_aborted) return;  // closed
+    if (error) {
+        // E.g. ICMP errors of a previous datagram, which are not fatal for UDP
+        std::cerr << "TelemetryReceiver: " << error.message() << std::endl;
+        startRecv();
+        return;
+    }
+
+    if (numBytes < TelemetryRecord::HEADER_SIZE) {
+        invalidDatagrams++;
+        startRecv();
+        return;
+    }
+    std::memcpy(&recvRecord, recvBuffer, TelemetryRecord::HEADER_SIZE);
+    if (recvRecord.magic != TelemetryRecord::MAGIC || recvRecord.version != TelemetryRecord::VERSION ||
+        recvRecord.armorCount > TelemetryRecord::MAX_ARMORS || numBytes != recvRecord.size()) {
+        invalidDatagrams++;
+        startRecv();
+        return;
+    }
+    std::memcpy(recvRecord.armors, recvBuffer + TelemetryRecord::HEADER_SIZE,
+                numBytes - TelemetryRecord::HEADER_SIZE);
+    std::memset(recvRecord.armors + recvRecord.armorCount, 0,
+                (TelemetryRecord::MAX_ARMORS - recvRecord.armorCount) * sizeof(TelemetryRecord::Armor));
+
+    // Loss accounting. A new sender (e.g. Core restarted) starts over, without counting the records before, which are
+    // taken as received so that one arriving late isn't subtracted from the loss.
+    uint32_t seq = recvRecord.sequence;
+    if (recvRecord.senderID != senderID) {
+        senderID = recvRecord.senderID;
+        lastSequence = seq;
+        recentSequences = ~0ULL;
+    } else if (seq > lastSequence) {
+        uint32_t gap = seq - lastSequence;
+        recordsLost += gap - 1;
+        recentSequences = (gap < 64 ? recentSequences << gap : 0) | 1;
+        lastSequence = seq;
+    } else {
+        recordsLate++;
+        uint32_t age = lastSequence - seq;
+        if (age < 64 && !(recentSequences & (1ULL << age))) {
+            recentSequences |= 1ULL << age;
+            recordsLost--;  // counted as lost when the gap was seen
+        }
+    }
+    recordsReceived++;
+
+    if (callback) callback(recvRecord);
+    startRecv();
+}
+
+}
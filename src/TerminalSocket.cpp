@@ -3,6 +3,8 @@
 //
 
 #include "TerminalSocket.h"
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <utility>
 
@@ -11,79 +13,67 @@ using boost::asio::ip::tcp;
 namespace meta {
 
 TerminalSocketBase::TerminalSocketBase(boost::asio::io_context &ioContext)
-        : ioContext(ioContext), recvBuf(RECV_BUFFER_SIZE * 4, 0) {
+        : ioContext(ioContext), recvBuf(RECV_BUFFER_SIZE, 0) {
 
 }
 
 bool TerminalSocketBase::sendSingleString(const std::string &name, const std::string &s) {
     if (!connected()) return false;
 
-    auto buf = allocateBuffer(SINGLE_STRING, name, s.length() + 1);
+    auto buf = acquireBuffer(SINGLE_STRING, name, s.length() + 1);
 
     // The string itself
-    buf->insert(buf->end(), s.begin(), s.end());
-    buf->emplace_back('\0');
+    buf.insert(buf.end(), s.begin(), s.end());
+    buf.emplace_back('\0');
 
-    // Send the data
-    boost::asio::async_write(*socket,
-                             boost::asio::buffer(*buf),
-                             [this, buf](auto &error, auto numBytes) { handleSend(buf, error, numBytes); });
-
-    return true;
+    return queuePackage({std::move(buf), nullptr});
 }
 
 bool TerminalSocketBase::sendSingleInt(const std::string &name, int32_t n) {
     if (!connected()) return false;
 
-    auto buf = allocateBuffer(SINGLE_INT, name, 4);
+    auto buf = acquireBuffer(SINGLE_INT, name, 4);
 
     // The int itself
-    emplaceInt32(*buf, (uint32_t) n);
-
-    // Send the data
-    boost::asio::async_write(*socket,
-                             boost::asio::buffer(*buf),
-                             [this, buf](auto &error, auto numBytes) { handleSend(buf, error, numBytes); });
+    emplaceInt32(buf, (uint32_t) n);
 
-    return true;
+    return queuePackage({std::move(buf), nullptr});
 }
 
 bool TerminalSocketBase::sendBytes(const std::string &name, uint8_t *data, size_t size) {
     if (!connected()) return false;
 
-    auto buf = allocateBuffer(BYTES, name, size);
+    auto buf = acquireBuffer(BYTES, name, size);
 
     // Data
     if (size != 0) {
         assert(data != nullptr);
-        buf->resize(buf->size() + size);
-        ::memcpy(buf->data() + (buf->size() - size), data, size);
+        buf.insert(buf.end(), data, data + size);
     }
 
-    // Send the data
-    boost::asio::async_write(*socket,
-                             boost::asio::buffer(*buf),
-                             [this, buf](auto &error, auto numBytes) { handleSend(buf, error, numBytes); });
-
-    return true;
+    return queuePackage({std::move(buf), nullptr});
 }
 
 bool TerminalSocketBase::sendBytes(const std::string &name, const google::protobuf::Message &message) {
     if (!connected()) return false;
 
     size_t size = message.ByteSizeLong();
-    auto buf = allocateBuffer(BYTES, name, size);
+    auto buf = acquireBuffer(BYTES, name, size);
 
-    // Data
-    buf->resize(buf->size() + size);
-    message.SerializeWithCachedSizesToArray(buf->data() + (buf->size() - size));
+    // Serialize right after the header
+    buf.resize(buf.size() + size);
+    message.SerializeWithCachedSizesToArray(buf.data() + (buf.size() - size));
 
-    // Send the data
-    boost::asio::async_write(*socket,
-                             boost::asio::buffer(*buf),
-                             [this, buf](auto &error, auto numBytes) { handleSend(buf, error, numBytes); });
+    return queuePackage({std::move(buf), nullptr});
+}
 
-    return true;
+bool TerminalSocketBase::sendBytes(const std::string &name, SharedPayload payload) {
+    if (!connected()) return false;
+
+    // Only the header goes into the buffer. The payload is referenced by the buffer sequence.
+    auto buf = acquireBuffer(BYTES, name, payload ? payload->size() : 0);
+
+    return queuePackage({std::move(buf), std::move(payload)});
 }
 
 bool TerminalSocketBase::sendListOfStrings(const std::string &name, const std::vector<std::string> &list) {
@@ -95,41 +85,53 @@ bool TerminalSocketBase::sendListOfStrings(const std::string &name, const std::v
         contentSize += s.length() + 1;  // include the NUL
     }
 
-    auto buf = allocateBuffer(LIST_OF_STRINGS, name, contentSize);
+    auto buf = acquireBuffer(LIST_OF_STRINGS, name, contentSize);
 
     // Emplace the strings
     for (const auto &s : list) {
-        buf->insert(buf->end(), s.begin(), s.end());
-        buf->emplace_back('\0');
+        buf.insert(buf.end(), s.begin(), s.end());
+        buf.emplace_back('\0');
     }
 
-    // Send the data
-    boost::asio::async_write(*socket,
-                             boost::asio::buffer(*buf),
-                             [this, buf](auto &error, auto numBytes) { handleSend(buf, error, numBytes); });
+    return queuePackage({std::move(buf), nullptr});
+}
 
-    return true;
+bool TerminalSocketBase::hasPendingSends() {
+    std::lock_guard<std::mutex> lock(sendMutex);
+    return writeInFlight;
 }
 
-std::shared_ptr<std::vector<uint8_t>> TerminalSocketBase::allocateBuffer(PackageType type, const std::string &name,
-                                                                         size_t contentSize) {
-    auto buf = std::make_shared<std::vector<uint8_t>>();
+void TerminalSocketBase::setSendQueueLimit(size_t maxBytes, OverflowPolicy policy) {
+    std::lock_guard<std::mutex> lock(sendMutex);
+    maxQueuedBytes = maxBytes;
+    overflowPolicy = policy;
+}
+
+std::vector<uint8_t> TerminalSocketBase::acquireBuffer(PackageType type, const std::string &name, size_t contentSize) {
+    std::vector<uint8_t> buf;
+    {
+        std::lock_guard<std::mutex> lock(sendMutex);
+        if (!bufferPool.empty()) {
+            buf = std::move(bufferPool.back());
+            bufferPool.pop_back();
+        }
+    }
 
     size_t bufSize = 1 + 1 + (name.length() + 1) + 4 + contentSize;
-    buf->reserve(bufSize);
+    buf.reserve(bufSize);  // no allocation if the buffer from the pool is large enough
 
     // Preamble, 1 byte
-    buf->emplace_back(PREAMBLE);
+    buf.emplace_back(PREAMBLE);
 
     // Type, 1 byte
-    buf->emplace_back((uint8_t) type);
+    buf.emplace_back((uint8_t) type);
 
     // NUL-terminated name
-    buf->insert(buf->end(), name.begin(), name.end());
-    buf->emplace_back('\0');
+    buf.insert(buf.end(), name.begin(), name.end());
+    buf.emplace_back('\0');
 
     // Size, 4 bytes, little endian
-    emplaceInt32(*buf, contentSize);
+    emplaceInt32(buf, contentSize);
 
     return buf;
 }
@@ -142,21 +144,129 @@ void TerminalSocketBase::emplaceInt32(std::vector<uint8_t> &buf, int32_t n) {
     buf.emplace_back((uint8_t) ((n >> 24) & 0xFF));
 }
 
-void TerminalSocketBase::handleSend(std::shared_ptr<std::vector<uint8_t>> buf, const boost::system::error_code &error,
+bool TerminalSocketBase::queuePackage(OutPackage &&package) {
+    bool shouldStart;
+    bool shouldClose = false;
+    {
+        std::lock_guard<std::mutex> lock(sendMutex);
+
+        if (maxQueuedBytes != 0 && queuedBytes + package.size() > maxQueuedBytes) {
+            if (overflowPolicy == DISCONNECT && !sendOverflowed.exchange(true)) {
+                std::cerr << "TerminalSocketBase: send queue full (" << queuedBytes << " bytes), disconnecting\n";
+                socketDisconnected = true;
+                // With a write in flight, handleSend() closes the socket. Otherwise (a package larger than the limit
+                // on an idle queue), it is closed on the IO thread, held as in flight so that a session is not
+                // destroyed before.
+                if (!writeInFlight) {
+                    writeInFlight = true;
+                    shouldClose = true;
+                }
+            }
+            if (bufferPool.size() < MAX_POOLED_BUFFERS && package.buf.capacity() <= MAX_POOLED_BUFFER_CAPACITY) {
+                package.buf.clear();
+                bufferPool.emplace_back(std::move(package.buf));
+            }
+            if (shouldClose) boost::asio::post(ioContext, [this] { closeOverflowed(); });
+            return false;
+        }
+
+        queuedBytes += package.size();
+        sendQueue.emplace_back(std::move(package));
+        shouldStart = !writeInFlight;
+        writeInFlight = true;  // the write is to be started on the IO thread
+    }
+    if (shouldStart) {
+        boost::asio::post(ioContext, [this] { startWrite(); });
+    }
+    return true;
+}
+
+void TerminalSocketBase::startWrite() {
+    // On the IO thread
+    auto s = socket;
+    {
+        std::lock_guard<std::mutex> lock(sendMutex);
+
+        if (sendQueue.empty() || s == nullptr || !s->is_open()) {
+            writing.assign(std::make_move_iterator(sendQueue.begin()), std::make_move_iterator(sendQueue.end()));
+            sendQueue.clear();
+            releaseBuffers(writing);
+            writeInFlight = false;
+            return;
+        }
+
+        // Coalesce all queued packages into one write
+        writeBuffers.clear();
+        while (!sendQueue.empty()) {
+            writing.emplace_back(std::move(sendQueue.front()));
+            sendQueue.pop_front();
+            const auto &package = writing.back();
+            writeBuffers.emplace_back(boost::asio::buffer(package.buf));
+            if (package.payload && !package.payload->empty()) {
+                writeBuffers.emplace_back(boost::asio::buffer(*package.payload));
+            }
+        }
+    }
+
+    // The socket is not captured, so that releasing it still aborts the operations (see handleRecv)
+    auto rawSocket = s.get();
+    boost::asio::async_write(*s, writeBuffers,
+                             [this, rawSocket](auto &error, auto numBytes) { handleSend(rawSocket, error, numBytes); });
+}
+
+void TerminalSocketBase::handleSend(boost::asio::ip::tcp::socket *s, const boost::system::error_code &error,
                                     size_t numBytes) {
+    uploadBytes += numBytes;
+
+    bool currentSocket = (s == socket.get());
     if (error == boost::asio::error::eof || error == boost::asio::error::connection_reset ||
         error == boost::asio::error::operation_aborted || error == boost::asio::error::broken_pipe) {
         // Disconnected or socket released
-
-        socketDisconnected = true;
-
+        if (currentSocket) socketDisconnected = true;
     } else if (error) {
         std::cerr << "TerminalSocketBase: send error: " << error.message() << "\n";
-    } else {
-        assert(buf->size() == numBytes && "Unexpected # of bytes sent");
     }
 
-    uploadBytes += numBytes;
+    bool overflowed = currentSocket && sendOverflowed;
+    bool shouldContinue;
+    {
+        std::lock_guard<std::mutex> lock(sendMutex);
+        releaseBuffers(writing);
+        if ((error || overflowed) && currentSocket) {
+            // Drop the packages for the broken socket
+            writing.assign(std::make_move_iterator(sendQueue.begin()), std::make_move_iterator(sendQueue.end()));
+            sendQueue.clear();
+            releaseBuffers(writing);
+        }
+        shouldContinue = !sendQueue.empty();
+        writeInFlight = shouldContinue;
+    }
+    if (overflowed) closeSocket();  // handleRecv() then triggers the disconnection callback
+    if (shouldContinue) startWrite();  // packages queued in the meantime, possibly for a new socket
+}
+
+void TerminalSocketBase::closeOverflowed() {
+    // On the IO thread
+    if (sendOverflowed) closeSocket();  // unless replaced by a new socket. handleRecv() triggers the disconnection
+    bool shouldContinue;
+    {
+        std::lock_guard<std::mutex> lock(sendMutex);
+        shouldContinue = !sendQueue.empty();  // packages for a new socket
+        writeInFlight = shouldContinue;
+    }
+    if (shouldContinue) startWrite();
+}
+
+void TerminalSocketBase::releaseBuffers(std::vector<OutPackage> &packages) {
+    // With sendMutex locked
+    for (auto &package : packages) {
+        queuedBytes -= package.size();
+        if (bufferPool.size() < MAX_POOLED_BUFFERS && package.buf.capacity() <= MAX_POOLED_BUFFER_CAPACITY) {
+            package.buf.clear();  // keep the capacity
+            bufferPool.emplace_back(std::move(package.buf));
+        }
+    }
+    packages.clear();
 }
 
 template<class T>
@@ -166,21 +276,48 @@ void TerminalSocketBase::setupSocket(std::shared_ptr<tcp::socket> newSocket, std
 
     // Setup socket
     socketDisconnected = false;
+    sendOverflowed = false;
     socket = std::move(newSocket);
 
     // Start recv cycle
-    recvState = RECV_PREAMBLE;
-    recvOffset = 0;
-    boost::asio::async_read(*socket,
-                            boost::asio::buffer(&recvBuf[recvOffset], 1),
-                            boost::asio::transfer_exactly(1),
-                            [this, disconnectCallback](auto &error, auto numBytes) { handleRecv(error, numBytes, disconnectCallback); });
+    recvBegin = recvEnd = 0;
+    recvLarge = false;
+    startRecv(disconnectCallback);
 }
 
 void TerminalSocketBase::closeSocket() {
+    socketDisconnected = true;
     socket.reset();
 }
 
+template<class T>
+void TerminalSocketBase::startRecv(std::function<void(T *)> disconnectCallback) {
+    if (socket == nullptr) return;  // socket may have been released due to async operation
+
+    auto handler = [this, disconnectCallback](auto &error, auto numBytes) {
+        handleRecv(error, numBytes, disconnectCallback);
+    };
+    if (recvLarge) {
+        // Read the rest of the content directly into the target
+        boost::asio::async_read(*socket,
+                                boost::asio::buffer(largeRecvTarget + largeRecvReceived,
+                                                    largeRecvSize - largeRecvReceived),
+                                boost::asio::transfer_all(),
+                                handler);
+    } else {
+        if (recvBuf.size() - recvEnd < RECV_READ_SIZE) {
+            // Compact: move the unparsed bytes to the front
+            std::memmove(recvBuf.data(), recvBuf.data() + recvBegin, recvEnd - recvBegin);
+            recvEnd -= recvBegin;
+            recvBegin = 0;
+        }
+        boost::asio::async_read(*socket,
+                                boost::asio::buffer(recvBuf.data() + recvEnd, recvBuf.size() - recvEnd),
+                                boost::asio::transfer_at_least(1),  // boost::asio::transfer_all doesn't work
+                                handler);
+    }
+}
+
 template<class T>
 void TerminalSocketBase::handleRecv(const boost::system::error_code &error, size_t numBytes,
                                     std::function<void(T *)> disconnectCallback) {
@@ -188,7 +325,7 @@ void TerminalSocketBase::handleRecv(const boost::system::error_code &error, size
     if (error == boost::asio::error::eof || error == boost::asio::error::connection_reset ||
         error == boost::asio::error::operation_aborted || error == boost::asio::error::broken_pipe) {
 
-        if (disconnectCallback) disconnectCallback(reinterpret_cast<T *>(this));
+        if (disconnectCallback) disconnectCallback(static_cast<T *>(this));
 
         socketDisconnected = true;
 
@@ -201,134 +338,138 @@ void TerminalSocketBase::handleRecv(const boost::system::error_code &error, size
     }
 
     // Otherwise, process data and continue next async_recv
+    downloadBytes += numBytes;
 
-    /**
-     * To avoid copying, strings and bytes are passed as const pointers, which however requires data to be continuous
-     * in the memory.
-     *
-     * Here a std::vector is used as the buffer. All bytes are discarded at once if the end of the buffer is exactly the end
-     * of one package. Before starting the next async_recv, the buffer is extended as needed. It's possible that the
-     * buffer can grow large (if packages are always received partially), but if the data flow is not heavy, it may not
-     * occur at all. An warning message is printed everytime the buffer is enlarged. Pay close attention to these
-     * warnings.
-     */
+    if (recvLarge) {
+        largeRecvReceived += numBytes;
+        if (largeRecvReceived == largeRecvSize) {
+            recvLarge = false;
+            handlePackage(largeRecvType, largeRecvName.c_str(), largeRecvTarget, largeRecvSize);
+            if (largeRecvPoolCapacity > MAX_POOLED_RECV_CAPACITY) {
+                largeRecvPool.reset();
+                largeRecvPoolCapacity = 0;
+            }
+        }
+    } else {
+        recvEnd += numBytes;
+        parseRecvBuffer();
+    }
 
+    startRecv(disconnectCallback);
+}
 
-    ssize_t i = recvOffset;
-    recvOffset += numBytes;  // move forward
-    downloadBytes += numBytes;
+void TerminalSocketBase::parseRecvBuffer() {
+    const uint8_t *buf = recvBuf.data();
 
-    for (; i < recvOffset; i++) {
-        switch (recvState) {
-            case RECV_PREAMBLE:
-                if (recvBuf[i] == PREAMBLE) {
-                    recvState = RECV_PACKAGE_TYPE;  // transfer to receive package type
-                }  // otherwise keep in RECV_PREAMBLE state
-                break;
-            case RECV_PACKAGE_TYPE:
-                if (recvBuf[i] < PACKAGE_TYPE_COUNT) {  // valid
-                    recvCurrentPackageType = (PackageType) recvBuf[i];
-                    recvState = RECV_NAME;  // transfer to receiving name
-                    recvNameStart = i + 1;
-                } else {
-                    std::cerr << "Received invalid package type " << (int) recvBuf[i] << "\n";
-                    recvState = RECV_PREAMBLE;
-                }
-                break;
-            case RECV_NAME:
-                if (recvBuf[i] == '\0') {
-                    recvState = RECV_SIZE;   // transfer to receive 4-byte size
-                    recvRemainingBytes = 4;  // for the 4 bytes of size
-                }
-                break;
-            case RECV_SIZE:
-                recvRemainingBytes--;
-                if (recvRemainingBytes == 0) {
-                    recvContentSize = decodeInt32(recvBuf.data() + (i - 3));
-                    recvRemainingBytes = recvContentSize;
-                    recvContentStart = i + 1;
-                    if (recvContentSize > 0) {
-                        recvState = RECV_CONTENT;  // transfer to receive content
-                    } else {
-                        // Empty content
-                        handlePackage();
-                        recvState = RECV_PREAMBLE;  // transfer to receive preamble
-                        if (i + 1 == recvOffset) {  // happen to be at the end of buffer
-                            recvOffset = 0;  // discard all received bytes
-                        }
-                    }
-                }
-                break;
-            case RECV_CONTENT:
-                recvRemainingBytes--;
-                if (recvRemainingBytes == 0) {
-                    handlePackage();
+    while (recvBegin < recvEnd) {
 
-                    recvState = RECV_PREAMBLE;  // transfer to receive preamble
-                }
-                break;
+        // Find the preamble
+        auto preamble = (const uint8_t *) std::memchr(buf + recvBegin, PREAMBLE, recvEnd - recvBegin);
+        if (preamble == nullptr) {
+            recvBegin = recvEnd;  // discard all
+            break;
+        }
+        recvBegin = preamble - buf;
+
+        // Package type
+        size_t i = recvBegin + 1;
+        if (i >= recvEnd) break;  // wait for more
+        if (buf[i] >= PACKAGE_TYPE_COUNT) {
+            std::cerr << "Received invalid package type " << (int) buf[i] << "\n";
+            recvBegin++;  // look for the next preamble
+            continue;
+        }
+        auto type = (PackageType) buf[i];
+
+        // Name
+        size_t nameStart = i + 1;
+        size_t nameSearchEnd = std::min(recvEnd, nameStart + MAX_NAME_LENGTH + 1);
+        auto nameEnd = (const uint8_t *) std::memchr(buf + nameStart, '\0', nameSearchEnd - nameStart);
+        if (nameEnd == nullptr) {
+            if (nameSearchEnd == recvEnd) break;  // wait for more
+            std::cerr << "Received invalid package name\n";
+            recvBegin++;
+            continue;
         }
-    }
-
-    if (recvState == RECV_PREAMBLE) {
-        recvOffset = 0;  // discard all received bytes
-    }
 
+        // Size
+        size_t sizeStart = nameEnd - buf + 1;
+        if (sizeStart + 4 > recvEnd) break;  // wait for more
+        int32_t contentSize = decodeInt32(buf + sizeStart);
+        if (contentSize < 0) {
+            std::cerr << "Received invalid package size " << contentSize << "\n";
+            recvBegin++;
+            continue;
+        }
 
-    if (recvOffset + RECV_BUFFER_SIZE > recvBuf.size()) {
-        std::cerr << "Warning: TerminalSocketBase enlarges its receiver buffer to 2x" << std::endl;
-        recvBuf.resize(recvBuf.size() * 2);  // enlarge the buffer to 2x
+        // Content
+        size_t contentStart = sizeStart + 4;
+        size_t available = recvEnd - contentStart;
+        if (available >= (size_t) contentSize) {
+            recvBegin = contentStart + contentSize;  // before the callback, which may close the socket
+            handlePackage(type, (const char *) (buf + nameStart), buf + contentStart, contentSize);
+            continue;
+        }
+        if ((size_t) contentSize < LARGE_PACKAGE_SIZE) break;  // wait for more, compacted if needed
+
+        // Large package: read the rest directly into a separate buffer
+        largeRecvType = type;
+        largeRecvName.assign((const char *) (buf + nameStart));
+        largeRecvSize = contentSize;
+        largeRecvTarget = nullptr;
+        if (type == BYTES && recvBufferProvider) {
+            largeRecvTarget = recvBufferProvider(largeRecvName, largeRecvSize);
+        }
+        if (largeRecvTarget == nullptr) {
+            if (largeRecvPoolCapacity < largeRecvSize) {
+                largeRecvPool.reset(new uint8_t[largeRecvSize]);
+                largeRecvPoolCapacity = largeRecvSize;
+            }
+            largeRecvTarget = largeRecvPool.get();
+        }
+        std::memcpy(largeRecvTarget, buf + contentStart, available);
+        largeRecvReceived = available;
+        recvLarge = true;
+        recvBegin = recvEnd;
+        break;
     }
 
-    if (socket != nullptr) {
-        // socket may have been released due to async operation
-        boost::asio::async_read(*socket,
-                                boost::asio::buffer(&recvBuf[recvOffset], RECV_BUFFER_SIZE),
-                                boost::asio::transfer_at_least(1),  // boost::asio::transfer_all doesn't work
-                                [this, disconnectCallback](auto &error, auto numBytes) {
-                                    handleRecv(error, numBytes, disconnectCallback);
-                                });
-    }
+    if (recvBegin == recvEnd) recvBegin = recvEnd = 0;  // all parsed
 }
 
-void TerminalSocketBase::handlePackage() const {
-    switch (recvCurrentPackageType) {
+void TerminalSocketBase::handlePackage(PackageType type, const char *name, const uint8_t *content, size_t size) const {
+    switch (type) {
         case SINGLE_STRING:
             if (singleStringCallBack) {
-                singleStringCallBack((const char *) (recvBuf.data() + recvNameStart),
-                                     (const char *) (recvBuf.data() + recvContentStart));
+                singleStringCallBack(name, (const char *) content);
             }
             break;
         case SINGLE_INT:
             if (singleIntCallBack) {
-                singleIntCallBack((const char *) (recvBuf.data() + recvNameStart),
-                                  decodeInt32(recvBuf.data() + recvContentStart));
+                singleIntCallBack(name, decodeInt32(content));
             }
             break;
         case BYTES:
             if (bytesCallBack) {
-                bytesCallBack((const char *) (recvBuf.data() + recvNameStart),
-                              recvBuf.data() + recvContentStart,
-                              recvContentSize);
+                bytesCallBack(name, content, size);
             }
             break;
         case LIST_OF_STRINGS:
             if (listOfStringsCallBack) {
                 std::vector<const char *> list;
-                size_t strStart = recvContentStart;
-                while (strStart < recvContentStart + recvContentSize) {
-                    list.emplace_back((const char *) (recvBuf.data() + strStart));
+                size_t strStart = 0;
+                while (strStart < size) {
+                    list.emplace_back((const char *) (content + strStart));
 
                     // Find the end of the std::string
-                    while (strStart < recvContentStart + recvContentSize && recvBuf[strStart] != '\0') {
+                    while (strStart < size && content[strStart] != '\0') {
                         strStart++;
                     }
 
                     // Move to the next start
                     strStart++;
                 }
-                listOfStringsCallBack((char *) (recvBuf.data() + recvNameStart),
-                                      list);
+                listOfStringsCallBack(name, list);
             }
             break;
         default:
@@ -341,16 +482,16 @@ int32_t TerminalSocketBase::decodeInt32(const uint8_t *start) {
     return (start[3] << 24) | (start[2] << 16) | (start[1] << 8) | start[0];
 }
 
-std::pair<unsigned, unsigned> TerminalSocketBase::getAndClearStats() {
-    std::pair<unsigned, unsigned> ret{uploadBytes, downloadBytes};
+std::pair<uint64_t, uint64_t> TerminalSocketBase::getAndClearStats() {
+    std::pair<uint64_t, uint64_t> ret{uploadBytes, downloadBytes};
     uploadBytes = 0;
     downloadBytes = 0;
     return ret;
 }
 
 TerminalSocketServer::TerminalSocketServer(boost::asio::io_context &ioContext, int port,
-                                           ServerDisconnectionCallback disconnectionCallback)
-        : TerminalSocketBase(ioContext), port(port),
+                                           ServerDisconnectionCallback disconnectionCallback, int maxSessions)
+        : ioContext(ioContext), port(port), maxSessions(maxSessions),
           acceptor(ioContext, tcp::endpoint(tcp::v4(), port)),
           disconnectionCallback(std::move(disconnectionCallback)) {
 
@@ -358,34 +499,185 @@ TerminalSocketServer::TerminalSocketServer(boost::asio::io_context &ioContext, i
 }
 
 void TerminalSocketServer::startAccept() {
+    std::cout << "TerminalSocketServer: listen on " << port << " for up to " << maxSessions << " clients"
+              << std::endl;
+    boost::asio::post(ioContext, [this] { doAccept(); });
+}
+
+void TerminalSocketServer::doAccept() {
 
     auto socket = std::make_shared<tcp::socket>(ioContext);
     // shared_ptr is used to manage socket. If the raw pointer is used and it doesn't reach handleAccept, memory leaks.
 
-    // ioContext is running as TerminalSocketBase instantiates
     acceptor.async_accept(*socket,
                           [this, socket](const auto &error) { handleAccept(socket, error); });
-
-
-    std::cout << "TerminalSocketServer: listen on " << port << std::endl;
 }
 
 void TerminalSocketServer::handleAccept(std::shared_ptr<tcp::socket> socket, const boost::system::error_code &error) {
     if (!error) {
-        std::cout << "TerminalSocketServer: get connection from " << socket->remote_endpoint().address().to_string()
-                  << "\n";
-        setupSocket(std::move(socket), disconnectionCallback);
+        boost::system::error_code addressError;
+        std::string address = socket->remote_endpoint(addressError).address().to_string();
+
+        std::lock_guard<std::mutex> lock(sessionMutex);
+        if ((int) sessions_.size() >= maxSessions) {
+            std::cerr << "TerminalSocketServer: refuse connection from " << address << ", already " << maxSessions
+                      << " clients\n";
+            // The socket is closed as it is released
+        } else {
+            auto session = std::make_shared<Session>(ioContext, nextSessionID++);
+            session->address_ = address;
+            session->setSendQueueLimit(sessionQueueLimit, sessionOverflowPolicy);
+
+            // The session is alive during its callbacks, see reapSession()
+            auto s = session.get();
+            session->setCallbacks(
+                    [this, s](auto name, auto str) {
+                        if (singleStringCallBack) singleStringCallBack(s, name, str);
+                    },
+                    [this, s](auto name, auto n) {
+                        if (singleIntCallBack) singleIntCallBack(s, name, n);
+                    },
+                    [this, s](auto name, auto buf, auto size) {
+                        if (bytesCallBack) bytesCallBack(s, name, buf, size);
+                    },
+                    [this, s](auto name, const auto &list) {
+                        if (listOfStringsCallBack) listOfStringsCallBack(s, name, list);
+                    });
+            session->setRecvBufferProvider([this, s](auto name, auto size) {
+                return recvBufferProvider ? recvBufferProvider(s, name, size) : nullptr;
+            });
+            session->setupSocket(std::move(socket), std::function<void(Session *)>(
+                    [this](Session *session) { handleSessionDisconnection(session); }));
+            sessions_.emplace_back(std::move(session));
+
+            std::cout << "TerminalSocketServer: get connection from " << address << " (client " << s->id() << ", "
+                      << sessions_.size() << " connected)\n";
+        }
     } else if (error == boost::asio::error::operation_aborted) {
-        // Ignore
+        return;  // the acceptor is closed
     } else {
         std::cerr << "TerminalSocketServer: accept error " << error.message() << "\n";
     }
+    doAccept();
+}
+
+void TerminalSocketServer::handleSessionDisconnection(Session *session) {
+    // On the IO thread, in the recv handler of the session
+    SessionPtr ptr;
+    {
+        std::lock_guard<std::mutex> lock(sessionMutex);
+        auto it = std::find_if(sessions_.begin(), sessions_.end(), [&](auto &s) { return s.get() == session; });
+        if (it == sessions_.end()) return;
+        ptr = std::move(*it);
+        sessions_.erase(it);
+    }
+    std::cout << "TerminalSocketServer: client " << session->id() << " (" << session->address() << ") disconnected"
+              << std::endl;
+
+    if (disconnectionCallback) disconnectionCallback(session);
+
+    // Not destroyed here, as the recv handler is still running
+    boost::asio::post(ioContext, [this, ptr] { reapSession(ptr); });
+}
+
+void TerminalSocketServer::reapSession(SessionPtr session) {
+    session->closeSocket();  // abort the write in flight, if any
+    if (session->hasPendingSends()) {
+        // Wait for handleSend() of the aborted write, which still accesses the session
+        boost::asio::post(ioContext, [this, session] { reapSession(session); });
+        return;
+    }
+
+    // Destroyed as the last reference is released, with its counts kept for getAndClearStats()
+    auto stats = session->getAndClearStats();
+    std::lock_guard<std::mutex> lock(sessionMutex);
+    reapedStats.first += stats.first;
+    reapedStats.second += stats.second;
+}
+
+bool TerminalSocketServer::connected() {
+    std::lock_guard<std::mutex> lock(sessionMutex);
+    return !sessions_.empty();
+}
+
+std::vector<TerminalSocketServer::SessionPtr> TerminalSocketServer::sessions() {
+    std::lock_guard<std::mutex> lock(sessionMutex);
+    return sessions_;
+}
+
+TerminalSocketBase::SharedPayload TerminalSocketServer::serialize(const google::protobuf::Message &message) {
+    std::shared_ptr<std::vector<uint8_t>> buf;
+    {
+        std::lock_guard<std::mutex> lock(sessionMutex);
+        // Reuse a buffer that is held by no send queue
+        for (const auto &b : payloadPool) {
+            if (b.use_count() == 1) {
+                buf = b;
+                break;
+            }
+        }
+        if (!buf) {
+            buf = std::make_shared<std::vector<uint8_t>>();
+            if (payloadPool.size() < MAX_POOLED_PAYLOADS) payloadPool.emplace_back(buf);
+        }
+    }
+    buf->resize(message.ByteSizeLong());
+    message.SerializeWithCachedSizesToArray(buf->data());
+    return buf;
+}
+
+template<class F>
+bool TerminalSocketServer::sendToAll(F &&send) {
+    bool sent = false;
+    for (const auto &session : sessions()) {
+        if (send(*session)) sent = true;
+    }
+    return sent;
+}
+
+bool TerminalSocketServer::sendSingleString(const std::string &name, const std::string &s) {
+    return sendToAll([&](Session &session) { return session.sendSingleString(name, s); });
+}
+
+bool TerminalSocketServer::sendSingleInt(const std::string &name, int32_t n) {
+    return sendToAll([&](Session &session) { return session.sendSingleInt(name, n); });
+}
+
+bool TerminalSocketServer::sendBytes(const std::string &name, uint8_t *data, size_t size) {
+    return sendToAll([&](Session &session) { return session.sendBytes(name, data, size); });
+}
+
+bool TerminalSocketServer::sendBytes(const std::string &name, const google::protobuf::Message &message) {
+    if (!connected()) return false;
+    return sendBytes(name, serialize(message));  // serialized once for all clients
+}
+
+bool TerminalSocketServer::sendBytes(const std::string &name, const TerminalSocketBase::SharedPayload &payload) {
+    return sendToAll([&](Session &session) { return session.sendBytes(name, payload); });
+}
+
+bool TerminalSocketServer::sendListOfStrings(const std::string &name, const std::vector<std::string> &list) {
+    return sendToAll([&](Session &session) { return session.sendListOfStrings(name, list); });
 }
 
 void TerminalSocketServer::disconnect() {
-    if (connected()) {
-        closeSocket();
+    for (auto &session : sessions()) {
+        boost::asio::post(ioContext, [session] { session->disconnect(); });
+    }
+}
+
+std::pair<uint64_t, uint64_t> TerminalSocketServer::getAndClearStats() {
+    std::pair<uint64_t, uint64_t> ret;
+    {
+        std::lock_guard<std::mutex> lock(sessionMutex);
+        ret = std::exchange(reapedStats, {0, 0});
     }
+    for (auto &session : sessions()) {
+        auto stats = session->getAndClearStats();
+        ret.first += stats.first;
+        ret.second += stats.second;
+    }
+    return ret;
 }
 
 bool TerminalSocketClient::connect(const std::string &server, const std::string &port) {
@@ -0,0 +1,142 @@
+#include "TimeBase.h"
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+namespace meta {
+
+TimePoint TimeBase::now() {
+    using namespace std::chrono;
+    static const steady_clock::time_point origin = steady_clock::now();
+    // Start from 1 since 0 indicates the end of the stream
+    return (TimePoint) duration_cast<duration<int64_t, std::ratio<1, 10000>>>(steady_clock::now() - origin).count() + 1;
+}
+
+ClockSync::ClockSync(size_t windowSize, uint64_t minDriftSpan)
+        : windowSize(windowSize), minDriftSpan(minDriftSpan) {}
+
+void ClockSync::addRoundTrip(TimePoint hostSend, uint64_t remote, TimePoint hostRecv) {
+    if (hostRecv < hostSend) return;  // not a valid round trip
+    oneWay = false;
+    addSample({remote, ((double) hostSend + (double) hostRecv) / 2, ((double) hostRecv - (double) hostSend) / 2});
+}
+
+void ClockSync::addOneWay(uint64_t remote, TimePoint hostRecv) {
+    oneWay = true;
+    addSample({remote, (double) hostRecv, 0});
+}
+
+void ClockSync::addSample(const Sample &sample) {
+    static constexpr double RESYNC_THRESHOLD = 10000;  // [0.1ms]
+
+    if (!samples.empty()) {
+        bool backward = sample.remote < samples.back().remote;
+        bool offTrack = synchronized() &&
+                        std::abs((double) toHost(sample.remote) - sample.host) > RESYNC_THRESHOLD + sample.halfRoundTrip;
+        if (backward || offTrack) {  // the remote has restarted or the clock jumped
+            reset();
+        }
+    }
+
+    samples.emplace_back(sample);
+    while (samples.size() > windowSize) samples.pop_front();
+    fit();
+}
+
+void ClockSync::reset() {
+    samples.clear();
+    std::lock_guard<std::mutex> lock(modelMutex);
+    model = Model();
+}
+
+void ClockSync::fit() {
+    static constexpr double ROUND_TRIP_TOLERANCE = 5;  // samples within 0.5 ms of the best one take part [0.1ms]
+    static constexpr double MAX_DRIFT = 1E-3;          // larger estimation is rejected, crystals are within 100 ppm
+
+    double minHalfRoundTrip = std::numeric_limits<double>::max();
+    for (const auto &s : samples) minHalfRoundTrip = std::min(minHalfRoundTrip, s.halfRoundTrip);
+    double threshold = minHalfRoundTrip + ROUND_TRIP_TOLERANCE;
+
+    // Use the oldest qualified sample as the origin to keep the fitting well-conditioned in double
+    uint64_t origin = 0;
+    bool hasOrigin = false;
+    size_t n = 0;
+    double sumX = 0, sumY = 0, span = 0;
+    for (const auto &s : samples) {
+        if (s.halfRoundTrip > threshold) continue;
+        if (!hasOrigin) {
+            origin = s.remote;
+            hasOrigin = true;
+        }
+        double x = (double) (s.remote - origin);
+        sumX += x;
+        sumY += s.host;
+        span = std::max(span, x);  // samples are in increasing remote time
+        ++n;
+    }
+    if (n == 0) return;
+
+    double slope = 1;
+    if (n >= 2 && span >= (double) minDriftSpan) {
+        double meanX = sumX / (double) n, meanY = sumY / (double) n;
+        double sxx = 0, sxy = 0;
+        for (const auto &s : samples) {
+            if (s.halfRoundTrip > threshold) continue;
+            double dx = (double) (s.remote - origin) - meanX;
+            sxx += dx * dx;
+            sxy += dx * (s.host - meanY);
+        }
+        double fitted = sxy / sxx;
+        if (std::abs(fitted - 1) <= MAX_DRIFT) slope = fitted;
+    }
+
+    // Intercept: the mean residual for round trips, the lower envelope for one-way samples
+    double offset = oneWay ? std::numeric_limits<double>::max() : 0;
+    for (const auto &s : samples) {
+        if (s.halfRoundTrip > threshold) continue;
+        double residual = s.host - slope * (double) (s.remote - origin);
+        if (oneWay) {
+            offset = std::min(offset, residual);
+        } else {
+            offset += residual / (double) n;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(modelMutex);
+    model.valid = true;
+    model.remoteOrigin = origin;
+    model.offset = offset;
+    model.slope = slope;
+    model.uncertainty = minHalfRoundTrip;
+}
+
+bool ClockSync::synchronized() const {
+    std::lock_guard<std::mutex> lock(modelMutex);
+    return model.valid;
+}
+
+TimePoint ClockSync::toHost(uint64_t remote) const {
+    std::lock_guard<std::mutex> lock(modelMutex);
+    double x = (double) (int64_t) (remote - model.remoteOrigin);
+    double host = model.offset + model.slope * x;
+    return host < 1 ? 1 : (TimePoint) std::llround(host);
+}
+
+uint64_t ClockSync::toRemote(TimePoint host) const {
+    std::lock_guard<std::mutex> lock(modelMutex);
+    double x = ((double) host - model.offset) / model.slope;
+    return model.remoteOrigin + (uint64_t) (int64_t) std::llround(x);
+}
+
+double ClockSync::driftPPM() const {
+    std::lock_guard<std::mutex> lock(modelMutex);
+    return (model.slope - 1) * 1E6;
+}
+
+double ClockSync::uncertainty() const {
+    std::lock_guard<std::mutex> lock(modelMutex);
+    return model.uncertainty;
+}
+
+}
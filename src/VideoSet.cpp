@@ -3,6 +3,7 @@
 //
 
 #include "VideoSet.h"
+#include "TimeBase.h"
 #include "Utilities.h"
 #include <iostream>
 #include <iomanip>
@@ -53,6 +54,7 @@ void VideoSet::loadFrameFromVideo(const std::string &videoName, const ParamSet &
     cv::VideoCapture video((videoSetRoot / videoName).string());
 
     auto startTime = std::chrono::steady_clock::now();
+    TimePoint startTimePoint = TimeBase::now();  // video time is offset onto the unified clock
 
     threadRunning = true;
     while (video.isOpened()) {
@@ -83,7 +85,7 @@ void VideoSet::loadFrameFromVideo(const std::string &videoName, const ParamSet &
         buffer[workingBuffer] = img;
 
         // Increment frame time, using the actual capture time
-        bufferCaptureTime[workingBuffer] = (int) (frameTimeMS * 10 / params.video_speed());;
+        bufferCaptureTime[workingBuffer] = startTimePoint + (TimePoint) (frameTimeMS * 10 / params.video_speed());
 
         // Switch
         lastBuffer = workingBuffer;
@@ -3,10 +3,19 @@
 //
 
 #include "Executor.h"  // includes headers of all components
+#include "PreviewEncoder.h"
+#include "MaskCodec.h"
 #include "TerminalSocket.h"
 #include "TerminalParameters.h"
 #include "Parameters.pb.h"
+#include <google/protobuf/arena.h>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
 #include <iostream>
+#include <map>
 #include <thread>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
@@ -21,11 +30,16 @@ using namespace package;
 boost::asio::io_context tcpIOContext;
 std::thread *tcpIOThread = nullptr;
 
-// Setup a server with automatic acceptance
-TerminalSocketServer socketServer(tcpIOContext, 8800, [](auto s) {
-    std::cout << "TerminalSocketServer: disconnected" << std::endl;
-    s->startAccept();
-});
+// Encode preview images in the background, only the channels fetched by Terminal
+std::unique_ptr<PreviewEncoder> previewEncoder;
+double previewMaxFPS = TERMINAL_PREVIEW_FPS;
+
+using Session = TerminalSocketServer::Session;
+
+void handleDisconnection(Session *session);
+
+// Setup a server with automatic acceptance of several Terminals, e.g. one for tuning and one for monitoring
+TerminalSocketServer socketServer(tcpIOContext, 8800, handleDisconnection, TERMINAL_MAX_CLIENTS);
 
 
 /** TCP Handling **/
@@ -34,124 +48,408 @@ TerminalSocketServer socketServer(tcpIOContext, 8800, [](auto s) {
 std::unique_ptr<Executor> executor;
 
 // Reuse message objects: developers.google.com/protocol-buffers/docs/cpptutorial#optimization-tips
-ParamSet recvParams;
-Result resultPackage;
+ResultSubscription recvSubscription;
+
+// Result and ParamSet packages are built on arenas and dropped at once after serialization (into the send buffer) or
+// applying. The initial blocks are reused, so a typical result (~4 KB of messages) makes no heap allocation other than
+// the image bytes. See unit-tests/ResultSerializationBenchmark.cpp. Only accessed on the TCP IO thread.
+constexpr size_t RESULT_ARENA_BLOCK_SIZE = 0x4000;
+constexpr size_t PARAMS_ARENA_BLOCK_SIZE = 0x2000;
+alignas(8) char resultArenaBlock[RESULT_ARENA_BLOCK_SIZE];
+alignas(8) char paramsArenaBlock[PARAMS_ARENA_BLOCK_SIZE];
+
+google::protobuf::ArenaOptions arenaOptions(char *block, size_t size) {
+    google::protobuf::ArenaOptions options;
+    options.initial_block = block;
+    options.initial_block_size = size;
+    return options;
+}
 
-Image *allocProtoJPG(const cv::Mat &mat) {
-    auto image = new package::Image;
-    image->set_format(package::Image::JPEG);
+google::protobuf::Arena resultArena(arenaOptions(resultArenaBlock, sizeof(resultArenaBlock)));
+google::protobuf::Arena paramsArena(arenaOptions(paramsArenaBlock, sizeof(paramsArenaBlock)));
 
-    if (!mat.empty()) {
-        cv::Mat outImage;
-        std::vector<uchar> buf;
-        float ratio = (float) TERMINAL_IMAGE_PREVIEW_HEIGHT / (float) mat.rows;
+Result *resultPackage = nullptr;  // on resultArena, valid until releaseResult()
 
-        cv::resize(mat, outImage, cv::Size(), ratio, ratio);
-        cv::imencode(".jpg", outImage, buf, {cv::IMWRITE_JPEG_QUALITY, 60});
+void newResult() {
+    resultArena.Reset();
+    resultPackage = google::protobuf::Arena::CreateMessage<Result>(&resultArena);
+}
+
+void releaseResult() {
+    resultPackage = nullptr;
+    resultArena.Reset();
+}
 
-        image->set_data(buf.data(), buf.size());
+Image *allocProtoImage(const PreviewEncoder::EncodedImage &encoded) {
+    auto image = google::protobuf::Arena::CreateMessage<Image>(&resultArena);
+    image->set_format(encoded.binary ? package::Image::BINARY : package::Image::JPEG);
+
+    if (encoded.data && !encoded.data->empty()) {
+        // set_data() would copy through a temporary string
+        image->mutable_data()->assign((const char *) encoded.data->data(), encoded.data->size());
     }
     return image;
 }
 
+Image *allocProtoJPG(const cv::Mat &mat) {
+    // Only for one-off images. Only called on the TCP IO thread, so the buffers can be reused.
+    static cv::Mat resized;
+    static std::vector<uint8_t> buf;
+
+    PreviewEncoder::encode(mat, TERMINAL_IMAGE_PREVIEW_HEIGHT, TERMINAL_PREVIEW_JPEG_QUALITY, resized, buf);
+
+    auto image = google::protobuf::Arena::CreateMessage<Image>(&resultArena);
+    image->set_format(package::Image::JPEG);
+    if (!buf.empty()) image->mutable_data()->assign((const char *) buf.data(), buf.size());
+    return image;
+}
+
 void sendStatusBarMsg(const std::string &msg) {
     socketServer.sendSingleString("msg", "Core: " + msg);
 }
 
-void sendResult(std::string_view mask) {
+// Channels of images, in the order of PreviewEncoder::Channel
+unsigned parseImageMask(std::string_view mask) {
+    unsigned channels = 0;
+    for (int i = 0; i < PreviewEncoder::CHANNEL_COUNT && i < (int) mask.length(); i++) {
+        if (mask[i] == 'T') channels |= 1U << i;
+    }
+    return channels;
+}
 
-    // Always send a package, but non-empty only if the executor is running
-    if (executor->hasOutputs()) {
-        resultPackage.Clear();
-
-        // Fetch outputs
-        cv::Mat originalImage, brightnessImage, colorImage, lightsImage;
-        std::vector<cv::RotatedRect> lightRects;
-        std::vector<AimingSolver::ArmorInfo> armors;
-        bool tkTriggered;
-        std::deque<AimingSolver::PulseInfo> tkPulses;
-        TimePoint tkPeriod;
-
-        executor->fetchOutputs(originalImage, brightnessImage, colorImage, lightsImage, lightRects, armors,
-                               tkTriggered, tkPulses, tkPeriod);
-        // If can't lock immediately, simply wait. Detector only performs several non-copy assignments.
-
-        // Detector images
-        {
-            // Empty handled in allocateProtoJPG
-            if (mask[0] == 'T') resultPackage.set_allocated_camera_image(allocProtoJPG(originalImage));
-            if (mask[1] == 'T') resultPackage.set_allocated_brightness_image(allocProtoJPG(brightnessImage));
-            if (mask[2] == 'T') resultPackage.set_allocated_color_image(allocProtoJPG(colorImage));
-            if (mask[3] == 'T') resultPackage.set_allocated_contour_image(allocProtoJPG(lightsImage));
+/**
+ * Build resultPackage with the outputs of the executor. Call only if executor->hasOutputs().
+ * @param subscription   Channels of images to include.
+ * @param skipFrameTime  If non-zero and the outputs are still of this frame, resultPackage is left untouched.
+ * @return Frame time of the outputs, 0 if skipped.
+ */
+TimePoint fillResult(unsigned subscription, TimePoint skipFrameTime = 0) {
+    // Fetch outputs
+    cv::Mat originalImage, brightnessImage, colorImage, lightsImage;
+    TimePoint imageFrameTime;
+    std::vector<cv::RotatedRect> lightRects;
+    std::vector<AimingSolver::ArmorInfo> armors;
+    bool tkTriggered;
+    std::deque<AimingSolver::PulseInfo> tkPulses;
+    TimePoint tkPeriod;
+    uint32_t paramsVersion;
+
+    TimePoint frameTime = executor->fetchOutputs(originalImage, brightnessImage, colorImage, lightsImage,
+                                                 imageFrameTime, lightRects, armors, tkTriggered, tkPulses, tkPeriod,
+                                                 paramsVersion);
+    // If can't lock immediately, simply wait. Detector only performs several assignments.
+
+    if (skipFrameTime != 0 && frameTime == skipFrameTime) return 0;
+    newResult();
+    auto arena = &resultArena;
+    resultPackage->set_params_version(paramsVersion);
+
+    // Detector images, encoded by previewEncoder. The images just fetched are only encoded here if there is no
+    // recent one (e.g. just subscribed). Empty (e.g. not output yet since subscribed) handled in allocProtoImage.
+    {
+        if (subscription & (1U << PreviewEncoder::ORIGINAL)) {
+            resultPackage->set_allocated_camera_image(allocProtoImage(
+                    previewEncoder->fetch(PreviewEncoder::ORIGINAL, originalImage, imageFrameTime)));
+        }
+        if (subscription & (1U << PreviewEncoder::BRIGHTNESS)) {
+            resultPackage->set_allocated_brightness_image(allocProtoImage(
+                    previewEncoder->fetch(PreviewEncoder::BRIGHTNESS, brightnessImage, imageFrameTime)));
+        }
+        if (subscription & (1U << PreviewEncoder::COLOR)) {
+            resultPackage->set_allocated_color_image(allocProtoImage(
+                    previewEncoder->fetch(PreviewEncoder::COLOR, colorImage, imageFrameTime)));
         }
+        if (subscription & (1U << PreviewEncoder::LIGHTS)) {
+            resultPackage->set_allocated_contour_image(allocProtoImage(
+                    previewEncoder->fetch(PreviewEncoder::LIGHTS, lightsImage, imageFrameTime)));
+        }
+    }
 
-        float imageScale = (float) TERMINAL_IMAGE_PREVIEW_HEIGHT / executor->getCurrentParams().roi_height();
-
-        // Light Rects
-        {
-            for (const auto &rect : lightRects) {
-                auto r = resultPackage.add_lights();
-                r->set_allocated_center(allocResultPoint2f(rect.center.x * imageScale, rect.center.y * imageScale));
-                r->set_allocated_size(allocResultPoint2f(rect.size.width * imageScale, rect.size.height * imageScale));
-                if (rect.angle <= 90) {
-                    r->set_angle(rect.angle);
-                } else {
-                    r->set_angle(rect.angle - 180);
-                }
+    float imageScale = (float) TERMINAL_IMAGE_PREVIEW_HEIGHT / executor->getCurrentParams().roi_height();
+
+    // Light Rects
+    {
+        for (const auto &rect : lightRects) {
+            auto r = resultPackage->add_lights();
+            r->set_allocated_center(allocResultPoint2f(
+                    rect.center.x * imageScale, rect.center.y * imageScale, arena));
+            r->set_allocated_size(allocResultPoint2f(
+                    rect.size.width * imageScale, rect.size.height * imageScale, arena));
+            if (rect.angle <= 90) {
+                r->set_angle(rect.angle);
+            } else {
+                r->set_angle(rect.angle - 180);
             }
         }
+    }
 
-        // Armors
-        {
-            for (const auto &armor : armors) {
-                auto armorInfo = resultPackage.add_armors();
-                for (int i = 0; i < 4; i++) {
-                    auto imagePoint = armorInfo->add_image_points();
-                    imagePoint->set_x(armor.imgPoints[i].x * imageScale);
-                    imagePoint->set_y(armor.imgPoints[i].y * imageScale);
-                }
-                armorInfo->set_allocated_image_center(allocResultPoint2f(
-                        armor.imgCenter.x * imageScale, armor.imgCenter.y * imageScale));
-                armorInfo->set_allocated_offset(allocResultPoint3f(armor.offset.x, armor.offset.y, armor.offset.z));
-                armorInfo->set_large_armor(armor.largeArmor);
-                armorInfo->set_number(armor.number);
-                armorInfo->set_selected(armor.flags & AimingSolver::ArmorInfo::SELECTED_TARGET);
-                armorInfo->set_allocated_ypd(allocResultPoint3f(armor.ypd.x, armor.ypd.y, armor.ypd.z));
+    // Armors
+    {
+        for (const auto &armor : armors) {
+            auto armorInfo = resultPackage->add_armors();
+            for (int i = 0; i < 4; i++) {
+                auto imagePoint = armorInfo->add_image_points();
+                imagePoint->set_x(armor.imgPoints[i].x * imageScale);
+                imagePoint->set_y(armor.imgPoints[i].y * imageScale);
             }
+            armorInfo->set_allocated_image_center(allocResultPoint2f(
+                    armor.imgCenter.x * imageScale, armor.imgCenter.y * imageScale, arena));
+            armorInfo->set_allocated_offset(allocResultPoint3f(
+                    armor.offset.x, armor.offset.y, armor.offset.z, arena));
+            armorInfo->set_large_armor(armor.largeArmor);
+            armorInfo->set_number(armor.number);
+            armorInfo->set_selected(armor.flags & AimingSolver::ArmorInfo::SELECTED_TARGET);
+            armorInfo->set_allocated_ypd(allocResultPoint3f(armor.ypd.x, armor.ypd.y, armor.ypd.z, arena));
         }
+    }
 
-        // TopKiller
-        {
-            resultPackage.set_tk_triggered(tkTriggered);
-            for (const auto &pulse : tkPulses) {
-                auto p = resultPackage.add_tk_pulses();
-                p->set_allocated_mid_ypd(allocResultPoint3f(pulse.ypdMid.x, pulse.ypdMid.y, pulse.ypdMid.z));
-                p->set_avg_time(pulse.avgTime / 10);
-                p->set_frame_count(pulse.frameCount);
-            }
-            resultPackage.set_tk_period(tkPeriod / 10);
+    // TopKiller
+    {
+        resultPackage->set_tk_triggered(tkTriggered);
+        for (const auto &pulse : tkPulses) {
+            auto p = resultPackage->add_tk_pulses();
+            p->set_allocated_mid_ypd(allocResultPoint3f(pulse.ypdMid.x, pulse.ypdMid.y, pulse.ypdMid.z, arena));
+            p->set_avg_time(pulse.avgTime / 10);
+            p->set_frame_count(pulse.frameCount);
+        }
+        resultPackage->set_tk_period(tkPeriod / 10);
+    }
+
+    // Aiming
+    {
+        AimingSolver::ControlCommand command;
+        if (executor->aimingSolver()->getControlCommand(command)) {
+            resultPackage->set_allocated_aiming_target(allocResultPoint2f(
+                    command.yawDelta, command.pitchDelta, arena));
+//            resultPackage->set_remaining_time_to_target(command.remainingTimeToTarget);
         }
+    }
 
-        // Aiming
-        {
-            AimingSolver::ControlCommand command;
-            if (executor->aimingSolver()->getControlCommand(command)) {
-                resultPackage.set_allocated_aiming_target(allocResultPoint2f(command.yawDelta, command.pitchDelta));
-//                resultPackage.set_remaining_time_to_target(command.remainingTimeToTarget);
+    return frameTime;
+}
+
+/** Result Streaming **/
+
+// After "subscribe", results are pushed to each Terminal at its subscribed rate on the TCP IO thread, instead of
+// replying to "fetch". Terminals subscribed to the same images share one serialized result. All the states are only
+// accessed on the TCP IO thread.
+struct Subscriber {
+    unsigned images = 0;
+    std::chrono::steady_clock::duration period{};
+    std::chrono::steady_clock::time_point lastPushTime;
+    TimePoint lastPushedFrameTime = 0;
+    bool emptyResultPushed = false;
+    bool needsKeyFrames = true;  // delta masks can't be decoded, as key frames were sent to other Terminals only
+    PreviewBudget budget{TERMINAL_PREVIEW_JPEG_QUALITY, TERMINAL_IMAGE_PREVIEW_HEIGHT};
+};
+
+std::map<Session *, Subscriber> subscribers;
+boost::asio::steady_timer streamTimer(tcpIOContext);
+bool streaming = false;
+std::chrono::steady_clock::duration streamTick{};  // period of the fastest subscriber
+
+// Mask channels of PreviewEncoder, encoded as deltas
+constexpr unsigned MASK_IMAGES = (1U << PreviewEncoder::BRIGHTNESS) | (1U << PreviewEncoder::COLOR) |
+                                 (1U << PreviewEncoder::LIGHTS);
+
+/**
+ * Mask channels of resultPackage that are key frames. Delta frames after them are only decodable by the Terminals
+ * that have received them.
+ */
+unsigned resultKeyFrameMasks() {
+    auto isKeyFrame = [](const Image &image) {  // empty if not set
+        return image.format() == package::Image::BINARY &&
+               isMaskKeyFrame((const uint8_t *) image.data().data(), image.data().size());
+    };
+    unsigned masks = 0;
+    if (isKeyFrame(resultPackage->brightness_image())) masks |= 1U << PreviewEncoder::BRIGHTNESS;
+    if (isKeyFrame(resultPackage->color_image())) masks |= 1U << PreviewEncoder::COLOR;
+    if (isKeyFrame(resultPackage->contour_image())) masks |= 1U << PreviewEncoder::LIGHTS;
+    return masks;
+}
+
+unsigned streamedImages() {
+    unsigned images = 0;
+    for (const auto &[session, subscriber] : subscribers) images |= subscriber.images;
+    return images;
+}
+
+/**
+ * Subscribe previewEncoder, and the image outputs of the executor, to the streamed images and the fetched ones.
+ * @param fetchedImages  Images of "fetch", which are output at the max preview rate if not streamed.
+ */
+void updateImageSubscription(unsigned fetchedImages = 0) {
+    unsigned images = streamedImages() | fetchedImages;
+    previewEncoder->setSubscription(images);
+    double fps = subscribers.empty() ? previewMaxFPS : std::chrono::duration<double>(1) / streamTick;
+    previewEncoder->setRate(fps);
+
+    // Channels of PreviewEncoder to the images of the executor, so that it only copies out the subscribed images
+    unsigned outputs = 0;
+    if (images & (1U << PreviewEncoder::ORIGINAL)) outputs |= Executor::ORIGINAL_OUTPUT;
+    if (images & (1U << PreviewEncoder::BRIGHTNESS)) outputs |= Executor::BRIGHTNESS_OUTPUT;
+    if (images & (1U << PreviewEncoder::COLOR)) outputs |= Executor::COLOR_OUTPUT;
+    if (images & (1U << PreviewEncoder::LIGHTS)) outputs |= Executor::LIGHTS_OUTPUT;
+    executor->setImageOutputs(outputs, fps);
+}
+
+void updatePreviewEncoderQuality() {
+    // Images are encoded once for all subscribers, so the most limited one decides
+    int quality = TERMINAL_PREVIEW_JPEG_QUALITY, height = TERMINAL_IMAGE_PREVIEW_HEIGHT;
+    for (const auto &[session, subscriber] : subscribers) {
+        quality = std::min(quality, subscriber.budget.quality());
+        height = std::min(height, subscriber.budget.height());
+    }
+    previewEncoder->setQuality(quality);
+    previewEncoder->setHeight(height);
+}
+
+void pushResults() {
+    auto now = std::chrono::steady_clock::now();
+    bool hasOutputs = executor->hasOutputs();
+
+    // Subscribers due for a result, grouped by images
+    std::map<unsigned, std::vector<std::pair<Session *, Subscriber *>>> groups;
+    bool restartMasks = false;
+    for (auto &[session, subscriber] : subscribers) {
+        if (now - subscriber.lastPushTime < subscriber.period - streamTick / 2) continue;  // not due yet
+
+        if (!hasOutputs) {
+            if (!subscriber.emptyResultPushed) {  // notify Terminal once
+                session->sendBytes("res", nullptr, 0);
+                subscriber.emptyResultPushed = true;
             }
+            continue;
         }
-        socketServer.sendBytes("res", resultPackage);
+        subscriber.emptyResultPushed = false;
 
-    } else {
+        // Under back-pressure (the previous result is still being written), skip this frame instead of queueing it
+        if (session->hasPendingSends()) continue;
 
-        socketServer.sendBytes("res", nullptr, 0);
+        if (subscriber.needsKeyFrames && (subscriber.images & MASK_IMAGES)) restartMasks = true;
+        groups[subscriber.images].emplace_back(session, &subscriber);
     }
+    if (groups.empty()) return;
 
+    if (restartMasks) previewEncoder->restartMasks();
+
+    unsigned keyFrameMasks = 0;
+    for (auto &[images, members] : groups) {
+        // Skip if all have got the current frame (e.g. single image detection)
+        TimePoint skipFrameTime = members[0].second->lastPushedFrameTime;
+        for (const auto &member : members) {
+            if (member.second->lastPushedFrameTime != skipFrameTime) skipFrameTime = 0;
+        }
+        TimePoint frameTime = fillResult(images, skipFrameTime);
+        if (frameTime == 0) continue;  // no new frame since the last push
+        auto payload = socketServer.serialize(*resultPackage);
+        keyFrameMasks |= resultKeyFrameMasks();
+        releaseResult();
+
+        for (auto &[session, subscriber] : members) {
+            session->sendBytes("res", payload);  // shared, not copied
+
+            // Adapt the images to the bandwidth budget
+            subscriber->budget.update(payload->size(),
+                                      std::chrono::duration<double>(now - subscriber->lastPushTime).count());
+            subscriber->lastPushTime = now;
+            subscriber->lastPushedFrameTime = frameTime;
+            subscriber->needsKeyFrames = false;
+        }
+    }
+
+    // The encoder now deltas against the key frames just sent, which those not served this time (not due, under
+    // back-pressure or without a new frame) have missed
+    for (auto &[session, subscriber] : subscribers) {
+        if (subscriber.lastPushTime != now && (subscriber.images & keyFrameMasks)) subscriber.needsKeyFrames = true;
+    }
+    updatePreviewEncoderQuality();
+}
+
+void handleStreamTimer(const boost::system::error_code &error) {
+    if (error || !streaming) return;  // cancelled
+
+    pushResults();
+
+    // Keep the schedule, but don't try to catch up with missed ticks
+    streamTimer.expires_at(std::max(streamTimer.expiry() + streamTick, std::chrono::steady_clock::now()));
+    streamTimer.async_wait(handleStreamTimer);
+}
+
+void startStreaming(Session *session, const ResultSubscription &subscription) {
+    // At least 1 FPS, unless the max preview rate is lower
+    double fps = std::clamp((double) subscription.fps(), std::min(1.0, previewMaxFPS), previewMaxFPS);
+
+    auto &subscriber = subscribers[session];  // new or updated
+    subscriber.images = parseImageMask(subscription.images());
+    subscriber.period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(1 / fps));
+    subscriber.budget.reset(subscription.max_bandwidth());
+    subscriber.lastPushTime = std::chrono::steady_clock::now();
+    subscriber.lastPushedFrameTime = 0;
+    subscriber.emptyResultPushed = false;
+    subscriber.needsKeyFrames = true;
+
+    streamTick = subscriber.period;
+    for (const auto &[s, other] : subscribers) streamTick = std::min(streamTick, other.period);
+    updateImageSubscription();
+    updatePreviewEncoderQuality();
+
+    if (!streaming) {  // otherwise the new tick takes effect from the next one
+        streaming = true;
+        streamTimer.expires_after(streamTick);
+        streamTimer.async_wait(handleStreamTimer);
+    }
+}
+
+/**
+ * @return Whether the session was streaming.
+ */
+bool stopStreaming(Session *session) {
+    if (subscribers.erase(session) == 0) return false;
+
+    if (subscribers.empty()) {
+        streaming = false;
+        streamTimer.cancel();
+    } else {
+        streamTick = subscribers.begin()->second.period;
+        for (const auto &[s, other] : subscribers) streamTick = std::min(streamTick, other.period);
+    }
+    updateImageSubscription();  // stop encoding the images no longer subscribed
+    updatePreviewEncoderQuality();
+    return true;
+}
+
+void handleDisconnection(Session *session) {
+    if (!stopStreaming(session)) updateImageSubscription();  // in case it was fetching
+}
+
+void sendResult(Session *session, std::string_view mask) {
+    unsigned images = parseImageMask(mask);
+    updateImageSubscription(images);
+    // Masks are delta-encoded against the previous ones sent. With other Terminals, this one may have missed some.
+    if (socketServer.sessions().size() > 1) previewEncoder->restartMasks();
+
+    // Always send a package, but non-empty only if the executor is running
+    if (executor->hasOutputs()) {
+        fillResult(images);
+        session->sendBytes("res", *resultPackage);
+        unsigned keyFrameMasks = resultKeyFrameMasks();
+        releaseResult();
+        for (auto &[s, subscriber] : subscribers) {  // streaming to others, which have missed the key frames
+            if (subscriber.images & keyFrameMasks) subscriber.needsKeyFrames = true;
+        }
+    } else {
+        session->sendBytes("res", nullptr, 0);
+    }
 }
 
-void handleRecvSingleString(std::string_view name, std::string_view s) {
+// Replies go to the requesting Terminal, while changes of the states (e.g. executionStarted) are sent to all
+
+void handleRecvSingleString(Session *session, std::string_view name, std::string_view s) {
     if (name == "fetch") {
-        sendResult(s);  // reply anyway, whether the executor is running or not
+        stopStreaming(session);
+        sendResult(session, s);  // reply anyway, whether the executor is running or not
 
     } else if (name == "switchImageSet") {
         if (executor->switchImageSet(std::string(s)) == 0) {
@@ -175,9 +473,10 @@ void handleRecvSingleString(std::string_view name, std::string_view s) {
 
     } else if (name == "previewVideo") {
         auto img = executor->getVideoPreview(std::string(s));
-        resultPackage.Clear();
-        resultPackage.set_allocated_camera_image(allocProtoJPG(img));
-        socketServer.sendBytes("res", resultPackage);
+        newResult();
+        resultPackage->set_allocated_camera_image(allocProtoJPG(img));
+        session->sendBytes("res", *resultPackage);
+        releaseResult();
 
     } else goto INVALID_COMMAND;
 
@@ -186,28 +485,43 @@ void handleRecvSingleString(std::string_view name, std::string_view s) {
     std::cerr << "Invalid single-string package <" << name << "> \"" << s << "\"" << std::endl;
 }
 
-void handleRecvBytes(std::string_view name, const uint8_t *buf, size_t size) {
+void handleRecvBytes(Session *session, std::string_view name, const uint8_t *buf, size_t size) {
     if (name == "fps") {
-        socketServer.sendListOfStrings("fps", {
+        session->sendListOfStrings("fps", {
                 std::to_string(executor->fetchAndClearInputFrameCounter()),
                 std::to_string(executor->fetchAndClearExecutorFrameCounter()),
                 std::to_string(executor->fetchAndClearSerialFrameCounter()),
         });
 
+    } else if (name == "subscribe") {
+        if (!recvSubscription.ParseFromArray(buf, size)) {
+            sendStatusBarMsg("invalid ResultSubscription package");
+        } else if (!std::isfinite(recvSubscription.fps())) {
+            sendStatusBarMsg("invalid subscription FPS");
+        } else {
+            startStreaming(session, recvSubscription);
+        }
+
+    } else if (name == "unsubscribe") {
+        stopStreaming(session);
+
     } else if (name == "setParams") {
-        if (!recvParams.ParseFromArray(buf, size)) {
+        auto recvParams = google::protobuf::Arena::CreateMessage<ParamSet>(&paramsArena);
+        if (!recvParams->ParseFromArray(buf, size)) {
             sendStatusBarMsg("invalid ParamSet package");
         } else {
-            executor->saveAndApplyParams(recvParams);
+            executor->saveAndApplyParams(*recvParams);  // copied by the executor
             sendStatusBarMsg(
-                    "parameter set \"" + executor->dataManager()->currentParamSetName() + "\" saved and applied");
+                    "parameter set \"" + executor->dataManager()->currentParamSetName() + "\" saved and applied" +
+                    " (version " + std::to_string(executor->getCurrentParamsVersion()) + ")");
         }
+        paramsArena.Reset();
 
     } else if (name == "getParams") {
-        socketServer.sendBytes("params", executor->getCurrentParams());
+        session->sendBytes("params", executor->getCurrentParams());
 
     } else if (name == "getCurrentParamSetName") {
-        socketServer.sendSingleString("currentParamSetName", executor->dataManager()->currentParamSetName());
+        session->sendSingleString("currentParamSetName", executor->dataManager()->currentParamSetName());
 
     } else if (name == "stop") {
         executor->stop();
@@ -219,9 +533,10 @@ void handleRecvBytes(std::string_view name, const uint8_t *buf, size_t size) {
             socketServer.sendSingleString("executionStarted", "camera");
 
             // Send camera info
-            resultPackage.Clear();
-            resultPackage.set_camera_info(executor->camera()->getCameraInfo());
-            socketServer.sendBytes("res", resultPackage);
+            newResult();
+            resultPackage->set_camera_info(executor->camera()->getCameraInfo());
+            socketServer.sendBytes("res", *resultPackage);
+            releaseResult();
         }
 
     } else if (name == "runImageSet") {
@@ -232,11 +547,11 @@ void handleRecvBytes(std::string_view name, const uint8_t *buf, size_t size) {
         }
 
     } else if (name == "fetchLists") {
-        socketServer.sendListOfStrings("imageSetList", executor->imageSet()->getImageSetList());
-        socketServer.sendListOfStrings("videoList", executor->videoSet()->getVideoList());
-        socketServer.sendListOfStrings("paramSetList", executor->dataManager()->getParamSetList());
-        socketServer.sendSingleString("currentParamSetName", executor->dataManager()->currentParamSetName());
-        socketServer.sendBytes("params", executor->getCurrentParams());
+        session->sendListOfStrings("imageSetList", executor->imageSet()->getImageSetList());
+        session->sendListOfStrings("videoList", executor->videoSet()->getVideoList());
+        session->sendListOfStrings("paramSetList", executor->dataManager()->getParamSetList());
+        session->sendSingleString("currentParamSetName", executor->dataManager()->currentParamSetName());
+        session->sendBytes("params", executor->getCurrentParams());
 
     } else if (name == "reloadLists") {
         executor->reloadLists();  // switch to default parameter set
@@ -273,9 +588,58 @@ std::unique_ptr<ParamSetManager> paramSetManager;
 std::unique_ptr<PositionCalculator> positionCalculator;
 std::unique_ptr<AimingSolver> aimingSolver;
 std::unique_ptr<Serial> serial;
+std::unique_ptr<TelemetrySender> telemetry;
 
 int main(int argc, char *argv[]) {
 
+    // Serial device: SERIAL_DEVICE defined in CMakeLists.txt by default, empty to disable
+    std::string serialDevice = SERIAL_DEVICE;
+    int serialBaudRate = Serial::DEFAULT_BAUD_RATE;
+    double previewCPUShare = TERMINAL_PREVIEW_CPU_SHARE;
+    std::string telemetryAddress;  // disabled by default
+    auto printUsage = [&] {
+        std::cerr << "Usage: " << argv[0] << " [--serial <device, empty to disable>] [--baud <baud rate>]"
+                  << " [--preview-fps <fps>] [--preview-cpu <CPU share of each encoder thread, (0, 1]>]"
+                  << " [--telemetry <unicast or multicast address of UDP telemetry, port " << TELEMETRY_PORT
+                  << ">]" << std::endl;
+    };
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--serial" && i + 1 < argc) {
+            serialDevice = argv[++i];
+        } else if (arg == "--baud" && i + 1 < argc) {
+            char *end;
+            long baudRate = std::strtol(argv[++i], &end, 10);
+            if (end == argv[i] || *end != '\0' || baudRate <= 0 || baudRate > INT_MAX) {
+                std::cerr << "Invalid baud rate \"" << argv[i] << "\", should be a positive integer" << std::endl;
+                printUsage();
+                return 1;
+            }
+            serialBaudRate = (int) baudRate;
+        } else if (arg == "--preview-fps" && i + 1 < argc) {
+            char *end;
+            previewMaxFPS = std::strtod(argv[++i], &end);
+            if (*end != '\0' || !(previewMaxFPS > 0) || !std::isfinite(previewMaxFPS)) {
+                std::cerr << "Invalid preview FPS \"" << argv[i] << "\", should be positive" << std::endl;
+                printUsage();
+                return 1;
+            }
+        } else if (arg == "--preview-cpu" && i + 1 < argc) {
+            char *end;
+            previewCPUShare = std::strtod(argv[++i], &end);
+            if (*end != '\0' || !(previewCPUShare > 0 && previewCPUShare <= 1)) {  // also rejects NaN
+                std::cerr << "Invalid preview CPU share \"" << argv[i] << "\", should be in (0, 1]" << std::endl;
+                printUsage();
+                return 1;
+            }
+        } else if (arg == "--telemetry" && i + 1 < argc) {
+            telemetryAddress = argv[++i];
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+
     std::cout << "CUDA device count: " << cv::cuda::getCudaEnabledDeviceCount() << std::endl;
     std::cout << cv::getBuildInformation() << std::endl;
 
@@ -289,26 +653,44 @@ int main(int argc, char *argv[]) {
     paramSetManager = std::make_unique<ParamSetManager>();
     positionCalculator = std::make_unique<PositionCalculator>();
     aimingSolver = std::make_unique<AimingSolver>();
-    if (strlen(SERIAL_DEVICE) != 0) {
+    if (!serialDevice.empty()) {
         serial = std::make_unique<Serial>(serialIOContext);
+        if (!serial->open(serialDevice, serialBaudRate)) {
+            return 1;  // error printed
+        }
     } else {
         std::cerr << "Serial disabled for debug purpose" << std::endl;
     }
+    if (!telemetryAddress.empty()) {
+        telemetry = std::make_unique<TelemetrySender>(serialIOContext);  // sent synchronously, no IO thread needed
+        if (!telemetry->open(telemetryAddress, TELEMETRY_PORT)) {
+            return 1;  // error printed
+        }
+    }
     executor = std::make_unique<Executor>(openCVCamera.get(), mvCamera.get(), imageSet.get(), videoSet.get(),
                                           paramSetManager.get(),
                                           detector.get(), positionCalculator.get(), aimingSolver.get(),
-                                          serial.get());
+                                          serial.get(), telemetry.get());
+
+    previewEncoder = std::make_unique<PreviewEncoder>([](PreviewEncoder::Images &images) {
+        return executor->fetchImageOutputs(images[PreviewEncoder::ORIGINAL], images[PreviewEncoder::BRIGHTNESS],
+                                           images[PreviewEncoder::COLOR], images[PreviewEncoder::LIGHTS]);
+    }, TERMINAL_IMAGE_PREVIEW_HEIGHT, TERMINAL_PREVIEW_ENCODER_THREADS);
+    previewEncoder->setRate(previewMaxFPS);
+    previewEncoder->setCPUShare(previewCPUShare);
+    previewEncoder->setQuality(TERMINAL_PREVIEW_JPEG_QUALITY);
 
     tcpIOThread = new std::thread([] {
         boost::asio::executor_work_guard<boost::asio::io_context::executor_type> workGuard(tcpIOContext.get_executor());
         tcpIOContext.run();  // this operation is blocking, until ioContext is deleted
     });
 
-    socketServer.startAccept();
+    socketServer.setSendQueueLimit(TERMINAL_CLIENT_SEND_QUEUE_LIMIT, TerminalSocketBase::DISCONNECT);
     socketServer.setCallbacks(handleRecvSingleString,
                               nullptr,
                               handleRecvBytes,
                               nullptr);
+    socketServer.startAccept();
 
     // Start on camera
     executor->startRealTimeDetection();
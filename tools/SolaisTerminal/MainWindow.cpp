@@ -50,11 +50,11 @@ MainWindow::MainWindow(QWidget *parent) :
     connect(ui->connectButton, &QPushButton::clicked, this, &MainWindow::connectToServer);
     connect(ui->transferImagesCheck, &QCheckBox::stateChanged, [this](auto state) {
         if (state == Qt::Checked) {
-            sendFetch();
+            sendSubscription();
         } else {
+            socket.sendBytes("unsubscribe");
             phases->resetImageLabels();
         }
-        holdingFetchPackage = false;  // the on-hold fetch package is either sent or discarded
     });
     connect(ui->reloadListsButton, &QPushButton::clicked, [this] {
         socket.sendBytes("reloadLists");
@@ -119,7 +119,7 @@ void MainWindow::connectToServer() {
             showStatusMessage("Connected to " + ui->serverCombo->currentText() + ":" + TCP_SOCKET_PORT_STR);
 
             if (ui->transferImagesCheck->isChecked()) {
-                holdingFetchPackage = true;
+                sendSubscription();
             }
 
             // Update UI
@@ -137,19 +137,27 @@ void MainWindow::connectToServer() {
     }
 }
 
-void MainWindow::sendFetch() {
+std::string MainWindow::visibleImagesMask() const {
     if (ui->fetchImageCheck->isChecked()) {
-        socket.sendSingleString("fetch",
-                                (std::string) (phases->cameraImageLabel->visibleRegion().isEmpty() &&
-                                               phases->armorImageLabel->visibleRegion().isEmpty() ? "F" : "T") +
-                                (phases->brightnessImageLabel->visibleRegion().isEmpty() ? "F" : "T") +
-                                (phases->colorImageLabel->visibleRegion().isEmpty() ? "F" : "T") +
-                                (phases->contourImageLabel->visibleRegion().isEmpty() ? "F" : "T"));
+        return (std::string) (phases->cameraImageLabel->visibleRegion().isEmpty() &&
+                              phases->armorImageLabel->visibleRegion().isEmpty() ? "F" : "T") +
+               (phases->brightnessImageLabel->visibleRegion().isEmpty() ? "F" : "T") +
+               (phases->colorImageLabel->visibleRegion().isEmpty() ? "F" : "T") +
+               (phases->contourImageLabel->visibleRegion().isEmpty() ? "F" : "T");
     } else {
-        socket.sendSingleString("fetch", "FFFF");
+        return "FFFF";
     }
 }
 
+void MainWindow::sendSubscription() {
+    package::ResultSubscription subscription;
+    subscribedImages = visibleImagesMask();
+    subscription.set_images(subscribedImages);
+    subscription.set_fps(TERMINAL_STREAM_FPS);
+    subscription.set_max_bandwidth(TERMINAL_STREAM_MAX_BANDWIDTH);
+    socket.sendBytes("subscribe", subscription);
+}
+
 void MainWindow::handleClientDisconnection(TerminalSocketClient *) {
     showStatusMessage(
             "Disconnected from " + ui->serverCombo->currentText() + ":" + TCP_SOCKET_PORT_STR);
@@ -157,6 +165,9 @@ void MainWindow::handleClientDisconnection(TerminalSocketClient *) {
     ui->connectButton->setText("Connect");
 
     phases->resetImageLabels();
+    brightnessMaskDecoder.reset();  // Core restarts the mask streams on the next subscription
+    colorMaskDecoder.reset();
+    contourMaskDecoder.reset();
     ui->imageSetList->clear();
     ui->imageList->clear();
     ui->paramSetCombo->clear();
@@ -168,9 +179,7 @@ void MainWindow::handleRecvBytes(std::string_view name, const uint8_t *buf, size
 
         if (ui->transferImagesCheck->isChecked()) {
             if (size == 0) {
-                // Do not send another fetch, but hold the fetch package
-                holdingFetchPackage = true;
-
+                // Core pushes again when the next execution starts
                 showStatusMessage("Execution stopped");
             } else {
                 if (!resultMessage.ParseFromArray(buf, size)) {
@@ -179,9 +188,9 @@ void MainWindow::handleRecvBytes(std::string_view name, const uint8_t *buf, size
                     ++resultPackageCounter;
                     applyResultMessage();
                 }
-                sendFetch();  // continue for next cycle
+                if (visibleImagesMask() != subscribedImages) sendSubscription();  // update the images to push
             }
-        }  // Otherwise, discard result and do not send next fetching request
+        }  // Otherwise, discard result (pushed before unsubscribe takes effect)
 
     } else if (name == "params") {
 
@@ -210,10 +219,7 @@ void MainWindow::handleRecvSingleString(std::string_view name, std::string_view
 
     } else if (name == "executionStarted") {
         showStatusMessage("Start execution on " + QString::fromStdString(std::string(s)));
-        if (holdingFetchPackage || lastRunSingleImage) {
-            sendFetch();
-            holdingFetchPackage = false;
-        }
+        // Results are pushed by Core
 
     } else goto INVALID_PACKAGE;
 
@@ -289,6 +295,28 @@ void MainWindow::showStatusMessage(const QString &text) {
     ui->statusBar->showMessage(text, 5000);
 }
 
+QImage MainWindow::decodePreviewImage(const package::Image &image, MaskDecoder *maskDecoder) {
+    QImage ret;
+    if (image.format() == package::Image::BINARY) {
+        if (!maskDecoder) return ret;
+        // Masks are in full resolution
+        int width, height;
+        if (maskDecoder->decode((const uint8_t *) image.data().c_str(), image.data().size(), maskBuffer,
+                                width, height)) {
+            ret = QImage(maskBuffer.data(), width, height, width, QImage::Format_Grayscale8)
+                    .scaledToHeight(TERMINAL_IMAGE_PREVIEW_HEIGHT);
+        }
+        return ret;
+    }
+
+    ret = QImage::fromData((const uint8_t *) image.data().c_str(), image.data().size()).copy();
+    // Core may lower the resolution to fit the bandwidth, while annotations are always in the full preview size
+    if (!ret.isNull() && ret.height() != TERMINAL_IMAGE_PREVIEW_HEIGHT) {
+        ret = ret.scaledToHeight(TERMINAL_IMAGE_PREVIEW_HEIGHT);
+    }
+    return ret;
+}
+
 void MainWindow::applyResultMessage() {
 
     // GROUP: Input
@@ -297,8 +325,7 @@ void MainWindow::applyResultMessage() {
     }
     if (resultMessage.has_camera_image()) {
         if (!resultMessage.camera_image().data().empty()) {
-            phases->cameraImage = QImage::fromData((const uint8_t *) resultMessage.camera_image().data().c_str(),
-                                                   resultMessage.camera_image().data().size()).copy();
+            phases->cameraImage = decodePreviewImage(resultMessage.camera_image());
             phases->cameraImageLabel->setPixmap(QPixmap::fromImage(phases->cameraImage));
         } else {
             phases->cameraImageLabel->setText("Empty");
@@ -308,9 +335,7 @@ void MainWindow::applyResultMessage() {
     // GROUP: Brightness
     if (resultMessage.has_brightness_image()) {
         if (!resultMessage.brightness_image().data().empty()) {
-            phases->brightnessImage = QImage::fromData(
-                    (const uint8_t *) resultMessage.brightness_image().data().c_str(),
-                    resultMessage.brightness_image().data().size()).copy();
+            phases->brightnessImage = decodePreviewImage(resultMessage.brightness_image(), &brightnessMaskDecoder);
             phases->brightnessImageLabel->setPixmap(QPixmap::fromImage(phases->brightnessImage));
         } else {
             phases->brightnessImageLabel->setText("Empty");
@@ -320,8 +345,7 @@ void MainWindow::applyResultMessage() {
     // GROUP: Color
     if (resultMessage.has_color_image()) {
         if (!resultMessage.color_image().data().empty()) {
-            phases->colorImage = QImage::fromData((const uint8_t *) resultMessage.color_image().data().c_str(),
-                                                  resultMessage.color_image().data().size()).copy();
+            phases->colorImage = decodePreviewImage(resultMessage.color_image(), &colorMaskDecoder);
             phases->colorImageLabel->setPixmap(QPixmap::fromImage(phases->colorImage));
         } else {
             phases->colorImageLabel->setText("Empty");
@@ -331,9 +355,7 @@ void MainWindow::applyResultMessage() {
     // GROUP: Contours
     if (resultMessage.has_contour_image()) {
         if (!resultMessage.contour_image().data().empty()) {
-            phases->contourImage = QImage::fromData((const uint8_t *) resultMessage.contour_image().data().c_str(),
-                                                    resultMessage.contour_image().data().size())
-                    .copy()
+            phases->contourImage = decodePreviewImage(resultMessage.contour_image(), &contourMaskDecoder)
                     .convertToFormat(QImage::Format_BGR888);
             QPainter painter(&phases->contourImage);
             painter.setPen(Qt::yellow);
@@ -426,7 +448,7 @@ void MainWindow::applyResultMessage() {
 }
 
 void MainWindow::updateStats() {
-    std::pair<unsigned, unsigned> stats = socket.getAndClearStats();  // {sent, received}
+    std::pair<uint64_t, uint64_t> stats = socket.getAndClearStats();  // {sent, received}
     ui->sentBytesLabel->setText(bytesToDateRate(stats.first));
     ui->recvBytesLabel->setText(bytesToDateRate(stats.second));
     ui->resultFPSLabel->setText(QString::number(resultPackageCounter) + " pkgs/s");
@@ -439,7 +461,7 @@ void MainWindow::performIO() {
     if (ioContext.stopped()) ioContext.restart();
 }
 
-QString MainWindow::bytesToDateRate(unsigned int n) {
+QString MainWindow::bytesToDateRate(uint64_t n) {
     n /= 1024;
     if (n < 1024) {
         return QString::number(n) + " KB/s";
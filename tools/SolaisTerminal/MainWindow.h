@@ -5,6 +5,7 @@
 #include <QtWidgets/QListWidget>
 //#include "AnnotatedMatViewer.h"
 #include "TerminalSocket.h"
+#include "MaskCodec.h"
 #include "Parameters.pb.h"
 
 namespace Ui {
@@ -52,10 +53,16 @@ private:
 
     void handleRecvListOfStrings(std::string_view name, const std::vector<const char *> &list);
 
-    static QString bytesToDateRate(unsigned bytes);
+    static QString bytesToDateRate(uint64_t bytes);
 
     void showStatusMessage(const QString &text);
 
+    // Threshold images are delta-encoded masks, each a separate stream
+    MaskDecoder brightnessMaskDecoder, colorMaskDecoder, contourMaskDecoder;
+    std::vector<uint8_t> maskBuffer;
+
+    QImage decodePreviewImage(const package::Image &image, MaskDecoder *maskDecoder = nullptr);
+
     void applyResultMessage();
 
     void runOnCurrentSelectedImage();
@@ -63,15 +70,17 @@ private:
     bool lastRunSingleImage = false;
 
     /*
-     * Solais Core always responses a Result package for a fetch package, but non-empty only if there are meaningful
-     * results (the executor is running, for example). If an empty Result package is received, Solais Terminal hold
-     * the fetch package until the start of next execution, which is triggered by the executionStarted package.
+     * Solais Terminal subscribes to results once, and Solais Core pushes them at the subscribed rate, as long as
+     * the executor is running. An empty Result package is pushed when the execution stops. The subscription is sent
+     * again when the set of visible images changes.
      */
-    bool holdingFetchPackage = false;
+    std::string subscribedImages;
 
     void loadListOfStringsToQListWidget(const std::vector<const char *> &list, QListWidget *listWidget);
 
-    void sendFetch();
+    std::string visibleImagesMask() const;
+
+    void sendSubscription();
 
 private slots:
 
@@ -0,0 +1,130 @@
+// Cost and output of ArmorClassifier on the armors detected in a recorded image set:
+//  - Time per frame of the classification of all armors of the frame in one batch, against one inference per armor.
+//  - Counts of the numbers, of the pairs of lights classified as not armors, and of the armors below
+//    armor_number_min_confidence of the parameter set.
+//
+// With a patch directory, the patches are saved as <image>_<index>.png, to be labeled for training. This works without
+// a model too.
+//
+// Usage: ArmorClassifierBenchmark <image set in DATA_SET_ROOT/images> [parameter set JSON = PARAM_SET_ROOT/params/
+//        meta-jetson-nano-1.json] [model = PARAM_SET_ROOT/models/armor_number.onnx] [patch directory]
+
+#include "ArmorClassifier.h"
+#include "ArmorDetector.h"
+#include "DetectionBenchmark.h"
+#include "ImageSet.h"
+#include <opencv2/imgcodecs.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace meta;
+
+static double elapsedMS(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <image set> [parameter set JSON] [model] [patch directory]" << std::endl;
+        return 1;
+    }
+    std::string imageSetName = argv[1];
+    std::string paramSetFile = argc > 2 ? argv[2] : std::string(PARAM_SET_ROOT) + "/params/meta-jetson-nano-1.json";
+    std::string modelFile = argc > 3 ? argv[3] : std::string(PARAM_SET_ROOT) + "/models/armor_number.onnx";
+    std::string patchDirectory = argc > 4 ? argv[4] : "";
+
+    ParamSet params;
+    if (!loadParamSet(paramSetFile, params)) return 1;
+    const float minConfidence = params.armor_number_min_confidence().val();
+
+    ArmorClassifier classifier;
+    if (!classifier.load(modelFile) && patchDirectory.empty()) return 1;
+    if (!patchDirectory.empty()) fs::create_directories(patchDirectory);
+
+    // All armors of the detector, without the classification
+    ArmorDetector detector;
+    params.mutable_armor_number_min_confidence()->set_enabled(false);
+    detector.setParams(params);
+
+    ImageSet imageSet;
+    if (imageSet.switchImageSet(imageSetName) == 0) {
+        std::cerr << "No image in image set " << imageSetName << std::endl;
+        return 1;
+    }
+
+    size_t frames = 0, framesWithArmors = 0, armorCount = 0, maxArmors = 0;
+    size_t rejected = 0, belowConfidence = 0;
+    std::map<int, size_t> numbers;
+    double batchedMS = 0, maxBatchedMS = 0, singleMS = 0;
+    std::vector<std::array<cv::Point2f, 4>> corners;
+    std::vector<ArmorClassifier::Result> results, singleResults;
+
+    for (const auto &name : imageSet.getImageList()) {
+        auto img = cv::imread((fs::path(DATA_SET_ROOT) / "images" / imageSetName / name).string());
+        if (img.empty()) continue;
+        if (img.rows != params.roi_height() || img.cols != params.roi_width()) {
+            cv::resize(img, img, cv::Size(params.roi_width(), params.roi_height()));
+        }
+        frames++;
+
+        auto armors = detector.detect(img);
+        if (armors.empty()) continue;
+        framesWithArmors++;
+        armorCount += armors.size();
+        maxArmors = std::max(maxArmors, armors.size());
+        corners.clear();
+        for (const auto &armor : armors) corners.emplace_back(armor.points);
+
+        if (!patchDirectory.empty()) {
+            cv::Mat patch;
+            for (size_t i = 0; i < corners.size(); i++) {
+                ArmorClassifier::extractPatch(img, corners[i], patch);
+                auto patchName = fs::path(name).stem().string() + "_" + std::to_string(i) + ".png";
+                cv::imwrite((fs::path(patchDirectory) / patchName).string(), patch);
+            }
+        }
+        if (!classifier.loaded()) continue;
+
+        // One batch
+        auto start = std::chrono::steady_clock::now();
+        classifier.classify(img, corners, results);
+        double ms = elapsedMS(start);
+        batchedMS += ms;
+        maxBatchedMS = std::max(maxBatchedMS, ms);
+
+        // One inference per armor
+        start = std::chrono::steady_clock::now();
+        for (const auto &armor : corners) classifier.classify(img, {armor}, singleResults);
+        singleMS += elapsedMS(start);
+
+        for (const auto &result : results) {
+            if (result.number < 0) {
+                rejected++;
+            } else {
+                numbers[result.number]++;
+                if (result.confidence < minConfidence) belowConfidence++;
+            }
+        }
+    }
+
+    std::printf("Image set %s: %zu images, %zu with armors, %zu armors (max %zu in a frame), parameter set %s\n",
+                imageSetName.c_str(), frames, framesWithArmors, armorCount, maxArmors, paramSetFile.c_str());
+    if (!patchDirectory.empty()) std::printf("Patches saved to %s\n", patchDirectory.c_str());
+    if (!classifier.loaded() || framesWithArmors == 0) return 0;
+
+    std::printf("\nModel %s\n", modelFile.c_str());
+    std::printf("%-20s %12s %12s\n", "Inference", "ms/frame", "max ms");
+    std::printf("%-20s %12.3f %12.3f\n", "batched", batchedMS / (double) framesWithArmors, maxBatchedMS);
+    std::printf("%-20s %12.3f %12s\n", "one per armor", singleMS / (double) framesWithArmors, "-");
+
+    std::printf("\n%-20s %12s\n", "Class", "armors");
+    for (const auto &[number, count] : numbers) std::printf("%-20d %12zu\n", number, count);
+    std::printf("%-20s %12zu\n", "not an armor", rejected);
+    std::printf("\n%zu armors below the min confidence %.2f\n", belowConfidence, minConfidence);
+    return 0;
+}
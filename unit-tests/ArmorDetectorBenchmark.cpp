@@ -0,0 +1,338 @@
+// Benchmark of ArmorDetector::detect(), specialized by setParams() for the modes and the enabled filters, against the
+// reference implementation with per-frame branches on them (as detect() was before the specialization). Each
+// combination of color threshold mode, enemy color and contour fit function is run with the filters of the parameter
+// set, then the parameter set is run with all filters disabled and all enabled. The results are checked to be the same.
+// CONNECTED_COMPONENTS has no reference implementation, so it is compared with contours fitted by ELLIPSE_DIRECT,
+// without the check.
+//
+// Usage: ArmorDetectorBenchmark [parameter set JSON = PARAM_SET_ROOT/params/meta-jetson-nano-1.json] [image]
+// Without an image, a synthetic one of the size of the parameter set is used, with red and blue armors and noise.
+
+#include "ArmorDetector.h"
+#include "DetectionBenchmark.h"
+#include <opencv2/imgcodecs.hpp>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace meta;
+using namespace cv;
+
+static volatile size_t sink;  // keep results alive
+
+template<typename F>
+static double measureMS(size_t iterations, F &&f) {
+    f();  // warm up
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) f();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() /
+           (double) iterations;
+}
+
+/** Reference **/
+
+static void canonicalizeRotatedRect(RotatedRect &rect) {
+    if (rect.size.width > rect.size.height) {
+        std::swap(rect.size.width, rect.size.height);
+        rect.angle += 90;
+    }
+    if (rect.angle < 0) {
+        rect.angle += 180;
+    } else if (rect.angle >= 180) {
+        rect.angle -= 180;
+    }
+}
+
+static std::vector<ArmorDetector::DetectedArmor> detectReference(const ParamSet &params, const Mat &imgOriginal) {
+    using DetectedArmor = ArmorDetector::DetectedArmor;
+
+    Mat imgGray, imgBrightness, imgColor, imgLights;
+    cvtColor(imgOriginal, imgGray, COLOR_BGR2GRAY);
+    threshold(imgGray, imgBrightness, params.brightness_threshold(), 255, THRESH_BINARY);
+
+    if (params.color_threshold_mode() == ParamSet::HSV) {
+        Mat hsvImg;
+        cvtColor(imgOriginal, hsvImg, COLOR_BGR2HSV);
+        if (params.enemy_color() == ParamSet::RED) {
+            Mat thresholdImg0, thresholdImg1;
+            inRange(hsvImg, Scalar(0, 0, 0), Scalar(params.hsv_red_hue().max(), 255, 255), thresholdImg0);
+            inRange(hsvImg, Scalar(params.hsv_red_hue().min(), 0, 0), Scalar(180, 255, 255), thresholdImg1);
+            imgColor = thresholdImg0 | thresholdImg1;
+        } else {
+            inRange(hsvImg, Scalar(params.hsv_blue_hue().min(), 0, 0), Scalar(params.hsv_blue_hue().max(), 255, 255),
+                    imgColor);
+        }
+    } else {
+        std::vector<Mat> channels;
+        split(imgOriginal, channels);
+        int mainChannel = (params.enemy_color() == ParamSet::RED ? 2 : 0);
+        int oppositeChannel = (params.enemy_color() == ParamSet::RED ? 0 : 2);
+        subtract(channels[mainChannel], channels[oppositeChannel], imgColor);
+        threshold(imgColor, imgColor, params.rb_channel_threshold(), 255, THRESH_BINARY);
+    }
+    if (params.contour_erode().enabled()) {
+        erode(imgColor, imgColor, getStructuringElement(
+                MORPH_ELLIPSE, Size(params.contour_erode().val(), params.contour_erode().val())));
+    }
+    if (params.contour_dilate().enabled()) {
+        dilate(imgColor, imgColor, getStructuringElement(
+                MORPH_ELLIPSE, Size(params.contour_dilate().val(), params.contour_dilate().val())));
+    }
+    imgLights = imgBrightness & imgColor;
+    if (params.contour_open().enabled()) {
+        morphologyEx(imgLights, imgLights, MORPH_OPEN, getStructuringElement(
+                MORPH_ELLIPSE, Size(params.contour_open().val(), params.contour_open().val())));
+    }
+    if (params.contour_close().enabled()) {
+        morphologyEx(imgLights, imgLights, MORPH_CLOSE, getStructuringElement(
+                MORPH_ELLIPSE, Size(params.contour_close().val(), params.contour_close().val())));
+    }
+
+    std::vector<RotatedRect> lightRects;
+    std::vector<std::vector<Point>> contours;
+    findContours(imgLights, contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
+    for (const auto &contour : contours) {
+        if (params.contour_pixel_count().enabled() && contour.size() < params.contour_pixel_count().val()) continue;
+        if (params.contour_min_area().enabled() && contourArea(contour) < params.contour_min_area().val()) continue;
+        RotatedRect rect;
+        switch (params.contour_fit_function()) {
+            case ParamSet::MIN_AREA_RECT:
+                rect = minAreaRect(contour);
+                break;
+            case ParamSet::ELLIPSE:
+                if (contour.size() < 5) continue;
+                rect = fitEllipse(contour);
+                break;
+            case ParamSet::ELLIPSE_AMS:
+                if (contour.size() < 5) continue;
+                rect = fitEllipseAMS(contour);
+                break;
+            case ParamSet::ELLIPSE_DIRECT:
+                if (contour.size() < 5) continue;
+                rect = fitEllipseDirect(contour);
+                break;
+            default:
+                continue;
+        }
+        canonicalizeRotatedRect(rect);
+        if (params.long_edge_min_length().enabled() && rect.size.height < params.long_edge_min_length().val()) {
+            continue;
+        }
+        if (params.light_max_rotation().enabled() &&
+            std::min(rect.angle, 180 - rect.angle) >= params.light_max_rotation().val()) {
+            continue;
+        }
+        if (params.light_aspect_ratio().enabled() &&
+            !inRange(rect.size.height / rect.size.width, params.light_aspect_ratio())) {
+            continue;
+        }
+        lightRects.emplace_back(rect);
+    }
+    if (lightRects.size() < 2) return {};
+    std::sort(lightRects.begin(), lightRects.end(), [](auto &a1, auto &a2) { return a1.center.x < a2.center.x; });
+
+    std::vector<DetectedArmor> acceptedArmors;
+    std::array<Point2f, 4> armorPoints;
+    for (int leftLightIndex = 0; leftLightIndex < (int) lightRects.size() - 1; ++leftLightIndex) {
+        const RotatedRect &leftRect = lightRects[leftLightIndex];
+        Point2f leftPoints[4];
+        leftRect.points(leftPoints);
+        armorPoints[0] = (leftRect.angle <= 90 ? leftPoints[0] + leftPoints[3] : leftPoints[1] + leftPoints[2]) / 2;
+        armorPoints[1] = (leftRect.angle <= 90 ? leftPoints[1] + leftPoints[2] : leftPoints[0] + leftPoints[3]) / 2;
+
+        for (int rightLightIndex = leftLightIndex + 1; rightLightIndex < (int) lightRects.size(); rightLightIndex++) {
+            const RotatedRect &rightRect = lightRects[rightLightIndex];
+            Point2f rightPoints[4];
+            rightRect.points(rightPoints);
+            bool upright = rightRect.angle <= 90;
+            armorPoints[3] = (upright ? rightPoints[0] + rightPoints[3] : rightPoints[1] + rightPoints[2]) / 2;
+            armorPoints[2] = (upright ? rightPoints[1] + rightPoints[2] : rightPoints[0] + rightPoints[3]) / 2;
+
+            auto leftVector = armorPoints[1] - armorPoints[0];
+            auto rightVector = armorPoints[2] - armorPoints[3];
+            auto topVector = armorPoints[2] - armorPoints[1];
+            auto bottomVector = armorPoints[3] - armorPoints[0];
+            if (leftVector.y > 0 || rightVector.y > 0 || topVector.x < 0 || bottomVector.x < 0) continue;
+
+            double leftLength = norm(armorPoints[1] - armorPoints[0]);
+            double rightLength = norm(armorPoints[2] - armorPoints[3]);
+            double averageLength = (leftLength + rightLength) / 2;
+            if (params.light_length_max_ratio().enabled() &&
+                (leftLength > rightLength ? leftLength / rightLength : rightLength / leftLength) >
+                params.light_length_max_ratio().val()) {
+                continue;
+            }
+            if (params.light_x_dist_over_l().enabled() &&
+                !inRange(std::abs(leftRect.center.x - rightRect.center.x) / averageLength,
+                         params.light_x_dist_over_l())) {
+                continue;
+            }
+            if (params.light_y_dist_over_l().enabled() &&
+                !inRange(std::abs(leftRect.center.y - rightRect.center.y) / averageLength,
+                         params.light_y_dist_over_l())) {
+                continue;
+            }
+            float angleDiff = std::abs(leftRect.angle - rightRect.angle);
+            if (params.light_angle_max_diff().enabled()) {
+                if (angleDiff > 90) angleDiff = 180 - angleDiff;
+                if (angleDiff > params.light_angle_max_diff().val()) continue;
+            }
+
+            double armorHeight = (norm(leftVector) + norm(rightVector)) / 2;
+            double armorWidth = (norm(topVector) + norm(bottomVector)) / 2;
+            bool largeArmor;
+            if (inRange(armorWidth / armorHeight, params.small_armor_aspect_ratio())) {
+                largeArmor = false;
+            } else if (inRange(armorWidth / armorHeight, params.large_armor_aspect_ratio())) {
+                largeArmor = true;
+            } else {
+                continue;
+            }
+
+            Point2f center = (armorPoints[0] + armorPoints[1] + armorPoints[2] + armorPoints[3]) / 4;
+            acceptedArmors.emplace_back(DetectedArmor{
+                    armorPoints, center, largeArmor, 0, {leftLightIndex, rightLightIndex}, angleDiff,
+                    (ArmorDetector::normalizeLightAngle(leftRect.angle) +
+                     ArmorDetector::normalizeLightAngle(rightRect.angle)) / 2});
+        }
+    }
+
+    // Remove armors that share lights, the large one or the one with lights more nonparallel
+    while (true) {
+        auto toRemove = acceptedArmors.end();
+        for (auto it = acceptedArmors.begin(); it != acceptedArmors.end() && toRemove == acceptedArmors.end(); ++it) {
+            for (auto it2 = it + 1; it2 != acceptedArmors.end(); ++it2) {
+                if (it->lightIndex[0] == it2->lightIndex[0] || it->lightIndex[0] == it2->lightIndex[1] ||
+                    it->lightIndex[1] == it2->lightIndex[0] || it->lightIndex[1] == it2->lightIndex[1]) {
+                    if (it->largeArmor != it2->largeArmor) {
+                        toRemove = it->largeArmor ? it : it2;
+                    } else {
+                        toRemove = (it->lightAngleDiff > it2->lightAngleDiff) ? it : it2;
+                    }
+                    break;
+                }
+            }
+        }
+        if (toRemove == acceptedArmors.end()) break;
+        acceptedArmors.erase(toRemove);
+    }
+    return acceptedArmors;
+}
+
+/** Input **/
+
+static Mat makeSyntheticImage(int width, int height) {
+    std::mt19937 rng(0);
+    Mat img(height, width, CV_8UC3);
+    randu(img, Scalar(0, 0, 0), Scalar(60, 60, 60));
+
+    // Armors of both colors, with the light bars bright in the center and colored at the edges
+    const Scalar colors[2] = {Scalar(40, 60, 255), Scalar(255, 120, 30)};  // red, blue (BGR)
+    for (int i = 0; i < 24; i++) {
+        float lightLength = std::uniform_real_distribution<float>(10, 60)(rng);
+        float armorWidth = lightLength * (i % 3 == 0 ? 4.0f : 2.2f);
+        Point2f center(std::uniform_real_distribution<float>(armorWidth, width - armorWidth)(rng),
+                       std::uniform_real_distribution<float>(lightLength, height - lightLength)(rng));
+        float angle = std::uniform_real_distribution<float>(-10, 10)(rng);
+        for (float side : {-0.5f, 0.5f}) {
+            RotatedRect light(center + Point2f(side * armorWidth, 0), Size2f(lightLength / 5, lightLength), angle);
+            ellipse(img, light, colors[i % 2], FILLED);
+            ellipse(img, RotatedRect(light.center, Size2f(light.size.width / 2, light.size.height * 0.8f), angle),
+                    Scalar(240, 240, 240), FILLED);
+        }
+    }
+
+    // Small bright spots, as reflections
+    for (int i = 0; i < 200; i++) {
+        Point center(std::uniform_int_distribution<int>(0, width - 1)(rng),
+                     std::uniform_int_distribution<int>(0, height - 1)(rng));
+        circle(img, center, std::uniform_int_distribution<int>(1, 4)(rng), colors[i % 2], FILLED);
+    }
+    return img;
+}
+
+static bool sameArmors(const std::vector<ArmorDetector::DetectedArmor> &a,
+                       const std::vector<ArmorDetector::DetectedArmor> &b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].points != b[i].points || a[i].largeArmor != b[i].largeArmor || a[i].lightIndex != b[i].lightIndex) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void setAllFilters(ParamSet &p, bool enabled) {
+    p.mutable_contour_pixel_count()->set_enabled(enabled);
+    p.mutable_contour_min_area()->set_enabled(enabled);
+    p.mutable_long_edge_min_length()->set_enabled(enabled);
+    p.mutable_light_aspect_ratio()->set_enabled(enabled);
+    p.mutable_light_max_rotation()->set_enabled(enabled);
+    p.mutable_light_length_max_ratio()->set_enabled(enabled);
+    p.mutable_light_x_dist_over_l()->set_enabled(enabled);
+    p.mutable_light_y_dist_over_l()->set_enabled(enabled);
+    p.mutable_light_angle_max_diff()->set_enabled(enabled);
+}
+
+int main(int argc, char *argv[]) {
+    std::string paramSetFile = argc > 1 ? argv[1] : std::string(PARAM_SET_ROOT) + "/params/meta-jetson-nano-1.json";
+
+    ParamSet baseParams;
+    if (!loadParamSet(paramSetFile, baseParams)) return 1;
+
+    Mat img;
+    if (argc > 2) {
+        img = imread(argv[2]);
+        if (img.empty()) {
+            std::cerr << "Failed to load image " << argv[2] << std::endl;
+            return 1;
+        }
+    } else {
+        img = makeSyntheticImage(baseParams.image_width(), baseParams.image_height());
+    }
+    std::printf("Image %dx%d, parameter set %s\n\n", img.cols, img.rows, paramSetFile.c_str());
+
+    ArmorDetector detector;
+    bool allSame = true;
+    std::printf("%-36s %8s %14s %14s %9s\n", "Combination", "armors", "reference ms", "specialized ms", "speedup");
+    auto report = [&](const std::string &name, const ParamSet &p) {
+        ParamSet referenceParams = p;
+        bool check = (p.contour_fit_function() != ParamSet::CONNECTED_COMPONENTS);
+        if (!check) referenceParams.set_contour_fit_function(ParamSet::ELLIPSE_DIRECT);
+
+        detector.setParams(p);
+        bool same = sameArmors(detector.detect(img), detectReference(referenceParams, img));
+        if (check) allSame &= same;
+        double referenceMS = measureMS(50, [&] { sink = detectReference(referenceParams, img).size(); });
+        double specializedMS = measureMS(50, [&] { sink = detector.detect(img).size(); });
+        std::printf("%-36s %8zu %14.3f %14.3f %8.2fx%s\n", name.c_str(), detector.detect(img).size(), referenceMS,
+                    specializedMS, referenceMS / specializedMS,
+                    !check ? "  (vs ELLIPSE_DIRECT)" : same ? "" : "  MISMATCH");
+    };
+
+    for (int mode = 0; mode < ParamSet::ColorThresholdMode_ARRAYSIZE; mode++) {
+        for (int enemy = 0; enemy < ParamSet::EnemyColor_ARRAYSIZE; enemy++) {
+            for (int fit = 0; fit < ParamSet::ContourFitFunction_ARRAYSIZE; fit++) {
+                ParamSet p = baseParams;
+                p.set_color_threshold_mode((ParamSet::ColorThresholdMode) mode);
+                p.set_enemy_color((ParamSet::EnemyColor) enemy);
+                p.set_contour_fit_function((ParamSet::ContourFitFunction) fit);
+                report(ParamSet::ColorThresholdMode_Name(p.color_threshold_mode()) + " " +
+                       ParamSet::EnemyColor_Name(p.enemy_color()) + " " +
+                       ParamSet::ContourFitFunction_Name(p.contour_fit_function()), p);
+            }
+        }
+    }
+
+    ParamSet p = baseParams;
+    setAllFilters(p, false);
+    report("Parameter set, no filters", p);
+    setAllFilters(p, true);
+    report("Parameter set, all filters", p);
+
+    std::printf("\n%s\n", allSame ? "All results are the same" : "Results MISMATCH");
+    return allSame ? 0 : 1;
+}
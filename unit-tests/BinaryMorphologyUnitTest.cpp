@@ -0,0 +1,222 @@
+// Bit-packed morphology against a reference of the definitions of cv::erode() and cv::dilate() (the min and max over
+// the kernel, with the default borders) on byte masks: kernels of cv::getStructuringElement(MORPH_ELLIPSE), packing
+// round trips with padded rows, erode, dilate, open and close for kernel sizes 1 to 9 on masks of various sizes, and
+// the time of the packed operations against the reference on lights-like masks.
+
+#include "BinaryMorphology.h"
+#include "UnitTestCheck.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace meta;
+
+struct Mask {
+    int width, height;
+    size_t step;  // with padding, like a ROI of a cv::Mat
+    std::vector<uint8_t> data;
+
+    Mask(int width, int height) : width(width), height(height), step(width + 5), data(step * height, 0) {}
+
+    uint8_t &at(int r, int c) { return data[r * step + c]; }
+
+    uint8_t at(int r, int c) const { return data[r * step + c]; }
+};
+
+// Kernel pattern as drawn by cv::getStructuringElement(MORPH_ELLIPSE, Size(size, size)), row-major
+static std::vector<uint8_t> kernelPattern(const BinaryMorphology::Kernel &kernel) {
+    int size = kernel.size(), anchor = size / 2;
+    std::vector<uint8_t> pattern(size * size, 0);
+    for (const auto &row : kernel.rows()) {
+        const auto &segment = kernel.segments()[row.segment];
+        for (int dx = segment.dxMin; dx <= segment.dxMax; dx++) pattern[(row.dy + anchor) * size + dx + anchor] = 1;
+    }
+    return pattern;
+}
+
+// Erode (min) or dilate (max) over the pattern, with pixels beyond the borders as 1 for erosion and 0 for dilation
+static Mask referenceMorph(const Mask &src, const std::vector<uint8_t> &pattern, int size, bool erode) {
+    Mask dst(src.width, src.height);
+    int anchor = size / 2;
+    for (int r = 0; r < src.height; r++) {
+        for (int c = 0; c < src.width; c++) {
+            bool v = erode;
+            for (int i = 0; i < size; i++) {
+                for (int j = 0; j < size; j++) {
+                    if (!pattern[i * size + j]) continue;
+                    int sr = r + i - anchor, sc = c + j - anchor;
+                    bool inside = sr >= 0 && sr < src.height && sc >= 0 && sc < src.width;
+                    bool p = inside ? src.at(sr, sc) != 0 : erode;
+                    v = erode ? (v && p) : (v || p);
+                }
+            }
+            dst.at(r, c) = v ? 255 : 0;
+        }
+    }
+    return dst;
+}
+
+static Mask referenceApply(const Mask &src, BinaryMorphology::Operation operation, int size) {
+    auto pattern = kernelPattern(BinaryMorphology::Kernel(size));
+    switch (operation) {
+        case BinaryMorphology::ERODE:
+            return referenceMorph(src, pattern, size, true);
+        case BinaryMorphology::DILATE:
+            return referenceMorph(src, pattern, size, false);
+        case BinaryMorphology::OPEN:
+            return referenceMorph(referenceMorph(src, pattern, size, true), pattern, size, false);
+        case BinaryMorphology::CLOSE:
+        default:
+            return referenceMorph(referenceMorph(src, pattern, size, false), pattern, size, true);
+    }
+}
+
+static Mask randomMask(int width, int height, double density, std::mt19937 &rng) {
+    Mask m(width, height);
+    std::bernoulli_distribution bit(density);
+    std::uniform_int_distribution<int> value(1, 255);
+    for (int r = 0; r < height; r++) {
+        for (int c = 0; c < width; c++) m.at(r, c) = bit(rng) ? (uint8_t) value(rng) : 0;  // any non-zero is 1
+    }
+    return m;
+}
+
+// Lights-like blobs with speckles of noise
+static Mask blobMask(int width, int height, std::mt19937 &rng) {
+    Mask m = randomMask(width, height, 0.01, rng);
+    for (int b = 0; b < 6; b++) {
+        int x0 = (b * 97) % (width - 20), y0 = (b * 61) % (height - 60);
+        for (int r = y0; r < y0 + 50; r++) {
+            for (int c = x0; c < x0 + 12; c++) m.at(r, c) = 255;
+        }
+    }
+    return m;
+}
+
+static bool matches(const Mask &a, const Mask &b) {
+    for (int r = 0; r < a.height; r++) {
+        for (int c = 0; c < a.width; c++) {
+            if ((a.at(r, c) != 0 ? 255 : 0) != b.at(r, c)) return false;
+        }
+    }
+    return true;
+}
+
+static const char *operationName(BinaryMorphology::Operation operation) {
+    static const char *names[] = {"erode", "dilate", "open", "close"};
+    return names[operation];
+}
+
+int main() {
+    std::mt19937 rng(2021);
+    BinaryMorphology morphology;
+    BinaryMorphology::Mask packed;
+
+    // Kernels as drawn by OpenCV
+    {
+        const std::vector<std::pair<int, std::vector<uint8_t>>> expected = {
+                {1, {1}},
+                {3, {0, 1, 0,
+                     1, 1, 1,
+                     0, 1, 0}},
+                {4, {0, 0, 1, 0,
+                     1, 1, 1, 1,
+                     1, 1, 1, 1,
+                     1, 1, 1, 1}},
+                {5, {0, 0, 1, 0, 0,
+                     1, 1, 1, 1, 1,
+                     1, 1, 1, 1, 1,
+                     1, 1, 1, 1, 1,
+                     0, 0, 1, 0, 0}},
+                {7, {0, 0, 0, 1, 0, 0, 0,
+                     0, 1, 1, 1, 1, 1, 0,
+                     1, 1, 1, 1, 1, 1, 1,
+                     1, 1, 1, 1, 1, 1, 1,
+                     1, 1, 1, 1, 1, 1, 1,
+                     0, 1, 1, 1, 1, 1, 0,
+                     0, 0, 0, 1, 0, 0, 0}},
+        };
+        for (const auto &[size, pattern] : expected) {
+            CHECK(kernelPattern(BinaryMorphology::Kernel(size)) == pattern, "kernel %d: pattern", size);
+        }
+    }
+
+    // Packing round trips, with widths around the words and the groups of 8 pixels
+    for (int width : {1, 7, 8, 9, 63, 64, 65, 127, 128, 130}) {
+        for (double density : {0.0, 0.3, 1.0}) {
+            Mask m = randomMask(width, 5, density, rng);
+            packed.pack(m.data.data(), m.width, m.height, m.step);
+            Mask out(width, 5);
+            std::fill(out.data.begin(), out.data.end(), 0x55);  // padding should be left as it is
+            packed.unpack(out.data.data(), out.step);
+            CHECK(matches(m, out), "pack %d wide, density %.1f: mismatch", width, density);
+            CHECK(out.data[out.step - 1] == 0x55, "pack %d wide: padding written", width);
+        }
+    }
+
+    // Operations against the reference
+    for (auto [width, height] : {std::make_pair(1, 1), std::make_pair(7, 3), std::make_pair(64, 5),
+                                 std::make_pair(65, 9), std::make_pair(130, 40), std::make_pair(200, 64)}) {
+        for (double density : {0.1, 0.5, 0.9}) {
+            Mask m = randomMask(width, height, density, rng);
+            for (int size = 1; size <= 9; size++) {
+                BinaryMorphology::Kernel kernel(size);
+                for (auto operation : {BinaryMorphology::ERODE, BinaryMorphology::DILATE, BinaryMorphology::OPEN,
+                                       BinaryMorphology::CLOSE}) {
+                    packed.pack(m.data.data(), m.width, m.height, m.step);
+                    morphology.apply(packed, operation, kernel);
+                    Mask out(width, height);
+                    packed.unpack(out.data.data(), out.step);
+                    CHECK(matches(referenceApply(m, operation, size), out), "%s %d on %dx%d, density %.1f: mismatch",
+                          operationName(operation), size, width, height, density);
+                }
+            }
+        }
+    }
+
+    // AND of two masks
+    {
+        Mask a = randomMask(100, 20, 0.5, rng), b = randomMask(100, 20, 0.5, rng), expected(100, 20);
+        for (int r = 0; r < 20; r++) {
+            for (int c = 0; c < 100; c++) expected.at(r, c) = (a.at(r, c) && b.at(r, c)) ? 255 : 0;
+        }
+        BinaryMorphology::Mask packedB;
+        packed.pack(a.data.data(), a.width, a.height, a.step);
+        packedB.pack(b.data.data(), b.width, b.height, b.step);
+        packed &= packedB;
+        Mask out(100, 20);
+        packed.unpack(out.data.data(), out.step);
+        CHECK(matches(expected, out), "and: mismatch");
+    }
+
+    // Time on lights-like masks, each operation including packing and unpacking
+    for (int size : {3, 5}) {
+        Mask m = blobMask(640, 512, rng), out(640, 512);
+        BinaryMorphology::Kernel kernel(size);
+        for (auto operation : {BinaryMorphology::ERODE, BinaryMorphology::OPEN, BinaryMorphology::CLOSE}) {
+            static constexpr int ROUNDS = 100;
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < ROUNDS; i++) {
+                packed.pack(m.data.data(), m.width, m.height, m.step);
+                morphology.apply(packed, operation, kernel);
+                packed.unpack(out.data.data(), out.step);
+            }
+            double packedTime = std::chrono::duration<double, std::micro>(
+                    std::chrono::steady_clock::now() - start).count() / ROUNDS;
+
+            start = std::chrono::steady_clock::now();
+            Mask expected = referenceApply(m, operation, size);
+            double referenceTime = std::chrono::duration<double, std::micro>(
+                    std::chrono::steady_clock::now() - start).count();
+
+            CHECK(matches(expected, out), "%s %d on blobs: mismatch", operationName(operation), size);
+            std::printf("640x512, %-6s %d: packed avg %.1f us, reference %.1f us\n", operationName(operation), size,
+                        packedTime, referenceTime);
+        }
+    }
+
+    return reportFailures();
+}
@@ -0,0 +1,101 @@
+// Microbenchmark of the CRC module: slicing-by-N against byte-at-a-time, interleaved batch verification against one
+// frame at a time, and the 16-offset resync scan against trying CRC8 at every offset.
+//
+// Usage: CRCBenchmark [frame length = 22]
+
+#include "CRC.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+static volatile uint32_t sink;  // keep results alive
+
+template<typename F>
+static double measureNS(size_t iterations, F &&f) {
+    f();  // warm up
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) f();
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() /
+           (double) iterations;
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t frameLength = argc > 1 ? (uint32_t) std::atoi(argv[1]) : 22;  // VisionCommand package by default
+    if (frameLength < 3) frameLength = 3;
+
+    std::mt19937 rng(0);
+    std::vector<uint8_t> stream(1 << 16);
+    for (auto &b : stream) b = (uint8_t) rng();
+
+    const size_t frameCount = 1024;
+    std::vector<const uint8_t *> frames(frameCount);
+    std::vector<uint32_t> lengths(frameCount, frameLength);
+    for (size_t i = 0; i < frameCount; i++) {
+        frames[i] = stream.data() + (i * 37) % (stream.size() - frameLength);
+    }
+    std::unique_ptr<bool[]> results(new bool[frameCount]);
+
+    std::printf("Frame length %u bytes\n\n", frameLength);
+
+    std::printf("%-28s %12s %12s\n", "Checksum", "ns/frame", "MB/s");
+    auto reportFrames = [&](const char *name, auto &&f) {
+        double ns = measureNS(200, [&] {
+            uint32_t acc = 0;
+            for (size_t i = 0; i < frameCount; i++) acc += f(frames[i], frameLength);
+            sink = acc;
+        }) / (double) frameCount;
+        std::printf("%-28s %12.2f %12.1f\n", name, ns, frameLength / ns * 1000);
+    };
+    reportFrames("CRC8 byte-at-a-time", rm::getCRC8CheckSumSliced<1>);
+    reportFrames("CRC8 slicing-by-4", rm::getCRC8CheckSumSliced<4>);
+    reportFrames("CRC8 slicing-by-8", rm::getCRC8CheckSumSliced<8>);
+    reportFrames("CRC16 byte-at-a-time", rm::getCRC16CheckSumSliced<1>);
+    reportFrames("CRC16 slicing-by-4", rm::getCRC16CheckSumSliced<4>);
+    reportFrames("CRC16 slicing-by-8", rm::getCRC16CheckSumSliced<8>);
+
+    std::printf("\n%-28s %12s\n", "Verification of 1024 frames", "ns/frame");
+    auto reportVerify = [&](const char *name, auto &&f) {
+        double ns = measureNS(200, f) / (double) frameCount;
+        std::printf("%-28s %12.2f\n", name, ns);
+    };
+    reportVerify("CRC8 one at a time", [&] {
+        uint32_t passed = 0;
+        for (size_t i = 0; i < frameCount; i++) passed += rm::verifyCRC8CheckSum(frames[i], frameLength);
+        sink = passed;
+    });
+    reportVerify("CRC8 batch", [&] {
+        sink = (uint32_t) rm::verifyCRC8Batch(frames.data(), lengths.data(), frameCount, results.get());
+    });
+    reportVerify("CRC16 one at a time", [&] {
+        uint32_t passed = 0;
+        for (size_t i = 0; i < frameCount; i++) passed += rm::verifyCRC16CheckSum(frames[i], frameLength);
+        sink = passed;
+    });
+    reportVerify("CRC16 batch", [&] {
+        sink = (uint32_t) rm::verifyCRC16Batch(frames.data(), lengths.data(), frameCount, results.get());
+    });
+
+    std::printf("\n%-28s %12s %12s\n", "Resync scan of 64 KiB", "ns/offset", "MB/s");
+    size_t offsets = (stream.size() - frameLength - 15) / 16 * 16;
+    auto reportScan = [&](const char *name, auto &&f) {
+        double ns = measureNS(5, f) / (double) offsets;
+        std::printf("%-28s %12.2f %12.1f\n", name, ns, 1000 / ns);
+    };
+    reportScan("CRC8 at every offset", [&] {
+        uint32_t found = 0;
+        for (size_t i = 0; i < offsets; i++) found += rm::verifyCRC8CheckSum(stream.data() + i, frameLength);
+        sink = found;
+    });
+    reportScan("CRC8 at 16 offsets at once", [&] {
+        uint32_t found = 0;
+        for (size_t i = 0; i < offsets; i += 16) {
+            found += (uint32_t) __builtin_popcount(rm::verifyCRC8At16Offsets(stream.data() + i, frameLength));
+        }
+        sink = found;
+    });
+
+    return 0;
+}
@@ -0,0 +1,219 @@
+// Stability of the armor position with the sub-pixel corner refinement (corner_refinement) on still frames, against the
+// corners as fitted from the lights of the same parameter set:
+//  - Standard deviation of the corners [pixel], of the PnP solution x, y, z and distance [mm], and of yaw and pitch
+//    [deg], over the frames, and the reduction of the variance by the refinement.
+//  - Time per frame of the detection, for the cost of the refinement.
+//
+// The frames are either a recorded image set of a still scene, or a synthetic one: a small armor projected with the
+// calibration, rendered once with anti-aliasing and blur, with new sensor noise on each frame. The armor closest to
+// the center of the image is taken on each frame.
+//
+// Usage: CornerRefinementBenchmark [image set in DATA_SET_ROOT/images, or "synthetic"] [parameter set JSON =
+//        PARAM_SET_ROOT/params/meta-jetson-nano-1.json] [synthetic frames = 200] [synthetic distance = 4000 mm]
+
+#include "ArmorDetector.h"
+#include "DetectionBenchmark.h"
+#include "CalibrationStore.h"
+#include "ImageSet.h"
+#include "PositionCalculator.h"
+#include <opencv2/calib3d/calib3d.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace meta;
+
+/**
+ * Running sums of a value for the standard deviation.
+ */
+struct Deviation {
+    double sum = 0;
+    double sumSquares = 0;
+    size_t count = 0;
+
+    void add(double v) {
+        sum += v;
+        sumSquares += v * v;
+        count++;
+    }
+
+    double variance() const {
+        if (count < 2) return 0;
+        double mean = sum / (double) count;
+        return std::max(sumSquares / (double) count - mean * mean, 0.0);
+    }
+
+    double stdDev() const { return std::sqrt(variance()); }
+};
+
+struct ModeResult {
+    double totalMS = 0;
+    size_t solvedFrames = 0;
+    Deviation corners[4][2];
+    Deviation x, y, z, distance, yaw, pitch;
+
+    double cornerStd() const {  // RMS of the corner coordinates
+        double sum = 0;
+        for (const auto &corner : corners) sum += corner[0].variance() + corner[1].variance();
+        return std::sqrt(sum / 8);
+    }
+};
+
+static ModeResult run(ArmorDetector &detector, const PositionCalculator &positionCalculator,
+                      const std::vector<cv::Mat> &frames) {
+    ModeResult result;
+    detector.detect(frames.front());  // warm up
+    for (const auto &frame : frames) {
+        auto start = std::chrono::steady_clock::now();
+        auto armors = detector.detect(frame);
+        result.totalMS += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        const cv::Point2f imageCenter((float) frame.cols / 2, (float) frame.rows / 2);
+        const ArmorDetector::DetectedArmor *armor = nullptr;
+        for (const auto &a : armors) {
+            if (!armor || cv::norm(a.center - imageCenter) < cv::norm(armor->center - imageCenter)) armor = &a;
+        }
+        cv::Point3f offset;
+        if (!armor || !positionCalculator.solve(armor->points, armor->largeArmor, false, offset)) continue;
+
+        result.solvedFrames++;
+        for (int i = 0; i < 4; i++) {
+            result.corners[i][0].add(armor->points[i].x);
+            result.corners[i][1].add(armor->points[i].y);
+        }
+        result.x.add(offset.x);
+        result.y.add(offset.y);
+        result.z.add(offset.z);
+        result.distance.add(cv::norm(offset));
+        result.yaw.add(std::atan2(offset.x, offset.z) * 180 / CV_PI);
+        result.pitch.add(std::atan2(offset.y, offset.z) * 180 / CV_PI);
+    }
+    return result;
+}
+
+/**
+ * Render a small armor facing the camera with some yaw, at the distance ahead and in the calibration of the ROI.
+ * Lights are a saturated core in a halo of the enemy color.
+ */
+static cv::Mat renderArmor(const ParamSet &params, const Calibration &calibration, float distance) {
+    cv::Mat img(params.roi_height(), params.roi_width(), CV_8UC3, cv::Scalar(30, 30, 30));
+
+    const float halfWidth = (float) params.small_armor_size().x() / 2;
+    const float halfHeight = (float) params.small_armor_size().y() / 2;
+    const cv::Mat rvec = (cv::Mat_<double>(3, 1) << 0, 20 * CV_PI / 180, 0);
+    const cv::Mat tvec = (cv::Mat_<double>(3, 1) << 0, 0, distance);
+
+    const bool blue = params.enemy_color() == ParamSet::BLUE;
+    const cv::Scalar halo = blue ? cv::Scalar(255, 140, 60) : cv::Scalar(60, 80, 255);
+    const cv::Scalar core = blue ? cv::Scalar(255, 245, 230) : cv::Scalar(230, 235, 255);
+
+    for (float side : {-1.f, 1.f}) {
+        for (const auto &[lightWidth, color] : {std::make_pair(24.f, halo), std::make_pair(8.f, core)}) {
+            std::vector<cv::Point3f> objectPoints;
+            for (auto [dx, dy] : {std::make_pair(-1, -1), std::make_pair(1, -1), std::make_pair(1, 1),
+                                  std::make_pair(-1, 1)}) {
+                objectPoints.emplace_back(side * halfWidth + (float) dx * lightWidth / 2, (float) dy * halfHeight, 0);
+            }
+            std::vector<cv::Point2f> imagePoints;
+            cv::projectPoints(objectPoints, rvec, tvec, calibration.cameraMatrix, calibration.distCoeffs,
+                              imagePoints);
+
+            static constexpr int SHIFT = 4;  // fractional bits of the vertices
+            std::vector<cv::Point> vertices;
+            for (const auto &p : imagePoints) {
+                vertices.emplace_back(cvRound(p.x * (1 << SHIFT)), cvRound(p.y * (1 << SHIFT)));
+            }
+            cv::fillConvexPoly(img, vertices, color, cv::LINE_AA, SHIFT);
+        }
+    }
+
+    cv::GaussianBlur(img, img, cv::Size(0, 0), 0.8);  // optics
+    return img;
+}
+
+int main(int argc, char *argv[]) {
+    std::string imageSetName = argc > 1 ? argv[1] : "synthetic";
+    std::string paramSetFile = argc > 2 ? argv[2] : std::string(PARAM_SET_ROOT) + "/params/meta-jetson-nano-1.json";
+    int syntheticFrames = argc > 3 ? std::atoi(argv[3]) : 200;
+    float syntheticDistance = argc > 4 ? (float) std::atof(argv[4]) : 4000;
+
+    ParamSet params;
+    if (!loadParamSet(paramSetFile, params)) return 1;
+
+    CalibrationStore calibrationStore(std::string(PARAM_SET_ROOT) + "/params");
+    auto calibration = calibrationStore.get(params.image_width(), params.image_height(), params.roi_width(),
+                                            params.roi_height());
+    if (!calibration) return 1;
+    PositionCalculator positionCalculator;
+    positionCalculator.setParameters({(float) params.small_armor_size().x(), (float) params.small_armor_size().y()},
+                                     {(float) params.large_armor_size().x(), (float) params.large_armor_size().y()},
+                                     calibration);
+
+    // Frames in memory at the ROI size, as ImageSet does
+    std::vector<cv::Mat> frames;
+    if (imageSetName == "synthetic") {
+        cv::Mat clean = renderArmor(params, *calibration, syntheticDistance);
+        cv::Mat noise(clean.size(), CV_16SC3);
+        cv::RNG rng(2333);
+        for (int i = 0; i < syntheticFrames; i++) {
+            rng.fill(noise, cv::RNG::NORMAL, cv::Scalar::all(0), cv::Scalar::all(5));
+            cv::Mat frame;
+            cv::add(clean, noise, frame, cv::noArray(), CV_8UC3);
+            frames.emplace_back(frame);
+        }
+        std::printf("Synthetic still frames: %zu frames of %dx%d, small armor at %.0f mm, parameter set %s\n\n",
+                    frames.size(), params.roi_width(), params.roi_height(), syntheticDistance, paramSetFile.c_str());
+    } else {
+        ImageSet imageSet;
+        if (imageSet.switchImageSet(imageSetName) == 0) {
+            std::cerr << "No image in image set " << imageSetName << std::endl;
+            return 1;
+        }
+        for (const auto &name : imageSet.getImageList()) {
+            auto img = cv::imread((fs::path(DATA_SET_ROOT) / "images" / imageSetName / name).string());
+            if (img.empty()) continue;
+            if (img.rows != params.roi_height() || img.cols != params.roi_width()) {
+                cv::resize(img, img, cv::Size(params.roi_width(), params.roi_height()));
+            }
+            frames.emplace_back(img);
+        }
+        std::printf("Image set %s: %zu images of %dx%d, parameter set %s\n\n", imageSetName.c_str(), frames.size(),
+                    params.roi_width(), params.roi_height(), paramSetFile.c_str());
+    }
+    if (frames.empty()) return 1;
+
+    ArmorDetector detector;
+    ModeResult results[2];
+    for (int refine = 0; refine <= 1; refine++) {
+        params.mutable_corner_refinement()->set_enabled(refine);
+        detector.setParams(params);
+        results[refine] = run(detector, positionCalculator, frames);
+    }
+
+    std::printf("%-10s %10s %8s %10s %8s %8s %8s %10s %10s %10s\n", "Refinement", "ms/frame", "solved", "corner px",
+                "x mm", "y mm", "z mm", "dist mm", "yaw deg", "pitch deg");
+    for (int refine = 0; refine <= 1; refine++) {
+        const auto &r = results[refine];
+        std::printf("%-10s %10.3f %8zu %10.4f %8.3f %8.3f %8.3f %10.3f %10.4f %10.4f\n", refine ? "on" : "off",
+                    r.totalMS / (double) frames.size(), r.solvedFrames, r.cornerStd(), r.x.stdDev(), r.y.stdDev(),
+                    r.z.stdDev(), r.distance.stdDev(), r.yaw.stdDev(), r.pitch.stdDev());
+    }
+
+    // Reduction of the variance, in percent
+    auto reduction = [](double off, double on) { return off > 0 ? 100 * (1 - on / off) : 0; };
+    const auto &off = results[0], &on = results[1];
+    std::printf("%-10s %10s %8s %9.1f%% %7.1f%% %7.1f%% %7.1f%% %9.1f%% %9.1f%% %9.1f%%\n", "var. red.", "", "",
+                reduction(off.cornerStd() * off.cornerStd(), on.cornerStd() * on.cornerStd()),
+                reduction(off.x.variance(), on.x.variance()), reduction(off.y.variance(), on.y.variance()),
+                reduction(off.z.variance(), on.z.variance()),
+                reduction(off.distance.variance(), on.distance.variance()),
+                reduction(off.yaw.variance(), on.yaw.variance()), reduction(off.pitch.variance(), on.pitch.variance()));
+
+    std::printf("\nStandard deviations over the frames with a solved armor. Light ends are searched up to %d px\n"
+                "beyond the fitted ones.\n", params.corner_refinement().val());
+    return 0;
+}
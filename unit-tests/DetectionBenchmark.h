@@ -0,0 +1,75 @@
+#ifndef META_VISION_SOLAIS_DETECTIONBENCHMARK_H
+#define META_VISION_SOLAIS_DETECTIONBENCHMARK_H
+
+#include "ArmorDetector.h"
+#include <google/protobuf/util/json_util.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * Parts shared by the benchmarks of the detector: loading the parameter set, and matching the detected armors against
+ * reference ones.
+ */
+
+/**
+ * Load a parameter set from a JSON file, the format of PARAM_SET_ROOT/params. Errors are printed.
+ * @return Whether the parameter set is loaded.
+ */
+static inline bool loadParamSet(const std::string &paramSetFile, meta::ParamSet &params) {
+    std::ifstream in(paramSetFile);
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    auto status = google::protobuf::util::JsonStringToMessage(buffer.str(), &params);
+    if (!in || !status.ok()) {
+        std::cerr << "Failed to load parameter set " << paramSetFile << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Armors matched against the reference ones, added up over frames.
+ */
+struct ArmorMatchResult {
+    size_t referenceArmors = 0;
+    size_t matchedArmors = 0;
+    size_t extraArmors = 0;     // not matched to any reference armor
+    double sumCornerError = 0;  // [pixel] of the matched armors
+    double maxCornerError = 0;
+};
+
+/**
+ * Match the armors of a frame against the reference ones by the center, within a quarter of the armor height.
+ */
+static inline void compare(const std::vector<meta::ArmorDetector::DetectedArmor> &reference,
+                           const std::vector<meta::ArmorDetector::DetectedArmor> &armors, ArmorMatchResult &result) {
+    result.referenceArmors += reference.size();
+    std::vector<bool> used(armors.size(), false);
+    for (const auto &ref : reference) {
+        float height = (float) (cv::norm(ref.points[1] - ref.points[0]) + cv::norm(ref.points[2] - ref.points[3])) / 2;
+        int best = -1;
+        double bestDist = height / 4;
+        for (int i = 0; i < (int) armors.size(); i++) {
+            double dist = cv::norm(armors[i].center - ref.center);
+            if (!used[i] && dist <= bestDist) {
+                best = i;
+                bestDist = dist;
+            }
+        }
+        if (best == -1) continue;
+        used[best] = true;
+        result.matchedArmors++;
+        for (int j = 0; j < 4; j++) {
+            double error = cv::norm(armors[best].points[j] - ref.points[j]);
+            result.sumCornerError += error;
+            result.maxCornerError = std::max(result.maxCornerError, error);
+        }
+    }
+    result.extraArmors += std::count(used.begin(), used.end(), false);
+}
+
+#endif //META_VISION_SOLAIS_DETECTIONBENCHMARK_H
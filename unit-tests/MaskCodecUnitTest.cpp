@@ -0,0 +1,176 @@
+// Round trips of the binary mask codec: key frames, packed bits for noise, delta frames with some frames never sent,
+// lost key frames, decoders at different rates, and corrupted data.
+
+#include "MaskCodec.h"
+#include "UnitTestCheck.h"
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace meta;
+
+struct Mask {
+    int width, height;
+    size_t step;  // with padding, like a ROI of a cv::Mat
+    std::vector<uint8_t> data;
+
+    Mask(int width, int height) : width(width), height(height), step(width + 5), data(step * height, 0) {}
+
+    uint8_t &at(int r, int c) { return data[r * step + c]; }
+};
+
+// Lights-like blobs: a few bright rectangles, the first ones of which move with the frame index
+static Mask blobMask(int width, int height, int frame, int moving = 6) {
+    Mask m(width, height);
+    for (int b = 0; b < 6; b++) {
+        int t = b < moving ? frame : 0;
+        int x0 = (b * 97 + t * 3) % (width - 20), y0 = (b * 61 + t) % (height - 60);
+        for (int r = y0; r < y0 + 50; r++) {
+            for (int c = x0; c < x0 + 12; c++) m.at(r, c) = 255;
+        }
+    }
+    return m;
+}
+
+static bool matches(const Mask &m, const std::vector<uint8_t> &decoded, int width, int height) {
+    if (width != m.width || height != m.height || decoded.size() != (size_t) width * height) return false;
+    for (int r = 0; r < height; r++) {
+        for (int c = 0; c < width; c++) {
+            if (decoded[r * width + c] != (m.data[r * m.step + c] ? 255 : 0)) return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    std::mt19937 rng(2021);
+    std::vector<uint8_t> encoded, decoded;
+    int w, h;
+
+    // Key frames of different contents and sizes
+    {
+        std::vector<Mask> masks;
+        for (auto size : {std::make_pair(1, 1), std::make_pair(7, 3), std::make_pair(13, 9), std::make_pair(640, 512)}) {
+            Mask zeros(size.first, size.second), ones(size.first, size.second), noise(size.first, size.second);
+            for (int r = 0; r < size.second; r++) {
+                for (int c = 0; c < size.first; c++) {
+                    ones.at(r, c) = 255;
+                    noise.at(r, c) = (rng() % 2) ? (uint8_t) (1 + rng() % 255) : 0;  // any non-zero is 1
+                }
+            }
+            masks.insert(masks.end(), {zeros, ones, noise});
+        }
+        masks.emplace_back(blobMask(640, 512, 0));
+
+        MaskEncoder encoder;
+        MaskDecoder decoder;
+        for (size_t i = 0; i < masks.size(); i++) {
+            const auto &m = masks[i];
+            encoder.encode(m.data.data(), m.width, m.height, m.step, encoded);
+            CHECK(!(encoded[0] & MASK_DELTA), "mask %zu: key frame expected", i);
+            CHECK(encoded.size() <= MASK_HEADER_SIZE + ((size_t) m.width * m.height + 7) / 8,
+                  "mask %zu: %zu bytes, larger than packed bits", i, encoded.size());
+            CHECK(decoder.decode(encoded.data(), encoded.size(), decoded, w, h), "mask %zu: decode", i);
+            CHECK(matches(m, decoded, w, h), "mask %zu: mismatch", i);
+        }
+    }
+
+    // Delta frames, with every third frame never sent. Half of the scene moves with different speeds.
+    for (int moving = 0; moving <= 6; moving += 3) {
+        MaskEncoder encoder(10);
+        MaskDecoder decoder;
+        size_t keyBytes = 0, deltaBytes = 0, keyCount = 0, deltaCount = 0;
+        double encodeTime = 0;
+        for (int frame = 0; frame < 100; frame++) {
+            Mask m = blobMask(640, 512, frame, moving);
+            auto start = std::chrono::steady_clock::now();
+            encoder.encode(m.data.data(), m.width, m.height, m.step, encoded);
+            encodeTime += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+            if (frame % 3 == 2) continue;  // encoded but skipped
+
+            bool delta = encoded[0] & MASK_DELTA;
+            (delta ? deltaBytes : keyBytes) += encoded.size();
+            (delta ? deltaCount : keyCount)++;
+            encoder.markDelivered(encoded.data(), encoded.size());
+            CHECK(decoder.decode(encoded.data(), encoded.size(), decoded, w, h), "delta frame %d: decode", frame);
+            CHECK(matches(m, decoded, w, h), "delta frame %d: mismatch", frame);
+        }
+        if (moving < 6) CHECK(deltaCount > 0, "%d moving: delta frames expected", moving);
+        std::printf("640x512, %d of 6 blobs moving (%d bytes raw): %zu key frames avg %zu bytes, "
+                    "%zu delta frames avg %zu bytes, encode avg %.1f us\n", moving, 640 * 512, keyCount, keyBytes / std::max<size_t>(keyCount, 1),
+                    deltaCount, deltaBytes / std::max<size_t>(deltaCount, 1), encodeTime / 100);
+    }
+
+    // Decoder restarted: deltas fail until the encoder is reset
+    {
+        MaskEncoder encoder(10);
+        MaskDecoder decoder;
+        Mask m = blobMask(64, 64, 0);
+        encoder.encode(m.data.data(), m.width, m.height, m.step, encoded);
+        encoder.markDelivered(encoded.data(), encoded.size());
+        CHECK(decoder.decode(encoded.data(), encoded.size(), decoded, w, h), "restart: first key frame");
+
+        decoder.reset();
+        encoder.encode(m.data.data(), m.width, m.height, m.step, encoded);
+        CHECK(encoded[0] & MASK_DELTA, "restart: delta frame expected");
+        CHECK(!decoder.decode(encoded.data(), encoded.size(), decoded, w, h), "restart: delta without key frame");
+
+        encoder.reset();
+        encoder.encode(m.data.data(), m.width, m.height, m.step, encoded);
+        CHECK(!(encoded[0] & MASK_DELTA), "restart: key frame expected after reset");
+        CHECK(decoder.decode(encoded.data(), encoded.size(), decoded, w, h) && matches(m, decoded, w, h),
+              "restart: key frame after reset");
+    }
+
+    // Two decoders sharing the encoder at different rates, like Terminals streaming at different FPS. The slow one misses
+    // key frames sent to the fast one only, and needs a restart before its next frame.
+    for (bool restartSlow : {false, true}) {
+        MaskEncoder encoder(4);
+        MaskDecoder fast, slow;
+        bool slowNeedsKeyFrame = true;
+        int slowFailures = 0;
+        for (int frame = 0; frame < 60; frame++) {
+            bool slowDue = frame % 3 == 0;
+            if (restartSlow && slowDue && slowNeedsKeyFrame) encoder.reset();
+
+            Mask m = blobMask(160, 120, frame, 1);
+            encoder.encode(m.data.data(), m.width, m.height, m.step, encoded);
+            encoder.markDelivered(encoded.data(), encoded.size());
+            CHECK(fast.decode(encoded.data(), encoded.size(), decoded, w, h) && matches(m, decoded, w, h),
+                  "different rates: fast frame %d", frame);
+            if (slowDue) {
+                if (!slow.decode(encoded.data(), encoded.size(), decoded, w, h) || !matches(m, decoded, w, h)) {
+                    slowFailures++;
+                }
+                slowNeedsKeyFrame = false;
+            } else if (isMaskKeyFrame(encoded.data(), encoded.size())) {
+                slowNeedsKeyFrame = true;
+            }
+        }
+        if (restartSlow) {
+            CHECK(slowFailures == 0, "different rates: %d slow frames undecodable with restarts", slowFailures);
+        } else {
+            CHECK(slowFailures > 0, "different rates: key frames expected to be missed without restarts");
+        }
+    }
+
+    // Corrupted data is rejected without overrun
+    {
+        MaskEncoder encoder;
+        MaskDecoder decoder;
+        Mask m = blobMask(64, 64, 0);
+        encoder.encode(m.data.data(), m.width, m.height, m.step, encoded);
+        for (size_t len = 0; len < MASK_HEADER_SIZE; len++) {
+            CHECK(!decoder.decode(encoded.data(), len, decoded, w, h), "truncated header %zu", len);
+        }
+        std::vector<uint8_t> bad(encoded);
+        bad.emplace_back(0xFF);  // unterminated varint
+        CHECK(!decoder.decode(bad.data(), bad.size(), decoded, w, h), "unterminated varint");
+        bad = encoded;
+        bad.insert(bad.end(), {0xFF, 0xFF, 0x7F});  // run beyond the mask
+        CHECK(!decoder.decode(bad.data(), bad.size(), decoded, w, h), "run beyond the mask");
+    }
+
+    return reportFailures();
+}
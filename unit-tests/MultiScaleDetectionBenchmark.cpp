@@ -0,0 +1,114 @@
+// Accuracy and throughput of the multi-scale detection (coarse_detection_level) on a recorded image set, against the
+// detection at the full resolution of the same parameter set:
+//  - Time per frame and speedup.
+//  - Recall: armors of the full resolution also found by the multi-scale detection, matched by the center within a
+//    quarter of the armor height, and extra armors not found at the full resolution.
+//  - Corner error [pixel] of the matched armors, mean and max, as seen by PositionCalculator::solve().
+//
+// Usage: MultiScaleDetectionBenchmark <image set in DATA_SET_ROOT/images> [parameter set JSON = PARAM_SET_ROOT/params/
+//        meta-jetson-nano-1.json] [max level = 3]
+
+#include "ArmorDetector.h"
+#include "DetectionBenchmark.h"
+#include "ImageSet.h"
+#include <opencv2/imgcodecs.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace meta;
+using Armors = std::vector<ArmorDetector::DetectedArmor>;
+
+struct LevelResult : ArmorMatchResult {
+    double totalMS = 0;
+};
+
+/**
+ * Run the detector on all images, returning the armors of each image and adding up the time.
+ */
+static std::vector<Armors> detectAll(ArmorDetector &detector, const std::vector<cv::Mat> &images, double &totalMS) {
+    std::vector<Armors> ret;
+    ret.reserve(images.size());
+    detector.detect(images.front());  // warm up
+    for (const auto &img : images) {
+        auto start = std::chrono::steady_clock::now();
+        ret.emplace_back(detector.detect(img));
+        totalMS += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    return ret;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <image set> [parameter set JSON] [max level = 3]" << std::endl;
+        return 1;
+    }
+    std::string imageSetName = argv[1];
+    std::string paramSetFile = argc > 2 ? argv[2] : std::string(PARAM_SET_ROOT) + "/params/meta-jetson-nano-1.json";
+    int maxLevel = argc > 3 ? std::atoi(argv[3]) : 3;
+
+    ParamSet params;
+    if (!loadParamSet(paramSetFile, params)) return 1;
+
+    // Images in memory at the ROI size, as ImageSet does
+    std::vector<cv::Mat> images;
+    {
+        ImageSet imageSet;
+        if (imageSet.switchImageSet(imageSetName) == 0) {
+            std::cerr << "No image in image set " << imageSetName << std::endl;
+            return 1;
+        }
+        for (const auto &name : imageSet.getImageList()) {
+            auto img = cv::imread((fs::path(DATA_SET_ROOT) / "images" / imageSetName / name).string());
+            if (img.empty()) continue;
+            if (img.rows != params.roi_height() || img.cols != params.roi_width()) {
+                cv::resize(img, img, cv::Size(params.roi_width(), params.roi_height()));
+            }
+            images.emplace_back(img);
+        }
+    }
+    std::printf("Image set %s: %zu images of %dx%d, parameter set %s\n\n", imageSetName.c_str(), images.size(),
+                params.roi_width(), params.roi_height(), paramSetFile.c_str());
+
+    ArmorDetector detector;
+
+    params.mutable_coarse_detection_level()->set_enabled(false);
+    detector.setParams(params);
+    double referenceMS = 0;
+    std::vector<Armors> reference = detectAll(detector, images, referenceMS);
+    size_t framesWithArmors = 0, referenceArmors = 0;
+    for (const auto &armors : reference) {
+        framesWithArmors += !armors.empty();
+        referenceArmors += armors.size();
+    }
+
+    std::printf("%-12s %10s %8s %8s %10s %8s %12s %12s\n", "Level", "ms/frame", "speedup", "recall", "armors", "extra",
+                "mean err px", "max err px");
+    std::printf("%-12s %10.3f %8s %8s %10zu %8s %12s %12s\n", "full", referenceMS / (double) images.size(),
+                "1.00x", "-", referenceArmors, "-", "-", "-");
+
+    for (int level = 1; level <= maxLevel; level++) {
+        params.mutable_coarse_detection_level()->set_enabled(true);
+        params.mutable_coarse_detection_level()->set_val(level);
+        detector.setParams(params);
+
+        LevelResult result;
+        std::vector<Armors> armors = detectAll(detector, images, result.totalMS);
+        for (size_t i = 0; i < images.size(); i++) compare(reference[i], armors[i], result);
+
+        char name[16];
+        std::snprintf(name, sizeof(name), "1/%d", 1 << level);
+        double recall = result.referenceArmors ? (double) result.matchedArmors / (double) result.referenceArmors : 1;
+        std::printf("%-12s %10.3f %7.2fx %7.1f%% %10zu %8zu %12.3f %12.3f\n", name,
+                    result.totalMS / (double) images.size(), referenceMS / result.totalMS, 100 * recall,
+                    result.matchedArmors + result.extraArmors, result.extraArmors,
+                    result.matchedArmors ? result.sumCornerError / (double) (4 * result.matchedArmors) : 0,
+                    result.maxCornerError);
+    }
+
+    std::printf("\n%zu of %zu frames have armors at the full resolution\n", framesWithArmors, images.size());
+    return 0;
+}
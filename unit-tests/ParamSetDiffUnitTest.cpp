@@ -0,0 +1,69 @@
+// ParamSetDiff: changed scalar, enum and message fields are found, unset fields differ from set ones, and all() has
+// every field.
+
+#include "Parameters.h"
+#include "UnitTestCheck.h"
+#include <cstdio>
+
+using namespace meta;
+
+static ParamSet makeParams() {
+    ParamSet p;
+    p.set_image_width(1280);
+    p.set_image_height(1024);
+    p.set_enemy_color(ParamSet::BLUE);
+    p.set_brightness_threshold(150);
+    p.set_allocated_gamma(allocToggledFloat(true, 1.5));
+    p.set_allocated_small_armor_size(allocIntPair(135, 55));
+    return p;
+}
+
+int main() {
+    ParamSet a = makeParams();
+
+    // No change
+    {
+        ParamSetDiff diff(a, makeParams());
+        CHECK(diff.empty(), "unchanged: %s", diff.toString().c_str());
+    }
+
+    // Scalar, enum and subfield of a message
+    {
+        ParamSet b = makeParams();
+        b.set_brightness_threshold(160);
+        b.set_enemy_color(ParamSet::RED);
+        b.mutable_gamma()->set_val(2);
+        ParamSetDiff diff(a, b);
+        CHECK(diff.changed(ParamSet::kBrightnessThresholdFieldNumber), "brightness_threshold not changed");
+        CHECK(diff.changed(ParamSet::kEnemyColorFieldNumber), "enemy_color not changed");
+        CHECK(diff.changed(ParamSet::kGammaFieldNumber), "gamma not changed");
+        CHECK(!diff.changed(ParamSet::kImageWidthFieldNumber), "image_width changed");
+        CHECK(!diff.changed(ParamSet::kSmallArmorSizeFieldNumber), "small_armor_size changed");
+        CHECK(diff.anyChanged({ParamSet::kImageWidthFieldNumber, ParamSet::kGammaFieldNumber}), "anyChanged");
+        CHECK(!diff.anyChanged({ParamSet::kImageWidthFieldNumber, ParamSet::kImageHeightFieldNumber}), "anyChanged");
+        CHECK(diff.toString() == "enemy_color gamma brightness_threshold", "toString: %s", diff.toString().c_str());
+    }
+
+    // Unset fields, even with the default value
+    {
+        ParamSet b = makeParams();
+        b.set_camera_id(0);
+        b.clear_gamma();
+        ParamSetDiff diff(a, b);
+        CHECK(diff.changed(ParamSet::kCameraIdFieldNumber), "set camera_id not changed");
+        CHECK(diff.changed(ParamSet::kGammaFieldNumber), "cleared gamma not changed");
+    }
+
+    // All
+    {
+        ParamSetDiff all = ParamSetDiff::all();
+        int fieldCount = ParamSet::GetDescriptor()->field_count();
+        int changedCount = 0;
+        for (int i = 0; i < fieldCount; i++) {
+            changedCount += all.changed(ParamSet::GetDescriptor()->field(i)->number());
+        }
+        CHECK(changedCount == fieldCount, "%d of %d fields in all()", changedCount, fieldCount);
+    }
+
+    return reportFailures();
+}
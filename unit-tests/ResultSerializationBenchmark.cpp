@@ -0,0 +1,191 @@
+// Microbenchmark of building and serializing Result packages as Solais Core does for each frame: heap-allocated
+// submessages on a reused message (set_allocated_* with alloc* helpers) against messages on an arena that is reset
+// after each serialization. Heap allocations are counted by replacing the global operator new.
+//
+// Usage: ResultSerializationBenchmark [lights = 12] [armors = 4]
+
+#include "Parameters.h"
+#include <google/protobuf/arena.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace meta;
+using namespace package;
+using google::protobuf::Arena;
+
+static size_t allocationCount = 0;  // single-threaded
+
+void *operator new(size_t size) {
+    allocationCount++;
+    if (void *p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete[](void *p) noexcept { std::free(p); }
+
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+void operator delete[](void *p, size_t) noexcept { std::free(p); }
+
+static volatile size_t sink;  // keep results alive
+
+// Sizes of the encoded preview images: a JPEG camera image and three masks
+static const size_t IMAGE_SIZES[] = {24000, 900, 900, 600};
+
+struct Frame {
+    int lights;
+    int armors;
+    std::vector<std::string> images;
+};
+
+static Image *allocImage(Arena *arena, const std::string &data) {
+    auto image = Arena::CreateMessage<Image>(arena);
+    image->set_format(Image::JPEG);
+    image->mutable_data()->assign(data.data(), data.size());  // set_data() would copy through a temporary string
+    return image;
+}
+
+/**
+ * Fill a result in the same way as fillResult() of Solais.
+ */
+static void fill(Result *result, Arena *arena, const Frame &frame) {
+    result->set_allocated_camera_image(allocImage(arena, frame.images[0]));
+    result->set_allocated_brightness_image(allocImage(arena, frame.images[1]));
+    result->set_allocated_color_image(allocImage(arena, frame.images[2]));
+    result->set_allocated_contour_image(allocImage(arena, frame.images[3]));
+
+    for (int i = 0; i < frame.lights; i++) {
+        auto r = result->add_lights();
+        r->set_allocated_center(allocResultPoint2f(100.0f + i, 200.0f + i, arena));
+        r->set_allocated_size(allocResultPoint2f(8.5f, 30.25f, arena));
+        r->set_angle(12.5f);
+    }
+
+    for (int a = 0; a < frame.armors; a++) {
+        auto armorInfo = result->add_armors();
+        for (int i = 0; i < 4; i++) {
+            auto imagePoint = armorInfo->add_image_points();
+            imagePoint->set_x(300.0f + i);
+            imagePoint->set_y(150.0f + i);
+        }
+        armorInfo->set_allocated_image_center(allocResultPoint2f(301.5f, 151.5f, arena));
+        armorInfo->set_allocated_offset(allocResultPoint3f(10.0f, 20.0f, 3000.0f, arena));
+        armorInfo->set_large_armor(a % 2);
+        armorInfo->set_number(a + 1);
+        armorInfo->set_selected(a == 0);
+        armorInfo->set_allocated_ypd(allocResultPoint3f(1.5f, -0.5f, 3000.0f, arena));
+    }
+
+    result->set_tk_triggered(false);
+    for (int i = 0; i < 3; i++) {
+        auto p = result->add_tk_pulses();
+        p->set_allocated_mid_ypd(allocResultPoint3f(1.0f, 2.0f, 3000.0f, arena));
+        p->set_avg_time(1000 + i);
+        p->set_frame_count(5);
+    }
+    result->set_tk_period(2000);
+
+    result->set_allocated_aiming_target(allocResultPoint2f(0.5f, -0.25f, arena));
+}
+
+struct Stats {
+    double buildNS = 0;
+    double serializeNS = 0;
+    double allocations = 0;
+    size_t bytes = 0;
+};
+
+template<typename Build, typename Release>
+static Stats measure(size_t iterations, Build &&build, Release &&release) {
+    std::vector<uint8_t> buf;  // reused send buffer
+
+    Stats stats;
+    for (size_t i = 0; i <= iterations; i++) {  // the first one to warm up
+        size_t allocationsBefore = allocationCount;
+        auto t0 = std::chrono::steady_clock::now();
+        Result *result = build();
+        auto t1 = std::chrono::steady_clock::now();
+        size_t size = result->ByteSizeLong();
+        if (buf.size() < size) buf.resize(size);
+        result->SerializeWithCachedSizesToArray(buf.data());
+        auto t2 = std::chrono::steady_clock::now();
+        release();
+        size_t allocations = allocationCount - allocationsBefore;
+        sink = buf[size / 2];
+
+        if (i == 0) continue;
+        stats.buildNS += std::chrono::duration<double, std::nano>(t1 - t0).count();
+        stats.serializeNS += std::chrono::duration<double, std::nano>(t2 - t1).count();
+        stats.allocations += (double) allocations;
+        stats.bytes = size;
+    }
+    stats.buildNS /= (double) iterations;
+    stats.serializeNS /= (double) iterations;
+    stats.allocations /= (double) iterations;
+    return stats;
+}
+
+int main(int argc, char *argv[]) {
+    Frame frame;
+    frame.lights = argc > 1 ? std::atoi(argv[1]) : 12;
+    frame.armors = argc > 2 ? std::atoi(argv[2]) : 4;
+    for (size_t size : IMAGE_SIZES) frame.images.emplace_back(size, 'x');
+
+    const size_t iterations = 20000;
+    std::printf("%d lights, %d armors, images of %zu + %zu + %zu + %zu bytes\n\n", frame.lights, frame.armors,
+                IMAGE_SIZES[0], IMAGE_SIZES[1], IMAGE_SIZES[2], IMAGE_SIZES[3]);
+    std::printf("%-32s %12s %12s %12s %10s\n", "Result", "allocs", "build ns", "serialize ns", "bytes");
+    auto report = [](const char *name, const Stats &stats) {
+        std::printf("%-32s %12.1f %12.0f %12.0f %10zu\n", name, stats.allocations, stats.buildNS, stats.serializeNS,
+                    stats.bytes);
+    };
+
+    // Before: one reused message, cleared for each frame, with heap-allocated submessages
+    {
+        Result reused;
+        report("reused message, heap submessages", measure(iterations, [&] {
+            reused.Clear();
+            fill(&reused, nullptr, frame);
+            return &reused;
+        }, [] {}));
+    }
+
+    // Arena with the default options: the blocks are freed on each reset
+    {
+        Arena arena;
+        report("arena, default blocks", measure(iterations, [&] {
+            auto result = Arena::CreateMessage<Result>(&arena);
+            fill(result, &arena, frame);
+            return result;
+        }, [&] { arena.Reset(); }));
+    }
+
+    // After: arena with a reused initial block, as Solais Core
+    {
+        static constexpr size_t INITIAL_BLOCK_SIZE = 0x4000;
+        alignas(8) static char initialBlock[INITIAL_BLOCK_SIZE];
+        google::protobuf::ArenaOptions options;
+        options.initial_block = initialBlock;
+        options.initial_block_size = sizeof(initialBlock);
+        Arena arena(options);
+
+        size_t spaceUsed = 0;
+        report("arena, 16 KiB initial block", measure(iterations, [&] {
+            auto result = Arena::CreateMessage<Result>(&arena);
+            fill(result, &arena, frame);
+            spaceUsed = arena.SpaceUsed();
+            return result;
+        }, [&] { arena.Reset(); }));
+        std::printf("\nArena space used per result: %zu bytes\n", spaceUsed);
+    }
+
+    return 0;
+}
@@ -0,0 +1,344 @@
+// Benchmark of the serial link against an emulated MCU over a pseudo-terminal, so that it runs without the robot.
+//
+// Serial opens the slave end of an openpty pair. The MCU emulator on the master end paces the bytes at the given baud
+// rate in both directions, parses packages with CRC8, replies to time sync requests on its own (offset and drifting)
+// clock, streams gimbal feedback that follows the commands, and corrupts a fraction of outgoing packages.
+//
+// Usage: SerialBenchmark [--baud 115200] [--duration 5] [--rate 0] [--feedback-rate 500] [--corrupt 0.01]
+//                        [--drift-ppm 50]
+//   --rate 0 sends commands as fast as the link sustains, keeping at most a few commands in flight.
+
+#include "Serial.h"
+#include "CRC.h"
+#include <pty.h>
+#include <poll.h>
+#include <pthread.h>
+#include <ctime>
+#include <termios.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace meta;
+using Package = Serial::Package;
+
+class MCUEmulator {
+public:
+
+    MCUEmulator(int fd, int baudRate, int feedbackRate, double corruptRate, double driftPPM)
+            : fd(fd), byteTime(10.0 / baudRate * 10000 /* [0.1ms] */), feedbackRate(feedbackRate),
+              corruptRate(corruptRate), drift(driftPPM * 1E-6), rng(0) {}
+
+    void start() {
+        shouldExit = false;
+        reader = std::thread(&MCUEmulator::readLoop, this);
+        writer = std::thread(&MCUEmulator::writeLoop, this);
+    }
+
+    void stop() {
+        shouldExit = true;
+        reader.join();
+        writer.join();
+    }
+
+    /** MCU clock: starts at some large offset and runs slightly slower than the host [0.1ms] **/
+    uint64_t mcuNow() const { return mcuTimeAt(TimeBase::now()); }
+
+    uint64_t mcuTimeAt(TimePoint host) const {
+        return CLOCK_OFFSET + (uint64_t) ((double) host * (1 - drift));
+    }
+
+    std::atomic<uint64_t> commandsReceived{0};
+
+    // Statistics, read after stop()
+    uint64_t timeSyncRequestsReceived = 0;
+    uint64_t crcErrors = 0;
+    uint64_t packagesSent = 0;
+    uint64_t packagesCorrupted = 0;
+    std::vector<double> latencies;  // from frame time to the arrival of the last byte of the command [0.1ms]
+
+private:
+
+    static constexpr uint64_t CLOCK_OFFSET = 0xFFFF0000ULL;  // let the 32-bit MCU time wrap soon
+
+    int fd;
+    double byteTime;
+    int feedbackRate;
+    double corruptRate;
+    double drift;
+
+    std::atomic<bool> shouldExit{false};
+    std::thread reader, writer;
+    std::mt19937 rng;
+
+    std::mutex echoMutex;
+    std::vector<Package> pendingEchoes;
+
+    std::atomic<int32_t> yaw{0}, pitch{0};  // MCU convention, [deg] * 100
+
+    static void sleepUntil(double time /* [0.1ms] */) {
+        auto now = (double) TimeBase::now();
+        if (time > now) std::this_thread::sleep_for(std::chrono::microseconds((int64_t) ((time - now) * 100)));
+    }
+
+    void readLoop() {
+        uint8_t buf[256];
+        Package pkg;
+        size_t received = 0, expected = 1;
+        double lineFreeAt = 0;  // when the bytes read so far finish arriving at the baud rate
+
+        while (!shouldExit) {
+            pollfd pfd{fd, POLLIN, 0};
+            if (poll(&pfd, 1, 100) <= 0) continue;
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n <= 0) continue;
+
+            lineFreeAt = std::max(lineFreeAt, (double) TimeBase::now()) + byteTime * (double) n;
+            sleepUntil(lineFreeAt);
+
+            for (ssize_t i = 0; i < n; i++) {
+                auto *p = (uint8_t *) &pkg;
+                p[received++] = buf[i];
+                if (received == 1) {
+                    if (pkg.sof != Serial::SOF) received = 0;
+                } else if (received == 2) {
+                    if (pkg.cmdID >= Serial::CMD_ID_COUNT) {
+                        received = 0;
+                    } else {
+                        expected = 2 + Serial::DATA_SIZE[pkg.cmdID] + 1;
+                    }
+                } else if (received == expected) {
+                    handlePackage(pkg, expected, (TimePoint) lineFreeAt);
+                    received = 0;
+                }
+            }
+        }
+    }
+
+    void handlePackage(Package &pkg, size_t size, TimePoint arrival) {
+        if (!rm::verifyCRC8CheckSum((uint8_t *) &pkg, size)) {
+            ++crcErrors;
+            return;
+        }
+        switch (pkg.cmdID) {
+            case Serial::VISION_CONTROL_CMD_ID: {
+                ++commandsReceived;
+                if (pkg.command.flag & Serial::VisionCommand::TIME_SYNCHRONIZED) {
+                    uint64_t mcuArrival = mcuTimeAt(arrival);
+                    uint64_t frameTime = TimeBase::unwrap(mcuArrival, pkg.command.frameTime);
+                    latencies.emplace_back((double) (int64_t) (mcuArrival - frameTime));
+                }
+                // The gimbal moves a fraction of the way in each command
+                yaw += pkg.command.yawDelta / 10;
+                pitch += pkg.command.pitchDelta / 10;
+                break;
+            }
+            case Serial::TIME_SYNC_REQUEST_CMD_ID: {
+                ++timeSyncRequestsReceived;
+                Package echo{};
+                echo.sof = Serial::SOF;
+                echo.cmdID = Serial::TIME_SYNC_ECHO_CMD_ID;
+                echo.timeSyncEcho.hostTime = pkg.timeSyncRequest.hostTime;
+                echo.timeSyncEcho.mcuTime = (uint32_t) mcuTimeAt(arrival);
+                std::lock_guard<std::mutex> lock(echoMutex);
+                pendingEchoes.emplace_back(echo);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    void writeLoop() {
+        std::uniform_real_distribution<double> uniform(0, 1);
+        double feedbackInterval = 10000.0 / feedbackRate;  // [0.1ms]
+        double nextFeedback = (double) TimeBase::now();
+        double lineFreeAt = 0;
+
+        auto send = [&](Package &pkg) {
+            size_t size = 2 + Serial::DATA_SIZE[pkg.cmdID] + 1;
+            rm::appendCRC8CheckSum((uint8_t *) &pkg, size);
+            if (uniform(rng) < corruptRate) {
+                // Flip a bit after the header, which Serial must detect with CRC8
+                size_t offset = 2 + rng() % (size - 2);
+                ((uint8_t *) &pkg)[offset] ^= (uint8_t) (1U << (rng() % 8));
+                ++packagesCorrupted;
+            }
+            lineFreeAt = std::max(lineFreeAt, (double) TimeBase::now()) + byteTime * (double) size;
+            sleepUntil(lineFreeAt);
+            if (write(fd, &pkg, size) == (ssize_t) size) ++packagesSent;
+        };
+
+        while (!shouldExit) {
+            std::vector<Package> echoes;
+            {
+                std::lock_guard<std::mutex> lock(echoMutex);
+                echoes.swap(pendingEchoes);
+            }
+            for (auto &echo : echoes) send(echo);
+
+            if ((double) TimeBase::now() >= nextFeedback) {
+                Package pkg{};
+                pkg.sof = Serial::SOF;
+                pkg.cmdID = Serial::GIMBAL_FEEDBACK_CMD_ID;
+                pkg.feedback.time = (uint32_t) mcuNow();
+                pkg.feedback.yaw = yaw;
+                pkg.feedback.pitch = pitch;
+                send(pkg);
+                nextFeedback = std::max(nextFeedback + feedbackInterval, (double) TimeBase::now() - feedbackInterval);
+            } else {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }
+    }
+};
+
+static double percentile(std::vector<double> v, double p) {
+    if (v.empty()) return 0;
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, (size_t) (p * (double) v.size()))];
+}
+
+int main(int argc, char *argv[]) {
+    int baudRate = Serial::DEFAULT_BAUD_RATE;
+    double duration = 5;
+    int commandRate = 0;
+    int feedbackRate = 500;
+    double corruptRate = 0.01;
+    double driftPPM = 50;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        if (arg == "--baud") baudRate = std::stoi(argv[i + 1]);
+        else if (arg == "--duration") duration = std::stod(argv[i + 1]);
+        else if (arg == "--rate") commandRate = std::stoi(argv[i + 1]);
+        else if (arg == "--feedback-rate") feedbackRate = std::stoi(argv[i + 1]);
+        else if (arg == "--corrupt") corruptRate = std::stod(argv[i + 1]);
+        else if (arg == "--drift-ppm") driftPPM = std::stod(argv[i + 1]);
+        else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    // Pseudo-terminal in raw mode
+    int master, slave;
+    char slaveName[256];
+    if (openpty(&master, &slave, slaveName, nullptr, nullptr) != 0) {
+        std::cerr << "openpty failed: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    termios tio{};
+    tcgetattr(slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+
+    boost::asio::io_context ioContext;
+    Serial serial(ioContext);
+    if (!serial.open(slaveName, baudRate)) return 1;
+
+    MCUEmulator mcu(master, baudRate, feedbackRate, corruptRate, driftPPM);
+    mcu.start();
+
+    std::thread ioThread([&] {
+        boost::asio::executor_work_guard<boost::asio::io_context::executor_type> workGuard(ioContext.get_executor());
+        ioContext.run();
+    });
+
+    std::cout << "SerialBenchmark: " << slaveName << " @ " << baudRate << " baud, command rate "
+              << (commandRate ? std::to_string(commandRate) + " Hz" : "max") << ", feedback rate " << feedbackRate
+              << " Hz, corrupt rate " << corruptRate << ", MCU drift " << driftPPM << " ppm" << std::endl;
+
+    // Wait for clock synchronization
+    auto syncStart = std::chrono::steady_clock::now();
+    while (!serial.mcuClock().synchronized()) {
+        if (std::chrono::steady_clock::now() - syncStart > std::chrono::seconds(3)) {
+            std::cerr << "Clock is not synchronized in 3 s" << std::endl;
+            return 1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    // Send commands
+    uint64_t commandsQueued = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + std::chrono::microseconds((int64_t) (duration * 1E6));
+    auto next = start;
+    while (std::chrono::steady_clock::now() < end) {
+        if (commandRate) {
+            std::this_thread::sleep_until(next);
+            next += std::chrono::microseconds(1000000 / commandRate);
+        } else {
+            // Keep a few commands in flight, so that the latency shows the link rather than the queue length. The
+            // kernel buffer of the pseudo-terminal is much larger than a UART one, so count on the MCU side.
+            while (commandsQueued - mcu.commandsReceived > 4) {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }
+        serial.sendControlCommand(true, false, TimeBase::now(), 1, -1, 3000, 0, 0, 0, 0, 0);
+        ++commandsQueued;
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Clock error measured against the emulator's ground truth
+    TimePoint hostNow = TimeBase::now();
+    double syncError = (double) (int64_t) (serial.mcuClock().toHost(mcu.mcuTimeAt(hostNow)) - hostNow);
+
+    // Let the commands drain to the MCU, then the last feedback to Serial
+    auto drainStart = std::chrono::steady_clock::now();
+    while (mcu.commandsReceived < commandsQueued &&
+           std::chrono::steady_clock::now() - drainStart < std::chrono::seconds(10)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    mcu.stop();
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    timespec ioCPUTime{};
+    clockid_t ioClock;
+    if (pthread_getcpuclockid(ioThread.native_handle(), &ioClock) == 0) clock_gettime(ioClock, &ioCPUTime);
+
+    ioContext.stop();
+    ioThread.join();
+    serial.close();
+
+    Serial::Statistics stats = serial.statistics();
+    GimbalHistory::Attitude attitude{};
+    serial.gimbalHistory().getLatest(attitude);
+
+    std::cout << std::fixed << std::setprecision(2)
+              << "Commands:   " << commandsQueued << " queued, " << mcu.commandsReceived << " received by MCU, "
+              << (double) commandsQueued / elapsed << " Hz sustained\n"
+              << "Latency:    mean " << (mcu.latencies.empty() ? 0 :
+                                         std::accumulate(mcu.latencies.begin(), mcu.latencies.end(), 0.0) /
+                                         (double) mcu.latencies.size()) / 10
+              << " ms, p50 " << percentile(mcu.latencies, 0.5) / 10
+              << " ms, p99 " << percentile(mcu.latencies, 0.99) / 10
+              << " ms, max " << percentile(mcu.latencies, 1) / 10 << " ms\n"
+              << "Feedback:   " << mcu.packagesSent << " sent by MCU, " << stats.packagesReceived
+              << " received, " << mcu.packagesCorrupted << " corrupted, " << stats.crcErrors << " CRC errors\n"
+              << "Link:       " << stats.bytesSent << " bytes sent, " << stats.bytesReceived << " bytes received, "
+              << mcu.crcErrors << " CRC errors at MCU\n"
+              << "IO thread:  " << (double) ioCPUTime.tv_sec * 1E3 + (double) ioCPUTime.tv_nsec / 1E6 << " ms CPU, "
+              << ((double) ioCPUTime.tv_sec * 1E9 + (double) ioCPUTime.tv_nsec) /
+                 (double) (stats.bytesReceived + stats.bytesSent) << " ns per byte\n"
+              << "Clock sync: error " << syncError / 10 << " ms, drift " << serial.mcuClock().driftPPM()
+              << " ppm (actual " << driftPPM << "), uncertainty " << serial.mcuClock().uncertainty() / 10 << " ms\n"
+              << "Gimbal:     yaw " << attitude.yaw << ", pitch " << attitude.pitch << std::endl;
+
+    // A corrupted package may cause extra CRC errors when the parser resyncs on a 0xA5 inside it
+    bool ok = stats.crcErrors >= mcu.packagesCorrupted &&
+              stats.packagesReceived + mcu.packagesCorrupted == mcu.packagesSent &&
+              mcu.commandsReceived == commandsQueued && mcu.crcErrors == 0;
+    std::cout << (ok ? "PASS" : "FAIL: packages lost or CRC errors not detected") << std::endl;
+
+    close(master);
+    close(slave);
+    return ok ? 0 : 1;
+}
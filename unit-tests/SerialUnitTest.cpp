@@ -3,33 +3,57 @@
 //
 
 #include "Serial.h"
+#include <atomic>
 #include <thread>
 #include <iostream>
 
 boost::asio::io_context tcpIOContext;
 
-std::thread ioThread([]{
-    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> workGuard(tcpIOContext.get_executor());
-    tcpIOContext.run();  // this operation is blocking, until ioContext is deleted
-});
+std::atomic<float> yawDelta = 0, pitchDelta = 0;
+std::atomic<bool> stopping = false;
 
-float yawDelta = 0, pitchDelta = 0;
+meta::Serial serial(tcpIOContext);  // opened in main()
 
-meta::Serial serial(tcpIOContext);
+int main(int argc, char *argv[]) {
 
-std::thread sendThread([]{
-    while (true) {
-        serial.sendTargetAngles(yawDelta, pitchDelta);
-        std::this_thread::sleep_for(std::chrono::seconds(1));
-    }
-});
+    if (!serial.open(argc > 1 ? argv[1] : "/dev/ttyTHS1")) return 1;
+
+    // Started after the serial is opened, and joined on exit
+    auto workGuard = boost::asio::make_work_guard(tcpIOContext);
+    std::thread ioThread([] { tcpIOContext.run(); });
+
+    std::thread sendThread([] {
+        while (!stopping) {
+            serial.sendControlCommand(true, false, meta::TimeBase::now(), yawDelta, pitchDelta, 0, 0, 0, 0, 0, 0);
 
-int main() {
+            if (serial.mcuClock().synchronized()) {
+                std::cout << "MCU clock: drift = " << serial.mcuClock().driftPPM() << " ppm, uncertainty = "
+                          << serial.mcuClock().uncertainty() / 10 << " ms" << std::endl;
+            }
 
+            meta::GimbalHistory::Attitude attitude;
+            if (serial.gimbalHistory().getLatest(attitude)) {
+                std::cout << "Gimbal [" << attitude.time << "] yaw = " << attitude.yaw
+                          << ", pitch = " << attitude.pitch << std::endl;
+            }
+
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+    });
+
+    float yaw, pitch;
     while (true) {
         std::cout << "Set new yawDelta and pitchDelta: ";
-        std::cin >> yawDelta >> pitchDelta;
+        if (!(std::cin >> yaw >> pitch)) break;  // EOF or invalid input
+        yawDelta = yaw;
+        pitchDelta = pitch;
     }
 
+    stopping = true;
+    sendThread.join();
+    boost::asio::post(tcpIOContext, [] { serial.close(); });  // on the IO thread
+    workGuard.reset();  // run() returns once the cancelled operations complete
+    ioThread.join();
+
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,173 @@
+// Telemetry over loopback: records are received intact over unicast and multicast, and lost, late and invalid
+// datagrams are counted.
+
+#include "Telemetry.h"
+#include "UnitTestCheck.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using namespace meta;
+using boost::asio::ip::udp;
+
+static constexpr int PORT = 18801;
+static constexpr const char *MULTICAST_ADDRESS = "239.255.80.1";
+
+boost::asio::io_context ioContext;
+std::vector<TelemetryRecord> received;
+
+static TelemetryRecord makeRecord(int i) {
+    TelemetryRecord r{};
+    r.frameTime = 10000 + i;
+    r.flags = (i % 2) ? TelemetryRecord::DETECTED : TelemetryRecord::NONE;
+    r.yawDelta = 0.5f * (float) i;
+    r.pitchDelta = -0.25f * (float) i;
+    r.distance = 3000;
+    r.stageMicros[TelemetryRecord::DETECT] = 1000 + i;
+    r.stageMicros[TelemetryRecord::LATENCY] = 5000 + i;
+    r.armorCount = i % (TelemetryRecord::MAX_ARMORS + 1);
+    for (int a = 0; a < r.armorCount; a++) {
+        r.armors[a].imageX = (int16_t) (100 + a);
+        r.armors[a].imageY = (int16_t) (200 + i);
+        r.armors[a].yaw = (float) a;
+        r.armors[a].number = a + 1;
+        r.armors[a].selected = (a == 0);
+    }
+    return r;
+}
+
+// Run the IO context until the number of records are received or the timeout
+static void waitFor(size_t count, int timeoutMS = 1000) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMS);
+    while (received.size() < count && std::chrono::steady_clock::now() < deadline) {
+        ioContext.run_one_for(std::chrono::milliseconds(10));
+    }
+}
+
+static void checkRecords(int count, const char *mode) {
+    CHECK(received.size() == (size_t) count, "%s: %zu of %d records received", mode, received.size(), count);
+    for (size_t i = 0; i < received.size(); i++) {
+        const auto &r = received[i];
+        auto expected = makeRecord((int) i);
+        CHECK(r.sequence == received[0].sequence + i, "%s: record %zu out of order", mode, i);
+        CHECK(r.frameTime == expected.frameTime && r.yawDelta == expected.yawDelta &&
+              r.pitchDelta == expected.pitchDelta && r.flags == expected.flags &&
+              r.stageMicros[TelemetryRecord::DETECT] == expected.stageMicros[TelemetryRecord::DETECT],
+              "%s: record %zu corrupted", mode, i);
+        CHECK(r.armorCount == expected.armorCount &&
+              std::memcmp(r.armors, expected.armors, sizeof(r.armors)) == 0,
+              "%s: armors of record %zu corrupted", mode, i);
+    }
+}
+
+// Send a raw datagram to the receiver
+static void sendRaw(udp::socket &socket, const void *data, size_t size) {
+    socket.send_to(boost::asio::buffer(data, size), udp::endpoint(boost::asio::ip::address_v4::loopback(), PORT));
+}
+
+int main() {
+    TelemetryReceiver receiver(ioContext);
+    auto collect = [](const TelemetryRecord &r) { received.emplace_back(r); };
+
+    // Unicast
+    {
+        CHECK(receiver.open(PORT, "", collect), "failed to open receiver");
+        TelemetrySender sender(ioContext);
+        CHECK(sender.open("127.0.0.1", PORT), "failed to open sender");
+
+        const int count = 200;
+        for (int i = 0; i < count; i++) {
+            auto r = makeRecord(i);
+            CHECK(sender.send(r), "failed to send record %d", i);
+            if (i % 20 == 19) waitFor(i + 1);  // don't overflow the receive buffer of the socket
+        }
+        waitFor(count);
+        checkRecords(count, "unicast");
+        CHECK(sender.statistics().recordsSent == count, "sender statistics");
+        auto stats = receiver.statistics();
+        CHECK(stats.recordsReceived == count && stats.recordsLost == 0 && stats.recordsLate == 0 &&
+              stats.invalidDatagrams == 0, "receiver statistics");
+        received.clear();
+    }
+
+    // Loss, reordering and invalid datagrams
+    {
+        CHECK(receiver.open(PORT, "", collect), "failed to reopen receiver");
+        udp::socket raw(ioContext, udp::v4());
+
+        for (uint32_t seq : {7, 8, 11, 10, 12, 12}) {  // 9 lost, 10 late, 12 duplicated
+            auto r = makeRecord((int) seq);
+            r.magic = TelemetryRecord::MAGIC;
+            r.version = TelemetryRecord::VERSION;
+            r.senderID = 42;
+            r.sequence = seq;
+            sendRaw(raw, &r, r.size());
+        }
+        waitFor(6);
+        auto stats = receiver.statistics();
+        CHECK(stats.recordsReceived == 6, "%llu records received", (unsigned long long) stats.recordsReceived);
+        CHECK(stats.recordsLost == 1, "%llu records lost", (unsigned long long) stats.recordsLost);
+        CHECK(stats.recordsLate == 2, "%llu records late", (unsigned long long) stats.recordsLate);
+
+        // A restarted sender starts over
+        auto r = makeRecord(1);
+        r.magic = TelemetryRecord::MAGIC;
+        r.version = TelemetryRecord::VERSION;
+        r.senderID = 43;
+        r.sequence = 1;
+        sendRaw(raw, &r, r.size());
+        waitFor(7);
+        CHECK(receiver.statistics().recordsLost == 1, "restarted sender taken as loss");
+
+        // Reordered right after a restart: the earlier record is late, not a loss recovered
+        r.senderID = 44;
+        for (uint32_t seq : {5, 4}) {
+            r.sequence = seq;
+            sendRaw(raw, &r, r.size());
+        }
+        waitFor(9);
+        stats = receiver.statistics();
+        CHECK(stats.recordsLost == 1, "%llu records lost after reordering at start",
+              (unsigned long long) stats.recordsLost);
+        CHECK(stats.recordsLate == 3, "%llu records late after reordering at start",
+              (unsigned long long) stats.recordsLate);
+
+        // Too short, wrong magic, and truncated armors
+        sendRaw(raw, &r, TelemetryRecord::HEADER_SIZE - 1);
+        auto bad = r;
+        bad.magic = 0;
+        sendRaw(raw, &bad, bad.size());
+        sendRaw(raw, &r, r.size() - 1);
+        sendRaw(raw, &r, r.size());  // a valid one to know when the others have arrived
+        waitFor(10);
+        stats = receiver.statistics();
+        CHECK(stats.invalidDatagrams == 3, "%llu invalid datagrams", (unsigned long long) stats.invalidDatagrams);
+        CHECK(stats.recordsReceived == 10, "invalid datagrams taken as records");
+        received.clear();
+    }
+
+    // Multicast, on the loopback interface
+    {
+        receiver.close();
+        TelemetrySender sender(ioContext);
+        if (!receiver.open(PORT, MULTICAST_ADDRESS, collect) || !sender.open(MULTICAST_ADDRESS, PORT)) {
+            std::printf("SKIP: multicast is not available\n");
+        } else {
+            const int count = 20;
+            for (int i = 0; i < count; i++) {
+                auto r = makeRecord(i);
+                sender.send(r);
+            }
+            waitFor(count);
+            if (received.empty() && sender.statistics().recordsDropped == count) {
+                std::printf("SKIP: no route for multicast\n");
+            } else {
+                checkRecords(count, "multicast");
+            }
+        }
+        receiver.close();
+    }
+
+    return reportFailures();
+}
@@ -0,0 +1,282 @@
+// Benchmark of TerminalSocket over loopback, with the server (Core) and the client (Terminal) on their own IO threads:
+//  - Throughput of each package type from the server to the client: messages/s, MB/s of the contents and on the wire,
+//    and CPU time per MB (of the whole process, i.e. both ends). Senders keep a bounded window of messages in flight.
+//  - Round-trip latency of small control messages (an int echoed by the server), idle and while large images are
+//    being streamed to the client, as Core does for results.
+//
+// The results are printed as JSON to stdout (progress goes to stderr), to be tracked over time.
+//
+// Usage: TerminalSocketBenchmark [--duration 2] [--port 18800] [--image-size 1048576]
+
+#include "TerminalSocket.h"
+#include <ctime>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace meta;
+using Clock = std::chrono::steady_clock;
+
+static double processCPUSeconds() {
+    timespec ts{};
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1E-9;
+}
+
+static double durationSeconds = 2;
+static int port = 18800;
+static size_t imageSize = 1 << 20;
+
+boost::asio::io_context serverIOContext;
+boost::asio::io_context clientIOContext;
+std::unique_ptr<TerminalSocketServer> server;  // created in main() with the port
+TerminalSocketClient client(clientIOContext);
+
+std::atomic<uint64_t> receivedMessages = 0;
+std::atomic<uint64_t> receivedBytes = 0;  // contents
+
+/** Throughput **/
+
+struct ThroughputResult {
+    std::string name;
+    size_t contentSize;
+    uint64_t messages;
+    double seconds;
+    double wireBytes;
+    double cpuSeconds;
+};
+
+/**
+ * Send with the function for the duration, keeping at most a window of messages or bytes in flight, then wait for
+ * all to arrive.
+ */
+static ThroughputResult runThroughput(const std::string &name, size_t contentSize, const std::function<void()> &send) {
+    static constexpr uint64_t MAX_MESSAGES_IN_FLIGHT = 1024;
+    static constexpr size_t MAX_BYTES_IN_FLIGHT = 0x1000000;
+    uint64_t window = std::max<uint64_t>(1, std::min<uint64_t>(MAX_MESSAGES_IN_FLIGHT,
+                                                               MAX_BYTES_IN_FLIGHT / std::max<size_t>(contentSize, 1)));
+
+    std::cerr << "Throughput of " << name << "..." << std::endl;
+    receivedMessages = 0;
+    receivedBytes = 0;
+    client.getAndClearStats();
+
+    uint64_t sent = 0;
+    double cpuStart = processCPUSeconds();
+    auto start = Clock::now();
+    auto end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(durationSeconds));
+    while (Clock::now() < end) {
+        if (sent - receivedMessages < window) {
+            send();
+            sent++;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    while (receivedMessages < sent) std::this_thread::yield();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    double cpuSeconds = processCPUSeconds() - cpuStart;
+
+    return {name, contentSize, sent, seconds, (double) client.getAndClearStats().second, cpuSeconds};
+}
+
+/** Latency **/
+
+struct LatencyResult {
+    std::string name;
+    std::vector<double> rttMicros;  // sorted
+    uint64_t imagesReceived;
+};
+
+std::atomic<int32_t> pongReceived = 0;
+
+/**
+ * Ping the server with one message in flight for the duration, optionally while the server streams images.
+ */
+static LatencyResult runLatency(const std::string &name, bool withImages) {
+    std::cerr << "Latency " << name << "..." << std::endl;
+
+    std::atomic<bool> streaming = withImages;
+    receivedMessages = 0;
+    std::thread imageThread;
+    if (withImages) {
+        // Stream images as Core does: skipped while the previous ones are still being written
+        imageThread = std::thread([&] {
+            auto payload = std::make_shared<std::vector<uint8_t>>(imageSize, 0x5A);
+            while (streaming) {
+                bool pending = false;
+                for (const auto &session : server->sessions()) pending |= session->hasPendingSends();
+                if (!pending) server->sendBytes("res", payload);
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+        });
+    }
+
+    LatencyResult result{name, {}, 0};
+    auto end = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(durationSeconds));
+    int32_t seq = 0;
+    while (Clock::now() < end) {
+        seq++;
+        auto sendTime = Clock::now();
+        client.sendSingleInt("ping", seq);
+        while (pongReceived != seq) std::this_thread::yield();
+        result.rttMicros.emplace_back(std::chrono::duration<double, std::micro>(Clock::now() - sendTime).count());
+        std::this_thread::sleep_for(std::chrono::microseconds(500));  // control messages are not back-to-back
+    }
+
+    if (withImages) {
+        streaming = false;
+        imageThread.join();
+        while (server->sessions().front()->hasPendingSends()) std::this_thread::yield();
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));  // for the last image to arrive
+    }
+    result.imagesReceived = receivedMessages;
+    std::sort(result.rttMicros.begin(), result.rttMicros.end());
+    return result;
+}
+
+static double percentile(const std::vector<double> &sorted, double p) {
+    if (sorted.empty()) return 0;
+    return sorted[std::min(sorted.size() - 1, (size_t) (p * (double) (sorted.size() - 1) + 0.5))];
+}
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--duration" && i + 1 < argc) {
+            durationSeconds = std::atof(argv[++i]);
+        } else if (arg == "--port" && i + 1 < argc) {
+            port = std::atoi(argv[++i]);
+        } else if (arg == "--image-size" && i + 1 < argc) {
+            imageSize = std::strtoul(argv[++i], nullptr, 10);
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--duration 2] [--port 18800] [--image-size 1048576]"
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout.rdbuf(std::cerr.rdbuf());  // logs of the sockets, keeping stdout for the JSON
+
+    // Server: echo pings
+    server = std::make_unique<TerminalSocketServer>(serverIOContext, port);
+    server->setCallbacks(nullptr,
+                         [](auto session, auto name, auto n) {
+                             if (name == "ping") session->sendSingleInt("pong", n);
+                         });
+    server->startAccept();
+
+    // Client: count the contents of each type, receive pongs
+    client.setCallbacks([](auto, auto s) {
+                            receivedBytes += s.size() + 1;
+                            receivedMessages++;
+                        },
+                        [](auto name, auto n) {
+                            if (name == "pong") {
+                                pongReceived = n;
+                            } else {
+                                receivedBytes += 4;
+                                receivedMessages++;
+                            }
+                        },
+                        [](auto, auto, auto size) {
+                            receivedBytes += size;
+                            receivedMessages++;
+                        },
+                        [](auto, const auto &list) {
+                            for (const auto &s : list) receivedBytes += std::strlen(s) + 1;
+                            receivedMessages++;
+                        });
+
+    auto serverWork = boost::asio::make_work_guard(serverIOContext);
+    auto clientWork = boost::asio::make_work_guard(clientIOContext);
+    std::thread serverThread([] { serverIOContext.run(); });
+    std::thread clientThread([] { clientIOContext.run(); });
+
+    client.connect("127.0.0.1", std::to_string(port));
+    for (int i = 0; i < 200 && !(client.connected() && server->connected()); i++) usleep(10000);
+    if (!client.connected() || !server->connected()) {
+        std::cerr << "Failed to connect over loopback on port " << port << std::endl;
+        return 1;
+    }
+
+    std::string smallString(32, 's');
+    std::vector<std::string> list(8, std::string(15, 'l'));
+    size_t listSize = 8 * 16;
+    std::vector<uint8_t> smallBytes(256, 0xA5);
+    std::vector<uint8_t> imageBytes(imageSize, 0x5A);
+    auto sharedImage = std::make_shared<const std::vector<uint8_t>>(imageSize, 0x5A);
+
+    std::vector<ThroughputResult> throughputs;
+    throughputs.emplace_back(runThroughput("single_string", smallString.size() + 1, [&] {
+        server->sendSingleString("str", smallString);
+    }));
+    throughputs.emplace_back(runThroughput("single_int", 4, [] {
+        server->sendSingleInt("int", 2333);
+    }));
+    throughputs.emplace_back(runThroughput("bytes_small", smallBytes.size(), [&] {
+        server->sendBytes("bytes", smallBytes.data(), smallBytes.size());
+    }));
+    throughputs.emplace_back(runThroughput("bytes_image_copied", imageSize, [&] {
+        server->sendBytes("res", imageBytes.data(), imageBytes.size());
+    }));
+    throughputs.emplace_back(runThroughput("bytes_image_shared", imageSize, [&] {
+        server->sendBytes("res", sharedImage);
+    }));
+    throughputs.emplace_back(runThroughput("list_of_strings", listSize, [&] {
+        server->sendListOfStrings("list", list);
+    }));
+
+    std::vector<LatencyResult> latencies;
+    latencies.emplace_back(runLatency("idle", false));
+    latencies.emplace_back(runLatency("with_images", true));
+
+    // Output
+    std::printf("{\n");
+    std::printf("  \"benchmark\": \"TerminalSocket\",\n");
+    std::printf("  \"timestamp\": %ld,\n", (long) std::time(nullptr));
+    std::printf("  \"duration_s\": %.3f,\n", durationSeconds);
+    std::printf("  \"image_size\": %zu,\n", imageSize);
+    std::printf("  \"throughput\": [\n");
+    for (size_t i = 0; i < throughputs.size(); i++) {
+        const auto &t = throughputs[i];
+        double mb = (double) (t.messages * t.contentSize) / (1 << 20);
+        std::printf("    {\"type\": \"%s\", \"content_size\": %zu, \"messages\": %llu, \"messages_per_s\": %.1f, "
+                    "\"content_mb_per_s\": %.2f, \"wire_mb_per_s\": %.2f, \"cpu_ms_per_mb\": %.3f}%s\n",
+                    t.name.c_str(), t.contentSize, (unsigned long long) t.messages, (double) t.messages / t.seconds,
+                    mb / t.seconds, t.wireBytes / (1 << 20) / t.seconds,
+                    t.cpuSeconds * 1000 / (t.wireBytes / (1 << 20)), i + 1 < throughputs.size() ? "," : "");
+    }
+    std::printf("  ],\n");
+    std::printf("  \"latency\": [\n");
+    for (size_t i = 0; i < latencies.size(); i++) {
+        const auto &l = latencies[i];
+        std::printf("    {\"condition\": \"%s\", \"samples\": %zu, \"images_received\": %llu, "
+                    "\"rtt_p50_us\": %.1f, \"rtt_p99_us\": %.1f, \"rtt_max_us\": %.1f}%s\n",
+                    l.name.c_str(), l.rttMicros.size(), (unsigned long long) l.imagesReceived,
+                    percentile(l.rttMicros, 0.5), percentile(l.rttMicros, 0.99),
+                    l.rttMicros.empty() ? 0 : l.rttMicros.back(), i + 1 < latencies.size() ? "," : "");
+    }
+    std::printf("  ]\n");
+    std::printf("}\n");
+
+    client.disconnect();
+    server->disconnect();
+    usleep(100000);
+    serverWork.reset();
+    clientWork.reset();
+    serverIOContext.stop();
+    clientIOContext.stop();
+    serverThread.join();
+    clientThread.join();
+    return 0;
+}
@@ -2,24 +2,31 @@
 // Created by liuzikai on 3/16/21.
 //
 
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <thread>
 #include <unistd.h>
 #include "TerminalSocket.h"
+#ifndef INTERACTIVE_MODE
 #define INTERACTIVE_MODE  1
+#endif
 using namespace meta;
 
 static char serverName[] = "Server";
 static char clientName[] = "Client";
+static char client2Name[] = "Client 2";
 
-void processSingleString(const char *param, const char *name, const char *s) {
+void processSingleString(const char *param, std::string_view name, std::string_view s) {
     std::cout << param << " received a string <" << name << "> \"" << s << "\"\n";
 }
 
-void processSingleInt(const char *param, const char *name, int n) {
+void processSingleInt(const char *param, std::string_view name, int n) {
     std::cout << param << " received a int <" << name << "> " << n << "\n";
 }
 
-void processBytes(const char *param, const char *name, const uint8_t *buf, size_t size) {
+void processBytes(const char *param, std::string_view name, const uint8_t *buf, size_t size) {
     std::cout << param << " received bytes <" << name << "> ";
     for (size_t i = 0; i < size; i++) {
         std::cout << std::hex << (int) buf[i] << std::dec << "  ";
@@ -27,27 +34,55 @@ void processBytes(const char *param, const char *name, const uint8_t *buf, size_
     std::cout << "\n";
 }
 
-void processListOfString(const char *param, const char *name, const vector<const char *> &list) {
+void processListOfString(const char *param, std::string_view name, const std::vector<const char *> &list) {
     std::cout << param << " received list of strings <" << name << ">\n";
     for (const auto &s : list) {
         std::cout << "  \"" << s << "\"\n";
     }
 }
 
-void handleServerDisconnection(TerminalSocketServer* s);
+void handleServerDisconnection(TerminalSocketServer::Session* s);
 void handleClientDisconnection(TerminalSocketClient* c);
 
-TerminalSocketServer server(8800, handleServerDisconnection);
-TerminalSocketClient client(handleClientDisconnection);
+boost::asio::io_context ioContext;
+TerminalSocketServer server(ioContext, 8800, handleServerDisconnection);
+TerminalSocketClient client(ioContext, handleClientDisconnection);
+TerminalSocketClient client2(ioContext, handleClientDisconnection);
 
 uint8_t testBytes1[] = {0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF};
 uint8_t testBytes2[] = {0xFF};
 uint8_t testBytes3[] = {};
 
-void handleServerDisconnection(TerminalSocketServer* s) {
+// Large packages (e.g. full-resolution frames), sent several times in each direction to measure the throughput
+static const size_t LARGE_SIZES[] = {1 << 20, 2 << 20, 5 << 20, 10 << 20};
+static constexpr int LARGE_REPEAT = 10;
+std::vector<uint8_t> largeBytes;
+std::vector<uint8_t> providedBuffer;  // the client reads large bytes directly into it
+std::atomic<int> largeReceived = 0;
+std::atomic<int> largeCorrupted = 0;
+
+void processLargeBytes(const uint8_t *buf, size_t size) {
+    if (size > largeBytes.size() || std::memcmp(buf, largeBytes.data(), size) != 0) largeCorrupted++;
+    largeReceived++;
+}
+
+// Send the large packages of each size and wait for them
+template<class Send>
+void runLargeBenchmark(const char *direction, Send &&send) {
+    for (size_t size : LARGE_SIZES) {
+        largeReceived = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < LARGE_REPEAT; i++) send(size);
+        while (largeReceived < LARGE_REPEAT) usleep(100);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << direction << " " << (size >> 20) << " MB x " << LARGE_REPEAT << ": "
+                  << (double) (size * LARGE_REPEAT) / seconds / (1 << 20) << " MB/s\n";
+    }
+}
+
+void handleServerDisconnection(TerminalSocketServer::Session* s) {
     static int count = 0;
-    std::cerr << "Server disconnected " << ++count << std::endl;
-    s->startAccept();
+    std::cerr << "Server disconnected from client " << s->id() << ", " << ++count << std::endl;
 }
 
 void handleClientDisconnection(TerminalSocketClient* c) {
@@ -57,6 +92,9 @@ void handleClientDisconnection(TerminalSocketClient* c) {
 
 int main() {
 
+    auto ioWork = boost::asio::make_work_guard(ioContext);
+    std::thread ioThread([] { ioContext.run(); });
+
 #if !INTERACTIVE_MODE
     usleep(5000000);
 #endif
@@ -64,10 +102,10 @@ int main() {
     std::cerr << "1. Setup server...\n";
 
     server.startAccept();
-    server.setCallbacks([](auto name, auto s) { processSingleString(serverName, name, s); },
-                        [](auto name, auto n) { processSingleInt(serverName, name, n); },
-                        [](auto name, auto buf, auto size) { processBytes(serverName, name, buf, size); },
-                        [](auto name, const auto &list) { processListOfString(serverName, name, list); });
+    server.setCallbacks([](auto, auto name, auto s) { processSingleString(serverName, name, s); },
+                        [](auto, auto name, auto n) { processSingleInt(serverName, name, n); },
+                        [](auto, auto name, auto buf, auto size) { processBytes(serverName, name, buf, size); },
+                        [](auto, auto name, const auto &list) { processListOfString(serverName, name, list); });
 
     std::cout.flush();
     std::cerr.flush();
@@ -132,19 +170,25 @@ int main() {
 #endif
 
     client.disconnect();
+    usleep(100000);  // for the aborted operations of the client to complete before it reconnects
 
     std::cout.flush();
     std::cerr.flush();
-    std::cerr << "6. Press any key to reconnect client...\n";
+    std::cerr << "6. Press any key to reconnect client and connect client 2...\n";
 #if INTERACTIVE_MODE
     std::cin.get();
 #endif
 
     client.connect("127.0.0.1", "8800");
+    client2.connect("127.0.0.1", "8800");
+    client2.setCallbacks([](auto name, auto s) { processSingleString(client2Name, name, s); },
+                         [](auto name, auto n) { processSingleInt(client2Name, name, n); },
+                         [](auto name, auto buf, auto size) { processBytes(client2Name, name, buf, size); },
+                         [](auto name, const auto &list) { processListOfString(client2Name, name, list); });
 
     std::cout.flush();
     std::cerr.flush();
-    std::cerr << "7. Press any key to start tests server -> client (2nd)...\n";
+    std::cerr << "7. Press any key to start tests server -> both clients...\n";
 #if INTERACTIVE_MODE
     std::cin.get();
 #endif
@@ -165,13 +209,65 @@ int main() {
 
     std::cout.flush();
     std::cerr.flush();
-    std::cerr << "8. Press any key to disconnect server...\n";
+    std::cerr << "8. Press any key to test large packages...\n";
+#if INTERACTIVE_MODE
+    std::cin.get();
+#endif
+
+    client2.disconnect();
+    largeBytes.resize(LARGE_SIZES[std::size(LARGE_SIZES) - 1]);
+    for (size_t i = 0; i < largeBytes.size(); i++) largeBytes[i] = (uint8_t) (i * 7 + (i >> 12));
+    providedBuffer.resize(largeBytes.size());
+
+    server.setCallbacks(nullptr, nullptr, [](auto, auto, auto buf, auto size) { processLargeBytes(buf, size); });
+    client.setCallbacks(nullptr, nullptr, [](auto, auto buf, auto size) {
+        if (buf != providedBuffer.data()) largeCorrupted++;  // should be read into the provided buffer
+        processLargeBytes(buf, size);
+    });
+    client.setRecvBufferProvider([](auto, auto size) {
+        return size <= providedBuffer.size() ? providedBuffer.data() : nullptr;
+    });
+    usleep(100000);  // for client 2 to be disconnected
+
+    runLargeBenchmark("Client -> server (pooled buffer)", [](size_t size) {
+        client.sendBytes("Large", largeBytes.data(), size);
+    });
+    runLargeBenchmark("Server -> client (provided buffer)", [](size_t size) {
+        server.sendBytes("Large", largeBytes.data(), size);
+    });
+    std::cout << (largeCorrupted ? "Large packages corrupted\n" : "Large packages passed\n");
+
+    std::cout.flush();
+    std::cerr.flush();
+    std::cerr << "9. Press any key to test a package larger than the send queue limit...\n";
+#if INTERACTIVE_MODE
+    std::cin.get();
+#endif
+
+    // With the queue idle, the client should still be disconnected, and its bytes still counted by the server
+    server.getAndClearStats();
+    client.sendSingleString("BeforeOverflow", "Hello world");
+    usleep(100000);
+    client.setSendQueueLimit(LARGE_SIZES[0] / 2, TerminalSocketBase::DISCONNECT);
+    bool oversizedQueued = client.sendBytes("Oversized", largeBytes.data(), LARGE_SIZES[0]);
+    usleep(100000);
+    auto serverStats = server.getAndClearStats();
+    std::cout << ((!oversizedQueued && !client.connected() && !server.connected() && serverStats.second != 0)
+                  ? "Send queue overflow passed\n" : "Send queue overflow failed\n");
+    client.setSendQueueLimit(0, TerminalSocketBase::DROP_PACKAGE);
+
+    std::cout.flush();
+    std::cerr.flush();
+    std::cerr << "10. Press any key to disconnect server...\n";
 #if INTERACTIVE_MODE
     std::cin.get();
 #endif
 
     server.disconnect();
 
+    ioWork.reset();
+    ioContext.stop();
+    ioThread.join();
 
     std::cout.flush();
     std::cerr.flush();
@@ -0,0 +1,106 @@
+// Throughput and accuracy of the tracked detection (armor_tracking) on a recorded video, against the full detection
+// of every frame with the same parameter set:
+//  - Time per frame, speedup, and the share of frames detected only in the windows of the tracked armors.
+//  - Recall: armors of the full detection also found, matched by the center within a quarter of the armor height, and
+//    extra armors not found by the full detection.
+//  - Frames with armors of the full detection but none found, i.e. the frames lost by the target.
+//  - Corner error [pixel] of the matched armors, mean and max.
+//
+// Usage: TrackingDetectionBenchmark <video in DATA_SET_ROOT/videos> [parameter set JSON = PARAM_SET_ROOT/params/
+//        meta-jetson-nano-1.json] [max frames = 2000]
+
+#include "ArmorDetector.h"
+#include "DetectionBenchmark.h"
+#include <opencv2/videoio.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace meta;
+using Armors = std::vector<ArmorDetector::DetectedArmor>;
+
+struct IntervalResult : ArmorMatchResult {
+    double totalMS = 0;
+    size_t trackedFrames = 0;
+    size_t lostFrames = 0;
+};
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <video> [parameter set JSON] [max frames = 2000]" << std::endl;
+        return 1;
+    }
+    std::string videoName = argv[1];
+    std::string paramSetFile = argc > 2 ? argv[2] : std::string(PARAM_SET_ROOT) + "/params/meta-jetson-nano-1.json";
+    size_t maxFrames = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 2000;
+
+    ParamSet params;
+    if (!loadParamSet(paramSetFile, params)) return 1;
+
+    // Frames in memory at the ROI size, as VideoSet does
+    std::vector<cv::Mat> frames;
+    {
+        cv::VideoCapture video(std::string(DATA_SET_ROOT) + "/videos/" + videoName);
+        cv::Mat img;
+        while (frames.size() < maxFrames && video.read(img)) {
+            if (img.rows != params.roi_height() || img.cols != params.roi_width()) {
+                cv::resize(img, img, cv::Size(params.roi_width(), params.roi_height()));
+            }
+            frames.emplace_back(img.clone());
+        }
+    }
+    if (frames.empty()) {
+        std::cerr << "No frame in video " << videoName << std::endl;
+        return 1;
+    }
+    std::printf("Video %s: %zu frames of %dx%d, parameter set %s\n\n", videoName.c_str(), frames.size(),
+                params.roi_width(), params.roi_height(), paramSetFile.c_str());
+
+    // Full detection of every frame
+    ArmorDetector detector;
+    params.mutable_armor_tracking()->set_enabled(false);
+    detector.setParams(params);
+    std::vector<Armors> reference;
+    double referenceMS = 0;
+    size_t referenceArmors = 0;
+    for (const auto &frame : frames) {
+        auto start = std::chrono::steady_clock::now();
+        reference.emplace_back(detector.detect(frame));
+        referenceMS += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        referenceArmors += reference.back().size();
+    }
+
+    std::printf("%-10s %10s %8s %8s %8s %10s %8s %8s %12s %12s\n", "Interval", "ms/frame", "speedup", "tracked",
+                "recall", "armors", "extra", "lost", "mean err px", "max err px");
+    std::printf("%-10s %10.3f %8s %8s %8s %10zu %8s %8s %12s %12s\n", "full", referenceMS / (double) frames.size(),
+                "1.00x", "-", "-", referenceArmors, "-", "-", "-", "-");
+
+    for (int interval : {5, 10, 20, 50}) {
+        params.mutable_armor_tracking()->set_enabled(true);
+        params.mutable_armor_tracking()->set_val(interval);
+        detector.setParams(params);  // also clears the tracked armors
+
+        IntervalResult result;
+        for (size_t i = 0; i < frames.size(); i++) {
+            auto start = std::chrono::steady_clock::now();
+            Armors armors = detector.detect(frames[i]);
+            auto end = std::chrono::steady_clock::now();
+            result.totalMS += std::chrono::duration<double, std::milli>(end - start).count();
+            result.trackedFrames += detector.lastDetectionTracked();
+            compare(reference[i], armors, result);
+            if (!reference[i].empty() && armors.empty()) result.lostFrames++;
+        }
+
+        double recall = result.referenceArmors ? (double) result.matchedArmors / (double) result.referenceArmors : 1;
+        std::printf("%-10d %10.3f %7.2fx %7.1f%% %7.1f%% %10zu %8zu %8zu %12.3f %12.3f\n", interval,
+                    result.totalMS / (double) frames.size(), referenceMS / result.totalMS,
+                    100 * (double) result.trackedFrames / (double) frames.size(), 100 * recall,
+                    result.matchedArmors + result.extraArmors, result.extraArmors, result.lostFrames,
+                    result.matchedArmors ? result.sumCornerError / (double) (4 * result.matchedArmors) : 0,
+                    result.maxCornerError);
+    }
+    return 0;
+}
@@ -0,0 +1,31 @@
+#ifndef META_VISION_SOLAIS_UNITTESTCHECK_H
+#define META_VISION_SOLAIS_UNITTESTCHECK_H
+
+#include <cstdio>
+
+/**
+ * Checks of the self-checking unit tests. A failed check is printed (the first 20 only) and the test continues, then
+ * main() returns reportFailures().
+ */
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do {              \
+        if (!(cond)) {                     \
+            if (failures++ < 20) {         \
+                std::printf("FAIL: " __VA_ARGS__); \
+                std::printf("\n");         \
+            }                              \
+        }                                  \
+    } while (0)
+
+/**
+ * Print the number of failed checks, or "All passed".
+ * @return Exit code of the test.
+ */
+static inline int reportFailures() {
+    std::printf(failures ? "%d failure(s)\n" : "All passed\n", failures);
+    return failures ? 1 : 0;
+}
+
+#endif //META_VISION_SOLAIS_UNITTESTCHECK_H